@@ -33,6 +33,7 @@ struct map_desc {
 #define MT_MEMORY_R		15
 #define MT_MEMORY_RW		16
 #define MT_MEMORY_RX		17
+#define MT_MEMORY_DMA_READY	18
 
 #ifdef CONFIG_MMU
 extern void iotable_init(struct map_desc *, int);
@@ -1575,6 +1575,7 @@ MACHINE_START(K3V2OEM1, "huawei")
 	.init_irq       = k3v2_gic_init_irq,
 	.init_machine   = k3v2oem1_init,
 	.map_io         = k3v2_map_io,
+	.reserve        = k3v2_reserve,
 	.timer          = &k3v2_timer,
 	.init_early 	= k3v2_early_init,
 MACHINE_END
@@ -681,6 +681,7 @@ MACHINE_START(TC45MSU3, "tc45msu3")
 	.init_irq     = k3v2_gic_init_irq,
 	.init_machine = tc45msu3_init,
 	.map_io       = k3v2_map_io,
+	.reserve      = k3v2_reserve,
 	.timer        = &k3v2_timer,
 	.init_early   = k3v2_early_init,
 MACHINE_END
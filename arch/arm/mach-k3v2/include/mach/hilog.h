@@ -10,6 +10,7 @@
 #define __K3LOG_H
 
 #include <linux/miscdevice.h>
+#include <linux/atomic.h>
 
 #define HISI_1K	(1024)
 #define HISI_1M	(1024 * 1024)
@@ -63,6 +64,10 @@ typedef struct {
 	unsigned long raddr;
 } log_buffer_head;
 
+struct logger_stage;
+struct logger_archive;
+struct logger_mmap_index;
+
 /* TBD: from drivers/staging/android/logger.c,
  * if android version changes, we should check it.
  */
@@ -75,9 +80,15 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_stage __percpu *stage; /* per-CPU staged writes */
+	atomic_t		seq;	/* sequence of the last staged entry */
+	struct logger_archive	*archive; /* compressed history, or NULL */
+	struct logger_mmap_index *index; /* index page shared with mmap */
+	atomic_t		mmap_readers; /* live mmaps of the log */
 #ifdef CONFIG_K3_LOG
 	volatile log_buffer_head	*log_buf_info;
 	volatile unsigned char		*rbuf;
+	spinlock_t			rbuf_lock; /* protects the mirror */
 #endif
 };
 #endif
@@ -90,5 +90,6 @@ extern unsigned long hisi_reserved_camera_phymem;
 
 unsigned long hisi_get_reserve_mem_size(void);
 unsigned long hisi_get_reserve_gpu_mem_size(void);
+void k3v2_reserve(void);
 #endif /* end _HI_MEM_INCLUDE_H_ */
 
@@ -131,7 +131,7 @@ static inline int canidle()
 static inline int k3v2_enter_wfi(struct cpuidle_device *dev,
 			struct cpuidle_state *state)
 {
-	struct timeval before, after;
+	struct timespec before, after;
 	int idle_time;
 
 	local_irq_disable();
@@ -146,7 +146,7 @@ static inline int k3v2_enter_wfi(struct cpuidle_device *dev,
 	local_irq_enable();
 
 	idle_time = (after.tv_sec - before.tv_sec) * USEC_PER_SEC +
-		    (after.tv_usec - before.tv_usec);
+		    (after.tv_nsec - before.tv_nsec) / NSEC_PER_USEC;
 
 	return idle_time;
 }
@@ -154,7 +154,7 @@ static inline int k3v2_enter_wfi(struct cpuidle_device *dev,
 static inline int k3v2_enter_ddrself(struct cpuidle_device *dev,
 			struct cpuidle_state *state)
 {
-	struct timeval before, after;
+	struct timespec before, after;
 	int idle_time;
 
 	local_irq_disable();
@@ -173,7 +173,7 @@ static inline int k3v2_enter_ddrself(struct cpuidle_device *dev,
 	local_irq_enable();
 
 	idle_time = (after.tv_sec - before.tv_sec) * USEC_PER_SEC +
-		    (after.tv_usec - before.tv_usec);
+		    (after.tv_nsec - before.tv_nsec) / NSEC_PER_USEC;
 
 	return idle_time;
 }
@@ -201,6 +201,23 @@ static int k3v2_enter_lowpm(struct cpuidle_device *dev,
 	return idle_time;
 }
 
+/*
+ * The low power state needs the other cpus offline and the peripherals
+ * quiet.  Hide it from the governor when that is not the case, so that
+ * it does not select a state that k3v2_enter_lowpm() has to demote.
+ */
+static int k3v2_idle_prepare(struct cpuidle_device *dev)
+{
+	struct cpuidle_state *lowpm = &dev->states[1];
+
+	if ((num_online_cpus() != 1) || (0 == canidle()))
+		lowpm->flags |= CPUIDLE_FLAG_IGNORE;
+	else
+		lowpm->flags &= ~CPUIDLE_FLAG_IGNORE;
+
+	return 0;
+}
+
 static struct cpuidle_state k3v2_cpuidle_set[] = {
 	[0] = {
 		.enter			= k3v2_enter_wfi,
@@ -274,6 +291,8 @@ int __init k3v2_idle_init(void)
 		}
 
 		dev->safe_state = &dev->states[0];
+		if (dev->state_count > 1)
+			dev->prepare = k3v2_idle_prepare;
 
 		if (cpuidle_register_device(dev)) {
 			cpuidle_unregister_driver(&k3v2_idle_driver);
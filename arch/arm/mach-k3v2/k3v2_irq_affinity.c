@@ -1,5 +1,5 @@
 /*
- *  arch/arm/mach-k3v2/xxx.c
+ *  arch/arm/mach-k3v2/k3v2_irq_affinity.c
  *
  *  Copyright (C) 2011 Hisilicon Ltd.
  *  All Rights Reserved
@@ -16,6 +16,16 @@
 #include <linux/notifier.h>
 #include <linux/interrupt.h>
 #include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/irq.h>
+#include <linux/kernel_stat.h>
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sort.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/irq.h>
 #include <asm/mach-types.h>
@@ -24,28 +34,21 @@
 
 static DEFINE_SPINLOCK(irqaff_lock);
 #ifdef CONFIG_SMP
-static unsigned long irqaffinity_mask[NR_CPUS][NR_IRQS] = {
-	[0 ... NR_CPUS-1] = {0},
+/* cpu a driver pinned the irq to, -1 if none */
+static s8 irq_pinned_cpu[NR_IRQS] = {
+	[0 ... NR_IRQS-1] = -1,
 };
 
 int k3v2_irqaffinity_register(unsigned int irq, int cpu)
 {
-	unsigned int i;
-
-	if (cpu >= NR_CPUS) {
-		pr_err(KERN_ERR "irq affinity set error cpu %d larger than max cpu num\n", cpu);
+	if (cpu >= NR_CPUS || irq >= NR_IRQS) {
+		pr_err("irq affinity set error irq %u cpu %d out of range\n",
+		       irq, cpu);
 		return -EINVAL;
 	}
 
 	spin_lock(&irqaff_lock);
-
-	for (i = 1; i < NR_CPUS; i++) {
-		if (i == cpu)
-			irqaffinity_mask[i][irq] = 1;
-		else
-			irqaffinity_mask[i][irq] = 0;
-	}
-
+	irq_pinned_cpu[irq] = cpu;
 	spin_unlock(&irqaff_lock);
 
 	irq_set_affinity(irq, cpumask_of(cpu));
@@ -58,27 +61,283 @@ EXPORT_SYMBOL_GPL(k3v2_irqaffinity_register);
 
 void k3v2_irqaffinity_unregister(unsigned int irq)
 {
-	unsigned int cpu = 0;
-	unsigned int i;
-
-	spin_lock(&irqaff_lock);
+	int cpu;
 
-	for (i = 1; i < NR_CPUS; i++) {
-		if(irqaffinity_mask[i][irq])
-			cpu = i;
-		irqaffinity_mask[cpu][irq] = 0;
-	}
+	if (irq >= NR_IRQS)
+		return;
 
+	spin_lock(&irqaff_lock);
+	cpu = irq_pinned_cpu[irq];
+	irq_pinned_cpu[irq] = -1;
 	spin_unlock(&irqaff_lock);
 
 	pr_info("k3v2 irqaffinity irq %u unregister irq from cpu %d to cpu 0\n", irq, cpu);
 
 	irq_set_affinity(irq, cpumask_of(0));
-
-	return;
 }
 EXPORT_SYMBOL_GPL(k3v2_irqaffinity_unregister);
 
+#ifdef CONFIG_K3V2_IRQ_BALANCE
+static bool irq_pinned_online(unsigned int irq)
+{
+	int cpu = irq_pinned_cpu[irq];
+
+	return cpu >= 0 && cpu_online(cpu);
+}
+
+/*
+ * Balancer
+ *
+ * Every balance_ms the rate and the handler time of each irq are
+ * sampled from the irq statistics.  Irqs that fire at least min_rate
+ * times a second and can be moved are hot; the others stay where they
+ * are and their handler time is charged to their cpu, together with
+ * boot_reserve_us for cpu 0, which also runs the timers and the irqs
+ * that cannot be moved.
+ *
+ * Hot irqs are then placed from the heaviest down.  Each has a
+ * preferred cpu: the affinity hint its driver gave, else the cpu its
+ * irq thread last ran on, else the cpu it is on.  That keeps the
+ * handler next to the thread consuming its data, and keeps irqs from
+ * moving around without need.  An irq only goes to the least loaded
+ * cpu instead if its preferred cpu is busier by more than the irq's
+ * own handler time plus imbalance_us.
+ *
+ * Irqs pinned with k3v2_irqaffinity_register() are not balanced while
+ * their cpu is online.  The placement is redone as soon as a cpu comes
+ * or goes.  balance_ms = 0 keeps sampling but stops moving irqs.
+ */
+static unsigned int balance_ms = 1000;
+module_param(balance_ms, uint, 0644);
+static unsigned int min_rate = 100;
+module_param(min_rate, uint, 0644);
+static unsigned int imbalance_us = 500;
+module_param(imbalance_us, uint, 0644);
+static unsigned int boot_reserve_us = 10000;
+module_param(boot_reserve_us, uint, 0644);
+
+struct irq_balance_stat {
+	unsigned int	count;		/* kstat_irqs() at the last sample */
+	u64		time_ns;	/* kstat_irq_time() at the last sample */
+	unsigned int	rate;		/* per second */
+	unsigned int	load;		/* handler time, us per second */
+	unsigned int	moves;
+	s8		cpu;
+	s8		prefer;
+	bool		hot;
+};
+
+static struct irq_balance_stat irq_stats[NR_IRQS];
+static int hot_irqs[NR_IRQS];
+static u64 last_sample_ns;
+
+static void irq_balance(struct work_struct *work);
+static DECLARE_DEFERRED_WORK(balance_work, irq_balance);
+
+static void irq_sample(struct irq_balance_stat *st, unsigned int irq,
+		       u64 period_ns)
+{
+	unsigned int count = kstat_irqs(irq);
+	u64 time_ns = kstat_irq_time(irq);
+	u64 delta_ns = time_ns - st->time_ns;
+
+	/* a torn read or a reused descriptor, skip this sample */
+	if (delta_ns > period_ns * num_possible_cpus())
+		delta_ns = 0;
+
+	st->rate = div64_u64((u64)(count - st->count) * NSEC_PER_SEC,
+			     period_ns);
+	st->load = div64_u64(delta_ns * USEC_PER_SEC, period_ns);
+	st->count = count;
+	st->time_ns = time_ns;
+}
+
+/* the cpu running the consumer of the irq, or @cur */
+static int irq_consumer_cpu(struct irq_desc *desc, int cur)
+{
+	struct irqaction *action;
+	int cpu;
+
+	if (desc->affinity_hint) {
+		cpu = cpumask_any_and(desc->affinity_hint, cpu_online_mask);
+		if (cpu < nr_cpu_ids)
+			return cpu;
+	}
+
+	for (action = desc->action; action; action = action->next) {
+		if (!action->thread)
+			continue;
+		cpu = task_cpu(action->thread);
+		if (cpu_online(cpu))
+			return cpu;
+	}
+
+	return cur;
+}
+
+static int irq_load_cmp(const void *a, const void *b)
+{
+	unsigned int la = irq_stats[*(const int *)a].load;
+	unsigned int lb = irq_stats[*(const int *)b].load;
+
+	return la < lb ? 1 : la > lb ? -1 : 0;
+}
+
+static void irq_balance(struct work_struct *work)
+{
+	unsigned int cpu_load[NR_CPUS] = { 0 };
+	unsigned int interval = balance_ms ? balance_ms : 1000;
+	u64 now = ktime_to_ns(ktime_get());
+	u64 period_ns = now - last_sample_ns;
+	bool sample;
+	int nr_hot = 0;
+	int irq, i;
+
+	get_online_cpus();
+
+	/* a hotplug kick reuses the last rates rather than a short window */
+	sample = period_ns >= (u64)interval * NSEC_PER_MSEC / 2;
+	if (sample)
+		last_sample_ns = now;
+
+	for (irq = 0; irq < NR_IRQS; irq++) {
+		struct irq_balance_stat *st = &irq_stats[irq];
+		struct irq_desc *desc = irq_to_desc(irq);
+		struct irq_data *d;
+		unsigned long flags;
+		int cur;
+
+		if (!desc)
+			continue;
+
+		raw_spin_lock_irqsave(&desc->lock, flags);
+		if (sample)
+			irq_sample(st, irq, period_ns);
+		if (!desc->action) {
+			st->hot = false;
+			raw_spin_unlock_irqrestore(&desc->lock, flags);
+			continue;
+		}
+
+		d = &desc->irq_data;
+		cur = cpumask_any_and(d->affinity, cpu_online_mask);
+		if (cur >= nr_cpu_ids)
+			cur = 0;
+		st->cpu = cur;
+		st->hot = st->rate >= min_rate && irqd_can_balance(d) &&
+			  d->chip && d->chip->irq_set_affinity &&
+			  !irq_pinned_online(irq);
+		if (st->hot) {
+			st->prefer = irq_consumer_cpu(desc, cur);
+			hot_irqs[nr_hot++] = irq;
+		} else {
+			cpu_load[cur] += st->load;
+		}
+		raw_spin_unlock_irqrestore(&desc->lock, flags);
+	}
+
+	if (!balance_ms || num_online_cpus() == 1)
+		goto out;
+
+	if (cpu_online(0))
+		cpu_load[0] += boot_reserve_us;
+
+	sort(hot_irqs, nr_hot, sizeof(int), irq_load_cmp, NULL);
+
+	for (i = 0; i < nr_hot; i++) {
+		struct irq_balance_stat *st = &irq_stats[hot_irqs[i]];
+		unsigned int w = max(st->load, 1U);
+		int cpu, least = st->prefer, target = st->prefer;
+
+		for_each_online_cpu(cpu)
+			if (cpu_load[cpu] < cpu_load[least])
+				least = cpu;
+
+		if (cpu_load[target] > cpu_load[least] + w + imbalance_us)
+			target = least;
+		cpu_load[target] += w;
+
+		if (target == st->cpu)
+			continue;
+		if (irq_set_affinity(hot_irqs[i], cpumask_of(target)))
+			continue;
+		st->cpu = target;
+		st->moves++;
+	}
+
+out:
+	put_online_cpus();
+	queue_delayed_work(system_nrt_wq, &balance_work,
+			   msecs_to_jiffies(interval));
+}
+
+static void irq_balance_kick(void)
+{
+	cancel_delayed_work(&balance_work);
+	queue_delayed_work(system_nrt_wq, &balance_work, 0);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int irq_balance_show(struct seq_file *s, void *unused)
+{
+	int irq;
+
+	seq_printf(s, "%4s %8s %8s %4s %6s %s\n", "irq", "rate", "load_us",
+		   "cpu", "moves", "name");
+
+	for (irq = 0; irq < NR_IRQS; irq++) {
+		struct irq_balance_stat *st = &irq_stats[irq];
+		struct irq_desc *desc = irq_to_desc(irq);
+		unsigned long flags;
+
+		if (!desc)
+			continue;
+
+		raw_spin_lock_irqsave(&desc->lock, flags);
+		if (desc->action && (st->rate || st->moves))
+			seq_printf(s, "%4d %8u %8u %3d%c %6u %s\n", irq,
+				   st->rate, st->load, st->cpu,
+				   irq_pinned_cpu[irq] >= 0 ? '*' :
+				   st->hot ? ' ' : '-',
+				   st->moves, desc->action->name);
+		raw_spin_unlock_irqrestore(&desc->lock, flags);
+	}
+
+	return 0;
+}
+
+static int irq_balance_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, irq_balance_show, NULL);
+}
+
+static const struct file_operations irq_balance_fops = {
+	.open		= irq_balance_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init irq_balance_debugfs_init(void)
+{
+	debugfs_create_file("k3v2_irq_balance", S_IRUGO, NULL, NULL,
+			    &irq_balance_fops);
+}
+#else
+static inline void irq_balance_debugfs_init(void) {}
+#endif
+
+static void __init irq_balance_init(void)
+{
+	irq_balance_debugfs_init();
+	queue_delayed_work(system_nrt_wq, &balance_work,
+			   msecs_to_jiffies(balance_ms ? balance_ms : 1000));
+}
+#else
+static inline void irq_balance_kick(void) {}
+static inline void irq_balance_init(void) {}
+#endif /* CONFIG_K3V2_IRQ_BALANCE */
+
 static int __cpuinit k3v2_hotplug_notify(struct notifier_block *self,
 				      unsigned long action, void *hcpu)
 {
@@ -89,21 +348,27 @@ static int __cpuinit k3v2_hotplug_notify(struct notifier_block *self,
 
 	switch (action) {
 		case CPU_ONLINE:
-			for (irq = 0; irq  < NR_IRQS; irq++) {
+			for (irq = 0; irq < NR_IRQS; irq++) {
 				/* set irq to affinity cpu when this cpu online */
-				if(irqaffinity_mask[cpu][irq]) {
+				if (irq_pinned_cpu[irq] == cpu)
 					irq_set_affinity(irq, cpumask_of(cpu));
-					/*pr_info("k3v2 set irq %d affinity to cpu %d again\n", irq, cpu);*/
-				}
 			}
+			irq_balance_kick();
+			break;
+		case CPU_DEAD:
+			/* migrate_irqs() put the irqs of the dead cpu anywhere */
+			irq_balance_kick();
+			break;
 		default:
 			break;
 	}
 
 	return NOTIFY_OK;
 }
+
 #else
 #define k3v2_hotplug_notify	NULL
+static inline void irq_balance_init(void) {}
 #endif
 
 static int __init k3v2_irqaffinity_init(void)
@@ -111,6 +376,8 @@ static int __init k3v2_irqaffinity_init(void)
 	/* Register hotplug notifier. */
 	hotcpu_notifier(k3v2_hotplug_notify, 0);
 
+	irq_balance_init();
+
 	pr_info("k3v2 irqaffinity init\n");
 
 	return 0;
@@ -52,12 +52,28 @@
 #include <mach/early-debug.h>
 #include <linux/android_pmem.h>
 #include <linux/bootmem.h>
+#include <linux/contig_heap.h>
 #include <mach/hisi_mem.h>
 
+#ifdef CONFIG_CMA
+/*
+ * Camera and gralloc pmem share the "media" contiguous heap and memalloc
+ * has the "codec" one.  Unlike the carve-outs they replace, the heaps are
+ * lent to the page allocator for movable pages while idle.  Overlay pmem
+ * is cached but may be switched to uncached per file, so it keeps its
+ * carve-out; heap users are uncached, see contig_heap_uncache().
+ */
+#define K3V2_MEDIA_HEAP		"media"
+#define K3V2_CODEC_HEAP		"codec"
+#endif
+
 static struct android_pmem_platform_data android_pmem_camera_pdata = {
 	.name = "camera_pmem",
 	.type = PMEM_TYPE_K3,
 	.cached = 0,
+#ifdef CONFIG_CMA
+	.heap = K3V2_MEDIA_HEAP,
+#endif
 };
 
 static struct platform_device android_pmem_camera_device = {
@@ -70,6 +86,9 @@ static struct android_pmem_platform_data android_pmem_gralloc_pdata = {
 	.name = "gralloc_pmem",
 	.type = PMEM_TYPE_K3,
 	.cached = 0,
+#ifdef CONFIG_CMA
+	.heap = K3V2_MEDIA_HEAP,
+#endif
 };
 
 static struct platform_device android_pmem_gralloc_device = {
@@ -225,9 +244,12 @@ unsigned long hisi_get_reserve_mem_size(void)
 
 	reserved += hisi_media_mem.gpu_size;
 	reserved += hisi_media_mem.framebuffer_size;
+#ifndef CONFIG_CMA
+	/* otherwise in the contiguous heaps, see k3v2_reserve() */
 	reserved += hisi_media_mem.codec_size;
 	reserved += hisi_media_mem.camera_size;
 	reserved += hisi_media_mem.gralloc_size;
+#endif
 #if defined(CONFIG_OVERLAY_COMPOSE)
 	reserved += hisi_media_mem.overlay_size;
 #endif
@@ -316,6 +338,7 @@ void __init k3v2_allocate_memory_regions(void)
 
 	reserved_base += size;
 
+#ifndef CONFIG_CMA
 	/* CODEC memory */
 	size = hisi_media_mem.codec_size;
 	/*Revived by y44207 ,V200 64 byte align*/
@@ -347,6 +370,7 @@ void __init k3v2_allocate_memory_regions(void)
 	}
 
 	reserved_base += size;
+#endif /* CONFIG_CMA */
 
 #if defined(CONFIG_OVERLAY_COMPOSE)
 	size = hisi_media_mem.overlay_size;
@@ -370,6 +394,27 @@ void __init k3v2_allocate_memory_regions(void)
 
 }
 
+/*
+ * Machine reserve() hook: declare the contiguous heaps while memblock is
+ * still the allocator.  Runs after the early params, so the sizes follow
+ * k3v2_lcd_density.
+ */
+void __init k3v2_reserve(void)
+{
+#ifdef CONFIG_CMA
+	unsigned long size;
+
+	android_pmem_camera_pdata.size = hisi_media_mem.camera_size;
+	android_pmem_gralloc_pdata.size = hisi_media_mem.gralloc_size;
+	size = hisi_media_mem.camera_size + hisi_media_mem.gralloc_size;
+	if (contig_heap_declare(K3V2_MEDIA_HEAP, size, 0))
+		printk(KERN_ERR "k3v2: no media heap, pmem disabled\n");
+
+	if (contig_heap_declare(K3V2_CODEC_HEAP, hisi_media_mem.codec_size, 0))
+		printk(KERN_ERR "k3v2: no codec heap, memalloc disabled\n");
+#endif
+}
+
 static int __init k3v2_pmem_setup(char *str)
 {
 	k3v2_allocate_memory_regions();
@@ -15,6 +15,7 @@
 #include <linux/nodemask.h>
 #include <linux/memblock.h>
 #include <linux/fs.h>
+#include <linux/contig_heap.h>
 
 #include <asm/cputype.h>
 #include <asm/sections.h>
@@ -23,6 +24,8 @@
 #include <asm/sizes.h>
 #include <asm/smp_plat.h>
 #include <asm/tlb.h>
+#include <asm/tlbflush.h>
+#include <asm/cacheflush.h>
 #include <asm/highmem.h>
 #include <asm/traps.h>
 
@@ -291,6 +294,11 @@ static struct mem_type mem_types[] = {
 		.prot_l1   = PMD_TYPE_TABLE,
 		.domain    = DOMAIN_KERNEL,
 	},
+	[MT_MEMORY_DMA_READY] = {	/* lowmem mapped with pages only */
+		.prot_pte  = L_PTE_PRESENT | L_PTE_YOUNG | L_PTE_DIRTY,
+		.prot_l1   = PMD_TYPE_TABLE,
+		.domain    = DOMAIN_KERNEL,
+	},
 };
 
 const struct mem_type *get_mem_type(unsigned int type)
@@ -510,6 +518,7 @@ static void __init build_mem_type_table(void)
 	mem_types[MT_HIGH_VECTORS].prot_l1 |= ecc_mask;
 	mem_types[MT_MEMORY].prot_sect |= ecc_mask | cp->pmd;
 	mem_types[MT_MEMORY].prot_pte |= kern_pgprot;
+	mem_types[MT_MEMORY_DMA_READY].prot_pte |= kern_pgprot;
 	mem_types[MT_MEMORY_NONCACHED].prot_sect |= ecc_mask;
 	mem_types[MT_MEMORY_R].prot_sect |= ecc_mask | cp->pmd;
 	mem_types[MT_MEMORY_RW].prot_sect |= ecc_mask | cp->pmd;
@@ -592,7 +601,7 @@ static void __init alloc_init_section(pud_t *pud, unsigned long addr,
 	 * L1 entries, whereas PGDs refer to a group of L1 entries making
 	 * up one logical pointer to an L2 table.
 	 */
-	if (((addr | end | phys) & ~SECTION_MASK) == 0) {
+	if (type->prot_sect && ((addr | end | phys) & ~SECTION_MASK) == 0) {
 		pmd_t *p = pmd;
 
 		if (addr & SECTION_SIZE)
@@ -1056,6 +1065,114 @@ static void __init map_lowmem(void)
 	}
 }
 
+#ifdef CONFIG_CMA
+/*
+ * The contiguous heaps are lowmem, so map_lowmem() put them in the
+ * cacheable linear mapping, with sections.  A heap range that a driver
+ * maps uncached must not keep a cacheable alias there: on ARMv7 that is
+ * a mismatched attribute mapping, and lines the cpu speculatively loads
+ * through it can be written back over the device's data.  So the heaps
+ * are mapped again with pages, and arch_contig_heap_remap() switches the
+ * attributes of the ranges handed out uncached.
+ */
+#define MAX_CONTIG_HEAP_AREAS	4
+
+static struct contig_heap_area {
+	unsigned long start;		/* kernel virtual */
+	unsigned long end;
+} contig_heap_areas[MAX_CONTIG_HEAP_AREAS];
+static unsigned int nr_contig_heap_areas;
+
+/* Called by contig_heap_declare(), from the machine's reserve() hook */
+void __init arch_contig_heap_reserve(phys_addr_t base, phys_addr_t size)
+{
+	struct contig_heap_area *area;
+
+	if (WARN_ON(nr_contig_heap_areas == MAX_CONTIG_HEAP_AREAS))
+		return;
+
+	area = &contig_heap_areas[nr_contig_heap_areas++];
+	area->start = __phys_to_virt(base);
+	area->end = __phys_to_virt(base + size);
+}
+
+static void __init map_contig_heaps(void)
+{
+	struct contig_heap_area *area;
+	struct map_desc map;
+	unsigned long addr;
+	unsigned int i;
+
+	for (i = 0; i < nr_contig_heap_areas; i++) {
+		area = &contig_heap_areas[i];
+		if (__pa(area->end - 1) >= lowmem_limit) {
+			area->end = area->start;
+			continue;
+		}
+
+		/* heaps are aligned well beyond a pmd, drop the sections */
+		for (addr = area->start; addr < area->end; addr += PMD_SIZE)
+			pmd_clear(pmd_off_k(addr));
+
+		map.pfn = __phys_to_pfn(__pa(area->start));
+		map.virtual = area->start;
+		map.length = area->end - area->start;
+		map.type = MT_MEMORY_DMA_READY;
+		create_mapping(&map);
+	}
+}
+
+static int contig_heap_update_pte(pte_t *pte, pgtable_t token,
+				  unsigned long addr, void *data)
+{
+	pgprot_t prot = *(pgprot_t *)data;
+
+	set_pte_ext(pte, mk_pte(virt_to_page(addr), prot), 0);
+	return 0;
+}
+
+/*
+ * Make the linear mapping of @count pages of a heap cacheable again, or
+ * non-cacheable.  In the latter case the range is written back and
+ * invalidated once the cacheable mapping is gone, so that nothing can be
+ * loaded into the caches again behind the flush.
+ *
+ * Non-cacheable is normal memory, bufferable, like __dma_remap() and the
+ * write-combined pmem user mappings; strongly ordered would fault on
+ * unaligned kernel accesses.  pgprot_dmacoherent() is forced uncached in
+ * this tree, so it is not used here.
+ */
+int arch_contig_heap_remap(struct page *page, unsigned long count,
+			   bool cached)
+{
+	unsigned long start = (unsigned long)page_address(page);
+	unsigned long end = start + (count << PAGE_SHIFT);
+	pgprot_t prot = cached ? pgprot_kernel :
+				 pgprot_writecombine(pgprot_kernel);
+	unsigned int i;
+
+	for (i = 0; i < nr_contig_heap_areas; i++)
+		if (start >= contig_heap_areas[i].start &&
+		    end <= contig_heap_areas[i].end)
+			break;
+	if (i == nr_contig_heap_areas)
+		return -EINVAL;
+
+	apply_to_page_range(&init_mm, start, end - start,
+			    contig_heap_update_pte, &prot);
+	flush_tlb_kernel_range(start, end);
+
+	if (!cached) {
+		dmac_flush_range((void *)start, (void *)end);
+		outer_flush_range(__pa(start), __pa(end));
+	}
+
+	return 0;
+}
+#else
+static inline void map_contig_heaps(void) {}
+#endif
+
 /*
  * paging_init() sets up the page tables, initialises the zone memory
  * maps, and sets up the zero page, bad page and bad page tables.
@@ -1069,6 +1186,7 @@ void __init paging_init(struct machine_desc *mdesc)
 	build_mem_type_table();
 	prepare_page_table();
 	map_lowmem();
+	map_contig_heaps();
 	devicemaps_init(mdesc);
 	kmap_init();
 
@@ -34,6 +34,7 @@
 #include <linux/net.h>
 
 #define DEFLATE_DEF_LEVEL		Z_DEFAULT_COMPRESSION
+#define DEFLATE_FAST_LEVEL		Z_BEST_SPEED
 #define DEFLATE_DEF_WINBITS		11
 #define DEFLATE_DEF_MEMLEVEL		MAX_MEM_LEVEL
 
@@ -42,7 +43,7 @@ struct deflate_ctx {
 	struct z_stream_s decomp_stream;
 };
 
-static int deflate_comp_init(struct deflate_ctx *ctx)
+static int deflate_comp_init(struct deflate_ctx *ctx, int level)
 {
 	int ret = 0;
 	struct z_stream_s *stream = &ctx->comp_stream;
@@ -53,7 +54,7 @@ static int deflate_comp_init(struct deflate_ctx *ctx)
 		ret = -ENOMEM;
 		goto out;
 	}
-	ret = zlib_deflateInit2(stream, DEFLATE_DEF_LEVEL, Z_DEFLATED,
+	ret = zlib_deflateInit2(stream, level, Z_DEFLATED,
 	                        -DEFLATE_DEF_WINBITS, DEFLATE_DEF_MEMLEVEL,
 	                        Z_DEFAULT_STRATEGY);
 	if (ret != Z_OK) {
@@ -101,12 +102,12 @@ static void deflate_decomp_exit(struct deflate_ctx *ctx)
 	vfree(ctx->decomp_stream.workspace);
 }
 
-static int deflate_init(struct crypto_tfm *tfm)
+static int __deflate_init(struct crypto_tfm *tfm, int level)
 {
 	struct deflate_ctx *ctx = crypto_tfm_ctx(tfm);
 	int ret;
 
-	ret = deflate_comp_init(ctx);
+	ret = deflate_comp_init(ctx, level);
 	if (ret)
 		goto out;
 	ret = deflate_decomp_init(ctx);
@@ -116,6 +117,16 @@ out:
 	return ret;
 }
 
+static int deflate_init(struct crypto_tfm *tfm)
+{
+	return __deflate_init(tfm, DEFLATE_DEF_LEVEL);
+}
+
+static int deflate_fast_init(struct crypto_tfm *tfm)
+{
+	return __deflate_init(tfm, DEFLATE_FAST_LEVEL);
+}
+
 static void deflate_exit(struct crypto_tfm *tfm)
 {
 	struct deflate_ctx *ctx = crypto_tfm_ctx(tfm);
@@ -207,13 +218,37 @@ static struct crypto_alg alg = {
 	.coa_decompress  	= deflate_decompress } }
 };
 
+/* Same format, fastest level; decompresses with either algorithm */
+static struct crypto_alg fast_alg = {
+	.cra_name		= "deflate-fast",
+	.cra_flags		= CRYPTO_ALG_TYPE_COMPRESS,
+	.cra_ctxsize		= sizeof(struct deflate_ctx),
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(fast_alg.cra_list),
+	.cra_init		= deflate_fast_init,
+	.cra_exit		= deflate_exit,
+	.cra_u			= { .compress = {
+	.coa_compress		= deflate_compress,
+	.coa_decompress		= deflate_decompress } }
+};
+
 static int __init deflate_mod_init(void)
 {
-	return crypto_register_alg(&alg);
+	int ret;
+
+	ret = crypto_register_alg(&alg);
+	if (ret)
+		return ret;
+
+	ret = crypto_register_alg(&fast_alg);
+	if (ret)
+		crypto_unregister_alg(&alg);
+	return ret;
 }
 
 static void __exit deflate_mod_fini(void)
 {
+	crypto_unregister_alg(&fast_alg);
 	crypto_unregister_alg(&alg);
 }
 
@@ -222,5 +257,6 @@ module_exit(deflate_mod_fini);
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Deflate Compression Algorithm for IPCOMP");
+MODULE_ALIAS("deflate-fast");
 MODULE_AUTHOR("James Morris <jmorris@intercode.com.au>");
 
@@ -27,7 +27,10 @@
 #include <linux/cpufreq-k3v2.h>
 #include <mach/boardid.h>
 #include <linux/suspend.h>
-#include <linux/ipps.h>
+#include <linux/kthread.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/k3hotplug.h>
 
 /* pm_qos interface global val*/
 struct pm_qos_lst {
@@ -77,6 +80,20 @@ struct cpu_num_limit gcpu_num_limit = {
 /***************************cpu hotplug*************************/
 #ifndef NO_CPU_HOTPLUG
 
+/*
+ * Each sampling period the load of every online cpu (the share of time
+ * it was not idle) and the average length of its runqueue are sampled,
+ * and both are folded into decaying averages.  A core is added when the
+ * least loaded cpu is busy and the runqueues are long, and removed when
+ * the load would fit on one core less and the runqueues are short.
+ * Either condition has to hold for a while (the hysteresis) before
+ * anything happens; the hold time is never shorter than cost_ratio times
+ * the measured cost of an online/offline round trip, so that slow
+ * transitions are made less often.  The transitions themselves run in
+ * a SCHED_FIFO thread, k3hotplug, so that the sampling never waits for
+ * them.
+ */
+
 #define DEFAULT_HOTPLUG_IN_LOAD			(95)
 #define DEFAULT_HOTPLUG_OUT_LOAD		(3)
 #define DEFAULT_DIFFERENTIAL			(10)
@@ -85,39 +102,63 @@ struct cpu_num_limit gcpu_num_limit = {
 /* 20s booting not hotplug */
 #define BOOTING_SAMPLING_PERIOD			(20000)
 
-/*hotplug task running*/
-#define DEFAULT_HOTPLUG_IN_RUN			(3)
-#define DEFAULT_HOTPLUG_OUT_RUN			(6)
-
-/*task running threshold*/
+/* runqueue length threshold per online cpu, times 100 */
 #define TASK_THRESHOLD_H				(199)
 #define TASK_THRESHOLD_L				(110)
 
 /*CPU NUM WATERSHED*/
 #define CPU_NUM_WATERSHED				(2)
 
-/* default number of sampling periods to average before hotplug-in decision */
-#define DEFAULT_HOTPLUG_IN_SAMPLING_PERIODS		(3)
+/* default hold times before a hotplug-in or hotplug-out, ms */
+#define DEFAULT_UP_DELAY				(150)
+#define DEFAULT_DOWN_DELAY				(1000)
+#define DEFAULT_LAST_DOWN_DELAY			(10000)
+
+/* hold at least this many times the hotplug round trip latency */
+#define DEFAULT_COST_RATIO				(10)
 
-/* default number of sampling periods to average before hotplug-out decision */
-#define DEFAULT_HOTPLUG_OUT_SAMPLING_PERIODS	(20)
-#define DEFAULT_HOTPLUG_OUT_SAMPLING_PERIODS1	(200)
+/* new samples weigh 1/2^LOAD_DECAY_SHIFT in the averages */
+#define LOAD_DECAY_SHIFT				(1)
 
 struct cpu_info_s {
 	cputime64_t prev_cpu_idle;
 	cputime64_t prev_cpu_wall;
 	cputime64_t prev_cpu_nice;
+	unsigned int load_avg;		/* percent */
 };
 static DEFINE_PER_CPU(struct cpu_info_s, hp_cpu_info);
 
 static struct delayed_work k_work;
 
-/*average nr_running on cpu*/
-static int g_iavruning = 0;
-static int g_iavraddcnt = 0;
-static int g_iavrsubcnt = 0;
-static int hotplug_in_count = 0;
-static int hotplug_out_count = 0;
+static unsigned int sampling_rate = DEFAULT_SAMPLING_PERIOD;
+static unsigned int up_load = DEFAULT_HOTPLUG_IN_LOAD;
+static unsigned int down_load = DEFAULT_HOTPLUG_IN_LOAD;
+static unsigned int up_nr_running = TASK_THRESHOLD_H;
+static unsigned int down_nr_running = TASK_THRESHOLD_L;
+static unsigned int up_delay = DEFAULT_UP_DELAY;
+static unsigned int down_delay = DEFAULT_DOWN_DELAY;
+static unsigned int last_down_delay = DEFAULT_LAST_DOWN_DELAY;
+static unsigned int cost_ratio = DEFAULT_COST_RATIO;
+
+/* total runqueue length of the online cpus, decaying average times 100 */
+static unsigned int nr_running_avg;
+
+/* when the hotplug-in or -out condition started to hold, or 0 */
+static u64 up_since;
+static u64 down_since;
+
+/*
+ * The hotplug thread and its single request: +1 to add a core, -1 to
+ * remove one.  hp_pending is set until the thread has served it, no
+ * new decision is made meanwhile.
+ */
+static struct task_struct *hp_task;
+static int hp_request;
+static atomic_t hp_pending = ATOMIC_INIT(0);
+
+/* decaying averages of the time cpu_up and cpu_down took, us */
+static unsigned int up_latency;
+static unsigned int down_latency;
 
 #ifdef CONFIG_IPPS_SUPPORT
 static void ippsclient_add(struct ipps_device *device)
@@ -152,19 +193,65 @@ static inline cputime64_t get_cpu_idle_time(unsigned int cpu, cputime64_t *wall)
 	return idle_time;
 }
 
+static inline unsigned int decay(unsigned int avg, unsigned int sample)
+{
+	return avg - (avg >> LOAD_DECAY_SHIFT) + (sample >> LOAD_DECAY_SHIFT);
+}
+
+/*
+ * ms a condition must hold before acting on it: the configured delay,
+ * or cost_ratio times the last round trip if that is longer.
+ */
+static unsigned int hold_time(unsigned int delay)
+{
+	unsigned int cost = cost_ratio * (up_latency + down_latency) / 1000;
+
+	return max(delay, cost);
+}
+
+/* ms since the condition started to hold, 0 when it just did */
+static unsigned int held_for(u64 *since, bool holds, u64 now)
+{
+	if (!holds) {
+		*since = 0;
+		return 0;
+	}
+	if (!*since)
+		*since = now;
+	return div_u64(now - *since, NSEC_PER_MSEC);
+}
+
+static void hotplug_request(int request, unsigned int online,
+			    unsigned int held, unsigned int needed)
+{
+	trace_k3hotplug_decision(online, request, held, needed);
+
+	up_since = 0;
+	down_since = 0;
+	hp_request = request;
+	/* pairs with the smp_rmb() in k3hotplug_thread() */
+	smp_wmb();
+	atomic_set(&hp_pending, 1);
+	wake_up_process(hp_task);
+}
+
 static void auto_hotplug(void)
 {
 	/* single largest CPU load percentage*/
 	unsigned int max_load = 0;
 	unsigned int min_load = 100;
-	int cpun = 0;
+	unsigned int nr_sample = 0;
+	unsigned int held, needed;
+	unsigned int cpun;
+	bool want_up, want_down;
 	unsigned int j;
+	u64 now;
 
 	cpufreq_get(0);
 
 	/*
 	 * cpu load accounting
-	 * get highest load, total load and average load across all CPUs
+	 * get highest and lowest average load and the runqueue lengths
 	 */
 	for_each_online_cpu(j) {
 		unsigned int load;
@@ -174,6 +261,8 @@ static void auto_hotplug(void)
 
 		j_info = &per_cpu(hp_cpu_info, j);
 
+		nr_sample += sched_get_nr_running_avg(j);
+
 		/* update both cur_idle_time and cur_wall_time */
 		cur_idle_time = get_cpu_idle_time(j, &cur_wall_time);
 
@@ -193,77 +282,156 @@ static void auto_hotplug(void)
 
 		/* load is the percentage of time not spent in idle */
 		load = 100 * (wall_time - idle_time) / wall_time;
+		j_info->load_avg = decay(j_info->load_avg, load);
 
 		/* keep track of highest single load across all CPUs */
-		if (load > max_load)
-			max_load = load;
-		if (load < min_load)
-			min_load = load;
+		if (j_info->load_avg > max_load)
+			max_load = j_info->load_avg;
+		if (j_info->load_avg < min_load)
+			min_load = j_info->load_avg;
 	}
 
 	cpun = num_online_cpus();
+	nr_running_avg = decay(nr_running_avg, nr_sample);
 
-	/*avg running task on each cpu*/
-	g_iavruning = nr_running() * 100 / cpun;
-
-	if (g_iavruning > TASK_THRESHOLD_H) {
-		g_iavraddcnt ++ ;
-		g_iavrsubcnt = 0 ;
-	} else if (g_iavruning < TASK_THRESHOLD_L) {
-		g_iavraddcnt = 0 ;
-		g_iavrsubcnt ++ ;
-	}
+	trace_k3hotplug_sample(cpun, min_load, max_load, nr_sample,
+			       nr_running_avg);
 
-	/*min_load bigger than (95-(cpu number-1)*10)*/
-	if (min_load > (DEFAULT_HOTPLUG_IN_LOAD - (cpun-1) * DEFAULT_DIFFERENTIAL)) {
-		hotplug_in_count++;
-		hotplug_out_count = 0;
-	} else if ((cpun > CPU_NUM_WATERSHED)
-		&& ((max_load + min_load) < DEFAULT_HOTPLUG_IN_LOAD
-			|| min_load < cpun*DEFAULT_HOTPLUG_OUT_LOAD)) {
-		/*max+min load lower than 95 or min load lower than cpun * 5*/
-		hotplug_out_count++;
-		hotplug_in_count = 0;
-	} else if ((cpun <= CPU_NUM_WATERSHED) && (max_load + min_load) < DEFAULT_HOTPLUG_IN_LOAD) {
-		/*max+min load lower than 95*/
-		hotplug_out_count++;
-		hotplug_in_count = 0;
-	}
+	/* the thread has not served the last request yet */
+	if (atomic_read(&hp_pending))
+		return;
 
-	if ((g_iavraddcnt >= DEFAULT_HOTPLUG_IN_RUN)
-		&& (hotplug_in_count >= DEFAULT_HOTPLUG_IN_SAMPLING_PERIODS)
-		&& (gcpu_num_limit.max > cpun)) {
-#ifdef CONFIG_HOTPLUG_CPU
-		cpu_up(num_online_cpus());
-#endif
-		hotplug_out_count = 0;
-		hotplug_in_count = hotplug_in_count/2;
-		g_iavraddcnt = 0 ;
-		g_iavrsubcnt = 0 ;
+	/*
+	 * in: min_load bigger than (95-(cpu number-1)*10) and more than
+	 * up_nr_running tasks per cpu
+	 */
+	want_up = min_load > up_load - min(up_load, (cpun - 1) * DEFAULT_DIFFERENTIAL)
+		&& nr_running_avg > up_nr_running * cpun
+		&& gcpu_num_limit.max > cpun;
 
+	/*
+	 * out: max+min load lower than down_load, or (above the watershed)
+	 * min load lower than cpun * 3, and fewer than down_nr_running
+	 * tasks per cpu
+	 */
+	want_down = (max_load + min_load < down_load
+			|| (cpun > CPU_NUM_WATERSHED
+				&& min_load < cpun * DEFAULT_HOTPLUG_OUT_LOAD))
+		&& nr_running_avg < down_nr_running * cpun
+		&& gcpu_num_limit.min < cpun;
+
+	now = ktime_to_ns(ktime_get());
+
+	held = held_for(&up_since, want_up, now);
+	needed = hold_time(up_delay);
+	if (want_up && held >= needed) {
+		hotplug_request(1, cpun, held, needed);
 		return;
 	}
 
-	if (((g_iavrsubcnt >= DEFAULT_HOTPLUG_OUT_RUN)
-		&& (gcpu_num_limit.min < cpun))
-		&& (((cpun > CPU_NUM_WATERSHED) && (hotplug_out_count >= DEFAULT_HOTPLUG_OUT_SAMPLING_PERIODS))
-			|| ((cpun <= CPU_NUM_WATERSHED) && (hotplug_out_count >= DEFAULT_HOTPLUG_OUT_SAMPLING_PERIODS1)))) {
+	held = held_for(&down_since, want_down, now);
+	needed = hold_time(cpun > CPU_NUM_WATERSHED ? down_delay : last_down_delay);
+	if (want_down && held >= needed)
+		hotplug_request(-1, cpun, held, needed);
+}
+
+static unsigned int update_latency(unsigned int avg, unsigned int sample)
+{
+	/* the first transition gives the initial estimate */
+	if (!avg)
+		return sample;
+	return avg - (avg >> 2) + (sample >> 2);
+}
 
+/* one core in or out, always the lowest offline or highest online one */
+static void hotplug_one(int request)
+{
+	unsigned int cpu, j, latency;
+	ktime_t start;
+	int ret = -EINVAL;
+
+	start = ktime_get();
+	if (request > 0) {
+		cpu = cpumask_next_zero(0, cpu_online_mask);
+		if (cpu < nr_cpu_ids && cpu_present(cpu)) {
+#ifdef CONFIG_HOTPLUG_CPU
+			ret = cpu_up(cpu);
+#endif
+		}
+	} else {
+		cpu = 0;
+		for_each_online_cpu(j)
+			cpu = j;
+		if (cpu) {
 #ifdef CONFIG_HOTPLUG_CPU
-		cpu_down(num_online_cpus()-1);
+			ret = cpu_down(cpu);
 #endif
-		hotplug_in_count  = 0;
-		hotplug_out_count = 0;
-		g_iavraddcnt = 0 ;
-		g_iavrsubcnt = 0 ;
+		}
+	}
+	latency = ktime_to_us(ktime_sub(ktime_get(), start));
 
+	trace_k3hotplug_transition(cpu, request > 0, latency, ret);
+	if (ret)
 		return;
+
+	if (request > 0)
+		up_latency = update_latency(up_latency, latency);
+	else
+		down_latency = update_latency(down_latency, latency);
+}
+
+static int k3hotplug_thread(void *data)
+{
+	int request;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+
+		if (!atomic_read(&hp_pending)) {
+			schedule();
+			continue;
+		}
+
+		__set_current_state(TASK_RUNNING);
+		/* see the request that was stored before pending was set */
+		smp_rmb();
+		request = hp_request;
+		if (gcpu_num_limit.block == 0)
+			hotplug_one(request);
+		atomic_set(&hp_pending, 0);
 	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static int hotplug_thread_start(void)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+
+	hp_task = kthread_create(k3hotplug_thread, NULL, "k3hotplug");
+	if (IS_ERR(hp_task))
+		return PTR_ERR(hp_task);
+
+	sched_setscheduler_nocheck(hp_task, SCHED_FIFO, &param);
+	get_task_struct(hp_task);
+	wake_up_process(hp_task);
+
+	return 0;
+}
+
+static void hotplug_thread_stop(void)
+{
+	kthread_stop(hp_task);
+	put_task_struct(hp_task);
+	atomic_set(&hp_pending, 0);
 }
 
 static void do_dbs_timer(struct work_struct *work)
 {
-	int delay = usecs_to_jiffies(DEFAULT_SAMPLING_PERIOD);
+	int delay = usecs_to_jiffies(sampling_rate);
 	delay -= jiffies % delay;
 	if (gcpu_num_limit.block == 0) {
 		auto_hotplug();
@@ -275,8 +443,10 @@ static inline void dbs_timer_init(void)
 {
 	INIT_DELAYED_WORK_DEFERRABLE(&k_work, do_dbs_timer);
 
+	up_since = 0;
+	down_since = 0;
 	if (RUNMODE_FLAG_NORMAL == runmode_is_factory())
-		schedule_delayed_work_on(0, &k_work, usecs_to_jiffies(DEFAULT_SAMPLING_PERIOD));
+		schedule_delayed_work_on(0, &k_work, usecs_to_jiffies(sampling_rate));
 }
 
 static inline void dbs_timer_exit(void)
@@ -284,6 +454,74 @@ static inline void dbs_timer_exit(void)
 	cancel_delayed_work_sync(&k_work);
 }
 
+/* sysfs, in /sys/devices/system/cpu/cpufreq/k3hotplug */
+#define show_one(name)							\
+static ssize_t show_##name(struct kobject *kobj,			\
+			   struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, "%u\n", name);				\
+}
+
+#define store_one(name, min_val)					\
+static ssize_t store_##name(struct kobject *kobj,			\
+		struct attribute *attr, const char *buf, size_t count)	\
+{									\
+	unsigned long val;						\
+	int ret;							\
+									\
+	ret = strict_strtoul(buf, 0, &val);				\
+	if (ret < 0)							\
+		return ret;						\
+	if (val < min_val || val > UINT_MAX)				\
+		return -EINVAL;						\
+	name = val;							\
+	return count;							\
+}
+
+#define k3hotplug_attr_rw(name, min_val)				\
+show_one(name)								\
+store_one(name, min_val)						\
+static struct global_attr name##_attr = __ATTR(name, 0644,		\
+		show_##name, store_##name)
+
+#define k3hotplug_attr_ro(name)						\
+show_one(name)								\
+static struct global_attr name##_attr = __ATTR(name, 0444,		\
+		show_##name, NULL)
+
+/* at least a jiffy */
+k3hotplug_attr_rw(sampling_rate, 10000);
+k3hotplug_attr_rw(up_load, 0);
+k3hotplug_attr_rw(down_load, 0);
+k3hotplug_attr_rw(up_nr_running, 0);
+k3hotplug_attr_rw(down_nr_running, 0);
+k3hotplug_attr_rw(up_delay, 0);
+k3hotplug_attr_rw(down_delay, 0);
+k3hotplug_attr_rw(last_down_delay, 0);
+k3hotplug_attr_rw(cost_ratio, 0);
+k3hotplug_attr_ro(up_latency);
+k3hotplug_attr_ro(down_latency);
+
+static struct attribute *k3hotplug_attributes[] = {
+	&sampling_rate_attr.attr,
+	&up_load_attr.attr,
+	&down_load_attr.attr,
+	&up_nr_running_attr.attr,
+	&down_nr_running_attr.attr,
+	&up_delay_attr.attr,
+	&down_delay_attr.attr,
+	&last_down_delay_attr.attr,
+	&cost_ratio_attr.attr,
+	&up_latency_attr.attr,
+	&down_latency_attr.attr,
+	NULL,
+};
+
+static struct attribute_group k3hotplug_attr_group = {
+	.attrs = k3hotplug_attributes,
+	.name = "k3hotplug",
+};
+
 #endif
 
 /********************cpu hotplug end**************************/
@@ -340,6 +578,7 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 	unsigned int cpu = policy->cpu;
 	unsigned int uippsmode = 0;
 	struct cpu_dbs_info_s *this_dbs_info = NULL;
+	int rc;
 
 	this_dbs_info = &per_cpu(hp_cpu_dbs_info, cpu);
 
@@ -349,16 +588,26 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 			return -EINVAL;
 
 		mutex_lock(&dbs_mutex);
-		dbs_enable++;
-
-		this_dbs_info->cpu = cpu;
-		this_dbs_info->freq_table = cpufreq_frequency_get_table(cpu);
 
 		/*
 		 * Start the timerschedule work, when this governor
 		 * is used for first time
 		 */
 		if (cpu == 0) {
+			rc = hotplug_thread_start();
+			if (rc) {
+				mutex_unlock(&dbs_mutex);
+				return rc;
+			}
+
+			rc = sysfs_create_group(cpufreq_global_kobject,
+						&k3hotplug_attr_group);
+			if (rc) {
+				hotplug_thread_stop();
+				mutex_unlock(&dbs_mutex);
+				return rc;
+			}
+
 #ifdef CONFIG_IPPS_SUPPORT
 			uippsmode = IPPS_DVFS_AVS_ENABLE;
 			ipps_set_func(&vcc_ipps_client, IPPS_OBJ_CPU, &uippsmode);
@@ -368,24 +617,39 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 			register_pm_notifier(&hotplug_pm_nb);
 		}
 
+		dbs_enable++;
+		this_dbs_info->cpu = cpu;
+		this_dbs_info->freq_table = cpufreq_frequency_get_table(cpu);
+
 		mutex_unlock(&dbs_mutex);
 
 		break;
 
 	case CPUFREQ_GOV_STOP:
 
+		/*
+		 * The thread may be in cpu_up()/cpu_down(), which starts or
+		 * stops the governor of that cpu and so takes dbs_mutex.
+		 * Stop sampling and wait for it before taking the mutex.
+		 */
+		if (cpu == 0) {
+			unregister_pm_notifier(&hotplug_pm_nb);
+			dbs_timer_exit();
+			hotplug_thread_stop();
+		}
+
 		mutex_lock(&dbs_mutex);
 
 		dbs_enable--;
 
 		if (cpu == 0) {
-			dbs_timer_exit();
 			k3hotplug_pm_qos_remove();
 #ifdef CONFIG_IPPS_SUPPORT
 			uippsmode = IPPS_DVFS_AVS_DISABLE;
 			ipps_set_func(&vcc_ipps_client, IPPS_OBJ_CPU, &uippsmode);
 #endif
-			unregister_pm_notifier(&hotplug_pm_nb);
+			sysfs_remove_group(cpufreq_global_kobject,
+					   &k3hotplug_attr_group);
 		}
 
 		mutex_unlock(&dbs_mutex);
@@ -0,0 +1,593 @@
+/*
+ * drivers/cpufreq/cpufreq_sched.c
+ *
+ * A cpufreq governor driven by the scheduler.  It computes load like
+ * 'interactive' does and honours the same hispeed_freq, go_hispeed_load
+ * and min_sample_time tunables, but instead of sampling from a timer it
+ * evaluates each cpu when the scheduler enqueues, dequeues or ticks on
+ * it, at most every rate_limit us.  A new frequency is picked right
+ * there and set by one SCHED_FIFO thread per policy.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/cpufreq.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/tick.h>
+#include <linux/time.h>
+#include <linux/timer.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_sched.h>
+
+static atomic_t active_count = ATOMIC_INIT(0);
+
+/* one per policy: the thread that sets the frequency */
+struct cpufreq_sched_policy {
+	struct cpufreq_policy *policy;
+	struct task_struct *task;
+	struct hrtimer kick;
+	spinlock_t lock;	/* protects pending and kick_time */
+	int pending;
+	ktime_t kick_time;	/* of the oldest request not yet served */
+};
+
+struct cpufreq_sched_cpuinfo {
+	struct update_util_data update_util;
+	struct timer_list slack_timer;
+	struct cpufreq_sched_policy *sp;
+	struct cpufreq_frequency_table *freq_table;
+	u64 last_update;	/* runqueue clock, ns */
+	u64 sample_time;	/* us, start of the current load sample */
+	u64 sample_idle;
+	u64 freq_change_time;	/* us */
+	u64 freq_change_time_in_idle;
+	unsigned int target_freq;
+	int table_error;	/* set by eval, reported by the thread */
+	int governor_enabled;
+};
+
+static DEFINE_PER_CPU(struct cpufreq_sched_cpuinfo, cpuinfo);
+
+static struct mutex set_speed_lock;
+
+/* Hi speed to bump to from lo speed when load burst (default max) */
+static u64 hispeed_freq;
+
+/* Go to hi speed when CPU load at or above this value. */
+#define DEFAULT_GO_HISPEED_LOAD 95
+static unsigned long go_hispeed_load;
+
+/*
+ * The minimum amount of time to spend at a frequency before we can ramp down.
+ */
+#define DEFAULT_MIN_SAMPLE_TIME 20 * USEC_PER_MSEC
+static unsigned long min_sample_time;
+
+/*
+ * The minimum time between two evaluations of a cpu, and so the shortest
+ * load sample.
+ */
+#define DEFAULT_RATE_LIMIT 1 * USEC_PER_MSEC
+static unsigned long rate_limit;
+
+/*
+ * The scheduler hook cannot wake the policy thread up, it runs under the
+ * runqueue lock: arm a timer this far ahead to do it, as hrtick does.
+ */
+#define KICK_DELAY_NS	10000
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+		unsigned int event);
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED
+static
+#endif
+struct cpufreq_governor cpufreq_gov_sched = {
+	.name = "sched",
+	.governor = cpufreq_governor_sched,
+	.max_transition_latency = 10000000,
+	.owner = THIS_MODULE,
+};
+
+static void cpufreq_sched_kick(struct cpufreq_sched_policy *sp, int in_sched)
+{
+	unsigned long flags;
+	int wake = 0;
+
+	spin_lock_irqsave(&sp->lock, flags);
+	if (!sp->pending) {
+		sp->pending = 1;
+		sp->kick_time = ktime_get();
+		wake = 1;
+	}
+	spin_unlock_irqrestore(&sp->lock, flags);
+
+	if (!wake)
+		return;
+	if (in_sched)
+		__hrtimer_start_range_ns(&sp->kick, ns_to_ktime(KICK_DELAY_NS),
+					 0, HRTIMER_MODE_REL_PINNED, 0);
+	else
+		wake_up_process(sp->task);
+}
+
+static enum hrtimer_restart cpufreq_sched_kick_timer(struct hrtimer *timer)
+{
+	struct cpufreq_sched_policy *sp =
+		container_of(timer, struct cpufreq_sched_policy, kick);
+
+	wake_up_process(sp->task);
+	return HRTIMER_NORESTART;
+}
+
+static unsigned int load_since(u64 now, u64 now_idle, u64 time, u64 idle)
+{
+	unsigned int delta_time = (unsigned int) cputime64_sub(now, time);
+	unsigned int delta_idle = (unsigned int) cputime64_sub(now_idle, idle);
+
+	if (delta_time == 0 || delta_idle > delta_time)
+		return 0;
+	return 100 * (delta_time - delta_idle) / delta_time;
+}
+
+/*
+ * Pick a frequency for the load of cpu since its last evaluation, or since
+ * the last frequency change if that is higher.  Runs on cpu with
+ * interrupts disabled, from the scheduler hook or the slack timer.
+ */
+static void cpufreq_sched_eval(struct cpufreq_sched_cpuinfo *pcpu,
+			       unsigned int cpu, int in_sched)
+{
+	struct cpufreq_policy *policy = pcpu->sp->policy;
+	unsigned int cpu_load, load_since_change;
+	unsigned int new_freq, index;
+	u64 now, now_idle;
+
+	now_idle = get_cpu_idle_time_us(cpu, &now);
+	cpu_load = load_since(now, now_idle, pcpu->sample_time,
+			      pcpu->sample_idle);
+	load_since_change = load_since(now, now_idle, pcpu->freq_change_time,
+				       pcpu->freq_change_time_in_idle);
+	pcpu->sample_time = now;
+	pcpu->sample_idle = now_idle;
+
+	if (load_since_change > cpu_load)
+		cpu_load = load_since_change;
+
+	if (cpu_load >= go_hispeed_load) {
+		if (policy->cur == policy->min)
+			new_freq = hispeed_freq;
+		else
+			new_freq = policy->max * cpu_load / 100;
+	} else {
+		new_freq = policy->cur * cpu_load / 100;
+	}
+
+	if (cpufreq_frequency_table_target(policy, pcpu->freq_table,
+					   new_freq, CPUFREQ_RELATION_H,
+					   &index)) {
+		/* no printk under the runqueue lock, the thread reports it */
+		if (!pcpu->table_error) {
+			pcpu->table_error = 1;
+			cpufreq_sched_kick(pcpu->sp, in_sched);
+		}
+		goto out;
+	}
+	new_freq = pcpu->freq_table[index].frequency;
+
+	if (new_freq == pcpu->target_freq)
+		goto out;
+
+	/*
+	 * Do not scale down unless we have been at this frequency for the
+	 * minimum sample time.
+	 */
+	if (new_freq < pcpu->target_freq &&
+	    cputime64_sub(now, pcpu->freq_change_time) < min_sample_time)
+		goto out;
+
+	trace_cpufreq_sched_target(cpu, cpu_load, pcpu->target_freq, new_freq);
+	pcpu->target_freq = new_freq;
+	cpufreq_sched_kick(pcpu->sp, in_sched);
+
+out:
+	/*
+	 * A cpu that goes idle above min gets no more scheduler events, yet
+	 * may hold the other cpus of the policy up: look at it again once
+	 * it may ramp down.
+	 */
+	if (pcpu->target_freq > policy->min &&
+	    !timer_pending(&pcpu->slack_timer))
+		mod_timer_pinned(&pcpu->slack_timer,
+				 jiffies + usecs_to_jiffies(min_sample_time));
+}
+
+static void cpufreq_sched_update(struct update_util_data *data, u64 time,
+				 unsigned int flags)
+{
+	struct cpufreq_sched_cpuinfo *pcpu =
+		container_of(data, struct cpufreq_sched_cpuinfo, update_util);
+
+	if (!pcpu->governor_enabled)
+		return;
+	if (time - pcpu->last_update < (u64)rate_limit * NSEC_PER_USEC)
+		return;
+	pcpu->last_update = time;
+	cpufreq_sched_eval(pcpu, smp_processor_id(), 1);
+}
+
+static void cpufreq_sched_slack_timer(unsigned long data)
+{
+	struct cpufreq_sched_cpuinfo *pcpu = &per_cpu(cpuinfo, data);
+	unsigned long flags;
+
+	/* the timer may have migrated if the cpu went down */
+	if (data != smp_processor_id())
+		return;
+
+	/* keep the scheduler hook out */
+	local_irq_save(flags);
+	smp_rmb();
+	if (pcpu->governor_enabled)
+		cpufreq_sched_eval(pcpu, data, 0);
+	local_irq_restore(flags);
+}
+
+static void cpufreq_sched_set_speed(struct cpufreq_sched_policy *sp,
+				    ktime_t kick_time)
+{
+	struct cpufreq_policy *policy = sp->policy;
+	struct cpufreq_sched_cpuinfo *pjcpu;
+	unsigned int j, max_freq = 0;
+
+	mutex_lock(&set_speed_lock);
+
+	for_each_cpu(j, policy->cpus) {
+		pjcpu = &per_cpu(cpuinfo, j);
+		smp_rmb();
+		if (pjcpu->governor_enabled && pjcpu->target_freq > max_freq)
+			max_freq = pjcpu->target_freq;
+		if (pjcpu->table_error)
+			pr_warn_once("cpufreq_sched: cpu %u: "
+				     "cpufreq_frequency_table_target error\n",
+				     j);
+	}
+
+	if (max_freq && max_freq != policy->cur)
+		__cpufreq_driver_target(policy, max_freq, CPUFREQ_RELATION_H);
+
+	mutex_unlock(&set_speed_lock);
+
+	trace_cpufreq_sched_setspeed(policy->cpu, max_freq, policy->cur,
+			(unsigned int) ktime_us_delta(ktime_get(), kick_time));
+
+	for_each_cpu(j, policy->cpus) {
+		pjcpu = &per_cpu(cpuinfo, j);
+		pjcpu->freq_change_time_in_idle =
+			get_cpu_idle_time_us(j, &pjcpu->freq_change_time);
+	}
+}
+
+static int cpufreq_sched_thread(void *data)
+{
+	struct cpufreq_sched_policy *sp = data;
+	unsigned long flags;
+	ktime_t kick_time;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+
+		spin_lock_irqsave(&sp->lock, flags);
+		if (!sp->pending) {
+			spin_unlock_irqrestore(&sp->lock, flags);
+			schedule();
+			continue;
+		}
+		sp->pending = 0;
+		kick_time = sp->kick_time;
+		spin_unlock_irqrestore(&sp->lock, flags);
+
+		set_current_state(TASK_RUNNING);
+		cpufreq_sched_set_speed(sp, kick_time);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static ssize_t show_hispeed_freq(struct kobject *kobj,
+				 struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n", hispeed_freq);
+}
+
+static ssize_t store_hispeed_freq(struct kobject *kobj,
+				  struct attribute *attr, const char *buf,
+				  size_t count)
+{
+	int ret;
+	u64 val;
+
+	ret = strict_strtoull(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	hispeed_freq = val;
+	return count;
+}
+
+static struct global_attr hispeed_freq_attr = __ATTR(hispeed_freq, 0644,
+		show_hispeed_freq, store_hispeed_freq);
+
+
+static ssize_t show_go_hispeed_load(struct kobject *kobj,
+				     struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", go_hispeed_load);
+}
+
+static ssize_t store_go_hispeed_load(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	go_hispeed_load = val;
+	return count;
+}
+
+static struct global_attr go_hispeed_load_attr = __ATTR(go_hispeed_load, 0644,
+		show_go_hispeed_load, store_go_hispeed_load);
+
+static ssize_t show_min_sample_time(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", min_sample_time);
+}
+
+static ssize_t store_min_sample_time(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	min_sample_time = val;
+	return count;
+}
+
+static struct global_attr min_sample_time_attr = __ATTR(min_sample_time, 0644,
+		show_min_sample_time, store_min_sample_time);
+
+static ssize_t show_rate_limit(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", rate_limit);
+}
+
+static ssize_t store_rate_limit(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	rate_limit = val;
+	return count;
+}
+
+static struct global_attr rate_limit_attr = __ATTR(rate_limit, 0644,
+		show_rate_limit, store_rate_limit);
+
+static struct attribute *sched_attributes[] = {
+	&hispeed_freq_attr.attr,
+	&go_hispeed_load_attr.attr,
+	&min_sample_time_attr.attr,
+	&rate_limit_attr.attr,
+	NULL,
+};
+
+static struct attribute_group sched_attr_group = {
+	.attrs = sched_attributes,
+	.name = "sched",
+};
+
+static struct cpufreq_sched_policy *
+cpufreq_sched_policy_alloc(struct cpufreq_policy *policy)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+	struct cpufreq_sched_policy *sp;
+
+	sp = kzalloc(sizeof(*sp), GFP_KERNEL);
+	if (!sp)
+		return NULL;
+
+	sp->policy = policy;
+	spin_lock_init(&sp->lock);
+	hrtimer_init(&sp->kick, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sp->kick.function = cpufreq_sched_kick_timer;
+
+	sp->task = kthread_create(cpufreq_sched_thread, sp, "kschedfreq/%d",
+				  policy->cpu);
+	if (IS_ERR(sp->task)) {
+		kfree(sp);
+		return NULL;
+	}
+	sched_setscheduler_nocheck(sp->task, SCHED_FIFO, &param);
+	get_task_struct(sp->task);
+	wake_up_process(sp->task);
+
+	return sp;
+}
+
+static void cpufreq_sched_policy_free(struct cpufreq_sched_policy *sp)
+{
+	hrtimer_cancel(&sp->kick);
+	kthread_stop(sp->task);
+	put_task_struct(sp->task);
+	kfree(sp);
+}
+
+static void cpufreq_sched_stop(struct cpufreq_policy *policy)
+{
+	struct cpufreq_sched_policy *sp = per_cpu(cpuinfo, policy->cpu).sp;
+	struct cpufreq_sched_cpuinfo *pcpu;
+	unsigned int j;
+
+	for_each_cpu(j, policy->cpus) {
+		pcpu = &per_cpu(cpuinfo, j);
+		pcpu->governor_enabled = 0;
+		smp_wmb();
+		cpufreq_remove_update_util_hook(j);
+	}
+	/* wait for the scheduler hooks to be done */
+	synchronize_sched();
+	for_each_cpu(j, policy->cpus)
+		del_timer_sync(&per_cpu(cpuinfo, j).slack_timer);
+
+	if (sp)
+		cpufreq_sched_policy_free(sp);
+	for_each_cpu(j, policy->cpus)
+		per_cpu(cpuinfo, j).sp = NULL;
+}
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+		unsigned int event)
+{
+	int rc;
+	unsigned int j;
+	struct cpufreq_sched_cpuinfo *pcpu;
+	struct cpufreq_sched_policy *sp;
+	struct cpufreq_frequency_table *freq_table;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu))
+			return -EINVAL;
+
+		freq_table =
+			cpufreq_frequency_get_table(policy->cpu);
+		if (!freq_table)
+			return -EINVAL;
+
+		sp = cpufreq_sched_policy_alloc(policy);
+		if (!sp)
+			return -ENOMEM;
+
+		if (!hispeed_freq)
+			hispeed_freq = policy->max;
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->sp = sp;
+			pcpu->freq_table = freq_table;
+			pcpu->target_freq = policy->cur;
+			pcpu->last_update = 0;
+			pcpu->freq_change_time_in_idle =
+				get_cpu_idle_time_us(j,
+					     &pcpu->freq_change_time);
+			pcpu->sample_time = pcpu->freq_change_time;
+			pcpu->sample_idle = pcpu->freq_change_time_in_idle;
+			pcpu->table_error = 0;
+			pcpu->governor_enabled = 1;
+			smp_wmb();
+			cpufreq_add_update_util_hook(j, &pcpu->update_util,
+						     cpufreq_sched_update);
+		}
+
+		/*
+		 * Do not create sysfs entries if we have already done so.
+		 */
+		if (atomic_inc_return(&active_count) > 1)
+			return 0;
+
+		rc = sysfs_create_group(cpufreq_global_kobject,
+				&sched_attr_group);
+		if (rc) {
+			/* the core restarts the old governor, leave nothing */
+			cpufreq_sched_stop(policy);
+			atomic_dec(&active_count);
+			return rc;
+		}
+
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		cpufreq_sched_stop(policy);
+
+		if (atomic_dec_return(&active_count) > 0)
+			return 0;
+
+		sysfs_remove_group(cpufreq_global_kobject,
+				&sched_attr_group);
+
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		mutex_lock(&set_speed_lock);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy,
+					policy->max, CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy,
+					policy->min, CPUFREQ_RELATION_L);
+		mutex_unlock(&set_speed_lock);
+		break;
+	}
+	return 0;
+}
+
+static int __init cpufreq_sched_init(void)
+{
+	unsigned int i;
+	struct cpufreq_sched_cpuinfo *pcpu;
+
+	go_hispeed_load = DEFAULT_GO_HISPEED_LOAD;
+	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	rate_limit = DEFAULT_RATE_LIMIT;
+
+	for_each_possible_cpu(i) {
+		pcpu = &per_cpu(cpuinfo, i);
+		init_timer(&pcpu->slack_timer);
+		pcpu->slack_timer.function = cpufreq_sched_slack_timer;
+		pcpu->slack_timer.data = i;
+	}
+
+	mutex_init(&set_speed_lock);
+
+	return cpufreq_register_governor(&cpufreq_gov_sched);
+}
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED
+fs_initcall(cpufreq_sched_init);
+#else
+module_init(cpufreq_sched_init);
+#endif
+
+MODULE_DESCRIPTION("'cpufreq_sched' - A scheduler driven cpufreq governor "
+	"for latency sensitive workloads");
+MODULE_LICENSE("GPL");
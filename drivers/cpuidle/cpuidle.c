@@ -42,6 +42,46 @@ static void cpuidle_kick_cpus(void) {}
 
 static int __cpuidle_register_device(struct cpuidle_device *dev);
 
+/*
+ * Record the residency of the state just left, and whether the state was
+ * too deep (the cpu woke up before its target residency and a shallower
+ * state was usable) or too shallow (a deeper usable state would have
+ * paid off even after its exit latency).
+ */
+static void cpuidle_account_residency(struct cpuidle_device *dev,
+				      struct cpuidle_state *state)
+{
+	unsigned int residency = dev->last_residency;
+	int idx = state - dev->states;
+	int i;
+
+	if (!(state->flags & CPUIDLE_FLAG_TIME_VALID))
+		return;
+
+	state->residency_hist[cpuidle_hist_bucket(residency)]++;
+
+	if (residency < state->target_residency) {
+		for (i = idx - 1; i >= 0; i--) {
+			if (dev->states[i].flags & CPUIDLE_FLAG_IGNORE)
+				continue;
+			state->above++;
+			break;
+		}
+		return;
+	}
+
+	for (i = idx + 1; i < dev->state_count; i++) {
+		struct cpuidle_state *s = &dev->states[i];
+
+		if (s->flags & CPUIDLE_FLAG_IGNORE)
+			continue;
+		if (residency >= s->target_residency + s->exit_latency) {
+			state->below++;
+			break;
+		}
+	}
+}
+
 /**
  * cpuidle_idle_call - the main idle loop
  *
@@ -110,6 +150,7 @@ static void cpuidle_idle_call(void)
 
 	target_state->time += (unsigned long long)dev->last_residency;
 	target_state->usage++;
+	cpuidle_account_residency(dev, target_state);
 
 	/* give the governor an opportunity to reflect on the outcome */
 	if (cpuidle_curr_governor->reflect)
@@ -0,0 +1,272 @@
+/*
+ * predict.c - an idle governor that learns from observed residency
+ *
+ * This code is licenced under the GPL version 2 as described
+ * in the COPYING file that acompanies the Linux Kernel.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cpuidle.h>
+#include <linux/pm_qos_params.h>
+#include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/tick.h>
+#include <linux/sched.h>
+
+#define BUCKETS		CPUIDLE_HIST_BUCKETS
+#define INTERVALS	8
+#define HIST_ONE	1024
+#define DECAY_SHIFT	3
+#define EARLY_PCT	50
+#define STDDEV_THRESH	400
+
+/*
+ * Concepts behind the predict governor
+ *
+ * The next timer event, from the hrtimers and the timer wheel, is an
+ * upper bound of the coming idle period.  What cuts it shorter are
+ * interrupts, and those are learnt per cpu from the residency actually
+ * observed:
+ *
+ * - hits[] counts the idle periods that lasted until the timer, by the
+ *   length the timer allowed;
+ * - intercepts[] counts the ones that something else ended early, by
+ *   how long they lasted.
+ *
+ * Both are log2 histograms in US (see cpuidle_hist_bucket()) whose old
+ * samples lose 1/2^DECAY_SHIFT of their weight per idle period.
+ *
+ * To enter a state, the timer must leave room for its target residency.
+ * Of the past periods in which that much room was there, that is hits
+ * at or above the target's bucket and all intercepts, fewer than
+ * EARLY_PCT percent may have been intercepted below the target.
+ * Otherwise the state is too deep and the next shallower one is tried.
+ *
+ * Interrupts that arrive at a steady rate (a periodic device, a
+ * display refresh) make the early wakeups themselves regular.  The
+ * last INTERVALS of them are kept, and when their standard deviation
+ * is small their average bounds the prediction too.
+ *
+ * The cpuidle core counts, per state, the entries that turned out too
+ * deep or too shallow ("above" and "below" in sysfs) next to the
+ * residency histogram, which shows how well this works.
+ */
+
+struct predict_device {
+	int		last_state_idx;
+	int		needs_update;
+
+	unsigned int	sleep_us;	/* time to the next timer on entry */
+	unsigned int	exit_us;
+	unsigned int	hits[BUCKETS];
+	unsigned int	intercepts[BUCKETS];
+	u32		intervals[INTERVALS];
+	int		interval_ptr;
+};
+
+static DEFINE_PER_CPU(struct predict_device, predict_devices);
+
+static void predict_update(struct cpuidle_device *dev);
+
+/*
+ * Average of the recent early wakeups if they repeat, or @limit.
+ */
+static unsigned int repeating_interval(struct predict_device *data,
+				       unsigned int limit)
+{
+	u64 avg = 0, stddev = 0;
+	int i;
+
+	for (i = 0; i < INTERVALS; i++)
+		avg += data->intervals[i];
+	avg = avg / INTERVALS;
+
+	if (!avg || avg > limit)
+		return limit;
+
+	for (i = 0; i < INTERVALS; i++)
+		stddev += (data->intervals[i] - avg) *
+			  (data->intervals[i] - avg);
+	stddev = stddev / INTERVALS;
+
+	return stddev < STDDEV_THRESH ? avg : limit;
+}
+
+/*
+ * Did past idle periods that had room for @target_us by the timer end
+ * before it too often?
+ */
+static int too_deep(struct predict_device *data, unsigned int target_us)
+{
+	unsigned int early = 0, later = 0;
+	int bucket = cpuidle_hist_bucket(target_us);
+	int i;
+
+	for (i = 0; i < BUCKETS; i++) {
+		if (i < bucket) {
+			early += data->intercepts[i];
+		} else {
+			later += data->intercepts[i];
+			later += data->hits[i];
+		}
+	}
+
+	return early * 100 > EARLY_PCT * (early + later);
+}
+
+/**
+ * predict_select - selects the next idle state to enter
+ * @dev: the CPU
+ */
+static int predict_select(struct cpuidle_device *dev)
+{
+	struct predict_device *data = &__get_cpu_var(predict_devices);
+	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	unsigned int predicted_us;
+	struct timespec t;
+	int i;
+
+	if (data->needs_update) {
+		predict_update(dev);
+		data->needs_update = 0;
+	}
+
+	data->last_state_idx = CPUIDLE_DRIVER_STATE_START;
+	data->exit_us = 0;
+
+	t = ktime_to_timespec(tick_nohz_get_sleep_length());
+	if (t.tv_sec >= INT_MAX / USEC_PER_SEC)
+		data->sleep_us = INT_MAX;
+	else
+		data->sleep_us =
+			t.tv_sec * USEC_PER_SEC + t.tv_nsec / NSEC_PER_USEC;
+
+	/* Special case when user has set very strict latency requirement */
+	if (unlikely(latency_req == 0))
+		return 0;
+
+	predicted_us = repeating_interval(data, data->sleep_us);
+
+	/* the deepest state that fits, then shallower while it is too deep */
+	for (i = dev->state_count - 1; i > CPUIDLE_DRIVER_STATE_START; i--) {
+		struct cpuidle_state *s = &dev->states[i];
+
+		if (s->flags & CPUIDLE_FLAG_IGNORE)
+			continue;
+		if (s->target_residency > predicted_us)
+			continue;
+		if (s->exit_latency > latency_req)
+			continue;
+		if (s->exit_latency * (1 + 10 * nr_iowait_cpu(dev->cpu)) >
+		    predicted_us)
+			continue;
+		if (too_deep(data, s->target_residency))
+			continue;
+		break;
+	}
+
+	data->last_state_idx = i;
+	data->exit_us = dev->states[i].exit_latency;
+
+	return i;
+}
+
+/**
+ * predict_reflect - records that the histograms need an update
+ * @dev: the CPU
+ *
+ * NOTE: this is on the idle exit path, the work is done on the next
+ *       select.
+ */
+static void predict_reflect(struct cpuidle_device *dev)
+{
+	struct predict_device *data = &__get_cpu_var(predict_devices);
+
+	data->needs_update = 1;
+}
+
+/**
+ * predict_update - learns from the last idle period
+ * @dev: the CPU
+ */
+static void predict_update(struct cpuidle_device *dev)
+{
+	struct predict_device *data = &__get_cpu_var(predict_devices);
+	struct cpuidle_state *target = &dev->states[data->last_state_idx];
+	unsigned int measured_us = cpuidle_get_last_residency(dev);
+	int i;
+
+	/* the driver may have entered a shallower state than selected */
+	if (dev->last_state && dev->last_state != target) {
+		target = dev->last_state;
+		data->exit_us = target->exit_latency;
+	}
+
+	/* no measurement, assume the timer ended it */
+	if (unlikely(!(target->flags & CPUIDLE_FLAG_TIME_VALID)))
+		measured_us = data->sleep_us;
+
+	/* the exit latency comes after the wakeup event */
+	if (measured_us > data->exit_us)
+		measured_us -= data->exit_us;
+
+	for (i = 0; i < BUCKETS; i++) {
+		data->hits[i] -= data->hits[i] >> DECAY_SHIFT;
+		data->intercepts[i] -= data->intercepts[i] >> DECAY_SHIFT;
+	}
+
+	/* within 1/8 of the timer counts as the timer */
+	if (measured_us >= data->sleep_us - (data->sleep_us >> 3)) {
+		data->hits[cpuidle_hist_bucket(data->sleep_us)] += HIST_ONE;
+		return;
+	}
+
+	data->intercepts[cpuidle_hist_bucket(measured_us)] += HIST_ONE;
+
+	data->intervals[data->interval_ptr++] = measured_us;
+	if (data->interval_ptr >= INTERVALS)
+		data->interval_ptr = 0;
+}
+
+/**
+ * predict_enable_device - scans a CPU's states and does setup
+ * @dev: the CPU
+ */
+static int predict_enable_device(struct cpuidle_device *dev)
+{
+	struct predict_device *data = &per_cpu(predict_devices, dev->cpu);
+
+	memset(data, 0, sizeof(struct predict_device));
+
+	return 0;
+}
+
+static struct cpuidle_governor predict_governor = {
+	.name =		"predict",
+	.rating =	30,
+	.enable =	predict_enable_device,
+	.select =	predict_select,
+	.reflect =	predict_reflect,
+	.owner =	THIS_MODULE,
+};
+
+/**
+ * init_predict - initializes the governor
+ */
+static int __init init_predict(void)
+{
+	return cpuidle_register_governor(&predict_governor);
+}
+
+/**
+ * exit_predict - exits the governor
+ */
+static void __exit exit_predict(void)
+{
+	cpuidle_unregister_governor(&predict_governor);
+}
+
+MODULE_LICENSE("GPL");
+module_init(init_predict);
+module_exit(exit_predict);
@@ -243,10 +243,26 @@ static ssize_t show_state_##_name(struct cpuidle_state *state, char *buf) \
 	return sprintf(buf, "%s\n", state->_name);\
 }
 
+/* one line per bucket: lowest residency in US, and count */
+static ssize_t show_state_histogram(struct cpuidle_state *state, char *buf)
+{
+	ssize_t n = 0;
+	int i;
+
+	for (i = 0; i < CPUIDLE_HIST_BUCKETS; i++)
+		n += sprintf(buf + n, "%u %u\n", i ? 1U << (i - 1) : 0,
+			     state->residency_hist[i]);
+
+	return n;
+}
+
 define_show_state_function(exit_latency)
 define_show_state_function(power_usage)
+define_show_state_function(target_residency)
 define_show_state_ull_function(usage)
 define_show_state_ull_function(time)
+define_show_state_ull_function(above)
+define_show_state_ull_function(below)
 define_show_state_str_function(name)
 define_show_state_str_function(desc)
 
@@ -256,6 +272,10 @@ define_one_state_ro(latency, show_state_exit_latency);
 define_one_state_ro(power, show_state_power_usage);
 define_one_state_ro(usage, show_state_usage);
 define_one_state_ro(time, show_state_time);
+define_one_state_ro(residency, show_state_target_residency);
+define_one_state_ro(above, show_state_above);
+define_one_state_ro(below, show_state_below);
+define_one_state_ro(histogram, show_state_histogram);
 
 static struct attribute *cpuidle_state_default_attrs[] = {
 	&attr_name.attr,
@@ -264,6 +284,10 @@ static struct attribute *cpuidle_state_default_attrs[] = {
 	&attr_power.attr,
 	&attr_usage.attr,
 	&attr_time.attr,
+	&attr_residency.attr,
+	&attr_above.attr,
+	&attr_below.attr,
+	&attr_histogram.attr,
 	NULL
 };
 
@@ -1,4 +1,4 @@
-/* 
+/*
  * memory heap
  *
  * Copyright (C) 2012 Google Finland Oy.
@@ -19,368 +19,385 @@
  *
 --------------------------------------------------------------------------------
 --
---  Abstract : memory heap
+--  Abstract : memory heap, best fit with address-ordered coalescing
 --
 ------------------------------------------------------------------------------*/
 
 /*** Header Files ***/
 #include <linux/kernel.h>
-#include <linux/module.h>
-/* needed for remap_page_range */
-#include <linux/mm.h>
 /* obviously, for kmalloc */
 #include <linux/slab.h>
-/* for struct file_operations, register_chrdev() */
-#include <linux/fs.h>
-/* standard error codes */
-#include <linux/errno.h>
-/* this header files wraps some common module-space operations ...
-   here we use mem_map_reserve() macro */
-#include <linux/kdev_t.h>
-#include <asm/io.h>
-#include <asm/uaccess.h>
-#include <linux/ioport.h>
-#include <linux/list.h>
+#include <linux/rbtree.h>
 /* our header */
 #include "hisi_memheap.h"
 
-typedef struct MemNode {
-	struct list_head NodeList;
-	uint m_BusAddr;		/*BusAddr */
-	uint m_Size;		/*size */
-	unchar m_Usage;		/*usage */
-} MEMNODE;
-typedef MEMNODE *pMEMNODE;
-
-#define MemFree             0
-#define MemUsing            1
-#define NODEFOUND           1
-#define NODEMISS            0
 #define PAGESIZE            4096
 
-/*** global various ***/
-static struct list_head g_ListHead;	/*List Head */
-
-/* list starting MemNode */
-#define LISTSTART         list_entry((g_ListHead.next), MEMNODE, NodeList)
-#define PREVNODE(x)       list_entry((x)->NodeList.prev, MEMNODE, NodeList)
-#define NEXTNODE(x)       list_entry((x)->NodeList.next, MEMNODE, NodeList)
+#define addr_entry(node)	rb_entry(node, struct memheap_block, addr_node)
+#define free_entry(node)	rb_entry(node, struct memheap_block, free_node)
 
 /*******************************************************
   Function:       aligned_size
   Description:    align mem-size to 4kb, for remap
-  Called By:      memory_alloc
+  Called By:      memheap_alloc
   Input:          request buffer size
   Return:         aligned size
 ********************************************************/
-static uint aligned_size(uint size)
+static unsigned long aligned_size(unsigned long size)
 {
-	ulong temp = size % PAGESIZE;
-	if (temp) {		/*non aligned size */
-		temp = (size / PAGESIZE + 1) * PAGESIZE;
-	} else {		/*aligned size */
-		temp = size;
-	}
-	return temp;
+	return (size + PAGESIZE - 1) & ~(unsigned long)(PAGESIZE - 1);
 }
 
 /*******************************************************
-  Function:       create_node
-  Description:    create a mem-node
-  Called By:      memory_alloc
-  Input:          buffer size, base addr, prev pNode
-  Return:         New mem-node
+  Function:       free_insert / free_erase
+  Description:    add or remove a block in the free tree,
+                    ordered by size and then address
+  Called By:      memheap_*
 ********************************************************/
-static pMEMNODE create_node(uint size, uint base, pMEMNODE pNode)
+static void free_insert(struct memheap *heap, struct memheap_block *block)
 {
-	pMEMNODE NewNode = (pMEMNODE) kmalloc(sizeof(MEMNODE), GFP_KERNEL);
-
-	if (NewNode != NULL) {
-		NewNode->m_BusAddr = base;
-		NewNode->m_Size = size;
-		NewNode->m_Usage = MemFree;
-		list_add(&NewNode->NodeList, &pNode->NodeList);
+	struct rb_node **p = &heap->free_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct memheap_block *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = free_entry(parent);
+		if (block->size < entry->size ||
+		    (block->size == entry->size && block->base < entry->base))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
 	}
+	rb_link_node(&block->free_node, parent, p);
+	rb_insert_color(&block->free_node, &heap->free_root);
+	heap->nr_free++;
+}
 
-	return NewNode;
+static void free_erase(struct memheap *heap, struct memheap_block *block)
+{
+	rb_erase(&block->free_node, &heap->free_root);
+	heap->nr_free--;
 }
 
 /*******************************************************
-  Function:       del_node
-  Description:    del a mem-node
-  Called By:      memory_free
-  Input:          mem-node found by find_node()
-  Return:         N/A
+  Function:       addr_insert
+  Description:    add a block to the address tree
+  Called By:      memheap_init, memheap_alloc
 ********************************************************/
-static void del_node(pMEMNODE pNode)
+static void addr_insert(struct memheap *heap, struct memheap_block *block)
 {
-	pMEMNODE pPrevNode = PREVNODE(pNode);
-	pPrevNode->m_Size += pNode->m_Size;	/*merge pNode size to PrevNode */
-
-	list_del(&pNode->NodeList);
-	kfree(pNode);
-	return;
+	struct rb_node **p = &heap->addr_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (block->base < addr_entry(parent)->base)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&block->addr_node, parent, p);
+	rb_insert_color(&block->addr_node, &heap->addr_root);
 }
 
 /*******************************************************
-  Function:       find_node
-  Description:    find a mem-node by given address
-  Called By:      memory_free
-  Input:          address of the free node
-  Return:         pointer of the free node
+  Function:       find_block
+  Description:    find a block by its base address
+  Called By:      memheap_free
+  Input:          address of the block
+  Return:         the block, or NULL
 ********************************************************/
-static pMEMNODE find_node(uint addr)
+static struct memheap_block *find_block(struct memheap *heap,
+					unsigned long addr)
 {
-	pMEMNODE pNode;
-	unchar find = NODEMISS;
-
-	list_for_each_entry(pNode, &g_ListHead, NodeList) {
-		if (addr == pNode->m_BusAddr) {
-			/*printk(KERN_ERR "MemNode Found,BusAddr: 0x%x\n",addr); */
-			find = NODEFOUND;
-			break;
-		}
+	struct rb_node *node = heap->addr_root.rb_node;
+	struct memheap_block *block;
+
+	while (node) {
+		block = addr_entry(node);
+		if (addr < block->base)
+			node = node->rb_left;
+		else if (addr > block->base)
+			node = node->rb_right;
+		else
+			return block;
 	}
 
-	if (NODEMISS == find) {
-		pNode = NULL;
-		printk(KERN_ERR "MemNode: busaddr 0x%x donot match\n", addr);
-	}
-	return pNode;
+	return NULL;
 }
 
 /*******************************************************
-  Function:       list_dump
-  Description:    this is used to dump the node list
-  Called By:      N/A
-  Input:          N/A
-  Return:         N/A
+  Function:       release_block
+  Description:    mark a block free and merge it with
+                    free neighbours
+  Called By:      memheap_free, memheap_free_owner
+  Input:          an allocated block
+  Return:         the resulting free block
 ********************************************************/
-void list_dump(void)
+static struct memheap_block *release_block(struct memheap *heap,
+					   struct memheap_block *block)
 {
-	pMEMNODE pNode;
-	uint i = 0;
-	list_for_each_entry(pNode, &g_ListHead, NodeList) {
-		i++;
-		printk(KERN_INFO "Node(%d): usage:%d; size:%dByte; ba:0x%08x\n",
-		       i, pNode->m_Usage, pNode->m_Size, pNode->m_BusAddr);
+	struct memheap_block *prev = NULL, *next = NULL;
+	struct rb_node *node;
+
+	if (heap->release)
+		heap->release(block->base, block->size);
+	heap->used_bytes -= block->size;
+	heap->nr_used--;
+	block->owner = NULL;
+	block->pid = 0;
+
+	node = rb_prev(&block->addr_node);
+	if (node && !addr_entry(node)->owner)
+		prev = addr_entry(node);
+	node = rb_next(&block->addr_node);
+	if (node && !addr_entry(node)->owner)
+		next = addr_entry(node);
+
+	if (next) {
+		free_erase(heap, next);
+		rb_erase(&next->addr_node, &heap->addr_root);
+		block->size += next->size;
+		kfree(next);
 	}
+	if (prev) {
+		/* prev grows, so it moves in the free tree */
+		free_erase(heap, prev);
+		rb_erase(&block->addr_node, &heap->addr_root);
+		prev->size += block->size;
+		kfree(block);
+		block = prev;
+	}
+	free_insert(heap, block);
+
+	return block;
 }
 
 /*******************************************************
-  Function:       initial_list
-  Description:    this is used to initial a MEMNODE list
-  Called By:      called by memalloc.c
-  Input:          buffer size, base addresss
-  Return:         succeed: return 0; failed: return errno
+  Function:       memheap_init
+  Description:    set up a heap of one free block
+  Called By:      memalloc.c
+  Input:          heap, base address, size
+  Return:         succeed: INIT_SUCCEED; failed: INIT_FAILED
 ********************************************************/
-
-uint initial_list(uint size, ulong ba)
+int memheap_init(struct memheap *heap, unsigned long base, unsigned long size)
 {
-	/*allocate memory from pmem, create list */
-	pMEMNODE pStart = NULL;
-
-	if (size <= 0 || ba <= 0)
-		return INIT_FAILED;
+	struct memheap_block *block;
 
-	INIT_LIST_HEAD(&g_ListHead);	/*initial a list */
+	memset(heap, 0, sizeof(*heap));
+	heap->addr_root = RB_ROOT;
+	heap->free_root = RB_ROOT;
 
-	pStart = create_node(size, ba, (pMEMNODE) & g_ListHead);
+	if (!size || !base)
+		return INIT_FAILED;
 
-	if (!pStart) {
+	block = kzalloc(sizeof(*block), GFP_KERNEL);
+	if (!block)
 		return INIT_FAILED;
-	}
+
+	block->base = base;
+	block->size = size;
+	addr_insert(heap, block);
+	free_insert(heap, block);
+	heap->base = base;
+	heap->size = size;
 
 	return INIT_SUCCEED;
 }
 
 /*******************************************************
-  Function:       destroy_list
-  Description:    this is used to destroy a MEMNODE list
-  Called By:      called by memalloc.c
-  Input:          N/A
-  Return:         N/A
+  Function:       memheap_destroy
+  Description:    free all blocks, allocated or not
+  Called By:      memalloc.c
 ********************************************************/
-void destroy_list(void)
+void memheap_destroy(struct memheap *heap)
 {
-	pMEMNODE pLast = LISTSTART;
-
-	while (pLast->NodeList.next != &g_ListHead) {	/*move to tail */
-		pLast = NEXTNODE(pLast);
-	}
-
-	while (pLast->NodeList.prev != &g_ListHead) {	/*del from tail to head */
-		pLast = PREVNODE(pLast);	/*move to prev node,and del "its next" */
-		del_node(NEXTNODE(pLast));
+	struct memheap_block *block;
+	struct rb_node *node;
+
+	while ((node = rb_first(&heap->addr_root))) {
+		block = addr_entry(node);
+		if (block->owner && heap->release)
+			heap->release(block->base, block->size);
+		rb_erase(node, &heap->addr_root);
+		kfree(block);
 	}
-
-	return;
+	heap->free_root = RB_ROOT;
+	heap->used_bytes = 0;
+	heap->nr_used = 0;
+	heap->nr_free = 0;
 }
 
 /*******************************************************
-  Function:       memory_alloc
-  Description:    alloc a buffer by the given size,
-                    split into 2 parts, in-use & unused spaces
+  Function:       memheap_alloc
+  Description:    alloc a buffer by the given size from the
+                    smallest free block that fits, split into
+                    in-use & unused parts
   Called By:      memalloc.c
-  Input:          buffer size
+  Input:          heap, buffer size, owner and its pid
   Return:         base address of buffer; failed return 0
 ********************************************************/
-ulong memory_alloc(uint size)
+unsigned long memheap_alloc(struct memheap *heap, unsigned long size,
+			    void *owner, int pid)
 {
+	struct rb_node *node = heap->free_root.rb_node;
+	struct memheap_block *block = NULL, *rest;
 
-	pMEMNODE pNode;
-	uint aligsize;
-	unchar alloced = NODEMISS;
-
-	if (size <= 0) {
-		printk(KERN_ERR "%s(%d): wrong params\n", __FUNCTION__,
-		       __LINE__);
-		goto out;
+	if (!size || !owner) {
+		printk(KERN_ERR "%s(%d): wrong params\n", __func__, __LINE__);
+		return MEMALLOC_FAILED;
 	}
-	aligsize = aligned_size(size);	/*aligned to 4kb */
+	size = aligned_size(size);	/*aligned to 4kb */
 
-	/*printk("%s(%d): size:%d; aligsize:%d\n",
-	   __FUNCTION__,__LINE__,size,aligsize); */
-
-	list_for_each_entry(pNode, &g_ListHead, NodeList) {
-		if ((MemFree == pNode->m_Usage) && (pNode->m_Size >= aligsize)) {
-			/*printk("%s(%d):Alloc %d match\n", __FUNCTION__,__LINE__,aligsize); */
-			alloced = NODEFOUND;
-			break;
+	while (node) {
+		if (free_entry(node)->size >= size) {
+			block = free_entry(node);
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
 		}
 	}
 
-	if ((&g_ListHead) == (&pNode->NodeList)) {	/*loop back to head,no match */
-		alloced = NODEMISS;
-		printk(KERN_ERR "%s(%d): memalloc failed: request size:%d\n",
-		       __FUNCTION__, __LINE__, size);
-		list_dump();
-
-		goto out;
+	if (!block) {
+		heap->nr_failed++;
+		printk(KERN_ERR "%s(%d): memalloc failed: request size:%lu\n",
+		       __func__, __LINE__, size);
+		return MEMALLOC_FAILED;
 	}
 
-	if ((NODEFOUND == alloced) && (pNode->m_Size > aligsize)) {
-		pMEMNODE pFreeNode = create_node((pNode->m_Size - aligsize),
-						 (aligsize + pNode->m_BusAddr),
-						 pNode);
-
-		if (!pFreeNode) {
-			pNode = (pMEMNODE) NULL;
-			alloced = NODEMISS;
+	/* no second choice if refused, the range is busy only briefly */
+	if (heap->acquire && heap->acquire(block->base, size)) {
+		heap->nr_failed++;
+		printk(KERN_ERR "%s(%d): 0x%lx busy, request size:%lu\n",
+		       __func__, __LINE__, block->base, size);
+		return MEMALLOC_FAILED;
+	}
 
+	free_erase(heap, block);
+	if (block->size > size) {
+		/* keep the tail free */
+		rest = kzalloc(sizeof(*rest), GFP_KERNEL);
+		if (!rest) {
+			free_insert(heap, block);
+			if (heap->release)
+				heap->release(block->base, size);
+			heap->nr_failed++;
 			printk(KERN_ERR "%s(%d):Failed to memalloc free node\n",
-			       __FUNCTION__, __LINE__);
-		} else {
-			/* if free space bigger than request, split into free & inuse parts
-			   return with inuse size */
-			pNode->m_Size = aligsize;
+			       __func__, __LINE__);
+			return MEMALLOC_FAILED;
 		}
+		rest->base = block->base + size;
+		rest->size = block->size - size;
+		addr_insert(heap, rest);
+		free_insert(heap, rest);
+		block->size = size;
 	}
 
-	/*1. request size just equal free space, just mark m_Usage to 1;
-	   2. pNode->m_Size has changed upper, mark m_Usage to 1 */
-	if (NODEFOUND == alloced)
-		pNode->m_Usage = MemUsing;
+	block->owner = owner;
+	block->pid = pid;
+	heap->used_bytes += size;
+	heap->nr_used++;
+	heap->nr_allocs++;
 
-out:
-	if ((NODEFOUND == alloced) && (pNode->m_BusAddr > 0))
-		return pNode->m_BusAddr;
-	else
-		return MEMALLOC_FAILED;	/*alloc mem failed,return 0 */
+	return block->base;
 }
 
 /*******************************************************
-  Function:       memory_free
-  Description:    free a buffer by the given address,
-                    split into 2 parts, in-use & unused spaces
+  Function:       memheap_free
+  Description:    free a buffer by the given address
   Called By:      memalloc.c
-  Input:          buffer size
-  Return:         base address of buffer
+  Input:          heap, base address of buffer
+  Return:         0, or -1 if no buffer starts there
 ********************************************************/
-void memory_free(ulong addr)
+int memheap_free(struct memheap *heap, unsigned long addr)
 {
-	pMEMNODE pMerge, pNode;
+	struct memheap_block *block = find_block(heap, addr);
 
-	if (addr <= 0) {
-		printk(KERN_ERR "%s(%d):wrong params\n", __FUNCTION__,
-		       __LINE__);
-		return;
+	if (!block || !block->owner) {
+		printk(KERN_ERR "%s(%d): busaddr 0x%lx not allocated\n",
+		       __func__, __LINE__, addr);
+		return -1;
 	}
 
-	pNode = find_node(addr);
-	if (pNode) {
-		/*printk("%s(%d): size:%dByte free\n",
-		   __FUNCTION__,__LINE__,pNode->m_Size); */
-		pNode->m_Usage = MemFree;
-	} else {
-		printk(KERN_ERR "%s(%d): no mem-node found\n", __FUNCTION__,
-		       __LINE__);
-		return;
-	}
-
-	if (&g_ListHead != pNode->NodeList.prev) {	/*try to merge prev Node */
-		pMerge = PREVNODE(pNode);
+	release_block(heap, block);
+	return 0;
+}
 
-		/* check prevnode & nextnode whether can merge */
-		if (pMerge && MemFree == pMerge->m_Usage) {
-			/*printk("++++ mem_free(Ln:%d): del node!\n", __LINE__); //xmd test */
-			del_node(pNode);
-			pNode = pMerge;
-		}
+/*******************************************************
+  Function:       memheap_free_owner
+  Description:    free the buffers of an owner that did not
+                    call memheap_free, e.g. on close
+  Called By:      memalloc.c
+  Input:          heap, owner
+  Return:         number of buffers freed
+********************************************************/
+unsigned long memheap_free_owner(struct memheap *heap, void *owner)
+{
+	struct memheap_block *block;
+	struct rb_node *node;
+	unsigned long count = 0;
+
+	for (node = rb_first(&heap->addr_root); node; node = rb_next(node)) {
+		block = addr_entry(node);
+		if (block->owner != owner)
+			continue;
+		/* the result may have absorbed node's successor, go on from it */
+		block = release_block(heap, block);
+		node = &block->addr_node;
+		count++;
 	}
 
-	if (&g_ListHead != pNode->NodeList.next) {	/*try to merge next Node */
-		pMerge = NEXTNODE(pNode);
-
-		if (pMerge && MemFree == pMerge->m_Usage) {
-			/*printk("++++ mem_free(Ln:%d): del node!\n", __LINE__); //xmd test */
-			del_node(pMerge);
-		}
-	}
+	return count;
+}
 
-	return;
+/*******************************************************
+  Function:       memheap_get_stats
+  Description:    usage and fragmentation of the heap
+  Called By:      memalloc.c
+********************************************************/
+void memheap_get_stats(struct memheap *heap, struct memheap_stats *stats)
+{
+	struct rb_node *node = rb_last(&heap->free_root);
+
+	stats->size = heap->size;
+	stats->used_bytes = heap->used_bytes;
+	stats->free_bytes = heap->size - heap->used_bytes;
+	stats->nr_used = heap->nr_used;
+	stats->nr_free = heap->nr_free;
+	stats->largest_free = node ? free_entry(node)->size : 0;
+	stats->frag_pct = 0;
+	if (stats->free_bytes)
+		stats->frag_pct = 100 - (unsigned long)((unsigned long long)
+			stats->largest_free * 100 / stats->free_bytes);
+	stats->nr_allocs = heap->nr_allocs;
+	stats->nr_failed = heap->nr_failed;
 }
 
 /*******************************************************
-  Function:       free_allocated_memory
-  Description:    free a buffer when app do not call the memory_free
+  Function:       memheap_print_blocks
+  Description:    one line per block: base, size and owner pid,
+                    or "free"
   Called By:      memalloc.c
-  Input:          NA
-  Return:         NA
+  Input:          heap, buffer and its length
+  Return:         bytes written, without the terminating NUL
 ********************************************************/
-void free_allocated_memory()
+int memheap_print_blocks(struct memheap *heap, char *buf, int len)
 {
-	pMEMNODE pMerge, pNode;
-	unchar find = NODEMISS;
-
-	list_for_each_entry(pNode, &g_ListHead, NodeList) {
-		if (pNode->m_Usage == MemUsing) {
-			printk
-			    ("free the used memory when memalloc was closed\n");
-			pNode->m_Usage = MemFree;
-			find = NODEFOUND;
-
-			if (&g_ListHead != pNode->NodeList.prev)	//try to merge prev Node
-			{
-				pMerge = PREVNODE(pNode);
-
-				/* check prevnode & nextnode whether can merge */
-				if (pMerge && MemFree == pMerge->m_Usage) {
-					del_node(pNode);
-					pNode = pMerge;
-				}
-			}
-
-			if (&g_ListHead != pNode->NodeList.next)	//try to merge next Node
-			{
-				pMerge = NEXTNODE(pNode);
-
-				if (pMerge && MemFree == pMerge->m_Usage) {
-					del_node(pMerge);
-				}
-			}
-		}
+	struct memheap_block *block;
+	struct rb_node *node;
+	int n = 0;
+
+	for (node = rb_first(&heap->addr_root); node && n < len;
+	     node = rb_next(node)) {
+		block = addr_entry(node);
+		if (block->owner)
+			n += scnprintf(buf + n, len - n, "0x%08lx %10lu %d\n",
+				       block->base, block->size, block->pid);
+		else
+			n += scnprintf(buf + n, len - n, "0x%08lx %10lu free\n",
+				       block->base, block->size);
 	}
 
-	return;
+	return n;
 }
@@ -1,4 +1,4 @@
-/* 
+/*
  * memory heap (module header)
  *
  * Copyright (C) 2012 Google Finland Oy.
@@ -25,14 +25,70 @@
 #ifndef __HISI_MEMHEAP
 #define __HISI_MEMHEAP
 
+#include <linux/rbtree.h>
+
 #define INIT_FAILED         -1
 #define INIT_SUCCEED        0
 #define MEMALLOC_FAILED     0
 
-uint initial_list(uint, ulong);
-void destroy_list(void);
-ulong memory_alloc(uint);
-void memory_free(ulong);
-void free_allocated_memory();
+/*
+ * A heap is split into blocks, each either free or owned by an opener
+ * of the device.  All blocks are in addr_root by address, so neighbours
+ * are found for coalescing; free blocks are also in free_root by size
+ * and then address, so allocation takes the smallest block that fits,
+ * lowest first.  Both are O(log n) in the number of blocks.
+ *
+ * The heap does no locking of its own.  It only uses kzalloc, kfree and
+ * the rbtree library, so it also builds in user space for testing, see
+ * tools/hisi_memheap.
+ */
+struct memheap_block {
+	struct rb_node addr_node;
+	struct rb_node free_node;	/* if free */
+	unsigned long base;
+	unsigned long size;
+	void *owner;			/* NULL if free */
+	int pid;			/* of the owner, for reporting */
+};
+
+struct memheap {
+	struct rb_root addr_root;
+	struct rb_root free_root;
+	unsigned long base;
+	unsigned long size;
+	unsigned long used_bytes;
+	unsigned long nr_used;
+	unsigned long nr_free;
+	unsigned long nr_allocs;	/* since init */
+	unsigned long nr_failed;
+	/*
+	 * Optional, set after memheap_init: acquire is called for a range
+	 * about to be handed out and may refuse it, release for every
+	 * range given back, e.g. to back the heap with a contig_heap.
+	 */
+	int (*acquire)(unsigned long base, unsigned long size);
+	void (*release)(unsigned long base, unsigned long size);
+};
+
+struct memheap_stats {
+	unsigned long size;
+	unsigned long used_bytes;
+	unsigned long free_bytes;
+	unsigned long nr_used;
+	unsigned long nr_free;
+	unsigned long largest_free;
+	unsigned long frag_pct;		/* free bytes not in the largest block */
+	unsigned long nr_allocs;
+	unsigned long nr_failed;
+};
+
+int memheap_init(struct memheap *heap, unsigned long base, unsigned long size);
+void memheap_destroy(struct memheap *heap);
+unsigned long memheap_alloc(struct memheap *heap, unsigned long size,
+			    void *owner, int pid);
+int memheap_free(struct memheap *heap, unsigned long addr);
+unsigned long memheap_free_owner(struct memheap *heap, void *owner);
+void memheap_get_stats(struct memheap *heap, struct memheap_stats *stats);
+int memheap_print_blocks(struct memheap *heap, char *buf, int len);
 
 #endif
@@ -47,6 +47,7 @@
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <linux/ioport.h>
+#include <linux/contig_heap.h>
 #include <linux/list.h>
 /* for current pid */
 #include <linux/sched.h>
@@ -64,10 +65,53 @@
 
 static int memalloc_major;	/* dynamic */
 static ulong g_baseaddr;
-static int open_count = 0;
+static ulong g_size;
 
+/* mem_sem protects g_heap */
+static struct memheap g_heap;
 static struct semaphore mem_sem = __SEMAPHORE_INITIALIZER(mem_sem, 1);
 
+/*
+ * With a "codec" contiguous heap g_heap manages its space, and the pages
+ * of a buffer are taken from the page allocator only while it is held.
+ */
+static struct contig_heap *g_cheap;
+
+static int memalloc_heap_acquire(unsigned long base, unsigned long size)
+{
+	struct page *page = pfn_to_page(base >> PAGE_SHIFT);
+	int ret;
+
+	ret = contig_heap_alloc_at(g_cheap, base >> PAGE_SHIFT,
+				   size >> PAGE_SHIFT);
+	if (ret)
+		return ret;
+
+	/* mapped uncached, so no cacheable alias in the linear map either */
+	ret = contig_heap_uncache(g_cheap, page, size >> PAGE_SHIFT);
+	if (ret)
+		contig_heap_free(g_cheap, page, size >> PAGE_SHIFT);
+	return ret;
+}
+
+static void memalloc_heap_release(unsigned long base, unsigned long size)
+{
+	contig_heap_free(g_cheap, pfn_to_page(base >> PAGE_SHIFT),
+			 size >> PAGE_SHIFT);
+}
+
+static int memalloc_heap_init(void)
+{
+	if (INIT_FAILED == memheap_init(&g_heap, g_baseaddr, g_size))
+		return INIT_FAILED;
+
+	if (g_cheap) {
+		g_heap.acquire = memalloc_heap_acquire;
+		g_heap.release = memalloc_heap_release;
+	}
+	return INIT_SUCCEED;
+}
+
 /* Added MMAP method */
 static int memalloc_mmap(struct file *file, struct vm_area_struct *vma)
 {
@@ -123,9 +167,10 @@ static long memalloc_ioctl(struct file *filp,
 	case MEMALLOC_IOCHARDRESET:{
 			printk("%s(%d):HARDRESET\n", __FUNCTION__, __LINE__);
 
-			destroy_list();
-
-			initial_list(HISI_MEM_CODEC_SIZE, g_baseaddr);	/*init head */
+			down(&mem_sem);
+			memheap_destroy(&g_heap);
+			memalloc_heap_init();
+			up(&mem_sem);
 
 			break;
 		}
@@ -149,7 +194,8 @@ static long memalloc_ioctl(struct file *filp,
 
 			/*printk("%s(%d):GETBUFFER:%u\n",
 			   __FUNCTION__,__LINE__,memparams.size); */
-			ba = memory_alloc(memparams.size);
+			ba = memheap_alloc(&g_heap, memparams.size, filp,
+					   current->tgid);
 			if (!ba) {
 				/*spin_unlock(&mem_lock); */
 				/*up(&mem_sem);*/
@@ -182,7 +228,7 @@ static long memalloc_ioctl(struct file *filp,
 			down(&mem_sem);
 
 			__get_user(busaddr, (unsigned long *)arg);
-			memory_free(busaddr);
+			memheap_free(&g_heap, busaddr);
 
 			up(&mem_sem);
 			return 0;
@@ -195,17 +241,22 @@ static long memalloc_ioctl(struct file *filp,
 
 static int memalloc_open(struct inode *inode, struct file *filp)
 {
-	open_count++;
 	PDEBUG("dev opened\n");
 	return 0;
 }
 
+/* free what this opener did not, without touching other openers' buffers */
 static int memalloc_release(struct inode *inode, struct file *filp)
 {
-	if (--open_count <= 0) {
-		free_allocated_memory();
-		open_count = 0;
-	}
+	unsigned long count;
+
+	down(&mem_sem);
+	count = memheap_free_owner(&g_heap, filp);
+	up(&mem_sem);
+
+	if (count)
+		printk("memalloc: freed %lu buffers left by pid %d\n",
+		       count, current->tgid);
 	PDEBUG("dev closed\n");
 	return 0;
 }
@@ -222,9 +273,47 @@ unlocked_ioctl:
 	memalloc_ioctl,
 };
 
+static ssize_t memalloc_stats_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct memheap_stats stats;
+
+	down(&mem_sem);
+	memheap_get_stats(&g_heap, &stats);
+	up(&mem_sem);
+
+	return sprintf(buf,
+		       "size: %lu\n"
+		       "used_bytes: %lu\n"
+		       "free_bytes: %lu\n"
+		       "used_blocks: %lu\n"
+		       "free_blocks: %lu\n"
+		       "largest_free: %lu\n"
+		       "fragmentation: %lu%%\n"
+		       "allocs: %lu\n"
+		       "failed: %lu\n",
+		       stats.size, stats.used_bytes, stats.free_bytes,
+		       stats.nr_used, stats.nr_free, stats.largest_free,
+		       stats.frag_pct, stats.nr_allocs, stats.nr_failed);
+}
+
+static ssize_t memalloc_blocks_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	int n;
+
+	down(&mem_sem);
+	n = memheap_print_blocks(&g_heap, buf, PAGE_SIZE);
+	up(&mem_sem);
+
+	return n;
+}
+
 static struct device_attribute memalloc_attrs[] = {
 	__ATTR(name, S_IRUGO, NULL, NULL),
 	__ATTR(index, S_IRUGO, NULL, NULL),
+	__ATTR(stats, S_IRUGO, memalloc_stats_show, NULL),
+	__ATTR(blocks, S_IRUGO, memalloc_blocks_show, NULL),
 	__ATTR_NULL
 };
 
@@ -273,9 +362,16 @@ int __init memalloc_init(void)
 
 	printk("memalloc_major is %d\n", memalloc_major);
 
-	g_baseaddr = hisi_reserved_codec_phymem;
+	g_cheap = contig_heap_find("codec");
+	if (g_cheap) {
+		g_baseaddr = contig_heap_base(g_cheap);
+		g_size = contig_heap_size(g_cheap);
+	} else {
+		g_baseaddr = hisi_reserved_codec_phymem;
+		g_size = HISI_MEM_CODEC_SIZE;
+	}
 
-	if (INIT_FAILED == initial_list(HISI_MEM_CODEC_SIZE, g_baseaddr)) {
+	if (INIT_FAILED == memalloc_heap_init()) {
 		printk("memalloc: initial memory list failed\n");
 		goto err;
 	}
@@ -294,7 +390,7 @@ void __exit memalloc_cleanup(void)
 	PDEBUG("clenup called\n");
 
 	unregister_chrdev(memalloc_major, "memalloc");
-	destroy_list();
+	memheap_destroy(&g_heap);
 
 	PDEBUG("memalloc: module removed\n");
 
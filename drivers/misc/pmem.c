@@ -24,6 +24,7 @@
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/sched.h>
+#include <linux/contig_heap.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
@@ -87,8 +88,8 @@ struct pmem_bits {
 
 struct pmem_bits_k3 {
 	struct {
-		short page_index;
-		unsigned short pages_needed;
+		int page_index;
+		unsigned int pages_needed;
 	} *chunk;
 	int32_t num_chunks;
 	
@@ -162,6 +163,8 @@ struct pmem_info {
 	enum pmem_type type;
 	/* segment and page */
 	struct pmem_bits_k3 bitmap_k3;
+	/* contiguous heap the space is allocated from, base is its start */
+	struct contig_heap *heap;
 	
 	int (*pmem_allocate)(int, unsigned long);
 	int (*pmem_free)(int, int);
@@ -494,6 +497,9 @@ static unsigned long pmem_start_addr(int id, struct pmem_data *data)
 
 static inline void *pmem_start_vaddr(int id, struct pmem_data *data)
 {
+	/* heap memory is lowmem, always in the kernel's linear map */
+	if (pmem[id].heap)
+		return phys_to_virt(pmem[id].pmem_start_addr(id, data));
 	return pmem[id].pmem_start_addr(id, data) - pmem[id].base + pmem[id].vbase;
 }
 
@@ -604,30 +610,10 @@ static int make_seg(uint32_t *seg_table, unsigned int pages_needed, unsigned int
 	return -1;
 }
 
-static int pmem_allocator_k3(int id, unsigned long len)
+/* find a free chunk slot, growing the chunk array if needed */
+static int pmem_chunk_slot(int id)
 {
-	int index; 
 	int i;
-	unsigned int pages_needed;
-	unsigned int total_pages;
-	
-	if (!pmem[id].bitmap_k3.chunk) {
-		printk(KERN_ERR "%s: invalid chunk. \n", __func__);
-		return -1;
-	}
-
-	pages_needed = (len + PMEM_MIN_ALLOC - 1) / PMEM_MIN_ALLOC;
-	if (pages_needed <= 0 || pages_needed > pmem[id].bitmap_k3.pages_free) {
-		printk(KERN_ERR "%s: invalid pages (0x%x), total (0x%x). \n", __func__, pages_needed, pmem[id].bitmap_k3.pages_free);
-		return -1;
-	}
-
-	total_pages = (pmem[id].size + PMEM_MIN_ALLOC - 1) / PMEM_MIN_ALLOC;
-	/* make segment */
-	if ((index = make_seg(pmem[id].bitmap_k3.seg_table, pages_needed, total_pages)) == -1) {
-		printk(KERN_ERR "%s: invalid seg index got. \n", __func__);
-		return -1;
-	}
 
 	for (i = 0; i < pmem[id].bitmap_k3.num_chunks && 
 		pmem[id].bitmap_k3.chunk[i].page_index != -1; i++)
@@ -654,10 +640,52 @@ static int pmem_allocator_k3(int id, unsigned long len)
 
 		for (j = i; j < new_num_chunks; j++) {
 			pmem[id].bitmap_k3.chunk[j].page_index = -1;
-			pmem[id].bitmap_k3.chunk[i].pages_needed = 0;
+			pmem[id].bitmap_k3.chunk[j].pages_needed = 0;
 		}
 	}
 
+	return i;
+}
+
+static unsigned int pmem_pages_needed(int id, unsigned long len)
+{
+	unsigned int pages_needed = (len + PMEM_MIN_ALLOC - 1) / PMEM_MIN_ALLOC;
+
+	if (pages_needed <= 0 || pages_needed > pmem[id].bitmap_k3.pages_free) {
+		printk(KERN_ERR "%s: invalid pages (0x%x), total (0x%x). \n", __func__, pages_needed, pmem[id].bitmap_k3.pages_free);
+		return 0;
+	}
+
+	return pages_needed;
+}
+
+static int pmem_allocator_k3(int id, unsigned long len)
+{
+	int index; 
+	int i;
+	unsigned int pages_needed;
+	unsigned int total_pages;
+	
+	if (!pmem[id].bitmap_k3.chunk) {
+		printk(KERN_ERR "%s: invalid chunk. \n", __func__);
+		return -1;
+	}
+
+	pages_needed = pmem_pages_needed(id, len);
+	if (!pages_needed)
+		return -1;
+
+	i = pmem_chunk_slot(id);
+	if (i < 0)
+		return -1;
+
+	total_pages = (pmem[id].size + PMEM_MIN_ALLOC - 1) / PMEM_MIN_ALLOC;
+	/* make segment */
+	if ((index = make_seg(pmem[id].bitmap_k3.seg_table, pages_needed, total_pages)) == -1) {
+		printk(KERN_ERR "%s: invalid seg index got. \n", __func__);
+		return -1;
+	}
+
 	pmem[id].bitmap_k3.pages_free -= pages_needed;
 	pmem[id].bitmap_k3.chunk[i].page_index = index;
 	pmem[id].bitmap_k3.chunk[i].pages_needed = pages_needed;
@@ -689,6 +717,79 @@ static int pmem_free_k3(int id, int index)
 	return -1;
 }
 
+/*
+ * Heap backed devices keep the chunk table for lengths, but the space
+ * itself comes from the contiguous heap, whose idle pages are lent to
+ * the page allocator.  index is the page offset from the heap base.
+ */
+static int pmem_allocator_heap(int id, unsigned long len)
+{
+	struct page *page;
+	unsigned int pages_needed;
+	unsigned long size;
+	void *vaddr;
+	int i;
+
+	pages_needed = pmem_pages_needed(id, len);
+	if (!pages_needed)
+		return -1;
+
+	i = pmem_chunk_slot(id);
+	if (i < 0)
+		return -1;
+
+	/* may migrate pages out of the heap, which takes a while */
+	page = contig_heap_alloc(pmem[id].heap, pages_needed, 0);
+	if (!page) {
+		printk(KERN_ERR "%s: no 0x%x pages in heap. \n", __func__, pages_needed);
+		return -1;
+	}
+
+	/*
+	 * The heap zeroed the pages through the cached kernel mapping,
+	 * which must not stay cacheable under an uncached user mapping.
+	 */
+	if (!pmem[id].cached) {
+		if (contig_heap_uncache(pmem[id].heap, page, pages_needed)) {
+			contig_heap_free(pmem[id].heap, page, pages_needed);
+			printk(KERN_ERR "%s: cannot map heap pages uncached\n", __func__);
+			return -1;
+		}
+	} else {
+		size = pages_needed * PMEM_MIN_ALLOC;
+		vaddr = page_address(page);
+		dmac_flush_range(vaddr, vaddr + size);
+		outer_flush_range(page_to_phys(page), page_to_phys(page) + size);
+	}
+
+	pmem[id].bitmap_k3.pages_free -= pages_needed;
+	pmem[id].bitmap_k3.chunk[i].page_index =
+		(page_to_phys(page) - pmem[id].base) / PMEM_MIN_ALLOC;
+	pmem[id].bitmap_k3.chunk[i].pages_needed = pages_needed;
+
+	return pmem[id].bitmap_k3.chunk[i].page_index;
+}
+
+static int pmem_free_heap(int id, int index)
+{
+	unsigned long phys = index * PMEM_MIN_ALLOC + pmem[id].base;
+	int i;
+
+	for (i = 0; i < pmem[id].bitmap_k3.num_chunks; i++) {
+		if (pmem[id].bitmap_k3.chunk[i].page_index == index) {
+			contig_heap_free(pmem[id].heap, pfn_to_page(phys >> PAGE_SHIFT),
+				pmem[id].bitmap_k3.chunk[i].pages_needed);
+
+			pmem[id].bitmap_k3.pages_free += pmem[id].bitmap_k3.chunk[i].pages_needed;
+			pmem[id].bitmap_k3.chunk[i].page_index = -1;
+			pmem[id].bitmap_k3.chunk[i].pages_needed = 0;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
 static inline unsigned long pmem_len_k3(int id, struct pmem_data *data)
 {
 	int i;
@@ -1552,6 +1653,22 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	pmem[id].dev.minor = id;
 	pmem[id].dev.fops = &pmem_fops;
 	pmem[id].type = pdata->type;
+	if (pdata->heap) {
+		/* a cached device can still be mapped uncached per file */
+		if (pdata->cached) {
+			printk(KERN_ALERT "%s: heap %s needs an uncached device\n",
+				pdata->name, pdata->heap);
+			goto err_no_mem_for_metadata;
+		}
+		pmem[id].heap = contig_heap_find(pdata->heap);
+		if (!pmem[id].heap) {
+			printk(KERN_ALERT "%s: no heap %s\n", pdata->name, pdata->heap);
+			goto err_no_mem_for_metadata;
+		}
+		pmem[id].base = contig_heap_base(pmem[id].heap);
+		if (!pmem[id].size || pmem[id].size > contig_heap_size(pmem[id].heap))
+			pmem[id].size = contig_heap_size(pmem[id].heap);
+	}
 	pmem[id].num_entries = pmem[id].size / PMEM_MIN_ALLOC;
 	printk(KERN_INFO "%s: %d init\n", pdata->name, pdata->cached);
 
@@ -1566,16 +1683,21 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 			pmem[id].bitmap_k3.chunk[i].pages_needed = 0;
 		}
 
-		pmem[id].bitmap_k3.seg_table = kcalloc((pmem[id].num_entries + 31) / 32,
-				sizeof(unsigned int), GFP_KERNEL);
-		if (!pmem[id].bitmap_k3.seg_table)
-			goto err_no_mem_for_metadata1;
-
 		pmem[id].bitmap_k3.pages_free = pmem[id].num_entries;
 		pmem[id].bitmap_k3.num_chunks = PMEM_DEFAULT_NUM_CHUNKS;
-		
-		pmem[id].pmem_allocate = pmem_allocator_k3;
-		pmem[id].pmem_free = pmem_free_k3;
+
+		if (pmem[id].heap) {
+			pmem[id].pmem_allocate = pmem_allocator_heap;
+			pmem[id].pmem_free = pmem_free_heap;
+		} else {
+			pmem[id].bitmap_k3.seg_table = kcalloc((pmem[id].num_entries + 31) / 32,
+					sizeof(unsigned int), GFP_KERNEL);
+			if (!pmem[id].bitmap_k3.seg_table)
+				goto err_no_mem_for_metadata1;
+
+			pmem[id].pmem_allocate = pmem_allocator_k3;
+			pmem[id].pmem_free = pmem_free_k3;
+		}
 		pmem[id].pmem_len = pmem_len_k3;
 		pmem[id].pmem_start_addr = pmem_start_addr_k3;
 	} else {
@@ -1606,7 +1728,10 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 		goto err_cant_register_device;
 	}
 	
-	if (pmem[id].cached)
+	/* heap memory is already mapped, see pmem_start_vaddr() */
+	if (pmem[id].heap)
+		pmem[id].vbase = NULL;
+	else if (pmem[id].cached)
 		pmem[id].vbase = ioremap_cached(pmem[id].base,
 						pmem[id].size);
 #ifdef ioremap_ext_buffered
@@ -1617,7 +1742,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	else
 		pmem[id].vbase = ioremap(pmem[id].base, pmem[id].size);
 
-	if (pmem[id].vbase == 0)
+	if (!pmem[id].heap && pmem[id].vbase == 0)
 		goto error_cant_remap;
 
 	pmem[id].garbage_pfn = page_to_pfn(alloc_page(GFP_KERNEL));
@@ -19,6 +19,10 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/anon_inodes.h>
+#include <linux/highmem.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -36,6 +40,12 @@
 
 #include "binder.h"
 
+/*
+ * binder_lock is still the one lock for nodes, refs, threads, the todo
+ * lists and transaction state, in every process.  Only the buffer
+ * allocator has a lock of its own (binder_proc.buffer_lock), which lets
+ * binder_transaction() allocate and fill the target buffer without it.
+ */
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 static DEFINE_MUTEX(binder_mmap_lock);
@@ -44,6 +54,16 @@ static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
 
+/*
+ * Buffer pages are not unmapped when the buffers using them are freed.
+ * They stay mapped on binder_lru_pages until binder_shrink() needs the
+ * memory back, so that the next allocation covering them is free.
+ */
+static DEFINE_SPINLOCK(binder_lru_lock);
+static LIST_HEAD(binder_lru_pages);
+static int binder_lru_count;
+static unsigned long binder_lru_reclaimed;
+
 static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
@@ -81,6 +101,9 @@ BINDER_DEBUG_ENTRY(proc);
 
 #define BINDER_SMALL_BUF_SIZE (PAGE_SIZE * 64)
 
+#define BINDER_BLOB_MAX_SIZE  (32 * 1024 * 1024)
+#define BINDER_BLOB_PROC_MAX_PAGES ((64 * 1024 * 1024) >> PAGE_SHIFT)
+
 enum {
 	BINDER_DEBUG_USER_ERROR             = 1U << 0,
 	BINDER_DEBUG_FAILED_TRANSACTION     = 1U << 1,
@@ -211,6 +234,31 @@ struct binder_work {
 	} type;
 };
 
+/*
+ * Transaction latencies are kept in log2 buckets of microseconds; the
+ * last bucket collects everything from 2^(BINDER_LATENCY_BUCKETS - 2)
+ * microseconds up.
+ */
+#define BINDER_LATENCY_BUCKETS 20
+
+enum binder_latency_type {
+	BINDER_LATENCY_QUEUE,		/* queued until read by a thread */
+	BINDER_LATENCY_SERVICE,		/* read until replied to */
+	BINDER_LATENCY_ROUND_TRIP,	/* sent until the reply was read */
+	BINDER_LATENCY_COUNT
+};
+
+struct binder_latency_hist {
+	unsigned long count;
+	u64 total_ns;
+	u64 max_ns;
+	unsigned long buckets[BINDER_LATENCY_BUCKETS];
+};
+
+struct binder_latency_stats {
+	struct binder_latency_hist hist[BINDER_LATENCY_COUNT];
+};
+
 struct binder_node {
 	int debug_id;
 	struct binder_work work;
@@ -233,6 +281,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	struct binder_latency_stats *latency;	/* allocated on first use */
 };
 
 struct binder_ref_death {
@@ -274,6 +323,30 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+struct binder_lru_page {
+	struct list_head lru;
+	struct binder_proc *proc;
+};
+
+struct binder_alloc_stats {
+	unsigned long alloc_count;
+	unsigned long alloc_failed;
+	u64 alloc_time_ns;
+	u64 alloc_time_max_ns;
+	unsigned long pages_mapped;
+	unsigned long pages_reused;
+	unsigned long pages_reclaimed;
+};
+
+/*
+ * A scheduling policy and kernel priority (0 to MAX_PRIO - 1, lower is
+ * more important) that is carried across transactions.
+ */
+struct binder_priority {
+	unsigned int sched_policy;
+	int prio;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -296,23 +369,41 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	/*
+	 * buffer_lock protects the buffer allocator (buffers, free_buffers,
+	 * allocated_buffers, free_async_space and pages) so that a sender
+	 * can allocate and fill a buffer in this process without holding
+	 * binder_lock.  It nests inside binder_lock.
+	 */
+	struct mutex buffer_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
 	struct page **pages;
+	struct binder_lru_page *pages_lru;
+	int lru_pages;
+	struct binder_alloc_stats alloc_stats;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	/*
+	 * Temporary references held by senders that dropped binder_lock
+	 * while filling a buffer in this process.  The final teardown is
+	 * done by whoever drops the last one once is_dead is set.
+	 */
+	int tmp_ref;
+	int is_dead;
+	struct binder_blob_account *blob_account;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	struct binder_latency_stats latency;
 	struct list_head delivered_death;
 	int max_threads;
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
 	struct dentry *debugfs_entry;
 };
 
@@ -338,6 +429,15 @@ struct binder_thread {
 		/* we are also waiting on */
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	/*
+	 * The policy and priority the thread had before binder first
+	 * changed them, and the ones binder last set.  The former is put
+	 * back when the thread returns to wait for process work, unless
+	 * the thread changed its priority itself in the meantime.
+	 */
+	struct binder_priority own_priority;
+	struct binder_priority set_priority;
+	int priority_changed;
 };
 
 struct binder_transaction {
@@ -354,13 +454,28 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	queue_time;	/* when it was put on the todo list */
+	ktime_t	read_time;	/* when a thread read it */
+	ktime_t	start_time;	/* queue_time of the call, for replies */
 };
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_free_proc(struct binder_proc *proc);
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_ref <= 0);
+	proc->tmp_ref--;
+	if (proc->is_dead && proc->tmp_ref == 0)
+		binder_free_proc(proc);
+}
 
 /*
  * copied from get_unused_fd_flags
@@ -500,6 +615,244 @@ out_unlock:
 	return -EBADF;
 }
 
+/*
+ * Blob pages are charged to the sending process until the receiver
+ * closes the file, which may be after the sender is gone; the count
+ * lives apart from binder_proc for that reason.
+ */
+struct binder_blob_account {
+	struct kref ref;
+	atomic_t pages;
+};
+
+static void binder_blob_account_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct binder_blob_account, ref));
+}
+
+/*
+ * Pages backing a BINDER_TYPE_BLOB object.  They are either pinned
+ * pages of the sender (TF_ZERO_COPY) or private copies, and are handed
+ * to the receiver as a read-only file it can mmap.
+ */
+struct binder_blob {
+	struct binder_blob_account *account;
+	int nr_charged;
+	int nr_pages;
+	struct page *pages[0];
+};
+
+static void binder_blob_free(struct binder_blob *blob)
+{
+	int i;
+
+	for (i = 0; i < blob->nr_pages; i++)
+		put_page(blob->pages[i]);
+	atomic_sub(blob->nr_charged, &blob->account->pages);
+	kref_put(&blob->account->ref, binder_blob_account_release);
+	kfree(blob);
+}
+
+static int binder_blob_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct binder_blob *blob = filp->private_data;
+	unsigned long pgoff = vma->vm_pgoff;
+	unsigned long addr;
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (pgoff >= blob->nr_pages || vma_pages(vma) > blob->nr_pages - pgoff)
+		return -EINVAL;
+	vma->vm_flags = (vma->vm_flags | VM_DONTEXPAND) & ~VM_MAYWRITE;
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr += PAGE_SIZE) {
+		ret = remap_pfn_range(vma, addr,
+				      page_to_pfn(blob->pages[pgoff++]),
+				      PAGE_SIZE, vma->vm_page_prot);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int binder_blob_release(struct inode *inode, struct file *filp)
+{
+	binder_blob_free(filp->private_data);
+	return 0;
+}
+
+static const struct file_operations binder_blob_fops = {
+	.owner = THIS_MODULE,
+	.mmap = binder_blob_mmap,
+	.release = binder_blob_release,
+};
+
+/*
+ * Build the file for a blob of the current task.  With zero_copy the
+ * whole pages of the payload are pinned and shared with the receiver;
+ * a trailing partial page is always copied so that the receiver cannot
+ * see unrelated sender data past the end of the payload.
+ */
+static struct file *binder_blob_create(struct binder_blob_account *account,
+				       void __user *ubuf, size_t size,
+				       int zero_copy)
+{
+	struct binder_blob *blob;
+	struct file *file;
+	int nr_pages, nr_pinned = 0;
+	int ret;
+
+	if (size == 0 || size > BINDER_BLOB_MAX_SIZE)
+		return ERR_PTR(-EINVAL);
+	if (zero_copy && ((unsigned long)ubuf & ~PAGE_MASK))
+		return ERR_PTR(-EINVAL);
+
+	nr_pages = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	if (atomic_add_return(nr_pages, &account->pages) >
+	    BINDER_BLOB_PROC_MAX_PAGES) {
+		atomic_sub(nr_pages, &account->pages);
+		return ERR_PTR(-ENOSPC);
+	}
+	blob = kzalloc(sizeof(*blob) + nr_pages * sizeof(blob->pages[0]),
+		       GFP_KERNEL);
+	if (blob == NULL) {
+		atomic_sub(nr_pages, &account->pages);
+		return ERR_PTR(-ENOMEM);
+	}
+	kref_get(&account->ref);
+	blob->account = account;
+	blob->nr_charged = nr_pages;
+
+	if (zero_copy && size >= PAGE_SIZE) {
+		nr_pinned = size >> PAGE_SHIFT;
+		down_read(&current->mm->mmap_sem);
+		ret = get_user_pages(current, current->mm, (unsigned long)ubuf,
+				     nr_pinned, 0, 0, blob->pages, NULL);
+		up_read(&current->mm->mmap_sem);
+		if (ret > 0)
+			blob->nr_pages = ret;
+		if (ret != nr_pinned) {
+			ret = -EFAULT;
+			goto err;
+		}
+	}
+	while (blob->nr_pages < nr_pages) {
+		size_t offset = blob->nr_pages * PAGE_SIZE;
+		size_t len = min_t(size_t, size - offset, PAGE_SIZE);
+		struct page *page;
+		void *kaddr;
+
+		page = alloc_page(GFP_HIGHUSER);
+		if (page == NULL) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		blob->pages[blob->nr_pages++] = page;
+		kaddr = kmap(page);
+		ret = copy_from_user(kaddr, ubuf + offset, len);
+		if (len < PAGE_SIZE)
+			memset(kaddr + len, 0, PAGE_SIZE - len);
+		kunmap(page);
+		flush_dcache_page(page);
+		if (ret) {
+			ret = -EFAULT;
+			goto err;
+		}
+	}
+
+	file = anon_inode_getfile("[binder_blob]", &binder_blob_fops, blob,
+				  O_RDONLY);
+	if (IS_ERR(file)) {
+		ret = PTR_ERR(file);
+		goto err;
+	}
+	return file;
+
+err:
+	binder_blob_free(blob);
+	return ERR_PTR(ret);
+}
+
+/*
+ * Build the files of all BINDER_TYPE_BLOB objects in a transaction
+ * buffer.  This pins or copies up to BINDER_BLOB_MAX_SIZE per
+ * transaction, so it runs without binder_lock.  Objects at invalid
+ * offsets are skipped here and rejected by binder_transaction().
+ * Returns the number of files put in *filesp, in offset order.
+ */
+static int binder_blobs_create(struct binder_proc *proc,
+			       struct binder_buffer *buffer, size_t *offp,
+			       size_t *off_end, int zero_copy,
+			       struct file ***filesp)
+{
+	struct flat_binder_object *fp;
+	struct file **files;
+	size_t total = 0;
+	size_t *off;
+	int nr = 0, i;
+
+	*filesp = NULL;
+	for (off = offp; off < off_end; off++) {
+		if (*off > buffer->data_size - sizeof(*fp) ||
+		    buffer->data_size < sizeof(*fp) ||
+		    !IS_ALIGNED(*off, sizeof(void *)))
+			continue;
+		fp = (struct flat_binder_object *)(buffer->data + *off);
+		if (fp->type != BINDER_TYPE_BLOB)
+			continue;
+		total += (size_t)fp->cookie;
+		if ((size_t)fp->cookie > BINDER_BLOB_MAX_SIZE ||
+		    total > BINDER_BLOB_MAX_SIZE)
+			return -EINVAL;
+		nr++;
+	}
+	if (nr == 0)
+		return 0;
+
+	files = kcalloc(nr, sizeof(*files), GFP_KERNEL);
+	if (files == NULL)
+		return -ENOMEM;
+
+	i = 0;
+	for (off = offp; off < off_end; off++) {
+		if (*off > buffer->data_size - sizeof(*fp) ||
+		    buffer->data_size < sizeof(*fp) ||
+		    !IS_ALIGNED(*off, sizeof(void *)))
+			continue;
+		fp = (struct flat_binder_object *)(buffer->data + *off);
+		if (fp->type != BINDER_TYPE_BLOB)
+			continue;
+		files[i] = binder_blob_create(proc->blob_account, fp->binder,
+					      (size_t)fp->cookie, zero_copy);
+		if (IS_ERR(files[i])) {
+			int ret = PTR_ERR(files[i]);
+
+			binder_user_error("binder: %d got transaction with invalid blob %p size %zd, %d\n",
+				proc->pid, fp->binder, (size_t)fp->cookie, ret);
+			while (i--)
+				fput(files[i]);
+			kfree(files);
+			return ret;
+		}
+		i++;
+	}
+
+	*filesp = files;
+	return nr;
+}
+
+/* drop the blob files binder_transaction() did not hand over */
+static void binder_blobs_put(struct file **files, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (files[i])
+			fput(files[i]);
+	kfree(files);
+}
+
 static void binder_set_nice(long nice)
 {
 	long min_nice;
@@ -517,6 +870,131 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static inline int binder_nice_to_prio(long nice)
+{
+	return MAX_RT_PRIO + nice + 20;
+}
+
+static inline long binder_prio_to_nice(int prio)
+{
+	return prio - MAX_RT_PRIO - 20;
+}
+
+static bool binder_is_rt_policy(unsigned int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static struct binder_priority binder_current_priority(void)
+{
+	struct binder_priority prio;
+
+	prio.sched_policy = current->policy;
+	prio.prio = current->normal_prio;
+	return prio;
+}
+
+/*
+ * Switch the current thread to the policy and priority in desired.
+ * Real-time priorities are applied as they are; nice values are still
+ * subject to RLIMIT_NICE through binder_set_nice().  The thread's own
+ * reset-on-fork setting is left as it is.
+ */
+static void binder_do_set_priority(struct binder_priority desired)
+{
+	struct sched_param param;
+	unsigned int policy = desired.sched_policy;
+	unsigned int reset = current->sched_reset_on_fork ?
+			     SCHED_RESET_ON_FORK : 0;
+	int ret;
+
+	if (binder_is_rt_policy(policy)) {
+		param.sched_priority = MAX_USER_RT_PRIO - 1 - desired.prio;
+		if (current->policy == policy &&
+		    current->rt_priority == param.sched_priority)
+			return;
+		ret = sched_setscheduler_nocheck(current, policy | reset,
+						 &param);
+		if (ret)
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: failed to set policy %u prio %d, %d\n",
+				     current->pid, policy, desired.prio, ret);
+		return;
+	}
+	if (current->policy != policy) {
+		param.sched_priority = 0;
+		ret = sched_setscheduler_nocheck(current, policy | reset,
+						 &param);
+		if (ret)
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: failed to set policy %u, %d\n",
+				     current->pid, policy, ret);
+	}
+	binder_set_nice(binder_prio_to_nice(desired.prio));
+}
+
+static bool binder_priority_equal(struct binder_priority a,
+				  struct binder_priority b)
+{
+	return a.sched_policy == b.sched_policy && a.prio == b.prio;
+}
+
+/* Set the priority of thread (current) on behalf of a transaction. */
+static void binder_set_priority(struct binder_thread *thread,
+				struct binder_priority desired)
+{
+	if (!thread->priority_changed) {
+		thread->own_priority = binder_current_priority();
+		thread->priority_changed = 1;
+	}
+	binder_do_set_priority(desired);
+	thread->set_priority = binder_current_priority();
+}
+
+/*
+ * Give thread (current) back the policy and priority it had before
+ * binder changed them.  If it has changed them itself since, they are
+ * its own and are kept.
+ */
+static void binder_restore_priority(struct binder_thread *thread)
+{
+	if (!thread->priority_changed)
+		return;
+	thread->priority_changed = 0;
+	if (!binder_priority_equal(binder_current_priority(),
+				   thread->set_priority))
+		return;
+	binder_do_set_priority(thread->own_priority);
+}
+
+/*
+ * Set the priority of the current thread for handling t, sent to node.
+ * Synchronous calls run at the caller's policy and priority or at the
+ * node's minimum priority, whichever is more important.  One-way calls
+ * do not inherit from the caller and are only raised to the node's
+ * minimum priority.
+ */
+static void binder_transaction_priority(struct binder_thread *thread,
+					struct binder_transaction *t,
+					struct binder_node *node)
+{
+	struct binder_priority desired = t->priority;
+	struct binder_priority node_prio;
+
+	node_prio.sched_policy = SCHED_NORMAL;
+	node_prio.prio = binder_nice_to_prio(min_t(int, node->min_priority, 19));
+
+	t->saved_priority = binder_current_priority();
+	if (t->flags & TF_ONE_WAY) {
+		if (t->saved_priority.prio <= node_prio.prio)
+			return;
+		desired = node_prio;
+	} else if (node_prio.prio < desired.prio) {
+		desired = node_prio;
+	}
+	binder_set_priority(thread, desired);
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -609,15 +1087,47 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_lru_add_page(struct binder_proc *proc, size_t index)
+{
+	struct binder_lru_page *lru_page = &proc->pages_lru[index];
+
+	spin_lock(&binder_lru_lock);
+	BUG_ON(!list_empty(&lru_page->lru));
+	list_add_tail(&lru_page->lru, &binder_lru_pages);
+	binder_lru_count++;
+	proc->lru_pages++;
+	spin_unlock(&binder_lru_lock);
+}
+
+static int binder_lru_del_page(struct binder_proc *proc, size_t index)
+{
+	struct binder_lru_page *lru_page = &proc->pages_lru[index];
+	int on_lru;
+
+	spin_lock(&binder_lru_lock);
+	on_lru = !list_empty(&lru_page->lru);
+	if (on_lru) {
+		list_del_init(&lru_page->lru);
+		binder_lru_count--;
+		proc->lru_pages--;
+	}
+	spin_unlock(&binder_lru_lock);
+	return on_lru;
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
 {
 	void *page_addr;
+	void *run_start = NULL;
+	void *map_addr = NULL;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
 	struct page **page;
 	struct mm_struct *mm;
+	size_t index;
+	int missing = 0;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -626,6 +1136,21 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0)
+		goto free_range;
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		index = (page_addr - proc->buffer) / PAGE_SIZE;
+		if (proc->pages[index]) {
+			if (!binder_lru_del_page(proc, index))
+				BUG();
+			proc->alloc_stats.pages_reused++;
+		} else
+			missing++;
+	}
+	if (missing == 0)
+		return 0;
+
 	if (vma)
 		mm = NULL;
 	else
@@ -641,47 +1166,66 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
 		goto err_no_vma;
 	}
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+	/* map each run of missing pages into the kernel in one go */
+	page_addr = start;
+	while (page_addr < end) {
 		int ret;
 		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
+		if (proc->pages[(page_addr - proc->buffer) / PAGE_SIZE]) {
+			page_addr += PAGE_SIZE;
+			continue;
+		}
+		run_start = page_addr;
+		map_addr = page_addr;
+		while (page_addr < end) {
+			page = &proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE];
+			if (*page)
+				break;
+			*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+			if (*page == NULL) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed for page at %p\n",
+				       proc->pid, page_addr);
+				goto err_alloc_page_failed;
+			}
+			page_addr += PAGE_SIZE;
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		tmp_area.addr = run_start;
+		tmp_area.size = page_addr - run_start + PAGE_SIZE /* guard page? */;
+		page_array_ptr = &proc->pages[(run_start - proc->buffer) /
+					      PAGE_SIZE];
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
+			       "to map pages at %p-%p in kernel\n",
+			       proc->pid, run_start, page_addr);
 			goto err_map_kernel_failed;
 		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %lx in userspace\n",
-			       proc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
+		for (; map_addr < page_addr; map_addr += PAGE_SIZE) {
+			user_page_addr =
+				(uintptr_t)map_addr + proc->user_buffer_offset;
+			ret = vm_insert_page(vma, user_page_addr,
+				proc->pages[(map_addr - proc->buffer) /
+					    PAGE_SIZE]);
+			if (ret) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed to map page at %lx in "
+				       "userspace\n", proc->pid,
+				       user_page_addr);
+				goto err_vm_insert_page_failed;
+			}
+			/* vm_insert_page does not seem to increment the refcount */
 		}
-		/* vm_insert_page does not seem to increment the refcount */
+		proc->alloc_stats.pages_mapped +=
+			(page_addr - run_start) / PAGE_SIZE;
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -690,21 +1234,31 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	return 0;
 
 free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+		binder_lru_add_page(proc, (page_addr - proc->buffer) /
+				    PAGE_SIZE);
+	return 0;
+
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	if (map_addr > run_start)
+		zap_page_range(vma, (uintptr_t)run_start +
+			proc->user_buffer_offset, map_addr - run_start, NULL);
 err_map_kernel_failed:
+	unmap_kernel_range((unsigned long)run_start, page_addr - run_start);
+err_alloc_page_failed:
+	for (map_addr = run_start; map_addr < page_addr;
+	     map_addr += PAGE_SIZE) {
+		page = &proc->pages[(map_addr - proc->buffer) / PAGE_SIZE];
 		__free_page(*page);
 		*page = NULL;
-err_alloc_page_failed:
-		;
 	}
 err_no_vma:
+	/* pages that did get mapped are handed to the shrinker */
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		index = (page_addr - proc->buffer) / PAGE_SIZE;
+		if (proc->pages[index])
+			binder_lru_add_page(proc, index);
+	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
@@ -712,9 +1266,96 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Unmap and free one page that sits on the lru.  Called with
+ * proc->buffer_lock held; returns 0 if the page could not be unmapped
+ * from user space without blocking.
+ */
+static int binder_free_lru_page(struct binder_proc *proc, size_t index)
+{
+	void *page_addr = proc->buffer + index * PAGE_SIZE;
+	struct mm_struct *mm;
+
+	mm = get_task_mm(proc->tsk);
+	if (mm) {
+		struct vm_area_struct *vma;
+
+		if (!down_read_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			return 0;
+		}
+		vma = proc->vma;
+		if (vma && vma->vm_mm == mm)
+			zap_page_range(vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(proc->pages[index]);
+	proc->pages[index] = NULL;
+	proc->alloc_stats.pages_reclaimed++;
+	return 1;
+}
+
+/*
+ * binder_shrink - releases cached buffer pages, called from
+ * mm/vmscan.c :: shrink_slab
+ *
+ * Only trylocks are used: this can be entered from page allocations
+ * made under binder_lock or a proc's buffer_lock.
+ */
+static int binder_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct binder_lru_page *lru_page;
+	struct binder_proc *proc;
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	int count;
+
+	if (!nr_to_scan)
+		return binder_lru_count;
+
+	spin_lock(&binder_lru_lock);
+	while (nr_to_scan-- && !list_empty(&binder_lru_pages)) {
+		size_t index;
+		int freed;
+
+		lru_page = list_first_entry(&binder_lru_pages,
+					    struct binder_lru_page, lru);
+		proc = lru_page->proc;
+		if (!mutex_trylock(&proc->buffer_lock)) {
+			list_move_tail(&lru_page->lru, &binder_lru_pages);
+			continue;
+		}
+		list_del_init(&lru_page->lru);
+		binder_lru_count--;
+		proc->lru_pages--;
+		spin_unlock(&binder_lru_lock);
+
+		index = lru_page - proc->pages_lru;
+		freed = binder_free_lru_page(proc, index);
+		if (!freed)
+			binder_lru_add_page(proc, index);
+		mutex_unlock(&proc->buffer_lock);
+
+		spin_lock(&binder_lru_lock);
+		binder_lru_reclaimed += freed;
+	}
+	count = binder_lru_count;
+	spin_unlock(&binder_lru_lock);
+
+	return count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -818,6 +1459,30 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+	struct binder_alloc_stats *stats = &proc->alloc_stats;
+	ktime_t start;
+	u64 delta;
+
+	mutex_lock(&proc->buffer_lock);
+	start = ktime_get();
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (buffer) {
+		stats->alloc_count++;
+		stats->alloc_time_ns += delta;
+		if (delta > stats->alloc_time_max_ns)
+			stats->alloc_time_max_ns = delta;
+	} else
+		stats->alloc_failed++;
+	mutex_unlock(&proc->buffer_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -875,8 +1540,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -930,6 +1595,14 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->buffer_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->buffer_lock);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -989,6 +1662,13 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
+static void binder_free_node(struct binder_node *node)
+{
+	kfree(node->latency);
+	kfree(node);
+	binder_stats_deleted(BINDER_STAT_NODE);
+}
+
 static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			   struct list_head *target_list)
 {
@@ -1059,8 +1739,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
 			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
+			binder_free_node(node);
 		}
 	}
 
@@ -1235,6 +1914,51 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
+static void binder_latency_add(struct binder_latency_stats *stats,
+			       enum binder_latency_type type, u64 ns)
+{
+	struct binder_latency_hist *hist = &stats->hist[type];
+	int bucket = fls64(div_u64(ns, NSEC_PER_USEC));
+
+	if (bucket >= BINDER_LATENCY_BUCKETS)
+		bucket = BINDER_LATENCY_BUCKETS - 1;
+	hist->count++;
+	hist->total_ns += ns;
+	if (ns > hist->max_ns)
+		hist->max_ns = ns;
+	hist->buckets[bucket]++;
+}
+
+static void binder_node_latency_add(struct binder_node *node,
+				    enum binder_latency_type type, u64 ns)
+{
+	if (node->latency == NULL) {
+		node->latency = kzalloc(sizeof(*node->latency), GFP_KERNEL);
+		if (node->latency == NULL)
+			return;
+	}
+	binder_latency_add(node->latency, type, ns);
+}
+
+/*
+ * Account the service time of t, which proc is replying to.  The node
+ * is only known while the buffer of t has not been freed yet, which is
+ * the usual case since user-space frees it after sending the reply.
+ */
+static void binder_transaction_replied(struct binder_proc *proc,
+				       struct binder_transaction *t,
+				       ktime_t now)
+{
+	struct binder_node *node = t->buffer ? t->buffer->target_node : NULL;
+	u64 service_ns = ktime_to_ns(ktime_sub(now, t->read_time));
+
+	binder_latency_add(&proc->latency, BINDER_LATENCY_SERVICE, service_ns);
+	if (node)
+		binder_node_latency_add(node, BINDER_LATENCY_SERVICE,
+					service_ns);
+	trace_binder_transaction_reply(t, node, service_ns);
+}
+
 static void binder_pop_transaction(struct binder_thread *target_thread,
 				   struct binder_transaction *t)
 {
@@ -1368,6 +2092,7 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 		} break;
 
 		case BINDER_TYPE_FD:
+		case BINDER_TYPE_BLOB:
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        fd %ld\n", fp->handle);
 			if (failed_at)
@@ -1382,6 +2107,31 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/*
+ * Queue t on the todo list of proc, ahead of any transactions from less
+ * important callers.  Other work is never passed, so that reference
+ * count and death notifications stay ordered with the transactions
+ * around them.
+ */
+static void binder_enqueue_proc_transaction(struct binder_proc *proc,
+					    struct binder_transaction *t)
+{
+	struct list_head *pos;
+
+	list_for_each_prev(pos, &proc->todo) {
+		struct binder_work *w;
+		struct binder_transaction *queued;
+
+		w = list_entry(pos, struct binder_work, entry);
+		if (w->type != BINDER_WORK_TRANSACTION)
+			break;
+		queued = container_of(w, struct binder_transaction, work);
+		if (queued->priority.prio <= t->priority.prio)
+			break;
+	}
+	list_add(&t->work.entry, pos);
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1395,10 +2145,12 @@ static void binder_transaction(struct binder_proc *proc,
 	struct list_head *target_list;
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
-	struct binder_transaction_log_entry *e;
+	struct binder_transaction_log_entry log_entry, *e = &log_entry;
+	struct file **blob_files = NULL;
+	int nr_blobs = 0, blob_idx = 0;
 	uint32_t return_error;
 
-	e = binder_transaction_log_add(&binder_transaction_log);
+	memset(e, 0, sizeof(*e));
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
 	e->from_proc = proc->pid;
 	e->from_thread = thread->pid;
@@ -1415,7 +2167,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_set_priority(thread, in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1488,21 +2240,8 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1546,37 +2285,114 @@ static void binder_transaction(struct binder_proc *proc,
 		t->from = NULL;
 	t->sender_euid = proc->tsk->cred->euid;
 	t->to_proc = target_proc;
-	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	t->priority = binder_current_priority();
+
+	/*
+	 * Allocating the target buffer may have to map pages and copying
+	 * the payload may fault, so neither is done under binder_lock.
+	 * The buffer is not visible to anyone else until it is queued,
+	 * and the temporary reference keeps target_proc around; anything
+	 * else looked up above is revalidated once the lock is retaken.
+	 */
+	target_proc->tmp_ref++;
+	mutex_unlock(&binder_lock);
+
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
+		mutex_lock(&binder_lock);
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
 	t->buffer->allow_user_free = 0;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
+	t->buffer->target_node = NULL;
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
 	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
+		mutex_lock(&binder_lock);
 		binder_user_error("binder: %d:%d got transaction with invalid "
 			"data ptr\n", proc->pid, thread->pid);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
 	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
+		mutex_lock(&binder_lock);
 		binder_user_error("binder: %d:%d got transaction with invalid "
 			"offsets ptr\n", proc->pid, thread->pid);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
+	nr_blobs = binder_blobs_create(proc, t->buffer, offp,
+				       offp + tr->offsets_size / sizeof(size_t),
+				       t->flags & TF_ZERO_COPY, &blob_files);
+	if (nr_blobs < 0) {
+		mutex_lock(&binder_lock);
+		nr_blobs = 0;
+		return_error = BR_FAILED_REPLY;
+		goto err_copy_data_failed;
+	}
+	mutex_lock(&binder_lock);
+
+	if (target_proc->is_dead) {
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_proc;
+	}
+	if (reply) {
+		if (in_reply_to->from != target_thread) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_proc;
+		}
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			goto err_dead_proc;
+		}
+	} else {
+		if (tr->target.handle) {
+			struct binder_ref *ref;
+			ref = binder_get_ref(proc, tr->target.handle);
+			target_node = ref ? ref->node : NULL;
+		} else
+			target_node = binder_context_mgr_node;
+		if (target_node == NULL || target_node->proc != target_proc) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_proc;
+		}
+		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
+			struct binder_transaction *tmp;
+			tmp = thread->transaction_stack;
+			while (tmp) {
+				if (tmp->from && tmp->from->proc == target_proc)
+					target_thread = tmp->from;
+				tmp = tmp->from_parent;
+			}
+		}
+	}
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
+	t->to_thread = target_thread;
+	t->buffer->target_node = target_node;
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1617,6 +2433,7 @@ static void binder_transaction(struct binder_proc *proc,
 					proc->pid, thread->pid,
 					fp->binder, node->debug_id,
 					fp->cookie, node->cookie);
+				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
 			ref = binder_get_ref_for_node(target_proc, node);
@@ -1676,7 +2493,8 @@ static void binder_transaction(struct binder_proc *proc,
 			}
 		} break;
 
-		case BINDER_TYPE_FD: {
+		case BINDER_TYPE_FD:
+		case BINDER_TYPE_BLOB: {
 			int target_fd;
 			struct file *file;
 
@@ -1694,12 +2512,21 @@ static void binder_transaction(struct binder_proc *proc,
 				goto err_fd_not_allowed;
 			}
 
-			file = fget(fp->handle);
-			if (file == NULL) {
-				binder_user_error("binder: %d:%d got transaction with invalid fd, %ld\n",
-					proc->pid, thread->pid, fp->handle);
-				return_error = BR_FAILED_REPLY;
-				goto err_fget_failed;
+			if (fp->type == BINDER_TYPE_BLOB) {
+				/* built by binder_blobs_create(), in order */
+				BUG_ON(blob_idx >= nr_blobs);
+				file = blob_files[blob_idx];
+				blob_files[blob_idx++] = NULL;
+				/* the sender's address means nothing to the target */
+				fp->binder = NULL;
+			} else {
+				file = fget(fp->handle);
+				if (file == NULL) {
+					binder_user_error("binder: %d:%d got transaction with invalid fd, %ld\n",
+						proc->pid, thread->pid, fp->handle);
+					return_error = BR_FAILED_REPLY;
+					goto err_fget_failed;
+				}
 			}
 			target_fd = task_get_unused_fd_flags(target_proc, O_CLOEXEC);
 			if (target_fd < 0) {
@@ -1722,8 +2549,12 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
+	t->queue_time = ktime_get();
+	t->start_time = t->queue_time;
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		binder_transaction_replied(proc, in_reply_to, t->queue_time);
+		t->start_time = in_reply_to->start_time;
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1740,11 +2571,20 @@ static void binder_transaction(struct binder_proc *proc,
 			target_node->has_async_transaction = 1;
 	}
 	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
+	if (target_list == &target_proc->todo)
+		binder_enqueue_proc_transaction(target_proc, t);
+	else
+		list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
-	if (target_wait)
+	trace_binder_transaction(reply, t, target_node);
+	if (target_wait) {
+		trace_binder_transaction_wakeup(t);
 		wake_up_interruptible(target_wait);
+	}
+	*binder_transaction_log_add(&binder_transaction_log) = *e;
+	binder_proc_dec_tmpref(target_proc);
+	kfree(blob_files);
 	return;
 
 err_get_unused_fd_failed:
@@ -1755,11 +2595,15 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
+err_dead_proc:
 err_copy_data_failed:
+	if (blob_files)
+		binder_blobs_put(blob_files, nr_blobs);
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
 err_binder_alloc_buf_failed:
+	binder_proc_dec_tmpref(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1776,6 +2620,7 @@ err_no_context_mgr_node:
 		     proc->pid, thread->pid, return_error,
 		     tr->data_size, tr->offsets_size);
 
+	*binder_transaction_log_add(&binder_transaction_log) = *e;
 	{
 		struct binder_transaction_log_entry *fe;
 		fe = binder_transaction_log_add(&binder_transaction_log_failed);
@@ -1940,7 +2785,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->buffer_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
+			mutex_unlock(&proc->buffer_lock);
 			if (buffer == NULL) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
@@ -2252,7 +3099,7 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
+		binder_restore_priority(thread);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
@@ -2278,6 +3125,7 @@ retry:
 		struct binder_transaction_data tr;
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
+		u64 queue_ns;
 
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
@@ -2361,8 +3209,7 @@ retry:
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
-					kfree(node);
-					binder_stats_deleted(BINDER_STAT_NODE);
+					binder_free_node(node);
 				} else {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p state unchanged\n",
@@ -2416,13 +3263,7 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_transaction_priority(thread, t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2456,6 +3297,21 @@ retry:
 			return -EFAULT;
 		ptr += sizeof(tr);
 
+		t->read_time = ktime_get();
+		queue_ns = ktime_to_ns(ktime_sub(t->read_time, t->queue_time));
+		trace_binder_transaction_received(t, thread, queue_ns);
+		if (cmd == BR_TRANSACTION) {
+			binder_latency_add(&proc->latency, BINDER_LATENCY_QUEUE,
+					   queue_ns);
+			binder_node_latency_add(t->buffer->target_node,
+						BINDER_LATENCY_QUEUE, queue_ns);
+		} else {
+			binder_latency_add(&proc->latency,
+					   BINDER_LATENCY_ROUND_TRIP,
+					   ktime_to_ns(ktime_sub(t->read_time,
+								 t->start_time)));
+		}
+
 		binder_stat_br(proc, thread, cmd);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
@@ -2797,6 +3653,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
 	struct binder_buffer *buffer;
+	int i;
 
 	if ((vma->vm_end - vma->vm_start) > SZ_4M)
 		vma->vm_end = vma->vm_start + SZ_4M;
@@ -2845,6 +3702,17 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		failure_string = "alloc page array";
 		goto err_alloc_pages_failed;
 	}
+	proc->pages_lru = kcalloc((vma->vm_end - vma->vm_start) / PAGE_SIZE,
+				  sizeof(proc->pages_lru[0]), GFP_KERNEL);
+	if (proc->pages_lru == NULL) {
+		ret = -ENOMEM;
+		failure_string = "alloc page lru array";
+		goto err_alloc_pages_lru_failed;
+	}
+	for (i = 0; i < (vma->vm_end - vma->vm_start) / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages_lru[i].lru);
+		proc->pages_lru[i].proc = proc;
+	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
 
 	vma->vm_ops = &binder_vm_ops;
@@ -2871,6 +3739,9 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	return 0;
 
 err_alloc_small_buf_failed:
+	kfree(proc->pages_lru);
+	proc->pages_lru = NULL;
+err_alloc_pages_lru_failed:
 	kfree(proc->pages);
 	proc->pages = NULL;
 err_alloc_pages_failed:
@@ -2896,11 +3767,17 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc = kzalloc(sizeof(*proc), GFP_KERNEL);
 	if (proc == NULL)
 		return -ENOMEM;
+	proc->blob_account = kzalloc(sizeof(*proc->blob_account), GFP_KERNEL);
+	if (proc->blob_account == NULL) {
+		kfree(proc);
+		return -ENOMEM;
+	}
+	kref_init(&proc->blob_account->ref);
 	get_task_struct(current);
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
+	mutex_init(&proc->buffer_lock);
 	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
@@ -2959,9 +3836,8 @@ static int binder_release(struct inode *nodp, struct file *filp)
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
@@ -2990,8 +3866,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
 		if (hlist_empty(&node->refs)) {
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
+			binder_free_node(node);
 		} else {
 			struct binder_ref *ref;
 			int death = 0;
@@ -3027,8 +3902,28 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
 
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d threads %d, nodes %d (ref %d), "
+		     "refs %d, active transactions %d, tmp refs %d\n",
+		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
+		     active_transactions, proc->tmp_ref);
+
+	proc->is_dead = 1;
+	if (proc->tmp_ref == 0)
+		binder_free_proc(proc);
+}
+
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	BUG_ON(!proc->is_dead);
+	BUG_ON(proc->tmp_ref);
+
+	buffers = 0;
 	while ((n = rb_first(&proc->allocated_buffers))) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
@@ -3050,6 +3945,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 	page_count = 0;
 	if (proc->pages) {
 		int i;
+
+		/* wait out binder_shrink() before taking pages off the lru */
+		mutex_lock(&proc->buffer_lock);
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
 			if (proc->pages[i]) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
@@ -3058,12 +3956,15 @@ static void binder_deferred_release(struct binder_proc *proc)
 					     "page %d at %p not freed\n",
 					     proc->pid, i,
 					     page_addr);
+				binder_lru_del_page(proc, i);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
 				__free_page(proc->pages[i]);
 				page_count++;
 			}
 		}
+		mutex_unlock(&proc->buffer_lock);
+		kfree(proc->pages_lru);
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
@@ -3071,12 +3972,10 @@ static void binder_deferred_release(struct binder_proc *proc)
 	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
-		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
-		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
 
+	kref_put(&proc->blob_account->ref, binder_blob_account_release);
 	kfree(proc);
 }
 
@@ -3112,7 +4011,7 @@ static void binder_deferred_func(struct work_struct *work)
 			binder_deferred_flush(proc);
 
 		if (defer & BINDER_DEFERRED_RELEASE)
-			binder_deferred_release(proc); /* frees proc */
+			binder_deferred_release(proc); /* may free proc */
 
 		mutex_unlock(&binder_lock);
 		if (files)
@@ -3138,13 +4037,14 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
 	seq_printf(m,
-		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
+		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %u:%d r%d",
 		   prefix, t->debug_id, t,
 		   t->from ? t->from->proc->pid : 0,
 		   t->from ? t->from->pid : 0,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
-		   t->code, t->flags, t->priority, t->need_reply);
+		   t->code, t->flags, t->priority.sched_policy,
+		   t->priority.prio, t->need_reply);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3268,6 +4168,75 @@ static void print_binder_ref(struct seq_file *m, struct binder_ref *ref)
 		   ref->node->debug_id, ref->strong, ref->weak, ref->death);
 }
 
+static void print_binder_alloc_stats(struct seq_file *m,
+				     struct binder_proc *proc)
+{
+	struct binder_alloc_stats *stats = &proc->alloc_stats;
+	struct rb_node *n;
+	size_t free_size = 0, largest = 0;
+	int free_count = 0;
+
+	mutex_lock(&proc->buffer_lock);
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		size_t size = binder_buffer_size(proc, rb_entry(n,
+					struct binder_buffer, rb_node));
+		free_count++;
+		free_size += size;
+		if (size > largest)
+			largest = size;
+	}
+	seq_printf(m, "  alloc: %lu failed %lu avg %llu ns max %llu ns\n",
+		   stats->alloc_count, stats->alloc_failed,
+		   stats->alloc_count ?
+		   div64_u64(stats->alloc_time_ns, stats->alloc_count) : 0,
+		   stats->alloc_time_max_ns);
+	seq_printf(m, "  free space: %zd in %d chunks, largest %zd "
+		   "(fragmentation %zd%%)\n", free_size, free_count, largest,
+		   free_size ? 100 - largest * 100 / free_size : 0);
+	seq_printf(m, "  pages: mapped %lu reused %lu reclaimed %lu "
+		   "cached %d\n", stats->pages_mapped, stats->pages_reused,
+		   stats->pages_reclaimed, proc->lru_pages);
+	mutex_unlock(&proc->buffer_lock);
+}
+
+static const char * const binder_latency_names[] = {
+	"queue",
+	"service",
+	"round trip",
+};
+
+static void print_binder_latency_stats(struct seq_file *m, const char *prefix,
+				       struct binder_latency_stats *stats)
+{
+	int type, i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(binder_latency_names) != BINDER_LATENCY_COUNT);
+	for (type = 0; type < BINDER_LATENCY_COUNT; type++) {
+		struct binder_latency_hist *hist = &stats->hist[type];
+
+		if (!hist->count)
+			continue;
+		seq_printf(m, "%s%s: count %lu avg %lluus max %lluus\n",
+			   prefix, binder_latency_names[type], hist->count,
+			   (unsigned long long)div_u64(div_u64(hist->total_ns,
+						hist->count), NSEC_PER_USEC),
+			   (unsigned long long)div_u64(hist->max_ns,
+						       NSEC_PER_USEC));
+		seq_printf(m, "%s ", prefix);
+		for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+			if (!hist->buckets[i])
+				continue;
+			if (i == BINDER_LATENCY_BUCKETS - 1)
+				seq_printf(m, " >=%luus:%lu", 1UL << (i - 1),
+					   hist->buckets[i]);
+			else
+				seq_printf(m, " <%luus:%lu", 1UL << i,
+					   hist->buckets[i]);
+		}
+		seq_puts(m, "\n");
+	}
+}
+
 static void print_binder_proc(struct seq_file *m,
 			      struct binder_proc *proc, int print_all)
 {
@@ -3295,15 +4264,19 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_lock(&proc->buffer_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->buffer_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
 		seq_puts(m, "  has delivered dead binder\n");
 		break;
 	}
+	if (print_all)
+		print_binder_alloc_stats(m, proc);
 	if (!print_all && m->count == header_pos)
 		m->count = start_pos;
 }
@@ -3427,9 +4400,13 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	mutex_lock(&proc->buffer_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	mutex_unlock(&proc->buffer_lock);
 	seq_printf(m, "  buffers: %d\n", count);
+	seq_printf(m, "  blob pages: %d\n",
+		   atomic_read(&proc->blob_account->pages));
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3443,6 +4420,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 	}
 	seq_printf(m, "  pending transactions: %d\n", count);
 
+	print_binder_alloc_stats(m, proc);
 	print_binder_stats(m, "  ", &proc->stats);
 }
 
@@ -3483,6 +4461,8 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	seq_printf(m, "cached pages: %d reclaimed %lu\n",
+		   binder_lru_count, binder_lru_reclaimed);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
@@ -3522,6 +4502,36 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	return 0;
 }
 
+static int binder_transaction_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		mutex_lock(&binder_lock);
+
+	seq_puts(m, "binder transaction latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency_stats(m, "  ", &proc->latency);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n, struct binder_node,
+							    rb_node);
+
+			if (node->latency == NULL)
+				continue;
+			seq_printf(m, "  node %d: u%p c%p\n",
+				   node->debug_id, node->ptr, node->cookie);
+			print_binder_latency_stats(m, "    ", node->latency);
+		}
+	}
+	if (do_lock)
+		mutex_unlock(&binder_lock);
+	return 0;
+}
+
 static void print_binder_transaction_log_entry(struct seq_file *m,
 					struct binder_transaction_log_entry *e)
 {
@@ -3567,6 +4577,7 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(transaction_latency);
 
 static int __init binder_init(void)
 {
@@ -3581,6 +4592,8 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	if (!ret)
+		register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
@@ -3607,6 +4620,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("transaction_latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_transaction_latency_fops);
 	}
 	return ret;
 }
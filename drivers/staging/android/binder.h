@@ -32,6 +32,7 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_BLOB	= B_PACK_CHARS('b', 'l', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -61,6 +62,21 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+/*
+ * A BINDER_TYPE_BLOB object carries a large payload outside of the
+ * transaction buffer.  The sender puts the address of the payload in
+ * 'binder' and its length in bytes in 'cookie'.  The receiver gets a
+ * read-only file descriptor in 'handle' that can be mmapped to reach
+ * the payload, with 'cookie' still holding the length.  Without
+ * TF_ZERO_COPY the payload is copied into pages owned by the receiver;
+ * with it, the sender's pages are mapped into the receiver directly
+ * and must not be modified by the sender afterwards.  Blobs follow the
+ * same accept-fds rules as BINDER_TYPE_FD.  The receiver sees NULL in
+ * 'binder'.  The blobs of one transaction may not exceed 32MB, and the
+ * blob pages a process has sent and that are still open are limited
+ * to 64MB.
+ */
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses apropriately.
@@ -112,6 +128,7 @@ enum transaction_flags {
 	TF_ROOT_OBJECT	= 0x04,	/* contents are the component's root object */
 	TF_STATUS_CODE	= 0x08,	/* contents are a 32-bit status code */
 	TF_ACCEPT_FDS	= 0x10,	/* allow replies with file descriptors */
+	TF_ZERO_COPY	= 0x20,	/* hand over blob pages instead of copying */
 };
 
 struct binder_transaction_data {
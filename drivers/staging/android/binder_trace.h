@@ -0,0 +1,142 @@
+/*
+ * Tracepoints for binder transaction latency.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+struct binder_node;
+struct binder_proc;
+struct binder_thread;
+struct binder_transaction;
+
+/**
+ * binder_transaction - a transaction or reply was queued
+ * @reply:	non-zero for a reply
+ * @t:		the transaction
+ * @target_node: the node it was sent to, NULL for replies
+ */
+TRACE_EVENT(binder_transaction,
+	TP_PROTO(bool reply, struct binder_transaction *t,
+		 struct binder_node *target_node),
+	TP_ARGS(reply, t, target_node),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, target_node)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(int, reply)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->target_node = target_node ? target_node->debug_id : 0;
+		__entry->to_proc = t->to_proc->pid;
+		__entry->to_thread = t->to_thread ? t->to_thread->pid : 0;
+		__entry->reply = reply;
+		__entry->code = t->code;
+		__entry->flags = t->flags;
+	),
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d reply=%d flags=0x%x code=0x%x",
+		  __entry->debug_id, __entry->target_node,
+		  __entry->to_proc, __entry->to_thread,
+		  __entry->reply, __entry->flags, __entry->code)
+);
+
+/**
+ * binder_transaction_wakeup - the target of a transaction was woken up
+ * @t:		the transaction
+ *
+ * dest_thread is 0 when any thread of the target process may pick the
+ * transaction up.
+ */
+TRACE_EVENT(binder_transaction_wakeup,
+	TP_PROTO(struct binder_transaction *t),
+	TP_ARGS(t),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, to_proc)
+		__field(int, to_thread)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->to_proc = t->to_proc->pid;
+		__entry->to_thread = t->to_thread ? t->to_thread->pid : 0;
+	),
+	TP_printk("transaction=%d dest_proc=%d dest_thread=%d",
+		  __entry->debug_id, __entry->to_proc, __entry->to_thread)
+);
+
+/**
+ * binder_transaction_received - a transaction or reply was read
+ * @t:		the transaction
+ * @thread:	the thread that read it
+ * @queue_ns:	time spent queued since binder_transaction
+ */
+TRACE_EVENT(binder_transaction_received,
+	TP_PROTO(struct binder_transaction *t, struct binder_thread *thread,
+		 u64 queue_ns),
+	TP_ARGS(t, thread, queue_ns),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, thread)
+		__field(u64, queue_ns)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->thread = thread->pid;
+		__entry->queue_ns = queue_ns;
+	),
+	TP_printk("transaction=%d thread=%d queue_ns=%llu",
+		  __entry->debug_id, __entry->thread,
+		  (unsigned long long)__entry->queue_ns)
+);
+
+/**
+ * binder_transaction_reply - a transaction was replied to
+ * @t:		the transaction being replied to
+ * @node:	the node it was sent to, NULL if the buffer was already freed
+ * @service_ns:	time from reading the transaction to sending the reply
+ */
+TRACE_EVENT(binder_transaction_reply,
+	TP_PROTO(struct binder_transaction *t, struct binder_node *node,
+		 u64 service_ns),
+	TP_ARGS(t, node, service_ns),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, node)
+		__field(u64, service_ns)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->node = node ? node->debug_id : 0;
+		__entry->service_ns = service_ns;
+	),
+	TP_printk("transaction=%d node=%d service_ns=%llu",
+		  __entry->debug_id, __entry->node,
+		  (unsigned long long)__entry->service_ns)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE binder_trace
+#include <trace/define_trace.h>
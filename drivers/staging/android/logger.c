@@ -25,6 +25,13 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/lzo.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -53,13 +60,88 @@ typedef enum android_LogPriority {
 #define ANDROID_LOG_LEVEL               (ANDROID_LOG_INFO)
 
 
+/* bytes of staged entries each CPU can hold before it must drain */
+#define LOGGER_STAGE_SIZE	(2 * LOGGER_ENTRY_MAX_LEN)
+
+/*
+ * struct logger_stage - per-CPU staging area for writers
+ *
+ * Writers append entries here under 'lock' without taking log->mutex.
+ * Whoever holds log->mutex moves them into the ring with logger_drain();
+ * drain_off and drain_end are only used while doing so.
+ */
+struct logger_stage {
+	spinlock_t		lock;	/* protects len and appending to buf */
+	size_t			len;	/* bytes of staged entries in buf */
+	size_t			drain_off; /* next entry to drain */
+	size_t			drain_end; /* end of the entries being drained */
+	unsigned char		buf[LOGGER_STAGE_SIZE];
+};
+
+/*
+ * struct logger_staged - a staged entry, followed by its payload
+ *
+ * Entries of all CPUs are merged into the ring by the timestamp taken
+ * when they were staged; 'seq' breaks ties between equal timestamps.
+ */
+struct logger_staged {
+	__u32			seq;
+	struct logger_entry	entry;
+};
+
+/* bytes of entries compressed together into one archive chunk */
+#define LOGGER_CHUNK_SIZE	(4 * LOGGER_ENTRY_MAX_LEN)
+
+/*
+ * struct logger_chunk - a compressed run of entries evicted from the ring
+ *
+ * If the entries did not compress, they are stored as they are and
+ * comp_len equals raw_len.
+ */
+struct logger_chunk {
+	struct list_head	list;	/* entry in logger_archive's chunks */
+	__u32			seq;	/* sequence number of this chunk */
+	size_t			raw_len; /* bytes of entries */
+	size_t			comp_len; /* bytes of data */
+	unsigned char		data[0];
+};
+
+/*
+ * struct logger_archive - compressed history behind the ring
+ *
+ * Entries overwritten by the writer are appended to the 'open' chunk
+ * instead of being lost. Full chunks are compressed and kept, oldest
+ * first, until they take more than 'max_size' bytes. The chunks hold
+ * sequence numbers first_seq to open_seq - 1 and the open chunk is
+ * open_seq, so the archive always ends right where log->head begins.
+ * Protected by log->mutex.
+ */
+struct logger_archive {
+	struct list_head	chunks;	/* compressed chunks, oldest first */
+	size_t			size;	/* bytes of compressed data held */
+	size_t			max_size; /* limit for 'size' */
+	__u32			first_seq; /* oldest chunk held */
+	__u32			open_seq; /* chunk being filled */
+	size_t			open_len; /* bytes of entries in 'open' */
+	unsigned char		*open;	/* uncompressed entries */
+	unsigned char		*cbuf;	/* compression output */
+	void			*wrkmem; /* lzo work memory */
+	struct logger_archive_stats stats;
+};
+
+static unsigned int archive_kb;
+module_param(archive_kb, uint, S_IRUGO);
+MODULE_PARM_DESC(archive_kb,
+		 "kilobytes of compressed history to keep behind each log");
+
 #ifndef CONFIG_K3_LOG
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * mutex 'mutex', except for the per-CPU staging areas which have their own
+ * locks.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
@@ -70,6 +152,11 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_stage __percpu *stage; /* per-CPU staged writes */
+	atomic_t		seq;	/* sequence of the last staged entry */
+	struct logger_archive	*archive; /* compressed history, or NULL */
+	struct logger_mmap_index *index; /* index page shared with mmap */
+	atomic_t		mmap_readers; /* live mmaps of the log */
 };
 #endif
 /*
@@ -82,6 +169,12 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	int			in_archive; /* reading the archive, not the ring */
+	__u32			a_seq;	/* archive chunk being read */
+	size_t			a_off;	/* offset in that chunk */
+	unsigned char		*a_buf;	/* decompressed chunk, if any */
+	__u32			a_buf_seq; /* which chunk a_buf holds */
+	int			a_buf_valid; /* a_buf holds a_buf_seq */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -90,11 +183,29 @@ struct logger_reader {
 #ifdef CONFIG_K3_LOG
 extern struct semaphore k3log_sema;
 extern volatile log_buffer_head *log_buf_info;
-static char prefix_buf[1024];
-static ssize_t do_write_rbuf(struct logger_log *log, const struct iovec *iov,
-							unsigned long nr_segs, struct logger_entry head);
+static void do_write_rbuf(struct logger_log *log,
+			  const struct logger_entry *entry);
+
+/*
+ * logger_mirror - copies 'entry' to the k3-log text mirror as soon as it
+ * is written, so that a panic before the next drain does not lose it.
+ */
+static inline void logger_mirror(struct logger_log *log,
+				 const struct logger_entry *entry)
+{
+	spin_lock(&log->rbuf_lock);
+	do_write_rbuf(log, entry);
+	spin_unlock(&log->rbuf_lock);
+}
+#else
+static inline void logger_mirror(struct logger_log *log,
+				 const struct logger_entry *entry)
+{
+}
 #endif
 
+static void logger_drain(struct logger_log *log);
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -175,6 +286,167 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	return count;
 }
 
+/* archive_entry_len - the length of the entry at 'p' in an archive chunk */
+static inline __u32 archive_entry_len(const unsigned char *p)
+{
+	__u16 val;
+
+	memcpy(&val, p, sizeof(val));
+	return sizeof(struct logger_entry) + val;
+}
+
+static struct logger_chunk *archive_find(struct logger_archive *ar, __u32 seq)
+{
+	struct logger_chunk *chunk;
+
+	list_for_each_entry(chunk, &ar->chunks, list)
+		if (chunk->seq == seq)
+			return chunk;
+	return NULL;
+}
+
+/* archive_unpack - decompresses 'chunk' into 'buf' */
+static int archive_unpack(struct logger_archive *ar,
+			  struct logger_chunk *chunk, unsigned char *buf)
+{
+	size_t len = LOGGER_CHUNK_SIZE;
+	ktime_t start;
+	int ret;
+
+	if (chunk->comp_len == chunk->raw_len) {
+		memcpy(buf, chunk->data, chunk->raw_len);
+		return 0;
+	}
+
+	start = ktime_get();
+	ret = lzo1x_decompress_safe(chunk->data, chunk->comp_len, buf, &len);
+	ar->stats.decompress_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret != LZO_E_OK || len != chunk->raw_len) {
+		printk(KERN_ERR "logger: corrupt archive chunk %u (%d)\n",
+		       chunk->seq, ret);
+		return -EIO;
+	}
+	ar->stats.unpacked_chunks++;
+	return 0;
+}
+
+/*
+ * archive_next_entry - returns the next archived entry for 'reader', or
+ * NULL once it has read the whole archive and moved on to the ring.
+ *
+ * Caller must hold log->mutex.
+ */
+static unsigned char *archive_next_entry(struct logger_log *log,
+					 struct logger_reader *reader)
+{
+	struct logger_archive *ar = log->archive;
+	struct logger_chunk *chunk;
+	int ret;
+
+	while (reader->in_archive) {
+		/* skip whatever was dropped from the archive meanwhile */
+		if ((__s32)(reader->a_seq - ar->first_seq) < 0) {
+			reader->a_seq = ar->first_seq;
+			reader->a_off = 0;
+		}
+
+		if (reader->a_seq == ar->open_seq) {
+			if (reader->a_off < ar->open_len)
+				return ar->open + reader->a_off;
+			reader->in_archive = 0;
+			reader->r_off = log->head;
+			break;
+		}
+
+		chunk = archive_find(ar, reader->a_seq);
+		if (!chunk || reader->a_off >= chunk->raw_len) {
+			reader->a_seq++;
+			reader->a_off = 0;
+			continue;
+		}
+
+		if (!reader->a_buf) {
+			reader->a_buf = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+			if (!reader->a_buf)
+				return ERR_PTR(-ENOMEM);
+		}
+		if (!reader->a_buf_valid || reader->a_buf_seq != chunk->seq) {
+			reader->a_buf_valid = 0;
+			ret = archive_unpack(ar, chunk, reader->a_buf);
+			if (ret)
+				return ERR_PTR(ret);
+			reader->a_buf_seq = chunk->seq;
+			reader->a_buf_valid = 1;
+		}
+		return reader->a_buf + reader->a_off;
+	}
+
+	return NULL;
+}
+
+/*
+ * archive_read - reads exactly one archived entry into 'buf'. Returns 0
+ * if the reader has reached the end of the archive and should read from
+ * the ring instead.
+ *
+ * Caller must hold log->mutex.
+ */
+static ssize_t archive_read(struct logger_log *log,
+			    struct logger_reader *reader,
+			    char __user *buf, size_t count)
+{
+	unsigned char *entry;
+	size_t len;
+
+	entry = archive_next_entry(log, reader);
+	if (IS_ERR_OR_NULL(entry))
+		return PTR_ERR(entry);
+
+	len = archive_entry_len(entry);
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, entry, len))
+		return -EFAULT;
+	reader->a_off += len;
+
+	return len;
+}
+
+/*
+ * archive_len - bytes of archived entries 'reader' has yet to read
+ *
+ * Caller must hold log->mutex.
+ */
+static size_t archive_len(struct logger_log *log, struct logger_reader *reader)
+{
+	struct logger_archive *ar = log->archive;
+	struct logger_chunk *chunk;
+	size_t len = 0;
+
+	if (!reader->in_archive)
+		return 0;
+
+	list_for_each_entry(chunk, &ar->chunks, list)
+		if ((__s32)(chunk->seq - reader->a_seq) >= 0)
+			len += chunk->raw_len;
+	len += ar->open_len;
+
+	return len > reader->a_off ? len - reader->a_off : 0;
+}
+
+/*
+ * logger_readable - is there anything for 'reader' to read?
+ *
+ * Caller must hold log->mutex.
+ */
+static int logger_readable(struct logger_log *log,
+			   struct logger_reader *reader)
+{
+	if (reader->in_archive && archive_next_entry(log, reader))
+		return 1;
+	return log->w_off != reader->r_off;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -200,7 +472,8 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
+		logger_drain(log);
+		ret = !logger_readable(log, reader);
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -224,6 +497,13 @@ start:
 
 	mutex_lock(&log->mutex);
 
+	/* the archive holds older entries than the ring, so it goes first */
+	if (reader->in_archive) {
+		ret = archive_read(log, reader, buf, count);
+		if (ret)
+			goto out;
+	}
+
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
 		mutex_unlock(&log->mutex);
@@ -282,6 +562,143 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
 	return 0;
 }
 
+/*
+ * archive_seal - compresses the open chunk and adds it to the archive,
+ * dropping the oldest chunks if the archive is over its size.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void archive_seal(struct logger_archive *ar)
+{
+	struct logger_chunk *chunk;
+	size_t clen = 0;
+	const unsigned char *src = ar->cbuf;
+	ktime_t start;
+	int ret;
+
+	if (!ar->open_len)
+		return;
+
+	start = ktime_get();
+	ret = lzo1x_1_compress(ar->open, ar->open_len, ar->cbuf, &clen,
+			       ar->wrkmem);
+	ar->stats.compress_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret != LZO_E_OK || clen >= ar->open_len) {
+		src = ar->open;
+		clen = ar->open_len;
+	}
+
+	chunk = kmalloc(sizeof(*chunk) + clen, GFP_KERNEL);
+	if (!chunk) {
+		/* keep the chunk sequence contiguous by dropping it all */
+		while (!list_empty(&ar->chunks)) {
+			chunk = list_first_entry(&ar->chunks,
+						 struct logger_chunk, list);
+			list_del(&chunk->list);
+			kfree(chunk);
+		}
+		ar->size = 0;
+		ar->open_seq++;
+		ar->first_seq = ar->open_seq;
+		ar->open_len = 0;
+		ar->stats.chunks = 0;
+		ar->stats.held_bytes = 0;
+		return;
+	}
+	chunk->seq = ar->open_seq;
+	chunk->raw_len = ar->open_len;
+	chunk->comp_len = clen;
+	memcpy(chunk->data, src, clen);
+	list_add_tail(&chunk->list, &ar->chunks);
+	ar->size += clen;
+	ar->stats.raw_bytes += chunk->raw_len;
+	ar->stats.compressed_bytes += clen;
+	ar->open_seq++;
+	ar->open_len = 0;
+
+	while (ar->size > ar->max_size) {
+		chunk = list_first_entry(&ar->chunks, struct logger_chunk, list);
+		list_del(&chunk->list);
+		ar->size -= chunk->comp_len;
+		ar->first_seq = chunk->seq + 1;
+		kfree(chunk);
+	}
+
+	ar->stats.held_bytes = ar->size;
+	ar->stats.chunks = ar->open_seq - ar->first_seq;
+}
+
+/*
+ * archive_entries - moves the entries from 'off' up to 'end' in the ring
+ * into the archive before they are overwritten.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void archive_entries(struct logger_log *log, size_t off, size_t end)
+{
+	struct logger_archive *ar = log->archive;
+
+	while (off != end) {
+		size_t n = get_entry_len(log, off);
+		size_t len;
+
+		if (ar->open_len + n > LOGGER_CHUNK_SIZE)
+			archive_seal(ar);
+
+		len = min(n, log->size - off);
+		memcpy(ar->open + ar->open_len, log->buffer + off, len);
+		if (n != len)
+			memcpy(ar->open + ar->open_len + len, log->buffer,
+			       n - len);
+		ar->open_len += n;
+		ar->stats.entries++;
+
+		off = logger_offset(off + n);
+	}
+}
+
+/*
+ * archive_flush - drops everything in the archive
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void archive_flush(struct logger_archive *ar)
+{
+	struct logger_chunk *chunk, *tmp;
+
+	list_for_each_entry_safe(chunk, tmp, &ar->chunks, list) {
+		list_del(&chunk->list);
+		kfree(chunk);
+	}
+	ar->size = 0;
+	ar->first_seq = ar->open_seq;
+	ar->open_len = 0;
+	ar->stats.chunks = 0;
+	ar->stats.held_bytes = 0;
+}
+
+/*
+ * logger_index_begin - marks the index of an mmapped log as changing
+ *
+ * Readers seeing an odd 'seq' or a different 'seq' before and after
+ * reading head_pos and w_pos retry. The caller needs to hold log->mutex.
+ */
+static inline void logger_index_begin(struct logger_log *log)
+{
+	if (!log->index)
+		return;
+	log->index->seq++;
+	smp_wmb();
+}
+
+static inline void logger_index_end(struct logger_log *log)
+{
+	if (!log->index)
+		return;
+	smp_wmb();
+	log->index->seq++;
+}
+
 /*
  * fix_up_readers - walk the list of all readers and "fix up" any who were
  * lapped by the writer; also do the same for the default "start head".
@@ -296,8 +713,16 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	size_t new = logger_offset(old + len);
 	struct logger_reader *reader;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	if (clock_interval(old, new, log->head)) {
+		size_t head = get_next_entry(log, log->head, len);
+
+		if (log->archive)
+			archive_entries(log, log->head, head);
+		/* tell mmap readers before the old entries get overwritten */
+		if (log->index)
+			log->index->head_pos += logger_offset(head - log->head);
+		log->head = head;
+	}
 
 	list_for_each_entry(reader, &log->readers, list)
 		if (clock_interval(old, new, reader->r_off))
@@ -324,44 +749,211 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * logger_commit - writes the complete entry 'entry' to the ring
  *
  * The caller needs to hold log->mutex.
+ */
+static void logger_commit(struct logger_log *log,
+			  const struct logger_entry *entry)
+{
+	size_t count = sizeof(struct logger_entry) + entry->len;
+
+	logger_index_begin(log);
+
+	/*
+	 * Fix up any readers, pulling them forward to the first readable
+	 * entry after (what will be) the new write offset.
+	 */
+	fix_up_readers(log, count);
+
+	do_write_log(log, entry, count);
+
+	if (log->index)
+		log->index->w_pos += count;
+	logger_index_end(log);
+}
+
+/* logger_staged_size - bytes taken in a stage by an entry of 'len' bytes */
+static inline size_t logger_staged_size(size_t len)
+{
+	return ALIGN(sizeof(struct logger_staged) + len, sizeof(__u32));
+}
+
+/* logger_staged_before - whether 'a' was written before 'b' */
+static inline int logger_staged_before(const struct logger_staged *a,
+				       const struct logger_staged *b)
+{
+	if (a->entry.sec != b->entry.sec)
+		return (__s32)(a->entry.sec - b->entry.sec) < 0;
+	if (a->entry.nsec != b->entry.nsec)
+		return a->entry.nsec < b->entry.nsec;
+	return (__s32)(a->seq - b->seq) < 0;
+}
+
+/*
+ * logger_drain - moves the entries staged on every CPU into the ring, in
+ * timestamp order.  Entries are stamped when they are staged, so
+ * readers see the timestamps of the ring ascend across CPUs.
  *
- * Returns 'count' on success, negative error code on failure.
+ * The caller needs to hold log->mutex.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void logger_drain(struct logger_log *log)
 {
-	size_t len;
+	struct logger_stage *stage;
+	int cpu, pending = 0;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	if (!log->stage)
+		return;
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+	/*
+	 * Writers only ever append, so everything below drain_end stays put
+	 * until we remove it below.
+	 */
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stage, cpu);
+		stage->drain_off = 0;
+		stage->drain_end = 0;
+		if (!ACCESS_ONCE(stage->len))
+			continue;
+		spin_lock(&stage->lock);
+		stage->drain_end = stage->len;
+		spin_unlock(&stage->lock);
+		pending = 1;
+	}
+	if (!pending)
+		return;
+
+	while (1) {
+		struct logger_staged *rec, *first = NULL;
+		struct logger_stage *next = NULL;
+
+		for_each_possible_cpu(cpu) {
+			stage = per_cpu_ptr(log->stage, cpu);
+			if (stage->drain_off == stage->drain_end)
+				continue;
+			rec = (struct logger_staged *)
+				(stage->buf + stage->drain_off);
+			if (!first || logger_staged_before(rec, first)) {
+				first = rec;
+				next = stage;
+			}
+		}
+		if (!next)
+			break;
+
+		logger_commit(log, &first->entry);
+		next->drain_off += logger_staged_size(first->entry.len);
+	}
+
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stage, cpu);
+		if (!stage->drain_end)
+			continue;
+		spin_lock(&stage->lock);
+		stage->len -= stage->drain_end;
+		memmove(stage->buf, stage->buf + stage->drain_end, stage->len);
+		spin_unlock(&stage->lock);
+	}
+}
+
+/*
+ * copy_entry_from_user - copies the payload of 'entry' from the iovecs
+ *
+ * With 'atomic' set page faults are not taken and -EFAULT is returned
+ * if the payload is not resident.
+ */
+static int copy_entry_from_user(struct logger_entry *entry,
+				const struct iovec *iov, unsigned long nr_segs,
+				int atomic)
+{
+	size_t copied = 0;
+
+	while (nr_segs-- > 0 && copied < entry->len) {
+		/* figure out how much of this vector we can keep */
+		size_t len = min_t(size_t, iov->iov_len, entry->len - copied);
+		unsigned long left;
+
+		if (atomic)
+			left = __copy_from_user_inatomic(entry->msg + copied,
+							 iov->iov_base, len);
+		else
+			left = copy_from_user(entry->msg + copied,
+					      iov->iov_base, len);
+		if (left)
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
+		iov++;
+		copied += len;
+	}
 
-	return count;
+	return 0;
+}
+
+/*
+ * logger_stage_write - stages an entry on this CPU without taking
+ * log->mutex.
+ *
+ * Returns -ENOSPC if the stage is full and must be drained first, or
+ * -EFAULT if the payload could not be copied without faulting.
+ */
+static int logger_stage_write(struct logger_log *log,
+			      const struct logger_entry *header,
+			      const struct iovec *iov, unsigned long nr_segs)
+{
+	size_t size = logger_staged_size(header->len);
+	struct logger_stage *stage;
+	struct logger_staged *rec;
+	struct timespec now;
+	int ret;
+
+	stage = get_cpu_ptr(log->stage);
+	spin_lock(&stage->lock);
+
+	if (stage->len + size > LOGGER_STAGE_SIZE) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	rec = (struct logger_staged *)(stage->buf + stage->len);
+	rec->entry = *header;
+
+	pagefault_disable();
+	ret = copy_entry_from_user(&rec->entry, iov, nr_segs, 1);
+	pagefault_enable();
+	if (unlikely(ret))
+		goto out;
+
+	/* stamp and number the entry together, once it is complete */
+	now = current_kernel_time();
+	rec->entry.sec = now.tv_sec;
+	rec->entry.nsec = now.tv_nsec;
+	rec->seq = atomic_inc_return(&log->seq);
+	stage->len += size;
+	logger_mirror(log, &rec->entry);
+
+out:
+	spin_unlock(&stage->lock);
+	put_cpu_ptr(log->stage);
+	return ret;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * Entries are normally staged on the local CPU, so concurrent writers do
+ * not serialize on log->mutex. If the stage is full it is drained first;
+ * if the payload is not resident it is copied with page faults allowed
+ * and written to the ring directly, after everything staged before it.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
-	struct logger_entry header;
+	struct logger_entry header, *entry;
 	struct timespec now;
-	ssize_t ret = 0;
+	int ret;
 
 	now = current_kernel_time();
 
@@ -370,52 +962,62 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-#ifdef CONFIG_K3_LOG
-	do_write_rbuf(log, iov, nr_segs, header);
-#endif
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
+	if (likely(log->stage)) {
+		ret = logger_stage_write(log, &header, iov, nr_segs);
+		if (ret == -ENOSPC) {
+			mutex_lock(&log->mutex);
+			logger_drain(log);
 			mutex_unlock(&log->mutex);
-			return nr;
+			ret = logger_stage_write(log, &header, iov, nr_segs);
+		}
+		if (likely(!ret)) {
+			/*
+			 * mmap readers do not call into the driver while
+			 * entries keep coming, so publish this one now if
+			 * nobody else is about to.
+			 */
+			if (atomic_read(&log->mmap_readers) &&
+			    mutex_trylock(&log->mutex)) {
+				logger_drain(log);
+				mutex_unlock(&log->mutex);
+			}
+			goto out;
 		}
+	}
 
-		iov++;
-		ret += nr;
+	entry = kmalloc(sizeof(struct logger_entry) + header.len, GFP_KERNEL);
+	if (!entry)
+		return -ENOMEM;
+	*entry = header;
+	ret = copy_entry_from_user(entry, iov, nr_segs, 0);
+	if (unlikely(ret)) {
+		kfree(entry);
+		return ret;
 	}
 
+	mutex_lock(&log->mutex);
+	logger_drain(log);
+	/* stamped after the drain, so it sorts after the staged entries */
+	now = current_kernel_time();
+	entry->sec = now.tv_sec;
+	entry->nsec = now.tv_nsec;
+	logger_mirror(log, entry);
+	logger_commit(log, entry);
 	mutex_unlock(&log->mutex);
 
+	kfree(entry);
+
+out:
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
-	return ret;
+	return header.len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -447,9 +1049,16 @@ static int logger_open(struct inode *inode, struct file *file)
 
 		reader->log = log;
 		INIT_LIST_HEAD(&reader->list);
+		reader->a_off = 0;
+		reader->a_buf = NULL;
+		reader->a_buf_valid = 0;
 
 		mutex_lock(&log->mutex);
 		reader->r_off = log->head;
+		/* new readers start with the oldest archived entry */
+		reader->in_archive = log->archive != NULL;
+		if (log->archive)
+			reader->a_seq = log->archive->first_seq;
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -475,6 +1084,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 		list_del(&reader->list);
 		mutex_unlock(&log->mutex);
 
+		kfree(reader->a_buf);
 		kfree(reader);
 	}
 
@@ -505,7 +1115,8 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	logger_drain(log);
+	if (logger_readable(log, reader))
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -516,9 +1127,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	size_t r_off;
 	long ret = -ENOTTY;
 
 	mutex_lock(&log->mutex);
+	logger_drain(log);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -530,10 +1143,13 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		/* archived entries come before everything in the ring */
+		ret = archive_len(log, reader);
+		r_off = reader->in_archive ? log->head : reader->r_off;
+		if (log->w_off >= r_off)
+			ret += log->w_off - r_off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret += (log->size - r_off) + log->w_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -541,6 +1157,18 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
+		if (reader->in_archive) {
+			unsigned char *entry = archive_next_entry(log, reader);
+
+			if (IS_ERR(entry)) {
+				ret = PTR_ERR(entry);
+				break;
+			}
+			if (entry) {
+				ret = archive_entry_len(entry);
+				break;
+			}
+		}
 		if (log->w_off != reader->r_off)
 			ret = get_entry_len(log, reader->r_off);
 		else
@@ -551,11 +1179,30 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
+		list_for_each_entry(reader, &log->readers, list) {
 			reader->r_off = log->w_off;
+			reader->in_archive = 0;
+		}
+		logger_index_begin(log);
 		log->head = log->w_off;
+		if (log->index)
+			log->index->head_pos = log->index->w_pos;
+		logger_index_end(log);
+		if (log->archive)
+			archive_flush(log->archive);
 		ret = 0;
 		break;
+	case LOGGER_GET_ARCHIVE_STATS:
+		if (!log->archive) {
+			ret = -ENODEV;
+			break;
+		}
+		if (copy_to_user((void __user *)arg, &log->archive->stats,
+				 sizeof(log->archive->stats)))
+			ret = -EFAULT;
+		else
+			ret = 0;
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -563,11 +1210,103 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+static void logger_vma_open(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_inc(&log->mmap_readers);
+}
+
+static void logger_vma_close(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_dec(&log->mmap_readers);
+}
+
+static const struct vm_operations_struct logger_vm_ops = {
+	.open = logger_vma_open,
+	.close = logger_vma_close,
+};
+
+/*
+ * logger_remap - maps @size bytes at @kaddr into @vma at @addr
+ *
+ * The rings are static arrays.  In a modular build they sit in module
+ * space, which is not linearly mapped, so they go page by page.
+ */
+static int logger_remap(struct vm_area_struct *vma, unsigned long addr,
+			void *kaddr, unsigned long size)
+{
+	unsigned long off;
+	int ret;
+
+	if (virt_addr_valid(kaddr))
+		return remap_pfn_range(vma, addr,
+				       virt_to_phys(kaddr) >> PAGE_SHIFT,
+				       size, vma->vm_page_prot);
+
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		ret = remap_pfn_range(vma, addr + off,
+				      vmalloc_to_pfn(kaddr + off),
+				      PAGE_SIZE, vma->vm_page_prot);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Readers may map the index page followed by the ring, read-only and as
+ * a whole; see struct logger_mmap_index for how to consume entries.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long len = vma->vm_end - vma->vm_start;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+	if (!log->index)
+		return -ENODEV;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff != 0 || len != PAGE_SIZE + log->size)
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTEXPAND;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = logger_remap(vma, vma->vm_start, log->index, PAGE_SIZE);
+	if (ret)
+		return ret;
+	ret = logger_remap(vma, vma->vm_start + PAGE_SIZE, log->buffer,
+			   log->size);
+	if (ret)
+		return ret;
+
+	vma->vm_ops = &logger_vm_ops;
+	vma->vm_private_data = log;
+	logger_vma_open(vma);
+
+	/* hand over anything still staged */
+	mutex_lock(&log->mutex);
+	logger_drain(log);
+	mutex_unlock(&log->mutex);
+
+	return 0;
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -577,10 +1316,18 @@ static const struct file_operations logger_fops = {
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
  * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * LONG_MAX minus LOGGER_ENTRY_MAX_LEN. The buffer is page aligned so that
+ * it can be mapped by readers.
  */
+#ifdef CONFIG_K3_LOG
+#define LOGGER_RBUF_INIT(VAR) \
+	.rbuf_lock = __SPIN_LOCK_UNLOCKED(VAR .rbuf_lock),
+#else
+#define LOGGER_RBUF_INIT(VAR)
+#endif
+
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -595,6 +1342,9 @@ static struct logger_log VAR = { \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.seq = ATOMIC_INIT(0), \
+	.mmap_readers = ATOMIC_INIT(0), \
+	LOGGER_RBUF_INIT(VAR) \
 };
 
 #ifdef CONFIG_K3_LOG
@@ -633,12 +1383,45 @@ static struct logger_log *get_log_from_minor(int minor)
 extern unsigned int get_logctl_value(void);
 
 
+static int __init init_archive(struct logger_log *log)
+{
+	struct logger_archive *ar;
+
+	ar = kzalloc(sizeof(*ar), GFP_KERNEL);
+	if (!ar)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&ar->chunks);
+	ar->max_size = archive_kb * 1024;
+	ar->open = vmalloc(LOGGER_CHUNK_SIZE);
+	ar->cbuf = vmalloc(lzo1x_worst_compress(LOGGER_CHUNK_SIZE));
+	ar->wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!ar->open || !ar->cbuf || !ar->wrkmem) {
+		vfree(ar->open);
+		vfree(ar->cbuf);
+		vfree(ar->wrkmem);
+		kfree(ar);
+		return -ENOMEM;
+	}
+
+	log->archive = ar;
+	return 0;
+}
+
 static int __init init_log(struct logger_log *log)
 {
-	int ret;
+	int ret, cpu;
         if(get_logctl_value() != LOG_CTL_ON)
 		return 0;
 
+	/* without a stage every write takes log->mutex */
+	log->stage = alloc_percpu(struct logger_stage);
+	if (log->stage) {
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(log->stage, cpu)->lock);
+	} else
+		printk(KERN_WARNING "logger: no write staging for log '%s'\n",
+		       log->misc.name);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -646,8 +1429,22 @@ static int __init init_log(struct logger_log *log)
 		return ret;
 	}
 
-	printk(KERN_INFO "logger: created %luK log '%s'\n",
-	       (unsigned long) log->size >> 10, log->misc.name);
+	log->index = (struct logger_mmap_index *)get_zeroed_page(GFP_KERNEL);
+	if (log->index) {
+		log->index->version = LOGGER_MMAP_VERSION;
+		log->index->ring_offset = PAGE_SIZE;
+		log->index->size = log->size;
+	} else
+		printk(KERN_WARNING "logger: no mmap support for log '%s'\n",
+		       log->misc.name);
+
+	if (archive_kb && init_archive(log))
+		printk(KERN_WARNING "logger: no archive for log '%s'\n",
+		       log->misc.name);
+
+	printk(KERN_INFO "logger: created %luK log '%s'%s\n",
+	       (unsigned long) log->size >> 10, log->misc.name,
+	       log->archive ? " with compressed archive" : "");
 
 	return 0;
 }
@@ -713,92 +1510,18 @@ static char filterPriToChar (android_LogPriority pri)
 	}
 }
 
-static int add_prefix_to_rbuf(struct logger_log *log, struct iovec **iov,
-							unsigned long nr_segs, struct logger_entry head)
+static void do_write_rbuf_from_buf(struct logger_log *log,
+				   const void *buf, size_t count)
 {
-	char prichar;
-	unsigned long prefix_len;
 	size_t len;
-	size_t ret_len = 0;
-	struct rtc_time cur_tm;
-	int proc = 0;
-
-	if (log == &log_events) {
-		return ret_len;
-	} else {
-		len = min_t(size_t, (*iov)->iov_len, sizeof(int));
-		if(len && copy_from_user((void *)&proc, (void *)(*iov)->iov_base, len)){
-			return -EFAULT;
-		}else {
-			if (((proc < ANDROID_LOG_LEVEL) && (log != &log_radio))
-				|| (proc == ANDROID_LOG_SILENT)
-				|| ((proc < ANDROID_LOG_DEBUG) && (log == &log_radio)))
-				return -EFAULT;
-		}
-
-		/* figure out how much of this vector we can keep */
-		prichar = filterPriToChar(proc);
-
-		rtc_time_to_tm(head.sec + 3600*8, &cur_tm);
-
-		prefix_len = (unsigned int)snprintf(prefix_buf, sizeof(prefix_buf),
-						"%d-%d-%d %2d:%2d:%2d.%03d %c/",
-						cur_tm.tm_year+1900, cur_tm.tm_mon+1, cur_tm.tm_mday,
-						cur_tm.tm_hour, cur_tm.tm_min, cur_tm.tm_sec,
-						head.nsec/1000000, prichar);
-
-		(*iov)++;
-
-		if(nr_segs > 2){
-			//ret_len = min_t(size_t, (*iov)->iov_len-1, head.len-1);
-			ret_len = min_t(size_t, (*iov)->iov_len, head.len);
-
-			len = min_t(size_t, (*iov)->iov_len-1, sizeof(prefix_buf) - prefix_len);
-			if(len && copy_from_user((void *)(prefix_buf + prefix_len), (void *)(*iov)->iov_base, len)){
-				return -EFAULT;
-			}
-
-			prefix_len += len;
-			(*iov)++;
-		}
-
-		len = (unsigned int)snprintf(prefix_buf + prefix_len, sizeof(prefix_buf)-prefix_len,
-									"(%5d): ", head.pid);
-
-		prefix_len += len;
-
-		//ret_len += 1;
-	}
-
-	len = min(prefix_len, log->size - log->log_buf_info->waddr);
-	memcpy((void *)log->rbuf + log->log_buf_info->waddr, prefix_buf, len);
-
-	if (prefix_len != len)
-		memcpy((void *)log->rbuf, prefix_buf + len, prefix_len - len);
-
-	log->log_buf_info->waddr = logger_offset(log->log_buf_info->waddr + prefix_len);
-
-	return ret_len;
-}
-
-static ssize_t do_write_rbuf_from_user(struct logger_log *log,
-					const void __user *buf, size_t count, unsigned long nr_segs)
-{
-	size_t len;
-	size_t free_len;
 
-	free_len = log->size - log->log_buf_info->waddr;
-	len = min(count, free_len);
-	if (len && copy_from_user((void *)log->rbuf + log->log_buf_info->waddr, buf, len))
-		return -EFAULT;
+	len = min_t(size_t, count, log->size - log->log_buf_info->waddr);
+	memcpy((void *)log->rbuf + log->log_buf_info->waddr, buf, len);
 
 	if (count != len)
-		if (copy_from_user((void *)log->rbuf, buf + len, count - len))
-			return -EFAULT;
+		memcpy((void *)log->rbuf, buf + len, count - len);
 
 	log->log_buf_info->waddr = logger_offset(log->log_buf_info->waddr + count);
-
-	return count;
 }
 
 static void add_suffix_to_rbuf(struct logger_log *log)
@@ -812,19 +1535,24 @@ static void add_suffix_to_rbuf(struct logger_log *log)
 	}
 }
 
-static ssize_t do_write_rbuf(struct logger_log *log, const struct iovec *iov,
-								unsigned long nr_segs, struct logger_entry head)
+/*
+ * do_write_rbuf - mirrors 'entry' as a line of text into the reserved
+ * memory dumped by k3-log. The payload is a priority byte followed by
+ * the NUL-terminated tag and message.
+ *
+ * The caller needs to hold log->rbuf_lock.
+ */
+static void do_write_rbuf(struct logger_log *log,
+			  const struct logger_entry *entry)
 {
-	struct iovec * tmp_iov = (struct iovec *)iov;
-	size_t orig_rbuf = 0;
-	ssize_t nr;
-	size_t len;
-	size_t prefix_len;
-
-	if (log == &log_events)
-		return -EFAULT;
+	char prefix[64];
+	const char *tag, *msg;
+	size_t tag_len, msg_len, prefix_len;
+	struct rtc_time cur_tm;
+	int prio;
 
-	orig_rbuf = log->log_buf_info->waddr;
+	if (log == &log_events || entry->len < 2)
+		return;
 
 	if (log->log_buf_info->waddr < log->log_buf_info->raddr) {
 		if ((log->log_buf_info->waddr + log->size - log->log_buf_info->raddr) >= (log->size >> 1))
@@ -834,27 +1562,35 @@ static ssize_t do_write_rbuf(struct logger_log *log, const struct iovec *iov,
 			up(&k3log_sema);
 	}
 
-	prefix_len = add_prefix_to_rbuf(log, &tmp_iov, nr_segs, head);
+	prio = entry->msg[0];
+	if (((prio < ANDROID_LOG_LEVEL) && (log != &log_radio))
+		|| (prio == ANDROID_LOG_SILENT)
+		|| ((prio < ANDROID_LOG_DEBUG) && (log == &log_radio)))
+		return;
 
-	if (prefix_len < 0) {
-		log->log_buf_info->waddr = orig_rbuf;
-		return -EFAULT;
-	}
+	tag = entry->msg + 1;
+	tag_len = strnlen(tag, entry->len - 1);
+	msg = tag + tag_len + 1;
+	if (tag_len + 2 < entry->len)
+		msg_len = strnlen(msg, entry->len - tag_len - 2);
+	else
+		msg_len = 0;
 
-	if(nr_segs > 1){
-		len = min_t(size_t, tmp_iov->iov_len-1, head.len-prefix_len);
+	rtc_time_to_tm(entry->sec + 3600*8, &cur_tm);
 
-		nr = do_write_rbuf_from_user(log, tmp_iov->iov_base, len, nr_segs);
+	prefix_len = scnprintf(prefix, sizeof(prefix),
+			"%d-%d-%d %2d:%2d:%2d.%03d %c/",
+			cur_tm.tm_year+1900, cur_tm.tm_mon+1, cur_tm.tm_mday,
+			cur_tm.tm_hour, cur_tm.tm_min, cur_tm.tm_sec,
+			entry->nsec/1000000, filterPriToChar(prio));
+	do_write_rbuf_from_buf(log, prefix, prefix_len);
+	do_write_rbuf_from_buf(log, tag, tag_len);
 
-		if (unlikely(nr < 0)) {
-			log->log_buf_info->waddr = orig_rbuf;
-			return nr;
-		}
-	}
+	prefix_len = scnprintf(prefix, sizeof(prefix), "(%5d): ", entry->pid);
+	do_write_rbuf_from_buf(log, prefix, prefix_len);
+	do_write_rbuf_from_buf(log, msg, msg_len);
 
 	add_suffix_to_rbuf(log);
-
-	return 0;
 }
 #endif
 
@@ -39,11 +39,54 @@ struct logger_entry {
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
 
+/*
+ * Statistics of the compressed archive that keeps entries overwritten in
+ * the ring, see the archive_kb parameter. The compression ratio is
+ * raw_bytes / compressed_bytes and compress_ns / entries is the cost of
+ * archiving one entry.
+ */
+struct logger_archive_stats {
+	__u64		entries;	/* entries archived */
+	__u64		raw_bytes;	/* bytes of entries compressed */
+	__u64		compressed_bytes; /* bytes they compressed to */
+	__u64		compress_ns;	/* time spent compressing */
+	__u64		decompress_ns;	/* time spent decompressing */
+	__u64		unpacked_chunks; /* chunks decompressed for readers */
+	__u32		chunks;		/* chunks currently held */
+	__u32		held_bytes;	/* compressed bytes currently held */
+};
+
+/*
+ * A reader can mmap() a log read-only: the first page holds this index
+ * and the ring follows at 'ring_offset'. Positions count bytes written
+ * since boot; an entry at position 'pos' starts at offset
+ * (pos & (size - 1)) in the ring and may wrap around its end.
+ *
+ * To read, snapshot head_pos and w_pos by reading 'seq', the positions
+ * and 'seq' again, retrying while it is odd or has changed. Read the
+ * entries from max(own position, head_pos) up to w_pos, then take a
+ * new snapshot: anything before the new head_pos may have been
+ * overwritten while it was read and has to be discarded as an overrun.
+ * Use poll() on the descriptor to wait for new entries.
+ */
+#define LOGGER_MMAP_VERSION	1
+
+struct logger_mmap_index {
+	__u32		version;	/* LOGGER_MMAP_VERSION */
+	__u32		ring_offset;	/* mmap offset of the ring */
+	__u32		size;		/* size of the ring, a power of two */
+	__u32		seq;		/* odd while the positions change */
+	__u64		head_pos;	/* position of the oldest entry */
+	__u64		w_pos;		/* position of the next entry */
+};
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_GET_ARCHIVE_STATS	_IOR(__LOGGERIO, 5, \
+					     struct logger_archive_stats)
 
 #endif /* _LINUX_LOGGER_H */
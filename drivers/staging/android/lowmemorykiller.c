@@ -35,6 +35,9 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/vmstat.h>
 
 #ifdef CONFIG_HUAWEI_FEATURE_LOW_MEMORY_KILLER_STUB
 #include "../../char/lowmemorykiller_stub.h"
@@ -58,6 +61,56 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * Pressure mode.  Instead of killing as soon as free and file pages drop
+ * below a minfree level, the level is moved by how badly reclaim is doing:
+ * the share of scanned pages vmscan failed to reclaim, the rate of direct
+ * reclaim stalls and the rate of major faults (pages that had to be read
+ * back in, mostly page cache evicted too early).  Under low pressure the
+ * next less aggressive level is used, under high pressure the next more
+ * aggressive one, so kills start before free memory actually runs out.
+ * After a kill, no new victim is picked until the previous victim's
+ * memory has been unmapped.
+ */
+#define LOWMEM_PRESSURE_WINDOW	(HZ / 10)
+
+static bool lowmem_pressure_mode;
+static int lowmem_pressure_low = 40;
+static int lowmem_pressure_high = 80;
+static uint lowmem_stall_max = 50;	/* stalls/s counted as full pressure */
+static uint lowmem_refault_max = 500;	/* major faults/s for full pressure */
+static uint lowmem_death_timeout_ms = 5000;
+static int lowmem_pressure_level;
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static struct {
+	unsigned long time;
+	unsigned long scanned;
+	unsigned long reclaimed;
+	unsigned long stalls;
+	unsigned long refaults;
+} lowmem_sample;
+
+static DEFINE_SPINLOCK(lowmem_death_lock);
+static struct mm_struct *lowmem_death_mm;
+static unsigned long lowmem_death_mm_timeout;
+
+/*
+ * Thread group leaders bucketed by oom_adj.  Fork, exit and exec keep the
+ * buckets up to date under tasklist_lock and writes to /proc/<pid>/oom_adj
+ * and oom_score_adj move the leader to its new bucket, so lowmem_shrink
+ * only has to look at the tasks in the highest non-empty bucket.
+ */
+#define LOWMEM_NR_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static struct list_head lowmem_buckets[LOWMEM_NR_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static bool lowmem_index_ready;
+
+static unsigned long lowmem_select_count;
+static unsigned long lowmem_select_time_us;
+static unsigned long lowmem_select_time_max_ns;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -82,16 +135,279 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static struct list_head *lowmem_bucket(int oom_adj)
+{
+	oom_adj = clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX);
+	return &lowmem_buckets[oom_adj - OOM_DISABLE];
+}
+
+/* Called with tasklist_lock held for writing */
+void lowmem_index_add(struct task_struct *p)
+{
+	INIT_LIST_HEAD(&p->lowmem_node);
+	if (!lowmem_index_ready)
+		return;
+	spin_lock(&lowmem_index_lock);
+	list_add_tail(&p->lowmem_node, lowmem_bucket(p->signal->oom_adj));
+	spin_unlock(&lowmem_index_lock);
+}
+
+/* Called with tasklist_lock held for writing */
+void lowmem_index_del(struct task_struct *p)
+{
+	spin_lock(&lowmem_index_lock);
+	list_del_init(&p->lowmem_node);
+	spin_unlock(&lowmem_index_lock);
+}
+
+/* Called from de_thread() with tasklist_lock held for writing */
+void lowmem_index_replace(struct task_struct *old, struct task_struct *new)
+{
+	spin_lock(&lowmem_index_lock);
+	if (list_empty(&old->lowmem_node))
+		INIT_LIST_HEAD(&new->lowmem_node);
+	else
+		list_replace_init(&old->lowmem_node, &new->lowmem_node);
+	spin_unlock(&lowmem_index_lock);
+}
+
+/*
+ * Called after the oom_adj of @task's thread group has changed.  The new
+ * value is read again under the index lock, so concurrent writers leave
+ * the leader in the bucket of whichever value was stored last.
+ */
+void lowmem_index_update(struct task_struct *task)
+{
+	struct task_struct *p;
+
+	read_lock(&tasklist_lock);
+	p = task->group_leader;
+	spin_lock(&lowmem_index_lock);
+	if (!list_empty(&p->lowmem_node))
+		list_move_tail(&p->lowmem_node,
+			       lowmem_bucket(p->signal->oom_adj));
+	spin_unlock(&lowmem_index_lock);
+	read_unlock(&tasklist_lock);
+}
+
+static void __init lowmem_index_init(void)
+{
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_NR_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
+	write_lock_irq(&tasklist_lock);
+	spin_lock(&lowmem_index_lock);
+	for_each_process(p)
+		list_add_tail(&p->lowmem_node, lowmem_bucket(p->signal->oom_adj));
+	lowmem_index_ready = true;
+	spin_unlock(&lowmem_index_lock);
+	write_unlock_irq(&tasklist_lock);
+}
+
+/*
+ * Pick the largest task in the highest non-empty bucket at or above
+ * min_adj.  The buckets are not kept sorted by RSS since that changes on
+ * every fault; scanning one bucket is cheap compared to walking every
+ * process.  Returns the task with a reference held, or NULL.
+ */
+static struct task_struct *lowmem_select(int min_adj, int *sizep, int *adjp)
 {
 	struct task_struct *p;
 	struct task_struct *selected = NULL;
-	int rem = 0;
+	int selected_tasksize = 0;
 	int tasksize;
+	int oom_adj;
+
+	min_adj = max(min_adj, OOM_DISABLE);
+	spin_lock(&lowmem_index_lock);
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj; oom_adj--) {
+		list_for_each_entry(p, lowmem_bucket(oom_adj), lowmem_node) {
+			struct mm_struct *mm;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= selected_tasksize)
+				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
+		}
+		if (selected)
+			break;
+	}
+	if (selected) {
+		get_task_struct(selected);
+		*sizep = selected_tasksize;
+		*adjp = oom_adj;
+	}
+	spin_unlock(&lowmem_index_lock);
+	return selected;
+}
+
+static unsigned long lowmem_vm_events(int first, int last)
+{
+	unsigned long sum = 0;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (i = first; i <= last; i++)
+			sum += this->event[i];
+	}
+	return sum;
+}
+
+#define lowmem_zone_events(item) \
+	lowmem_vm_events(item##_NORMAL - ZONE_NORMAL, item##_MOVABLE)
+
+static int lowmem_rate_level(unsigned long delta, unsigned long elapsed,
+			     uint full)
+{
+	unsigned long rate = delta * HZ / elapsed;
+
+	return min_t(unsigned long, rate * 100 / max(full, 1U), 100);
+}
+
+/*
+ * Sample the vmscan counters at most once per LOWMEM_PRESSURE_WINDOW and
+ * return the smoothed pressure level, 0 to 100.
+ */
+static int lowmem_update_pressure(void)
+{
+	unsigned long scanned, reclaimed, stalls, refaults, elapsed;
+	unsigned long ds, dr;
+	int level, eff;
+
+	spin_lock(&lowmem_pressure_lock);
+	elapsed = jiffies - lowmem_sample.time;
+	if (elapsed < LOWMEM_PRESSURE_WINDOW)
+		goto out;
+
+	scanned = lowmem_zone_events(PGSCAN_KSWAPD) +
+		  lowmem_zone_events(PGSCAN_DIRECT);
+	reclaimed = lowmem_zone_events(PGSTEAL);
+	stalls = lowmem_vm_events(ALLOCSTALL, ALLOCSTALL);
+	refaults = lowmem_vm_events(PGMAJFAULT, PGMAJFAULT);
+
+	ds = scanned - lowmem_sample.scanned;
+	dr = reclaimed - lowmem_sample.reclaimed;
+	eff = ds ? 100 - min_t(unsigned long, dr * 100 / ds, 100) : 0;
+	level = max(eff, lowmem_rate_level(stalls - lowmem_sample.stalls,
+					   elapsed, lowmem_stall_max));
+	level = max(level, lowmem_rate_level(refaults - lowmem_sample.refaults,
+					     elapsed, lowmem_refault_max));
+	lowmem_pressure_level = (lowmem_pressure_level + level) / 2;
+
+	lowmem_sample.time = jiffies;
+	lowmem_sample.scanned = scanned;
+	lowmem_sample.reclaimed = reclaimed;
+	lowmem_sample.stalls = stalls;
+	lowmem_sample.refaults = refaults;
+	lowmem_print(3, "lowmem pressure %d (scan %lu, reclaim %lu)\n",
+		     lowmem_pressure_level, ds, dr);
+out:
+	level = lowmem_pressure_level;
+	spin_unlock(&lowmem_pressure_lock);
+	return level;
+}
+
+/*
+ * i is the first minfree level that free and file pages are both below,
+ * or array_size if there is none.  Move it by one level according to the
+ * reclaim pressure.  The lowest level is never relaxed.
+ */
+static int lowmem_pressure_adjust(int i, int array_size)
+{
+	int level = lowmem_update_pressure();
+
+	if (level >= lowmem_pressure_high && i > 0)
+		return i - 1;
+	if (level < lowmem_pressure_low && i > 0 && i < array_size)
+		return i + 1;
+	return i;
+}
+
+/*
+ * Returns true while the previous victim is still around.  In pressure
+ * mode that is until its mm has no users and nothing left mapped, with
+ * lowmem_death_timeout_ms as a safety net for victims stuck in the kernel;
+ * the zombie that may linger after that does not hold up the next kill.
+ */
+static bool lowmem_death_pending(void)
+{
+	struct mm_struct *mm;
+	bool pending;
+
+	spin_lock(&lowmem_death_lock);
+	mm = lowmem_death_mm;
+	if (!mm) {
+		spin_unlock(&lowmem_death_lock);
+		return lowmem_deathpending &&
+		       time_before_eq(jiffies, lowmem_deathpending_timeout);
+	}
+	pending = atomic_read(&mm->mm_users) || get_mm_rss(mm);
+	if (pending && time_after(jiffies, lowmem_death_mm_timeout)) {
+		lowmem_print(1, "victim memory not freed after %u ms\n",
+			     lowmem_death_timeout_ms);
+		pending = false;
+	}
+	if (!pending) {
+		/*
+		 * The victim's memory is back; do not fall through to
+		 * waiting for its task_struct to be freed as well.
+		 */
+		lowmem_death_mm = NULL;
+		lowmem_deathpending = NULL;
+	}
+	spin_unlock(&lowmem_death_lock);
+
+	if (!pending)
+		mmdrop(mm);
+	return pending;
+}
+
+static void lowmem_wait_for_mm(struct task_struct *p)
+{
+	struct mm_struct *mm;
+
+	task_lock(p);
+	mm = p->mm;
+	if (mm)
+		atomic_inc(&mm->mm_count);
+	task_unlock(p);
+	if (!mm)
+		return;
+
+	spin_lock(&lowmem_death_lock);
+	swap(lowmem_death_mm, mm);
+	lowmem_death_mm_timeout = jiffies +
+		msecs_to_jiffies(lowmem_death_timeout_ms);
+	spin_unlock(&lowmem_death_lock);
+	if (mm)
+		mmdrop(mm);
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct task_struct *selected;
+	int rem = 0;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
-	int selected_oom_adj;
+	int selected_oom_adj = 0;
+	ktime_t start;
+	unsigned long ns;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
@@ -104,8 +420,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	 * this pass.
 	 *
 	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+	if (lowmem_death_pending())
 		return 0;
 
 	if (lowmem_adj_size < array_size)
@@ -114,11 +429,13 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
+		    other_file < lowmem_minfree[i])
 			break;
-		}
 	}
+	if (lowmem_pressure_mode && sc->nr_to_scan > 0)
+		i = lowmem_pressure_adjust(i, array_size);
+	if (i < array_size)
+		min_adj = lowmem_adj[i];
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -132,58 +449,31 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
+	start = ktime_get();
+	selected = lowmem_select(min_adj, &selected_tasksize, &selected_oom_adj);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	lowmem_select_count++;
+	lowmem_select_time_us += ns / NSEC_PER_USEC;
+	if (ns > lowmem_select_time_max_ns)
+		lowmem_select_time_max_ns = ns;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
+		if (lowmem_pressure_mode)
+			lowmem_wait_for_mm(selected);
 #ifdef CONFIG_HUAWEI_FEATURE_LOW_MEMORY_KILLER_STUB
         sysLowKernel_write(selected);
 #endif
 		force_sig(SIGKILL, selected);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -194,6 +484,7 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	lowmem_index_init();
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
 #ifdef CONFIG_HUAWEI_FEATURE_LOW_MEMORY_KILLER_STUB
@@ -217,6 +508,19 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure, lowmem_pressure_mode, bool, S_IRUGO | S_IWUSR);
+module_param_named(pressure_low, lowmem_pressure_low, int, S_IRUGO | S_IWUSR);
+module_param_named(pressure_high, lowmem_pressure_high, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(stall_max, lowmem_stall_max, uint, S_IRUGO | S_IWUSR);
+module_param_named(refault_max, lowmem_refault_max, uint, S_IRUGO | S_IWUSR);
+module_param_named(death_timeout_ms, lowmem_death_timeout_ms, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_level, lowmem_pressure_level, int, S_IRUGO);
+module_param_named(select_count, lowmem_select_count, ulong, S_IRUGO);
+module_param_named(select_time_us, lowmem_select_time_us, ulong, S_IRUGO);
+module_param_named(select_time_max_ns, lowmem_select_time_max_ns, ulong,
+		   S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -6,14 +6,15 @@
  *
  * Zcache provides an in-kernel "host implementation" for transcendent memory
  * and, thus indirectly, for cleancache and frontswap.  Zcache includes two
- * page-accessible memory [1] interfaces, both utilizing lzo1x compression:
+ * page-accessible memory [1] interfaces, both utilizing a crypto API
+ * compressor (lzo by default, chosen with zcache=<alg> at boot):
  * 1) "compression buddies" ("zbud") is used for ephemeral pages
- * 2) xvmalloc is used for persistent pages.
- * Xvmalloc (based on the TLSF allocator) has very low fragmentation
- * so maximizes space efficiency, while zbud allows pairs (and potentially,
- * in the future, more than a pair of) compressed pages to be closely linked
- * so that reclaiming can be done via the kernel's physical-page-oriented
- * "shrinker" interface.
+ * 2) zsmalloc is used for persistent pages.
+ * Zsmalloc packs objects of similar size across the pages of a "zspage"
+ * and can compact them, so maximizes space efficiency, while zbud allows
+ * pairs (and potentially, in the future, more than a pair of) compressed
+ * pages to be closely linked so that reclaiming can be done via the
+ * kernel's physical-page-oriented "shrinker" interface.
  *
  * [1] For a definition of page-accessible memory (aka PAM), see:
  *   http://marc.info/?l=linux-mm&m=127811271605009
@@ -22,14 +23,18 @@
 #include <linux/cpu.h>
 #include <linux/highmem.h>
 #include <linux/list.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
 #include "tmem.h"
 
-#include "../zram/xvmalloc.h" /* if built in drivers/staging */
+#include "../zram/zsmalloc.h" /* if built in drivers/staging */
 
 #if (!defined(CONFIG_CLEANCACHE) && !defined(CONFIG_FRONTSWAP))
 #error "zcache is useless without CONFIG_CLEANCACHE or CONFIG_FRONTSWAP"
@@ -49,6 +54,54 @@
 	(__GFP_FS | __GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC)
 #endif
 
+/*
+ * All pages are compressed with the same crypto API compressor, picked at
+ * boot: stored objects carry no tag saying how they were compressed.  Each
+ * cpu has its own tfm and destination buffer; both are only used with
+ * interrupts disabled, so they are never shared.  A put compresses the
+ * page into the buffer before tmem takes any lock, and the pampd create
+ * callback, called on the same cpu under the tmem hashbucket lock, only
+ * copies the result.
+ */
+static char zcache_comp_name[CRYPTO_MAX_ALG_NAME] = "lzo";
+
+#define ZCACHE_DSTMEM_PAGE_ORDER 1
+
+struct zcache_comp {
+	struct crypto_comp *tfm;
+	unsigned char *dstmem;
+	unsigned int clen;	/* of the page compressed into dstmem, or 0 */
+};
+static DEFINE_PER_CPU(struct zcache_comp, zcache_comps);
+
+enum comp_op {
+	ZCACHE_COMPOP_COMPRESS,
+	ZCACHE_COMPOP_DECOMPRESS
+};
+
+static inline int zcache_comp_op(enum comp_op op,
+				const u8 *src, unsigned int slen,
+				u8 *dst, unsigned int *dlen)
+{
+	struct crypto_comp *tfm;
+	int ret;
+
+	tfm = get_cpu_var(zcache_comps).tfm;
+	BUG_ON(!tfm);
+	switch (op) {
+	case ZCACHE_COMPOP_COMPRESS:
+		ret = crypto_comp_compress(tfm, src, slen, dst, dlen);
+		break;
+	case ZCACHE_COMPOP_DECOMPRESS:
+		ret = crypto_comp_decompress(tfm, src, slen, dst, dlen);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+	put_cpu_var(zcache_comps);
+	return ret;
+}
+
 /**********
  * Compression buddies ("zbud") provides for packing two (or, possibly
  * in the future, more) compressed ephemeral pages into a single "raw"
@@ -305,19 +358,18 @@ static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
 	int i, found_good_buddy = 0;
 
 	nchunks = zbud_size_to_chunks(size) ;
+	/* one pass over all candidate lists, most of them usually empty */
+	spin_lock(&zbud_budlists_spinlock);
 	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
-		spin_lock(&zbud_budlists_spinlock);
-		if (!list_empty(&zbud_unbuddied[i].list)) {
-			list_for_each_entry_safe(zbpg, ztmp,
-				    &zbud_unbuddied[i].list, bud_list) {
-				if (spin_trylock(&zbpg->lock)) {
-					found_good_buddy = i;
-					goto found_unbuddied;
-				}
+		list_for_each_entry_safe(zbpg, ztmp,
+			    &zbud_unbuddied[i].list, bud_list) {
+			if (spin_trylock(&zbpg->lock)) {
+				found_good_buddy = i;
+				goto found_unbuddied;
 			}
 		}
-		spin_unlock(&zbud_budlists_spinlock);
 	}
+	spin_unlock(&zbud_budlists_spinlock);
 	/* didn't find a good buddy, try allocating a new page */
 	zbpg = zbud_alloc_raw_page();
 	if (unlikely(zbpg == NULL))
@@ -372,7 +424,7 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 {
 	struct zbud_page *zbpg;
 	unsigned budnum = zbud_budnum(zh);
-	size_t out_len = PAGE_SIZE;
+	unsigned int out_len = PAGE_SIZE;
 	char *to_va, *from_va;
 	unsigned size;
 	int ret = 0;
@@ -389,8 +441,9 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 	to_va = kmap_atomic(page, KM_USER0);
 	size = zh->size;
 	from_va = zbud_data(zh, size);
-	ret = lzo1x_decompress_safe(from_va, size, to_va, &out_len);
-	BUG_ON(ret != LZO_E_OK);
+	ret = zcache_comp_op(ZCACHE_COMPOP_DECOMPRESS, from_va, size,
+				to_va, &out_len);
+	BUG_ON(ret);
 	BUG_ON(out_len != PAGE_SIZE);
 	kunmap_atomic(to_va, KM_USER0);
 out:
@@ -406,12 +459,18 @@ out:
 static unsigned long zcache_evicted_raw_pages;
 static unsigned long zcache_evicted_buddied_pages;
 static unsigned long zcache_evicted_unbuddied_pages;
+static unsigned long zcache_evict_batches;
+static unsigned long zcache_evict_async_pages;
+static atomic_t zcache_evict_pending = ATOMIC_INIT(0);
 
 static struct tmem_pool *zcache_get_pool_by_id(uint32_t poolid);
 static void zcache_put_pool(struct tmem_pool *pool);
+static void zcache_evict_async(int nr);
 
 /*
- * Flush and free all zbuds in a zbpg, then free the pageframe
+ * Flush and free all zbuds in a zbpg, then free the pageframe.  The zbpg
+ * has already been taken off the lists, making it a "zombie" that puts,
+ * gets and flushes leave alone.
  */
 static void zbud_evict_zbpg(struct zbud_page *zbpg)
 {
@@ -421,7 +480,7 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 	struct tmem_oid oid[ZBUD_MAX_BUDS];
 	struct tmem_pool *pool;
 
-	ASSERT_SPINLOCK(&zbpg->lock);
+	spin_lock(&zbpg->lock);
 	BUG_ON(!list_empty(&zbpg->bud_list));
 	for (i = 0, j = 0; i < ZBUD_MAX_BUDS; i++) {
 		zh = &zbpg->buddy[i];
@@ -447,86 +506,108 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 }
 
 /*
- * Free nr pages.  This code is funky because we want to hold the locks
- * protecting various lists for as short a time as possible, and in some
- * circumstances the list may change asynchronously when the list lock is
- * not held.  In some cases we also trylock not only to avoid waiting on a
- * page in use by another cpu, but also to avoid potential deadlock due to
- * lock inversion.
+ * Eviction works in batches of up to ZBUD_EVICT_BATCH pages: they are
+ * collected under a single hold of the list lock, then evicted or freed
+ * with no list lock held.
  */
-static void zbud_evict_pages(int nr)
+#define ZBUD_EVICT_BATCH	16
+
+/* free up to nr pages from the unused list, return how many were freed */
+static int zbud_free_unused_pages(int nr)
 {
-	struct zbud_page *zbpg;
-	int i;
+	struct zbud_page *zbpg, *ztmp;
+	LIST_HEAD(batch);
+	int n = 0;
 
-	/* first try freeing any pages on unused list */
-retry_unused_list:
 	spin_lock_bh(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
-		/* can't walk list here, since it may change when unlocked */
+	while (n < nr && n < ZBUD_EVICT_BATCH &&
+	       !list_empty(&zbpg_unused_list)) {
 		zbpg = list_first_entry(&zbpg_unused_list,
 				struct zbud_page, bud_list);
-		list_del_init(&zbpg->bud_list);
+		list_move(&zbpg->bud_list, &batch);
 		zcache_zbpg_unused_list_count--;
+		n++;
+	}
+	spin_unlock_bh(&zbpg_unused_list_spinlock);
+
+	list_for_each_entry_safe(zbpg, ztmp, &batch, bud_list) {
 		atomic_dec(&zcache_zbud_curr_raw_pages);
-		spin_unlock_bh(&zbpg_unused_list_spinlock);
 		zcache_free_page(zbpg);
-		zcache_evicted_raw_pages++;
-		if (--nr <= 0)
-			goto out;
-		goto retry_unused_list;
 	}
-	spin_unlock_bh(&zbpg_unused_list_spinlock);
+	zcache_evicted_raw_pages += n;
+	return n;
+}
 
-	/* now try freeing unbuddied pages, starting with least space avail */
-	for (i = 0; i < MAX_CHUNK; i++) {
-retry_unbud_list_i:
-		spin_lock_bh(&zbud_budlists_spinlock);
-		if (list_empty(&zbud_unbuddied[i].list)) {
-			spin_unlock_bh(&zbud_budlists_spinlock);
-			continue;
-		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
+/*
+ * Take up to nr zbpgs off the list, least valuable first: unbuddied pages
+ * starting with the least space used, then buddied ones.  Pages locked by
+ * another cpu are skipped rather than waited for, which also avoids lock
+ * inversion.  Returns how many were taken.
+ */
+static int zbud_collect_evictable(struct zbud_page **batch, int nr)
+{
+	struct zbud_page *zbpg, *ztmp;
+	int i, n = 0;
+
+	spin_lock_bh(&zbud_budlists_spinlock);
+	for (i = 0; i < MAX_CHUNK && n < nr; i++) {
+		list_for_each_entry_safe(zbpg, ztmp, &zbud_unbuddied[i].list,
+					 bud_list) {
 			if (unlikely(!spin_trylock(&zbpg->lock)))
 				continue;
 			list_del_init(&zbpg->bud_list);
 			zbud_unbuddied[i].count--;
-			spin_unlock(&zbud_budlists_spinlock);
+			spin_unlock(&zbpg->lock);
 			zcache_evicted_unbuddied_pages++;
-			/* want budlists unlocked when doing zbpg eviction */
-			zbud_evict_zbpg(zbpg);
-			local_bh_enable();
-			if (--nr <= 0)
-				goto out;
-			goto retry_unbud_list_i;
+			batch[n++] = zbpg;
+			if (n == nr)
+				break;
 		}
-		spin_unlock_bh(&zbud_budlists_spinlock);
 	}
-
-	/* as a last resort, free buddied pages */
-retry_bud_list:
-	spin_lock_bh(&zbud_budlists_spinlock);
-	if (list_empty(&zbud_buddied_list)) {
-		spin_unlock_bh(&zbud_budlists_spinlock);
-		goto out;
+	if (n < nr) {
+		list_for_each_entry_safe(zbpg, ztmp, &zbud_buddied_list,
+					 bud_list) {
+			if (unlikely(!spin_trylock(&zbpg->lock)))
+				continue;
+			list_del_init(&zbpg->bud_list);
+			zcache_zbud_buddied_count--;
+			spin_unlock(&zbpg->lock);
+			zcache_evicted_buddied_pages++;
+			batch[n++] = zbpg;
+			if (n == nr)
+				break;
+		}
 	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
-		if (unlikely(!spin_trylock(&zbpg->lock)))
+	spin_unlock_bh(&zbud_budlists_spinlock);
+	return n;
+}
+
+/*
+ * Free nr pages.  Pages on the unused list go first; when it runs dry, a
+ * batch of zbpgs is evicted onto it and freed on the next round.  Returns
+ * the number of pages freed.
+ */
+static int zbud_evict_pages(int nr)
+{
+	struct zbud_page *batch[ZBUD_EVICT_BATCH];
+	int i, n, freed = 0;
+
+	while (freed < nr) {
+		n = zbud_free_unused_pages(nr - freed);
+		freed += n;
+		if (n)
 			continue;
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		spin_unlock(&zbud_budlists_spinlock);
-		zcache_evicted_buddied_pages++;
-		/* want budlists unlocked when doing zbpg eviction */
-		zbud_evict_zbpg(zbpg);
+		n = zbud_collect_evictable(batch,
+				min(nr - freed, ZBUD_EVICT_BATCH));
+		if (!n)
+			break;
+		local_bh_disable();
+		for (i = 0; i < n; i++)
+			zbud_evict_zbpg(batch[i]);
 		local_bh_enable();
-		if (--nr <= 0)
-			goto out;
-		goto retry_bud_list;
+		zcache_evict_batches++;
 	}
-	spin_unlock_bh(&zbud_budlists_spinlock);
-out:
-	return;
+	return freed;
 }
 
 static void zbud_init(void)
@@ -585,12 +666,14 @@ static int zbud_show_cumul_chunk_counts(char *buf)
 #endif
 
 /**********
- * This "zv" PAM implementation combines the TLSF-based xvMalloc
- * with lzo1x compression to maximize the amount of data that can
+ * This "zv" PAM implementation combines the zsmalloc allocator
+ * with compression to maximize the amount of data that can
  * be packed into a physical page.
  *
  * Zv represents a PAM page with the index and object (plus a "size" value
  * necessary for decompression) immediately preceding the compressed data.
+ * The pampd is the zsmalloc handle of the object, which compaction may
+ * move.
  */
 
 #define ZVH_SENTINEL  0x43214321
@@ -599,69 +682,76 @@ struct zv_hdr {
 	uint32_t pool_id;
 	struct tmem_oid oid;
 	uint32_t index;
+	uint16_t size;
 	DECL_SENTINEL
 };
 
 static const int zv_max_page_size = (PAGE_SIZE / 8) * 7;
 
-static struct zv_hdr *zv_create(struct xv_pool *xvpool, uint32_t pool_id,
+static atomic_t zcache_zv_curr_zbytes = ATOMIC_INIT(0);
+
+static unsigned long zv_create(struct zs_pool *zspool, uint32_t pool_id,
 				struct tmem_oid *oid, uint32_t index,
 				void *cdata, unsigned clen)
 {
-	struct page *page;
-	struct zv_hdr *zv = NULL;
-	uint32_t offset;
-	int ret;
+	struct zv_hdr *zv;
+	unsigned long handle;
 
 	BUG_ON(!irqs_disabled());
-	ret = xv_malloc(xvpool, clen + sizeof(struct zv_hdr),
-			&page, &offset, ZCACHE_GFP_MASK);
-	if (unlikely(ret))
+	handle = zs_malloc(zspool, clen + sizeof(struct zv_hdr),
+			ZCACHE_GFP_MASK);
+	if (unlikely(!handle))
 		goto out;
-	zv = kmap_atomic(page, KM_USER0) + offset;
+	zv = zs_map_object(zspool, handle, ZS_MM_WO);
 	zv->index = index;
 	zv->oid = *oid;
 	zv->pool_id = pool_id;
+	zv->size = clen;
 	SET_SENTINEL(zv, ZVH);
 	memcpy((char *)zv + sizeof(struct zv_hdr), cdata, clen);
-	kunmap_atomic(zv, KM_USER0);
+	zs_unmap_object(zspool, handle);
+	atomic_add(clen, &zcache_zv_curr_zbytes);
 out:
-	return zv;
+	return handle;
 }
 
-static void zv_free(struct xv_pool *xvpool, struct zv_hdr *zv)
+static void zv_free(struct zs_pool *zspool, unsigned long handle)
 {
 	unsigned long flags;
-	struct page *page;
-	uint32_t offset;
+	struct zv_hdr *zv;
 	uint16_t size;
 
+	local_irq_save(flags);
+	zv = zs_map_object(zspool, handle, ZS_MM_RW);
 	ASSERT_SENTINEL(zv, ZVH);
-	size = xv_get_object_size(zv) - sizeof(*zv);
+	size = zv->size;
 	BUG_ON(size == 0 || size > zv_max_page_size);
 	INVERT_SENTINEL(zv, ZVH);
-	page = virt_to_page(zv);
-	offset = (unsigned long)zv & ~PAGE_MASK;
-	local_irq_save(flags);
-	xv_free(xvpool, page, offset);
+	zs_unmap_object(zspool, handle);
+	zs_free(zspool, handle);
 	local_irq_restore(flags);
+	atomic_sub(size, &zcache_zv_curr_zbytes);
 }
 
-static void zv_decompress(struct page *page, struct zv_hdr *zv)
+static void zv_decompress(struct zs_pool *zspool, struct page *page,
+				unsigned long handle)
 {
-	size_t clen = PAGE_SIZE;
+	unsigned int clen = PAGE_SIZE;
+	struct zv_hdr *zv;
 	char *to_va;
 	unsigned size;
 	int ret;
 
+	to_va = kmap_atomic(page, KM_USER0);
+	zv = zs_map_object(zspool, handle, ZS_MM_RO);
 	ASSERT_SENTINEL(zv, ZVH);
-	size = xv_get_object_size(zv) - sizeof(*zv);
+	size = zv->size;
 	BUG_ON(size == 0 || size > zv_max_page_size);
-	to_va = kmap_atomic(page, KM_USER0);
-	ret = lzo1x_decompress_safe((char *)zv + sizeof(*zv),
-					size, to_va, &clen);
+	ret = zcache_comp_op(ZCACHE_COMPOP_DECOMPRESS, (char *)zv + sizeof(*zv),
+				size, to_va, &clen);
+	zs_unmap_object(zspool, handle);
 	kunmap_atomic(to_va, KM_USER0);
-	BUG_ON(ret != LZO_E_OK);
+	BUG_ON(ret);
 	BUG_ON(clen != PAGE_SIZE);
 }
 
@@ -676,12 +766,35 @@ static unsigned long zcache_flobj_total;
 static unsigned long zcache_flobj_found;
 static unsigned long zcache_failed_eph_puts;
 static unsigned long zcache_failed_pers_puts;
+static unsigned long zcache_eph_get_hits;
+static unsigned long zcache_eph_get_misses;
+static unsigned long zcache_pers_get_hits;
+static unsigned long zcache_pers_get_misses;
+
+/* time spent in puts (compression included) and gets, in ns */
+struct zcache_latency {
+	unsigned long count;
+	u64 total;
+	unsigned long max;
+};
+static struct zcache_latency zcache_put_latency;
+static struct zcache_latency zcache_get_latency;
+
+static void zcache_latency_add(struct zcache_latency *lat, ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	lat->count++;
+	lat->total += ns;
+	if (ns > lat->max)
+		lat->max = ns;
+}
 
 #define MAX_POOLS_PER_CLIENT 16
 
 static struct {
 	struct tmem_pool *tmem_pools[MAX_POOLS_PER_CLIENT];
-	struct xv_pool *xvpool;
+	struct zs_pool *zspool;
 } zcache_client;
 
 /*
@@ -781,28 +894,40 @@ static int zcache_do_preload(struct tmem_pool *pool)
 		else
 			kmem_cache_free(zcache_objnode_cache, objnode);
 	}
-	preempt_enable_no_resched();
-	obj = kmem_cache_alloc(zcache_obj_cache, ZCACHE_GFP_MASK);
-	if (unlikely(obj == NULL)) {
-		zcache_failed_alloc++;
-		goto unlock_out;
+	/*
+	 * Most puts consume neither the obj nor the page (the object
+	 * exists, the data fits next to a buddy), so only refill them
+	 * once they have been used.
+	 */
+	if (kp->obj == NULL) {
+		preempt_enable_no_resched();
+		obj = kmem_cache_alloc(zcache_obj_cache, ZCACHE_GFP_MASK);
+		if (unlikely(obj == NULL)) {
+			zcache_failed_alloc++;
+			goto unlock_out;
+		}
+		preempt_disable();
+		kp = &__get_cpu_var(zcache_preloads);
+		if (kp->obj == NULL)
+			kp->obj = obj;
+		else
+			kmem_cache_free(zcache_obj_cache, obj);
 	}
-	page = (void *)__get_free_page(ZCACHE_GFP_MASK);
-	if (unlikely(page == NULL)) {
-		zcache_failed_get_free_pages++;
-		kmem_cache_free(zcache_obj_cache, obj);
-		goto unlock_out;
+	if (kp->page == NULL) {
+		preempt_enable_no_resched();
+		page = (void *)__get_free_page(ZCACHE_GFP_MASK);
+		if (unlikely(page == NULL)) {
+			zcache_failed_get_free_pages++;
+			zcache_evict_async(ZBUD_EVICT_BATCH);
+			goto unlock_out;
+		}
+		preempt_disable();
+		kp = &__get_cpu_var(zcache_preloads);
+		if (kp->page == NULL)
+			kp->page = page;
+		else
+			free_page((unsigned long)page);
 	}
-	preempt_disable();
-	kp = &__get_cpu_var(zcache_preloads);
-	if (kp->obj == NULL)
-		kp->obj = obj;
-	else
-		kmem_cache_free(zcache_obj_cache, obj);
-	if (kp->page == NULL)
-		kp->page = page;
-	else
-		free_page((unsigned long)page);
 	ret = 0;
 unlock_out:
 	spin_unlock(&zcache_direct_reclaim_lock);
@@ -898,24 +1023,25 @@ static unsigned long zcache_curr_eph_pampd_count_max;
 static atomic_t zcache_curr_pers_pampd_count = ATOMIC_INIT(0);
 static unsigned long zcache_curr_pers_pampd_count_max;
 
-/* forward reference */
-static int zcache_compress(struct page *from, void **out_va, size_t *out_len);
-
+/*
+ * The page was compressed by zcache_put_page() into this cpu's buffer,
+ * before tmem took its locks: only the compressed data is copied here.
+ */
 static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 				 uint32_t index, struct page *page)
 {
-	void *pampd = NULL, *cdata;
-	size_t clen;
-	int ret;
+	struct zcache_comp *zc = &__get_cpu_var(zcache_comps);
+	void *pampd = NULL, *cdata = zc->dstmem;
+	size_t clen = zc->clen;
 	bool ephemeral = is_ephemeral(pool);
 	unsigned long count;
 
+	BUG_ON(!irqs_disabled());
+	zc->clen = 0;
+	if (clen == 0)
+		goto out;
 	if (ephemeral) {
-		ret = zcache_compress(page, &cdata, &clen);
-		if (ret == 0)
-
-			goto out;
-		if (clen == 0 || clen > zbud_max_buddy_size()) {
+		if (clen > zbud_max_buddy_size()) {
 			zcache_compress_poor++;
 			goto out;
 		}
@@ -927,22 +1053,11 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 				zcache_curr_eph_pampd_count_max = count;
 		}
 	} else {
-		/*
-		 * FIXME: This is all the "policy" there is for now.
-		 * 3/4 totpages should allow ~37% of RAM to be filled with
-		 * compressed frontswap pages
-		 */
-		if (atomic_read(&zcache_curr_pers_pampd_count) >
-							3 * totalram_pages / 4)
-			goto out;
-		ret = zcache_compress(page, &cdata, &clen);
-		if (ret == 0)
-			goto out;
 		if (clen > zv_max_page_size) {
 			zcache_compress_poor++;
 			goto out;
 		}
-		pampd = (void *)zv_create(zcache_client.xvpool, pool->pool_id,
+		pampd = (void *)zv_create(zcache_client.zspool, pool->pool_id,
 						oid, index, cdata, clen);
 		if (pampd == NULL)
 			goto out;
@@ -966,7 +1081,8 @@ static int zcache_pampd_get_data(struct page *page, void *pampd,
 	if (is_ephemeral(pool))
 		ret = zbud_decompress(page, pampd);
 	else
-		zv_decompress(page, pampd);
+		zv_decompress(zcache_client.zspool, page,
+				(unsigned long)pampd);
 	return ret;
 }
 
@@ -981,7 +1097,7 @@ static void zcache_pampd_free(void *pampd, struct tmem_pool *pool)
 		atomic_dec(&zcache_curr_eph_pampd_count);
 		BUG_ON(atomic_read(&zcache_curr_eph_pampd_count) < 0);
 	} else {
-		zv_free(zcache_client.xvpool, (struct zv_hdr *)pampd);
+		zv_free(zcache_client.zspool, (unsigned long)pampd);
 		atomic_dec(&zcache_curr_pers_pampd_count);
 		BUG_ON(atomic_read(&zcache_curr_pers_pampd_count) < 0);
 	}
@@ -997,27 +1113,28 @@ static struct tmem_pamops zcache_pamops = {
  * zcache compression/decompression and related per-cpu stuff
  */
 
-#define LZO_WORKMEM_BYTES LZO1X_1_MEM_COMPRESS
-#define LZO_DSTMEM_PAGE_ORDER 1
-static DEFINE_PER_CPU(unsigned char *, zcache_workmem);
-static DEFINE_PER_CPU(unsigned char *, zcache_dstmem);
-
-static int zcache_compress(struct page *from, void **out_va, size_t *out_len)
+/*
+ * Compress a page into this cpu's buffer for the next pampd create on
+ * this cpu.  Returns 1 on success, 0 if the cpu has no buffer or tfm.
+ */
+static int zcache_compress(struct page *from)
 {
-	int ret = 0;
-	unsigned char *dmem = __get_cpu_var(zcache_dstmem);
-	unsigned char *wmem = __get_cpu_var(zcache_workmem);
+	struct zcache_comp *zc = &__get_cpu_var(zcache_comps);
+	unsigned int clen = PAGE_SIZE << ZCACHE_DSTMEM_PAGE_ORDER;
 	char *from_va;
+	int ret = 0;
 
 	BUG_ON(!irqs_disabled());
-	if (unlikely(dmem == NULL || wmem == NULL))
-		goto out;  /* no buffer, so can't compress */
+	zc->clen = 0;
+	if (unlikely(zc->dstmem == NULL || zc->tfm == NULL))
+		goto out;  /* no buffer or tfm, so can't compress */
 	from_va = kmap_atomic(from, KM_USER0);
 	mb();
-	ret = lzo1x_1_compress(from_va, PAGE_SIZE, dmem, out_len, wmem);
-	BUG_ON(ret != LZO_E_OK);
-	*out_va = dmem;
+	ret = zcache_comp_op(ZCACHE_COMPOP_COMPRESS, from_va, PAGE_SIZE,
+				zc->dstmem, &clen);
+	BUG_ON(ret);
 	kunmap_atomic(from_va, KM_USER0);
+	zc->clen = clen;
 	ret = 1;
 out:
 	return ret;
@@ -1029,23 +1146,28 @@ static int zcache_cpu_notifier(struct notifier_block *nb,
 {
 	int cpu = (long)pcpu;
 	struct zcache_preload *kp;
+	struct zcache_comp *zc = &per_cpu(zcache_comps, cpu);
+	struct crypto_comp *tfm;
 
 	switch (action) {
 	case CPU_UP_PREPARE:
-		per_cpu(zcache_dstmem, cpu) = (void *)__get_free_pages(
+		zc->dstmem = (void *)__get_free_pages(
 			GFP_KERNEL | __GFP_REPEAT,
-			LZO_DSTMEM_PAGE_ORDER),
-		per_cpu(zcache_workmem, cpu) =
-			kzalloc(LZO1X_MEM_COMPRESS,
-				GFP_KERNEL | __GFP_REPEAT);
+			ZCACHE_DSTMEM_PAGE_ORDER);
+		zc->clen = 0;
+		tfm = crypto_alloc_comp(zcache_comp_name, 0, 0);
+		if (IS_ERR(tfm))
+			return NOTIFY_BAD;
+		zc->tfm = tfm;
 		break;
 	case CPU_DEAD:
 	case CPU_UP_CANCELED:
-		free_pages((unsigned long)per_cpu(zcache_dstmem, cpu),
-				LZO_DSTMEM_PAGE_ORDER);
-		per_cpu(zcache_dstmem, cpu) = NULL;
-		kfree(per_cpu(zcache_workmem, cpu));
-		per_cpu(zcache_workmem, cpu) = NULL;
+		free_pages((unsigned long)zc->dstmem,
+				ZCACHE_DSTMEM_PAGE_ORDER);
+		zc->dstmem = NULL;
+		if (zc->tfm)
+			crypto_free_comp(zc->tfm);
+		zc->tfm = NULL;
 		kp = &per_cpu(zcache_preloads, cpu);
 		while (kp->nr) {
 			kmem_cache_free(zcache_objnode_cache,
@@ -1053,8 +1175,11 @@ static int zcache_cpu_notifier(struct notifier_block *nb,
 			kp->objnodes[kp->nr - 1] = NULL;
 			kp->nr--;
 		}
-		kmem_cache_free(zcache_obj_cache, kp->obj);
+		if (kp->obj)
+			kmem_cache_free(zcache_obj_cache, kp->obj);
+		kp->obj = NULL;
 		free_page((unsigned long)kp->page);
+		kp->page = NULL;
 		break;
 	default:
 		break;
@@ -1122,14 +1247,100 @@ ZCACHE_SYSFS_RO(put_to_flush);
 ZCACHE_SYSFS_RO(aborted_preload);
 ZCACHE_SYSFS_RO(aborted_shrink);
 ZCACHE_SYSFS_RO(compress_poor);
+ZCACHE_SYSFS_RO(evict_batches);
+ZCACHE_SYSFS_RO(evict_async_pages);
+ZCACHE_SYSFS_RO(eph_get_hits);
+ZCACHE_SYSFS_RO(eph_get_misses);
+ZCACHE_SYSFS_RO(pers_get_hits);
+ZCACHE_SYSFS_RO(pers_get_misses);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_raw_pages);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_zpages);
 ZCACHE_SYSFS_RO_ATOMIC(curr_obj_count);
 ZCACHE_SYSFS_RO_ATOMIC(curr_objnode_count);
+ZCACHE_SYSFS_RO_ATOMIC(zv_curr_zbytes);
+ZCACHE_SYSFS_RO_ATOMIC(evict_pending);
+
+static int zcache_show_latency(char *buf, struct zcache_latency *lat)
+{
+	unsigned long count = lat->count;
+	u64 avg = lat->total;
+
+	if (count)
+		do_div(avg, count);
+	return sprintf(buf, "%lu %llu %lu\n", count,
+		       (unsigned long long)avg, lat->max);
+}
+
+static int zcache_show_put_latency(char *buf)
+{
+	return zcache_show_latency(buf, &zcache_put_latency);
+}
+
+static int zcache_show_get_latency(char *buf)
+{
+	return zcache_show_latency(buf, &zcache_get_latency);
+}
+
+static ssize_t zcache_zv_pool_pages_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	struct zs_pool_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+	if (zcache_client.zspool)
+		zs_get_stats(zcache_client.zspool, &stats);
+	return sprintf(buf, "%llu\n", stats.pages);
+}
+static struct kobj_attribute zcache_zv_pool_pages_attr = {
+	.attr = { .name = "zv_pool_pages", .mode = 0444 },
+	.show = zcache_zv_pool_pages_show,
+};
+
+static ssize_t zcache_zv_pages_compacted_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	struct zs_pool_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+	if (zcache_client.zspool)
+		zs_get_stats(zcache_client.zspool, &stats);
+	return sprintf(buf, "%llu\n", stats.pages_compacted);
+}
+static struct kobj_attribute zcache_zv_pages_compacted_attr = {
+	.attr = { .name = "zv_pages_compacted", .mode = 0444 },
+	.show = zcache_zv_pages_compacted_show,
+};
+
+/* Writing anything compacts the zv pool */
+static ssize_t zcache_zv_compact_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	if (zcache_client.zspool)
+		zs_compact(zcache_client.zspool);
+	return count;
+}
+static struct kobj_attribute zcache_zv_compact_attr = {
+	.attr = { .name = "zv_compact", .mode = 0200 },
+	.store = zcache_zv_compact_store,
+};
+static ssize_t zcache_compressor_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", zcache_comp_name);
+}
+static struct kobj_attribute zcache_compressor_attr = {
+	.attr = { .name = "compressor", .mode = 0444 },
+	.show = zcache_compressor_show,
+};
+
 ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
+/* "count avg_ns max_ns" */
+ZCACHE_SYSFS_RO_CUSTOM(put_latency, zcache_show_put_latency);
+ZCACHE_SYSFS_RO_CUSTOM(get_latency, zcache_show_get_latency);
 
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
@@ -1153,6 +1364,9 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_evicted_raw_pages_attr.attr,
 	&zcache_evicted_unbuddied_pages_attr.attr,
 	&zcache_evicted_buddied_pages_attr.attr,
+	&zcache_evict_batches_attr.attr,
+	&zcache_evict_async_pages_attr.attr,
+	&zcache_evict_pending_attr.attr,
 	&zcache_failed_get_free_pages_attr.attr,
 	&zcache_failed_alloc_attr.attr,
 	&zcache_put_to_flush_attr.attr,
@@ -1160,6 +1374,17 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_compressor_attr.attr,
+	&zcache_zv_curr_zbytes_attr.attr,
+	&zcache_zv_pool_pages_attr.attr,
+	&zcache_zv_pages_compacted_attr.attr,
+	&zcache_zv_compact_attr.attr,
+	&zcache_eph_get_hits_attr.attr,
+	&zcache_eph_get_misses_attr.attr,
+	&zcache_pers_get_hits_attr.attr,
+	&zcache_pers_get_misses_attr.attr,
+	&zcache_put_latency_attr.attr,
+	&zcache_get_latency_attr.attr,
 	NULL,
 };
 
@@ -1178,6 +1403,46 @@ static struct attribute_group zcache_attr_group = {
  */
 static bool zcache_freeze;
 
+/*
+ * Background eviction.  Evicting from the shrinker adds to the latency of
+ * whoever is reclaiming, so the shrinker evicts a single batch itself and
+ * leaves the rest of its request to this work item, which is also kicked
+ * when a put finds no free page.  It runs in process context and does
+ * not allocate, so it needs no zcache_direct_reclaim_lock.
+ */
+static struct workqueue_struct *zcache_evict_wq;
+
+static void zcache_evict_work_fn(struct work_struct *work)
+{
+	int nr, freed;
+
+	while ((nr = atomic_read(&zcache_evict_pending)) > 0) {
+		nr = min(nr, ZBUD_EVICT_BATCH);
+		freed = zbud_evict_pages(nr);
+		zcache_evict_async_pages += freed;
+		if (freed < nr) {
+			/* nothing left to evict */
+			atomic_set(&zcache_evict_pending, 0);
+			break;
+		}
+		atomic_sub(nr, &zcache_evict_pending);
+		cond_resched();
+	}
+}
+static DECLARE_WORK(zcache_evict_work, zcache_evict_work_fn);
+
+static void zcache_evict_async(int nr)
+{
+	int raw_pages = atomic_read(&zcache_zbud_curr_raw_pages);
+
+	if (zcache_evict_wq == NULL)
+		return;
+	/* never ask for more than there is */
+	if (atomic_add_return(nr, &zcache_evict_pending) > raw_pages)
+		atomic_set(&zcache_evict_pending, raw_pages);
+	queue_work(zcache_evict_wq, &zcache_evict_work);
+}
+
 /*
  * zcache shrinker interface (only useful for ephemeral pages, so zbud only)
  */
@@ -1193,10 +1458,12 @@ static int shrink_zcache_memory(struct shrinker *shrink,
 			/* does this case really need to be skipped? */
 			goto out;
 		if (spin_trylock(&zcache_direct_reclaim_lock)) {
-			zbud_evict_pages(nr);
+			zbud_evict_pages(min(nr, ZBUD_EVICT_BATCH));
 			spin_unlock(&zcache_direct_reclaim_lock);
 		} else
 			zcache_aborted_shrink++;
+		if (nr > ZBUD_EVICT_BATCH)
+			zcache_evict_async(nr - ZBUD_EVICT_BATCH);
 	}
 	ret = (int)atomic_read(&zcache_zbud_curr_raw_pages);
 out:
@@ -1216,6 +1483,7 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	ktime_t start = ktime_get();
 	int ret = -1;
 
 	BUG_ON(!irqs_disabled());
@@ -1224,6 +1492,17 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 		goto out;
 	if (!zcache_freeze && zcache_do_preload(pool) == 0) {
 		/* preload does preempt_disable on success */
+		/*
+		 * FIXME: This is all the "policy" there is for now.
+		 * 3/4 totpages should allow ~37% of RAM to be filled with
+		 * compressed frontswap pages
+		 */
+		if (is_ephemeral(pool) ||
+		    atomic_read(&zcache_curr_pers_pampd_count) <=
+							3 * totalram_pages / 4)
+			zcache_compress(page);
+		else
+			__get_cpu_var(zcache_comps).clen = 0;
 		ret = tmem_put(pool, oidp, index, page);
 		if (ret < 0) {
 			if (is_ephemeral(pool))
@@ -1240,6 +1519,7 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 			(void)tmem_flush_page(pool, oidp, index);
 		zcache_put_pool(pool);
 	}
+	zcache_latency_add(&zcache_put_latency, start);
 out:
 	return ret;
 }
@@ -1248,6 +1528,7 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	ktime_t start = ktime_get();
 	int ret = -1;
 	unsigned long flags;
 
@@ -1256,7 +1537,19 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 	if (likely(pool != NULL)) {
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_get(pool, oidp, index, page);
+		if (is_ephemeral(pool)) {
+			if (ret >= 0)
+				zcache_eph_get_hits++;
+			else
+				zcache_eph_get_misses++;
+		} else {
+			if (ret >= 0)
+				zcache_pers_get_hits++;
+			else
+				zcache_pers_get_misses++;
+		}
 		zcache_put_pool(pool);
+		zcache_latency_add(&zcache_get_latency, start);
 	}
 	local_irq_restore(flags);
 	return ret;
@@ -1563,9 +1856,12 @@ struct frontswap_ops zcache_frontswap_register_ops(void)
 
 static int zcache_enabled;
 
+/* "zcache" enables with lzo, "zcache=<alg>" with any crypto API compressor */
 static int __init enable_zcache(char *s)
 {
 	zcache_enabled = 1;
+	if (*s == '=' && *++s)
+		strlcpy(zcache_comp_name, s, sizeof(zcache_comp_name));
 	return 1;
 }
 __setup("zcache", enable_zcache);
@@ -1607,6 +1903,12 @@ static int __init zcache_init(void)
 	if (zcache_enabled) {
 		unsigned int cpu;
 
+		if (!crypto_has_comp(zcache_comp_name, 0, 0)) {
+			pr_warning("zcache: %s not supported, using lzo\n",
+				zcache_comp_name);
+			strcpy(zcache_comp_name, "lzo");
+		}
+		pr_info("zcache: using %s compressor\n", zcache_comp_name);
 		tmem_register_hostops(&zcache_hostops);
 		tmem_register_pamops(&zcache_pamops);
 		ret = register_cpu_notifier(&zcache_cpu_notifier_block);
@@ -1630,6 +1932,11 @@ static int __init zcache_init(void)
 		struct cleancache_ops old_ops;
 
 		zbud_init();
+		zcache_evict_wq = alloc_workqueue("zcache_evict",
+						  WQ_MEM_RECLAIM, 1);
+		if (zcache_evict_wq == NULL)
+			pr_warning("zcache: no eviction workqueue, "
+				   "evicting from the shrinker only\n");
 		register_shrinker(&zcache_shrinker);
 		old_ops = zcache_cleancache_register_ops();
 		pr_info("zcache: cleancache enabled using kernel "
@@ -1642,9 +1949,9 @@ static int __init zcache_init(void)
 	if (zcache_enabled && use_frontswap) {
 		struct frontswap_ops old_ops;
 
-		zcache_client.xvpool = xv_create_pool();
-		if (zcache_client.xvpool == NULL) {
-			pr_err("zcache: can't create xvpool\n");
+		zcache_client.zspool = zs_create_pool();
+		if (zcache_client.zspool == NULL) {
+			pr_err("zcache: can't create zspool\n");
 			goto out;
 		}
 		old_ops = zcache_frontswap_register_ops();
@@ -23,15 +23,21 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
+#include <linux/ktime.h>
 #include <linux/string.h>
+#include <linux/time.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -42,16 +48,6 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
-{
-	*v = *v + 1;
-}
-
-static void zram_stat_dec(u32 *v)
-{
-	*v = *v - 1;
-}
-
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
 {
 	spin_lock(&zram->stat64_lock);
@@ -89,21 +85,465 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static void zram_lock_entry(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_unlock_entry(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_stream_free(struct zram_stream *zs)
+{
+	if (zs->tfm)
+		crypto_free_comp(zs->tfm);
+	free_pages((unsigned long)zs->buffer, 1);
+	kfree(zs);
+}
+
+static struct zram_stream *zram_stream_alloc(struct zram *zram)
+{
+	struct zram_stream *zs;
+
+	zs = kzalloc(sizeof(*zs), GFP_KERNEL);
+	if (!zs)
+		return NULL;
+
+	zs->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+	if (IS_ERR(zs->tfm)) {
+		zs->tfm = NULL;
+		goto fail;
+	}
+
+	zs->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zs->buffer)
+		goto fail;
+
+	return zs;
+
+fail:
+	zram_stream_free(zs);
+	return NULL;
+}
+
+/*
+ * Allocate streams up to max_strm.  This is only done from process
+ * context at init or when max_comp_streams is raised: the crypto API
+ * allocates with GFP_KERNEL, which must not happen in the I/O path.
+ */
+static int zram_add_streams(struct zram *zram)
+{
+	struct zram_stream *zs;
+	int need;
+
+	for (;;) {
+		spin_lock(&zram->strm_lock);
+		need = zram->avail_strm < zram->max_strm;
+		spin_unlock(&zram->strm_lock);
+		if (!need)
+			return 0;
+
+		zs = zram_stream_alloc(zram);
+		if (!zs)
+			return -ENOMEM;
+
+		spin_lock(&zram->strm_lock);
+		zram->avail_strm++;
+		list_add(&zs->list, &zram->idle_strm);
+		spin_unlock(&zram->strm_lock);
+		wake_up(&zram->strm_wait);
+	}
+}
+
+/* Take an idle compression stream, waiting for one if all are busy */
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *zs;
+
+	spin_lock(&zram->strm_lock);
+	while (list_empty(&zram->idle_strm)) {
+		spin_unlock(&zram->strm_lock);
+		wait_event(zram->strm_wait, !list_empty(&zram->idle_strm));
+		spin_lock(&zram->strm_lock);
+	}
+	zs = list_first_entry(&zram->idle_strm, struct zram_stream, list);
+	list_del(&zs->list);
+	spin_unlock(&zram->strm_lock);
+
+	return zs;
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_stream *zs)
+{
+	spin_lock(&zram->strm_lock);
+	if (zram->avail_strm > zram->max_strm) {
+		zram->avail_strm--;
+		spin_unlock(&zram->strm_lock);
+		zram_stream_free(zs);
+		return;
+	}
+	list_add(&zs->list, &zram->idle_strm);
+	spin_unlock(&zram->strm_lock);
+
+	wake_up(&zram->strm_wait);
+}
+
+int zram_set_max_streams(struct zram *zram, int num)
+{
+	struct zram_stream *zs;
+	int ret = 0;
+
+	mutex_lock(&zram->init_lock);
+	spin_lock(&zram->strm_lock);
+	zram->max_strm = num;
+
+	/* Busy streams above the limit are freed when they are released */
+	while (zram->avail_strm > num && !list_empty(&zram->idle_strm)) {
+		zs = list_first_entry(&zram->idle_strm,
+				struct zram_stream, list);
+		list_del(&zs->list);
+		zram->avail_strm--;
+		spin_unlock(&zram->strm_lock);
+		zram_stream_free(zs);
+		spin_lock(&zram->strm_lock);
+	}
+	spin_unlock(&zram->strm_lock);
+
+	if (zram->init_done)
+		ret = zram_add_streams(zram);
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+/*
+ * Check if the page is one word repeated.  Most pages that are not differ
+ * in the first or last word; the rest of the page is compared eight words
+ * at a time, with one branch per block instead of one per word.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
+	unsigned long *page = ptr;
+	unsigned long val = page[0];
 	unsigned int pos;
-	unsigned long *page;
 
-	page = (unsigned long *)ptr;
+	if (page[PAGE_SIZE / sizeof(*page) - 1] != val)
+		return 0;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos += 8) {
+		if ((page[pos] ^ val) | (page[pos + 1] ^ val) |
+		    (page[pos + 2] ^ val) | (page[pos + 3] ^ val) |
+		    (page[pos + 4] ^ val) | (page[pos + 5] ^ val) |
+		    (page[pos + 6] ^ val) | (page[pos + 7] ^ val))
 			return 0;
 	}
 
+	*element = val;
 	return 1;
 }
 
+/*
+ * Look for an object with the same contents as mem, and take a reference
+ * on it if there is one.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram, void *mem,
+				unsigned int size, u32 checksum)
+{
+	struct rb_node *node;
+	struct zram_entry *entry;
+	void *cmem;
+	int match;
+
+	spin_lock(&zram->dedup_lock);
+	node = zram->dedup_root.rb_node;
+	while (node) {
+		entry = rb_entry(node, struct zram_entry, node);
+		if (checksum < entry->checksum) {
+			node = node->rb_left;
+		} else if (checksum > entry->checksum) {
+			node = node->rb_right;
+		} else {
+			if (entry->size != size)
+				break;
+			cmem = zs_map_object(zram->mem_pool, entry->handle,
+						ZS_MM_RO);
+			match = !memcmp(cmem, mem, size);
+			zs_unmap_object(zram->mem_pool, entry->handle);
+			if (!match)
+				break;
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+static struct zram_entry *zram_dedup_add(struct zram *zram,
+				unsigned long handle, unsigned int size,
+				u32 checksum)
+{
+	struct rb_node **p, *parent = NULL;
+	struct zram_entry *entry, *e;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->size = size;
+	entry->refcount = 1;
+	RB_CLEAR_NODE(&entry->node);
+
+	spin_lock(&zram->dedup_lock);
+	p = &zram->dedup_root.rb_node;
+	while (*p) {
+		parent = *p;
+		e = rb_entry(parent, struct zram_entry, node);
+		if (checksum < e->checksum) {
+			p = &parent->rb_left;
+		} else if (checksum > e->checksum) {
+			p = &parent->rb_right;
+		} else {
+			/* Collision, or an identical page raced with us */
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	rb_link_node(&entry->node, parent, p);
+	rb_insert_color(&entry->node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+static void zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		zram_stat64_sub(zram, &zram->stats.dedup_saved, entry->size);
+		return;
+	}
+	if (!RB_EMPTY_NODE(&entry->node))
+		rb_erase(&entry->node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+}
+
+/* Called with the table entry locked */
+static unsigned long zram_get_handle(struct zram *zram, u32 index)
+{
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		return zram->table[index].entry->handle;
+
+	return zram->table[index].handle;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Called with the table entry locked */
+static void zram_touch_entry(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = get_seconds();
+}
+
+/* Block 0 is never handed out, so 0 means the device is full */
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long block;
+
+	spin_lock(&zram->bitmap_lock);
+	block = find_next_zero_bit(zram->bitmap, zram->nr_blocks, 1);
+	if (block >= zram->nr_blocks)
+		block = 0;
+	else
+		__set_bit(block, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+
+	return block;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long block)
+{
+	spin_lock(&zram->bitmap_lock);
+	WARN_ON(!test_bit(block, zram->bitmap));
+	__clear_bit(block, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+}
+
+/* Tracks a set of bios submitted to the backing device */
+struct zram_bio_ctl {
+	atomic_t pending;
+	int error;
+	struct completion done;
+};
+
+static void zram_bio_ctl_init(struct zram_bio_ctl *ctl)
+{
+	atomic_set(&ctl->pending, 1);
+	ctl->error = 0;
+	init_completion(&ctl->done);
+}
+
+static void zram_bio_end_io(struct bio *bio, int err)
+{
+	struct zram_bio_ctl *ctl = bio->bi_private;
+
+	if (err || !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ctl->error = -EIO;
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&ctl->pending))
+		complete(&ctl->done);
+}
+
+static void zram_bio_submit(struct zram_bio_ctl *ctl, struct bio *bio,
+				int rw)
+{
+	bio->bi_private = ctl;
+	bio->bi_end_io = zram_bio_end_io;
+	atomic_inc(&ctl->pending);
+	submit_bio(rw, bio);
+}
+
+static int zram_bio_wait(struct zram_bio_ctl *ctl)
+{
+	if (!atomic_dec_and_test(&ctl->pending))
+		wait_for_completion(&ctl->done);
+
+	return ctl->error;
+}
+
+static struct bio *zram_bio_alloc(struct zram *zram, unsigned long block,
+				int nr_pages)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, nr_pages);
+	if (!bio)
+		return NULL;
+
+	bio->bi_sector = (sector_t)block << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+
+	return bio;
+}
+
+static int __zram_read_from_bdev(struct zram *zram, struct page *page,
+				unsigned long block)
+{
+	struct zram_bio_ctl ctl;
+	struct bio *bio;
+
+	bio = zram_bio_alloc(zram, block, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	if (bio_add_page(bio, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	zram_bio_ctl_init(&ctl);
+	zram_bio_submit(&ctl, bio, READ);
+	if (zram_bio_wait(&ctl))
+		return -EIO;
+
+	zram_stat64_inc(zram, &zram->stats.wb_reads);
+	return 0;
+}
+
+/* Reads of written back pages issued from zram_make_request() */
+static struct workqueue_struct *zram_wb_wq;
+
+struct zram_bdev_read {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long block;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_read *rd =
+		container_of(work, struct zram_bdev_read, work);
+
+	rd->ret = __zram_read_from_bdev(rd->zram, rd->page, rd->block);
+}
+
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+				unsigned long block)
+{
+	struct zram_bdev_read rd;
+
+	/*
+	 * Within make_request, submit_bio() only queues the bio on
+	 * current->bio_list until we return, so waiting for it here would
+	 * never end.  Have a worker submit and wait for it instead.
+	 */
+	if (!current->bio_list)
+		return __zram_read_from_bdev(zram, page, block);
+
+	rd.zram = zram;
+	rd.page = page;
+	rd.block = block;
+	INIT_WORK_ONSTACK(&rd.work, zram_bdev_read_work);
+	queue_work(zram_wb_wq, &rd.work);
+	flush_work(&rd.work);
+	destroy_work_on_stack(&rd.work);
+
+	return rd.ret;
+}
+
+/* Called with no pages on the device, on request or at module exit */
+static void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_blocks = 0;
+	zram->backing_dev[0] = '\0';
+}
+#else
+static inline void zram_touch_entry(struct zram *zram, u32 index) {}
+static inline void zram_free_block(struct zram *zram, unsigned long block) {}
+static inline int zram_read_from_bdev(struct zram *zram, struct page *page,
+				unsigned long block)
+{
+	return -EIO;
+}
+static inline void zram_reset_bdev(struct zram *zram) {}
+#endif
+
+static int zram_wb_init(void)
+{
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_wb_wq = alloc_workqueue("zram_wb", WQ_MEM_RECLAIM, 0);
+	if (!zram_wb_wq)
+		return -ENOMEM;
+#endif
+	return 0;
+}
+
+static void zram_wb_exit(void)
+{
+#ifdef CONFIG_ZRAM_WRITEBACK
+	destroy_workqueue(zram_wb_wq);
+#endif
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,75 +573,161 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/* Called with the table entry locked */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
+	u16 size = zram->table[index].size;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
-		}
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, zram->table[index].block);
+		atomic_dec(&zram->stats.pages_wb);
+		zram->table[index].block = 0;
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
+	/*
+	 * No memory is allocated for same filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		if (!zram->table[index].element)
+			atomic_dec(&zram->stats.pages_zero);
+		atomic_dec(&zram->stats.pages_same);
+		zram->table[index].element = 0;
+		return;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	if (unlikely(!handle))
+		return;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		zram_dedup_put(zram, zram->table[index].entry);
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	if (unlikely(size == PAGE_SIZE))
+		atomic_dec(&zram->stats.pages_expand);
+	else if (size <= PAGE_SIZE / 2)
+		atomic_dec(&zram->stats.good_compress);
 
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	zram_stat64_sub(zram, &zram->stats.compr_size, size);
+	atomic_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct page *page)
+static void handle_same_page(struct page *page, unsigned long element)
 {
-	void *user_mem;
+	unsigned long *user_mem;
+	unsigned int pos;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		for (pos = 0; pos < PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
 }
 
-static void handle_uncompressed_page(struct zram *zram,
-				struct page *page, u32 index)
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
 {
+	int ret = 0;
+	unsigned int clen = PAGE_SIZE;
 	unsigned char *user_mem, *cmem;
+	struct zram_stream *zs = NULL;
+	unsigned long handle, element = 0;
+	ktime_t start;
+
+again:
+	zram_lock_entry(zram, index);
+	zram_touch_entry(zram, index);
+
+	/* On the backing device; read it without holding the entry */
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long block = zram->table[index].block;
+
+		zram_unlock_entry(zram, index);
+		if (zs)
+			zram_stream_put(zram, zs);
+		ret = zram_read_from_bdev(zram, page, block);
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, page=%u\n",
+				ret, index);
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+			return ret;
+		}
+		flush_dcache_page(page);
+		return 0;
+	}
+
+	/* Same filled, or not present in compressed area */
+	if (zram_test_flag(zram, index, ZRAM_SAME) ||
+	    !zram->table[index].handle) {
+		if (zram_test_flag(zram, index, ZRAM_SAME))
+			element = zram->table[index].element;
+		else
+			pr_debug("Read before write: page=%u\n", index);
+		zram_unlock_entry(zram, index);
+		if (zs)
+			zram_stream_put(zram, zs);
+		handle_same_page(page, element);
+		return 0;
+	}
+
+	/*
+	 * Only decompression needs a stream.  Waiting for one may sleep,
+	 * so drop the entry and look at it again once we have it.
+	 */
+	if (zram->table[index].size != PAGE_SIZE && !zs) {
+		zram_unlock_entry(zram, index);
+		zs = zram_stream_get(zram);
+		goto again;
+	}
 
+	handle = zram_get_handle(zram, index);
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram->table[index].size == PAGE_SIZE)) {
+		memcpy(user_mem, cmem, PAGE_SIZE);
+	} else {
+		start = ktime_get();
+		ret = crypto_comp_decompress(zs->tfm, cmem,
+			zram->table[index].size, user_mem, &clen);
+		zram_stat64_add(zram, &zram->stats.decompr_time,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+		zram_stat64_inc(zram, &zram->stats.decompr_count);
+	}
 
-	memcpy(user_mem, cmem, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+	zram_unlock_entry(zram, index);
+	if (zs)
+		zram_stream_put(zram, zs);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return -EIO;
+	}
 
 	flush_dcache_page(page);
+	return 0;
 }
 
 static void zram_read(struct zram *zram, struct bio *bio)
@@ -215,68 +741,144 @@ static void zram_read(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+		if (zram_read_page(zram, bvec->bv_page, index))
+			goto out;
+		index++;
+	}
 
-		page = bvec->bv_page;
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+out:
+	bio_io_error(bio);
+}
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+/*
+ * Compress and store one page.  Only the compression stream is held while
+ * compressing and allocating; the table entry is locked just to swap the
+ * new object in and free the old one.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	unsigned int clen = 2 * PAGE_SIZE;
+	int expand = 0;
+	int dedup = zram->dedup_enable;
+	struct zram_stream *zs;
+	struct zram_entry *entry = NULL;
+	unsigned long handle = 0, element;
+	unsigned char *user_mem, *cmem;
+	u32 checksum = 0;
+	ktime_t start;
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_lock_entry(zram, index);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = element;
+		zram_touch_entry(zram, index);
+		zram_unlock_entry(zram, index);
+		atomic_inc(&zram->stats.pages_same);
+		if (!element)
+			atomic_inc(&zram->stats.pages_zero);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	zs = zram_stream_get(zram);
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	start = ktime_get();
+	ret = crypto_comp_compress(zs->tfm, user_mem, PAGE_SIZE, zs->buffer,
+				&clen);
+	zram_stat64_add(zram, &zram->stats.compr_time,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+	kunmap_atomic(user_mem, KM_USER0);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	if (unlikely(ret)) {
+		zram_stream_put(zram, zs);
+		pr_err("Compression failed! err=%d\n", ret);
+		return -EIO;
+	}
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	zram_stat64_inc(zram, &zram->stats.compr_count);
+	zram_stat64_add(zram, &zram->stats.compr_out, clen);
 
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		clen = PAGE_SIZE;
+		expand = 1;
+		user_mem = kmap_atomic(page, KM_USER0);
+		memcpy(zs->buffer, user_mem, PAGE_SIZE);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	}
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
+	if (dedup) {
+		checksum = jhash(zs->buffer, clen, 0);
+		entry = zram_dedup_find(zram, zs->buffer, clen, checksum);
+		if (entry) {
+			zram_stream_put(zram, zs);
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+			goto store;
 		}
+	}
 
-		flush_dcache_page(page);
-		index++;
+	handle = zs_malloc(zram->mem_pool, clen, GFP_NOIO | __GFP_HIGHMEM);
+	if (unlikely(!handle)) {
+		zram_stream_put(zram, zs);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%u\n", index, clen);
+		return -ENOMEM;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memcpy(cmem, zs->buffer, clen);
+	zs_unmap_object(zram->mem_pool, handle);
 
-out:
-	bio_io_error(bio);
+	zram_stream_put(zram, zs);
+
+	if (dedup) {
+		entry = zram_dedup_add(zram, handle, clen, checksum);
+		if (unlikely(!entry)) {
+			zs_free(zram->mem_pool, handle);
+			return -ENOMEM;
+		}
+	}
+
+store:
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_lock_entry(zram, index);
+	zram_free_page(zram, index);
+	if (entry) {
+		zram->table[index].entry = entry;
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	} else {
+		zram->table[index].handle = handle;
+	}
+	zram->table[index].size = clen;
+	zram_touch_entry(zram, index);
+	zram_unlock_entry(zram, index);
+
+	/* Update stats */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	atomic_inc(&zram->stats.pages_stored);
+	if (unlikely(expand))
+		atomic_inc(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		atomic_inc(&zram->stats.good_compress);
+
+	return 0;
 }
 
 static void zram_write(struct zram *zram, struct bio *bio)
@@ -289,121 +891,234 @@ static void zram_write(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
-
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
-
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
+		if (zram_write_page(zram, bvec->bv_page, index)) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			goto out;
 		}
+		index++;
+	}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		kunmap_atomic(user_mem, KM_USER0);
+out:
+	bio_io_error(bio);
+}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Decompress the page at index into page if it should be written back,
+ * and mark it ZRAM_UNDER_WB.  Returns 1 if it was picked.
+ */
+static int zram_wb_prepare(struct zram *zram, u32 index, int mode,
+				struct zram_stream *zs, struct page *page)
+{
+	unsigned int clen = PAGE_SIZE;
+	unsigned char *user_mem, *cmem;
+	unsigned long handle;
+	u16 size;
+	int pick = 0, ret = 0;
+
+	zram_lock_entry(zram, index);
+	handle = zram->table[index].handle;
+	size = zram->table[index].size;
+
+	/* Shared objects are left alone, other pages may still use them */
+	if (!handle || zram->table[index].flags & (BIT(ZRAM_SAME) |
+			BIT(ZRAM_DEDUP) | BIT(ZRAM_WB) | BIT(ZRAM_UNDER_WB)))
+		goto out;
+
+	if ((mode & ZRAM_WB_HUGE) &&
+	    size * 100 >= zram->wb_ratio * PAGE_SIZE)
+		pick = 1;
+	if ((mode & ZRAM_WB_IDLE) && zram->wb_idle_age &&
+	    (u32)get_seconds() - zram->table[index].ac_time >=
+			zram->wb_idle_age)
+		pick = 1;
+	if (!pick)
+		goto out;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	if (size == PAGE_SIZE)
+		memcpy(user_mem, cmem, PAGE_SIZE);
+	else
+		ret = crypto_comp_decompress(zs->tfm, cmem, size,
+					user_mem, &clen);
+	zs_unmap_object(zram->mem_pool, handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		pick = 0;
+		goto out;
+	}
+
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+out:
+	zram_unlock_entry(zram, index);
+	return pick;
+}
+
+/*
+ * Write a batch of pages to the backing device.  Pages on consecutive
+ * blocks share a bio.  Pages that were freed or rewritten meanwhile are
+ * no longer ZRAM_UNDER_WB and keep their new contents; for the others,
+ * the copy in memory is replaced by the block.
+ */
+static int zram_wb_flush(struct zram *zram, u32 *index, struct page **pages,
+				int nr)
+{
+	unsigned long blocks[ZRAM_WB_BATCH];
+	struct zram_bio_ctl ctl;
+	struct blk_plug plug;
+	struct bio *bio = NULL;
+	int i, nr_blocks, ret;
+
+	for (nr_blocks = 0; nr_blocks < nr; nr_blocks++) {
+		blocks[nr_blocks] = zram_alloc_block(zram);
+		if (!blocks[nr_blocks])
+			break;
+	}
+
+	zram_bio_ctl_init(&ctl);
+	blk_start_plug(&plug);
+	for (i = 0; i < nr_blocks; i++) {
+		if (bio && blocks[i] == blocks[i - 1] + 1 &&
+		    bio_add_page(bio, pages[i], PAGE_SIZE, 0) == PAGE_SIZE)
+			continue;
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+		if (bio)
+			zram_bio_submit(&ctl, bio, WRITE);
+		bio = zram_bio_alloc(zram, blocks[i], nr_blocks - i);
+		if (!bio || bio_add_page(bio, pages[i], PAGE_SIZE, 0) !=
+				PAGE_SIZE) {
+			if (bio)
+				bio_put(bio);
+			bio = NULL;
+			ctl.error = -ENOMEM;
+			break;
 		}
+	}
+	if (bio)
+		zram_bio_submit(&ctl, bio, WRITE);
+	blk_finish_plug(&plug);
+	ret = zram_bio_wait(&ctl);
+
+	for (i = 0; i < nr; i++) {
+		zram_lock_entry(zram, index[i]);
+		if (!ret && i < nr_blocks &&
+		    zram_test_flag(zram, index[i], ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index[i]);
+			zram->table[index[i]].block = blocks[i];
+			zram_set_flag(zram, index[i], ZRAM_WB);
+			zram_unlock_entry(zram, index[i]);
+			atomic_inc(&zram->stats.pages_wb);
+			zram_stat64_inc(zram, &zram->stats.wb_writes);
+			continue;
+		}
+		zram_clear_flag(zram, index[i], ZRAM_UNDER_WB);
+		zram_unlock_entry(zram, index[i]);
+		if (i < nr_blocks)
+			zram_free_block(zram, blocks[i]);
+	}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
+	if (!ret && nr_blocks < nr)
+		ret = -ENOSPC;
+	return ret;
+}
+
+int zram_writeback(struct zram *zram, int mode)
+{
+	struct page *pages[ZRAM_WB_BATCH];
+	u32 index[ZRAM_WB_BATCH];
+	struct zram_stream *zs;
+	size_t i, num_pages;
+	int nr = 0, ret = 0;
+
+	memset(pages, 0, sizeof(pages));
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done || !zram->bdev) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
 			goto out;
 		}
+	}
 
-memstore:
-		zram->table[index].offset = offset;
+	zs = zram_stream_get(zram);
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	for (i = 0; i < num_pages; i++) {
+		if (zram_wb_prepare(zram, i, mode, zs, pages[nr]))
+			index[nr++] = i;
+		if (nr == ZRAM_WB_BATCH || (nr && i == num_pages - 1)) {
+			ret = zram_wb_flush(zram, index, pages, nr);
+			nr = 0;
+			if (ret)
+				break;
+		}
+		cond_resched();
+	}
+	zram_stream_put(zram, zs);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+out:
+	mutex_unlock(&zram->init_lock);
+	for (i = 0; i < ZRAM_WB_BATCH; i++)
+		if (pages[i])
+			__free_page(pages[i]);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+	return ret;
+}
 
-		memcpy(cmem, src, clen);
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_blocks, *bitmap;
+	int ret = 0;
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device for initialized device\n");
+		ret = -EBUSY;
+		goto out;
+	}
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	zram_reset_bdev(zram);
+	if (!*path)
+		goto out;
 
-		mutex_unlock(&zram->lock);
-		index++;
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto out;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (nr_blocks < 2 || !bitmap) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		vfree(bitmap);
+		ret = nr_blocks < 2 ? -EINVAL : -ENOMEM;
+		goto out;
+	}
 
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_blocks;
+	strlcpy(zram->backing_dev, path, sizeof(zram->backing_dev));
+	pr_info("Using %s as backing device, %lu pages\n", path, nr_blocks);
 out:
-	bio_io_error(bio);
+	mutex_unlock(&zram->init_lock);
+	return ret;
 }
+#endif
 
 /*
  * Check if request is within bounds and page aligned.
@@ -456,38 +1171,29 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
+	struct zram_stream *zs, *tmp;
 
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free compression streams, all idle now */
+	list_for_each_entry_safe(zs, tmp, &zram->idle_strm, list) {
+		list_del(&zs->list);
+		zram_stream_free(zs);
+	}
+	zram->avail_strm = 0;
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
-			continue;
-
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
-	}
+	for (index = 0; zram->table &&
+			index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
 
 	vfree(zram->table);
 	zram->table = NULL;
+	zram->dedup_root = RB_ROOT;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,18 +1217,15 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
-		goto fail;
+	ret = zram_add_streams(zram);
+	if (ret) {
+		if (!zram->avail_strm) {
+			pr_err("Error allocating %s compression stream\n",
+				zram->compressor);
+			goto fail;
+		}
+		pr_warning("Using %d of %d compression streams\n",
+			zram->avail_strm, zram->max_strm);
 	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
@@ -540,7 +1243,7 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool();
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1269,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_lock_entry(zram, index);
 	zram_free_page(zram, index);
+	zram_unlock_entry(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1284,20 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->strm_lock);
+	INIT_LIST_HEAD(&zram->idle_strm);
+	init_waitqueue_head(&zram->strm_wait);
+	zram->max_strm = num_online_cpus();
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_root = RB_ROOT;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+	zram->wb_ratio = default_wb_ratio;
+	zram->wb_idle_age = default_wb_idle_age;
+#endif
+	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1380,15 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	ret = zram_wb_init();
+	if (ret)
+		goto out;
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_wb;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1418,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_wb:
+	zram_wb_exit();
 out:
 	return ret;
 }
@@ -713,9 +1435,11 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_reset_bdev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	zram_wb_exit();
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
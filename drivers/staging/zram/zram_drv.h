@@ -17,8 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/rbtree.h>
+#include <linux/crypto.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,23 +29,14 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Compression algorithm, see comp_algorithm in sysfs */
+static const char default_compressor[] = "lzo";
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -50,10 +44,14 @@ static const unsigned default_disksize_perc_ram = 25;
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * Writeback to the backing device picks pages stored in at least this %
+ * of a page, or not accessed for this many seconds.
  */
+static const unsigned default_wb_ratio = 75;
+static const unsigned default_wb_idle_age = 3600;
+
+/* Pages written back per round of bios */
+#define ZRAM_WB_BATCH		32
 
 /*-- End of configurable params */
 
@@ -65,24 +63,56 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
-	/* Page is stored uncompressed */
-	ZRAM_UNCOMPRESSED,
+	/* Page is filled with one repeated word, kept in table.element */
+	ZRAM_SAME,
+
+	/* table.entry points to an object shared by identical pages */
+	ZRAM_DEDUP,
+
+	/* Page is on the backing device, in block table.block */
+	ZRAM_WB,
+
+	/* Page is being written back; cleared if it is freed meanwhile */
+	ZRAM_UNDER_WB,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Lock bit for the table entry (see zram_lock_entry) */
+	ZRAM_ACCESS,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * A compressed object that identical pages share when dedup is enabled.
+ * Found by the checksum of its contents in zram->dedup_root; entries
+ * whose checksum collides with another one are not in the tree.
+ */
+struct zram_entry {
+	struct rb_node node;
+	unsigned long handle;
+	u32 checksum;
+	u16 size;
+	int refcount;		/* protected by zram->dedup_lock */
+};
+
+/*
+ * Allocated for each disk page.  The entry is protected by the ZRAM_ACCESS
+ * bit spinlock in flags; the other flag bits are only changed under it.
+ */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
-} __attribute__((aligned(4)));
+	union {
+		unsigned long handle;		/* zsmalloc object */
+		unsigned long element;		/* ZRAM_SAME */
+		struct zram_entry *entry;	/* ZRAM_DEDUP */
+		unsigned long block;		/* ZRAM_WB */
+	};
+	u16 size;	/* object size; PAGE_SIZE if stored uncompressed */
+	unsigned long flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;	/* last access, in seconds */
+#endif
+};
 
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
@@ -92,20 +122,55 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 compr_count;	/* no. of pages compressed */
+	u64 compr_out;		/* total compressor output in bytes */
+	u64 compr_time;		/* ns spent compressing */
+	u64 decompr_count;	/* no. of pages decompressed */
+	u64 decompr_time;	/* ns spent decompressing */
+	u64 dedup_hits;		/* writes that found an identical object */
+	u64 dedup_saved;	/* bytes currently saved by sharing objects */
+	u64 wb_writes;		/* pages written to the backing device */
+	u64 wb_reads;		/* pages read back from it */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_same;	/* no. of same filled pages, zero included */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t pages_wb;	/* no. of pages on the backing device */
+};
+
+/*
+ * Compression context.  Readers and writers take an idle stream from the
+ * device's pool, so up to max_strm pages are (de)compressed in parallel.
+ */
+struct zram_stream {
+	struct list_head list;
+	struct crypto_comp *tfm;
+	void *buffer;
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	spinlock_t strm_lock;	/* protects idle_strm and avail_strm */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;		/* streams allocated */
+	int max_strm;
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	int dedup_enable;
+	spinlock_t dedup_lock;	/* protects dedup_root and refcounts */
+	struct rb_root dedup_root;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct block_device *bdev;	/* backing device, or NULL */
+	char backing_dev[64];
+	unsigned long nr_blocks;	/* pages that fit on bdev */
+	unsigned long *bitmap;		/* blocks in use */
+	spinlock_t bitmap_lock;
+	unsigned int wb_ratio;
+	unsigned int wb_idle_age;
+#endif
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -128,5 +193,15 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_set_max_streams(struct zram *zram, int num);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* What zram_writeback() picks */
+#define ZRAM_WB_HUGE		0x1
+#define ZRAM_WB_IDLE		0x2
+
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, int mode);
+#endif
 
 #endif
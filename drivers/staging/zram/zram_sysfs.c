@@ -15,6 +15,8 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/mm.h>
+#include <linux/crypto.h>
+#include <linux/math64.h>
 
 #include "zram_drv.h"
 
@@ -112,6 +114,114 @@ static ssize_t reset_store(struct device *dev,
 	return len;
 }
 
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->max_strm);
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long num;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &num);
+	if (ret)
+		return ret;
+
+	if (num < 1 || num > INT_MAX)
+		return -EINVAL;
+
+	ret = zram_set_max_streams(zram, num);
+	if (ret)
+		return ret;
+
+	return len;
+}
+
+static const char * const zram_compressors[] = {
+	"lzo",
+	"lz4",
+	"deflate-fast",
+	"deflate",
+};
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	for (i = 0; i < ARRAY_SIZE(zram_compressors); i++) {
+		const char *name = zram_compressors[i];
+
+		if (!strcmp(name, zram->compressor))
+			sz += sprintf(buf + sz, "[%s] ", name);
+		else if (crypto_has_comp(name, 0, 0))
+			sz += sprintf(buf + sz, "%s ", name);
+	}
+	sz += sprintf(buf + sz, "\n");
+
+	return sz;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	char name[CRYPTO_MAX_ALG_NAME];
+	struct zram *zram = dev_to_zram(dev);
+
+	strlcpy(name, buf, sizeof(name));
+	strim(name);
+
+	if (!crypto_has_comp(name, 0, 0))
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change compressor for initialized device\n");
+		return -EBUSY;
+	}
+	strcpy(zram->compressor, name);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+/*
+ * "<algorithm> <pages compressed> <ratio %> <avg compress ns>
+ *  <pages decompressed> <avg decompress ns>" since the last reset,
+ * so different backends can be compared on the same workload.
+ */
+static ssize_t comp_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 count, out, time, dcount, dtime;
+
+	count = zram_stat64_read(zram, &zram->stats.compr_count);
+	out = zram_stat64_read(zram, &zram->stats.compr_out);
+	time = zram_stat64_read(zram, &zram->stats.compr_time);
+	dcount = zram_stat64_read(zram, &zram->stats.decompr_count);
+	dtime = zram_stat64_read(zram, &zram->stats.decompr_time);
+
+	if (count) {
+		out = div64_u64(out * 100, count << PAGE_SHIFT);
+		time = div64_u64(time, count);
+	}
+	if (dcount)
+		dtime = div64_u64(dtime, dcount);
+
+	return sprintf(buf, "%s %llu %llu %llu %llu %llu\n", zram->compressor,
+		count, out, time, dcount, dtime);
+}
+
 static ssize_t num_reads_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -153,7 +263,51 @@ static ssize_t zero_pages_show(struct device *dev,
 {
 	struct zram *zram = dev_to_zram(dev);
 
-	return sprintf(buf, "%u\n", zram->stats.pages_zero);
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.pages_zero));
+}
+
+static ssize_t same_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.pages_same));
+}
+
+static ssize_t dedup_enable_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->dedup_enable);
+}
+
+/* Only affects pages written from now on */
+static ssize_t dedup_enable_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	zram->dedup_enable = !!val;
+
+	return len;
+}
+
+/* "<hits> <bytes saved>" */
+static ssize_t dedup_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu %llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_hits),
+		zram_stat64_read(zram, &zram->stats.dedup_saved));
 }
 
 static ssize_t orig_data_size_show(struct device *dev,
@@ -162,7 +316,7 @@ static ssize_t orig_data_size_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	return sprintf(buf, "%llu\n",
-		(u64)(zram->stats.pages_stored) << PAGE_SHIFT);
+		(u64)atomic_read(&zram->stats.pages_stored) << PAGE_SHIFT);
 }
 
 static ssize_t compr_data_size_show(struct device *dev,
@@ -180,39 +334,240 @@ static ssize_t mem_used_total_show(struct device *dev,
 	u64 val = 0;
 	struct zram *zram = dev_to_zram(dev);
 
-	if (zram->init_done) {
-		val = xv_get_total_size_bytes(zram->mem_pool) +
-			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
-	}
+	if (zram->init_done)
+		val = zs_get_total_size_bytes(zram->mem_pool);
 
 	return sprintf(buf, "%llu\n", val);
 }
 
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zs_compact(zram->mem_pool);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+/*
+ * "<pages used> <bytes stored> <overhead %> <objects moved>
+ *  <pages compacted>": the pool's pages against the compressed bytes in
+ * it, and what compaction has done since the last reset.
+ */
+static ssize_t frag_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zs_pool_stats stats;
+	u64 stored, overhead = 0;
+
+	memset(&stats, 0, sizeof(stats));
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zs_get_stats(zram->mem_pool, &stats);
+	mutex_unlock(&zram->init_lock);
+
+	stored = zram_stat64_read(zram, &zram->stats.compr_size) -
+		zram_stat64_read(zram, &zram->stats.dedup_saved);
+	if (stored && (stats.pages << PAGE_SHIFT) > stored)
+		overhead = div64_u64(((stats.pages << PAGE_SHIFT) - stored) * 100,
+					stored);
+
+	return sprintf(buf, "%llu %llu %llu %llu %llu\n", stats.pages, stored,
+		overhead, stats.objs_moved, stats.pages_compacted);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	mutex_lock(&zram->init_lock);
+	ret = sprintf(buf, "%s\n", zram->bdev ? zram->backing_dev : "none");
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+/* Writing "none" or an empty line releases the backing device */
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	char path[sizeof(((struct zram *)0)->backing_dev)];
+	char *p;
+	int ret;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (len >= sizeof(path))
+		return -EINVAL;
+
+	memcpy(path, buf, len);
+	path[len] = '\0';
+	p = strim(path);
+	if (!strcmp(p, "none"))
+		*p = '\0';
+
+	ret = zram_set_backing_dev(zram, p);
+	if (ret)
+		return ret;
+
+	return len;
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret, mode;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_WB_HUGE;
+	else if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_WB_IDLE;
+	else if (sysfs_streq(buf, "all"))
+		mode = ZRAM_WB_HUGE | ZRAM_WB_IDLE;
+	else
+		return -EINVAL;
+
+	ret = zram_writeback(zram, mode);
+	if (ret)
+		return ret;
+
+	return len;
+}
+
+static ssize_t writeback_ratio_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->wb_ratio);
+}
+
+/* Pages compressed to at least this % of PAGE_SIZE count as huge */
+static ssize_t writeback_ratio_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+	if (val > 100)
+		return -EINVAL;
+
+	zram->wb_ratio = val;
+
+	return len;
+}
+
+static ssize_t writeback_idle_age_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->wb_idle_age);
+}
+
+/* Pages not accessed for this many seconds count as idle, 0 disables */
+static ssize_t writeback_idle_age_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	zram->wb_idle_age = val;
+
+	return len;
+}
+
+/* "<pages on backing device> <pages written> <pages read back>" */
+static ssize_t bd_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d %llu %llu\n",
+		atomic_read(&zram->stats.pages_wb),
+		zram_stat64_read(zram, &zram->stats.wb_writes),
+		zram_stat64_read(zram, &zram->stats.wb_reads));
+}
+#endif
+
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
 static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
+static DEVICE_ATTR(max_comp_streams, S_IRUGO | S_IWUSR,
+		max_comp_streams_show, max_comp_streams_store);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
+static DEVICE_ATTR(comp_stats, S_IRUGO, comp_stats_show, NULL);
 static DEVICE_ATTR(num_reads, S_IRUGO, num_reads_show, NULL);
 static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
 static DEVICE_ATTR(invalid_io, S_IRUGO, invalid_io_show, NULL);
 static DEVICE_ATTR(notify_free, S_IRUGO, notify_free_show, NULL);
 static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
+static DEVICE_ATTR(same_pages, S_IRUGO, same_pages_show, NULL);
+static DEVICE_ATTR(dedup_enable, S_IRUGO | S_IWUSR,
+		dedup_enable_show, dedup_enable_store);
+static DEVICE_ATTR(dedup_stats, S_IRUGO, dedup_stats_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(frag_stats, S_IRUGO, frag_stats_show, NULL);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(writeback_ratio, S_IRUGO | S_IWUSR,
+		writeback_ratio_show, writeback_ratio_store);
+static DEVICE_ATTR(writeback_idle_age, S_IRUGO | S_IWUSR,
+		writeback_idle_age_show, writeback_idle_age_store);
+static DEVICE_ATTR(bd_stat, S_IRUGO, bd_stat_show, NULL);
+#endif
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
 	&dev_attr_initstate.attr,
 	&dev_attr_reset.attr,
+	&dev_attr_max_comp_streams.attr,
+	&dev_attr_comp_algorithm.attr,
 	&dev_attr_num_reads.attr,
 	&dev_attr_num_writes.attr,
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
+	&dev_attr_same_pages.attr,
+	&dev_attr_dedup_enable.attr,
+	&dev_attr_dedup_stats.attr,
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_comp_stats.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_frag_stats.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_writeback_ratio.attr,
+	&dev_attr_writeback_idle_age.attr,
+	&dev_attr_bd_stat.attr,
+#endif
 	NULL,
 };
 
@@ -0,0 +1,645 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Objects are packed into "zspages" of one to ZS_MAX_PAGES_PER_ZSPAGE
+ * pages, each holding objects of a single size class back to back, so
+ * an object may straddle two pages.  Users only get an opaque handle and
+ * map it to access the object; the extra indirection lets zs_compact()
+ * move objects out of sparsely used zspages and give their pages back.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *zs_handle_cache;
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static int get_size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/* Pick the zspage size that wastes the smallest share of its pages */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, best_used = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int bytes = i * PAGE_SIZE;
+		unsigned int used = (bytes / size * size) * 100 / bytes;
+
+		if (used > best_used) {
+			best_used = used;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static void pin_handle(struct zs_handle *handle)
+{
+	bit_spin_lock(ZS_HANDLE_PIN, &handle->loc);
+}
+
+static int trypin_handle(struct zs_handle *handle)
+{
+	return bit_spin_trylock(ZS_HANDLE_PIN, &handle->loc);
+}
+
+static void unpin_handle(struct zs_handle *handle)
+{
+	bit_spin_unlock(ZS_HANDLE_PIN, &handle->loc);
+}
+
+static unsigned int handle_idx(struct zs_handle *handle)
+{
+	return handle->loc >> ZS_HANDLE_IDX_SHIFT;
+}
+
+static enum fullness_group get_fullness_group(struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max = zspage->class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max)
+		return ZS_FULL;
+	if (inuse * 4 >= max * ZS_ALMOST_FULL_FRAC)
+		return ZS_ALMOST_FULL;
+
+	return ZS_ALMOST_EMPTY;
+}
+
+/*
+ * Move the zspage to the list of its current fullness group.  An empty
+ * zspage is taken off all lists and has to be freed by the caller.
+ * Called with the class lock held.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(zspage);
+
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	list_del_init(&zspage->list);
+	if (newfg != ZS_EMPTY)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	enum fullness_group fg;
+
+	for (fg = ZS_ALMOST_FULL; fg <= ZS_ALMOST_EMPTY; fg++) {
+		if (!list_empty(&class->fullness_list[fg]))
+			return list_first_entry(&class->fullness_list[fg],
+					struct zspage, list);
+	}
+
+	return NULL;
+}
+
+static void free_zspage(struct zspage *zspage)
+{
+	unsigned int i;
+
+	for (i = 0; i < zspage->class->pages_per_zspage; i++)
+		if (zspage->pages[i])
+			__free_page(zspage->pages[i]);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	struct zspage *zspage;
+	unsigned int i;
+
+	zspage = kzalloc(sizeof(*zspage) +
+			class->objs_per_zspage * sizeof(zspage->slots[0]),
+			flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i]) {
+			free_zspage(zspage);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < class->objs_per_zspage; i++)
+		zspage->slots[i] = (i + 1) << ZS_SLOT_NEXT_SHIFT | ZS_SLOT_FREE;
+	zspage->free_idx = 0;
+
+	return zspage;
+}
+
+/* Give the first free object of the zspage to handle; class lock held */
+static void obj_alloc(struct zspage *zspage, struct zs_handle *handle)
+{
+	unsigned int idx = zspage->free_idx;
+
+	BUG_ON(!(zspage->slots[idx] & ZS_SLOT_FREE));
+	zspage->free_idx = zspage->slots[idx] >> ZS_SLOT_NEXT_SHIFT;
+	zspage->slots[idx] = (unsigned long)handle;
+	zspage->inuse++;
+
+	/* Keep the pin bit, compaction moves pinned handles */
+	handle->zspage = zspage;
+	handle->loc = idx << ZS_HANDLE_IDX_SHIFT |
+			(handle->loc & BIT(ZS_HANDLE_PIN));
+}
+
+static void obj_free(struct zspage *zspage, unsigned int idx)
+{
+	BUG_ON(zspage->slots[idx] & ZS_SLOT_FREE);
+	zspage->slots[idx] = zspage->free_idx << ZS_SLOT_NEXT_SHIFT |
+				ZS_SLOT_FREE;
+	zspage->free_idx = idx;
+	zspage->inuse--;
+}
+
+/*
+ * Copy size bytes between buf and the object at byte offset off in the
+ * zspage, one page at a time.
+ */
+static void copy_obj(struct zspage *zspage, unsigned long off, char *buf,
+			unsigned int size, int to_obj)
+{
+	while (size) {
+		struct page *page = zspage->pages[off >> PAGE_SHIFT];
+		unsigned int poff = off & ~PAGE_MASK;
+		unsigned int len = min_t(unsigned int, size, PAGE_SIZE - poff);
+		char *addr;
+
+		addr = kmap_atomic(page, KM_USER1);
+		if (to_obj)
+			memcpy(addr + poff, buf, len);
+		else
+			memcpy(buf, addr + poff, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		buf += len;
+		off += len;
+		size -= len;
+	}
+}
+
+/* Copy an object between zspages of the same class */
+static void move_obj(struct size_class *class, struct zspage *dst,
+			unsigned int didx, struct zspage *src, unsigned int sidx)
+{
+	unsigned long doff = (unsigned long)didx * class->size;
+	unsigned long soff = (unsigned long)sidx * class->size;
+	unsigned int size = class->size;
+
+	while (size) {
+		unsigned int dp = doff & ~PAGE_MASK;
+		unsigned int sp = soff & ~PAGE_MASK;
+		unsigned int len;
+		char *d, *s;
+
+		len = min_t(unsigned int, size, PAGE_SIZE - dp);
+		len = min_t(unsigned int, len, PAGE_SIZE - sp);
+
+		s = kmap_atomic(src->pages[soff >> PAGE_SHIFT], KM_USER0);
+		d = kmap_atomic(dst->pages[doff >> PAGE_SHIFT], KM_USER1);
+		memcpy(d + dp, s + sp, len);
+		kunmap_atomic(d, KM_USER1);
+		kunmap_atomic(s, KM_USER0);
+
+		doff += len;
+		soff += len;
+		size -= len;
+	}
+}
+
+struct zs_pool *zs_create_pool(void)
+{
+	int i;
+	struct zs_pool *pool;
+
+	if (!zs_handle_cache)
+		return NULL;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		enum fullness_group fg;
+
+		spin_lock_init(&class->lock);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+						class->size;
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	mutex_init(&pool->compact_lock);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/* All objects must have been freed */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		enum fullness_group fg;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			struct zspage *zspage, *tmp;
+
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty zspage of class %u\n",
+					class->size);
+				list_del(&zspage->list);
+				free_zspage(zspage);
+			}
+		}
+	}
+
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: flags for the backing pages, may include __GFP_HIGHMEM
+ *
+ * Returns a handle to the object, to be mapped with zs_map_object(),
+ * or 0 on failure.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cache, flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	handle->loc = 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, handle);
+			return 0;
+		}
+		atomic_long_add(class->pages_per_zspage, &pool->pages);
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	obj_alloc(zspage, handle);
+	class->inuse++;
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fg;
+
+	if (unlikely(!handle))
+		return;
+
+	pin_handle(handle);
+	zspage = handle->zspage;
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(zspage, handle_idx(handle));
+	class->inuse--;
+	fg = fix_fullness_group(class, zspage);
+	if (fg == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+
+	unpin_handle(handle);
+	kmem_cache_free(zs_handle_cache, handle);
+
+	if (fg == ZS_EMPTY) {
+		atomic_long_sub(class->pages_per_zspage, &pool->pages);
+		free_zspage(zspage);
+	}
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the object will be accessed
+ *
+ * The object stays in place until zs_unmap_object(), which must be
+ * called before anything else is mapped on this cpu.  Like kmap_atomic()
+ * this disables preemption, so the caller must not sleep in between.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct mapping_area *area;
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned long off;
+	unsigned int poff;
+
+	BUG_ON(!handle);
+
+	pin_handle(handle);
+	zspage = handle->zspage;
+	class = zspage->class;
+	off = (unsigned long)handle_idx(handle) * class->size;
+	poff = off & ~PAGE_MASK;
+
+	area = &__get_cpu_var(zs_map_area);
+	area->mm = mm;
+
+	if (poff + class->size <= PAGE_SIZE) {
+		area->kaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return area->kaddr + poff;
+	}
+
+	area->kaddr = NULL;
+	if (mm != ZS_MM_WO)
+		copy_obj(zspage, off, area->buf, class->size, 0);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct mapping_area *area;
+	struct size_class *class;
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->kaddr) {
+		kunmap_atomic(area->kaddr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		class = handle->zspage->class;
+		copy_obj(handle->zspage,
+			(unsigned long)handle_idx(handle) * class->size,
+			area->buf, class->size, 1);
+	}
+
+	unpin_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* Compaction can only gain something with at least a zspage unused */
+static int zs_can_compact(struct size_class *class)
+{
+	unsigned long unused;
+
+	unused = class->zspages * class->objs_per_zspage - class->inuse;
+
+	return unused >= class->objs_per_zspage;
+}
+
+/*
+ * Move objects from src to dst until src is empty or dst is full.
+ * Returns -EBUSY if an object of src is pinned and cannot be moved now.
+ * Called with the class lock held.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *src, struct zspage *dst)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		unsigned long slot = src->slots[idx];
+		struct zs_handle *handle;
+
+		if (slot & ZS_SLOT_FREE)
+			continue;
+		if (dst->inuse == class->objs_per_zspage)
+			break;
+
+		handle = (struct zs_handle *)slot;
+		if (!trypin_handle(handle))
+			return -EBUSY;
+
+		obj_alloc(dst, handle);
+		move_obj(class, dst, handle_idx(handle), src, idx);
+		obj_free(src, idx);
+		unpin_handle(handle);
+
+		pool->objs_moved++;
+	}
+
+	return 0;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	LIST_HEAD(skipped);
+	unsigned long freed = 0;
+	struct zspage *zspage, *tmp;
+
+	for (;;) {
+		struct zspage *src, *dst = NULL, *empty = NULL;
+		struct list_head *list;
+		int ret;
+
+		spin_lock(&class->lock);
+		if (!zs_can_compact(class))
+			break;
+
+		/* Empty the least recently used sparse zspage ... */
+		list = &class->fullness_list[ZS_ALMOST_EMPTY];
+		if (list_empty(list))
+			break;
+		src = list_entry(list->prev, struct zspage, list);
+
+		/* ... into the fullest one that still has room */
+		list = &class->fullness_list[ZS_ALMOST_FULL];
+		if (!list_empty(list))
+			dst = list_first_entry(list, struct zspage, list);
+		else if (src->list.prev != &class->fullness_list[ZS_ALMOST_EMPTY])
+			dst = list_first_entry(
+				&class->fullness_list[ZS_ALMOST_EMPTY],
+				struct zspage, list);
+		if (!dst)
+			break;
+
+		ret = migrate_zspage(pool, class, src, dst);
+		fix_fullness_group(class, dst);
+		if (fix_fullness_group(class, src) == ZS_EMPTY) {
+			class->zspages--;
+			empty = src;
+		} else if (ret) {
+			/* Put back once done, so it is not picked again */
+			list_move(&src->list, &skipped);
+		}
+		spin_unlock(&class->lock);
+
+		if (empty) {
+			atomic_long_sub(class->pages_per_zspage, &pool->pages);
+			free_zspage(empty);
+			freed += class->pages_per_zspage;
+		}
+		cond_resched();
+	}
+
+	/*
+	 * Skipped zspages whose fullness changed meanwhile have already been
+	 * moved back to their list by zs_free().
+	 */
+	list_for_each_entry_safe(zspage, tmp, &skipped, list)
+		list_move(&zspage->list, &class->fullness_list[zspage->fullness]);
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Move objects to free sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * Objects that are mapped or being freed are left in place.  May sleep.
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	mutex_lock(&pool->compact_lock);
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += compact_class(pool, &pool->size_class[i]);
+	pool->compactions++;
+	pool->pages_compacted += freed;
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->pages = atomic_long_read(&pool->pages);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		stats->objs += class->inuse;
+		stats->obj_bytes += (u64)class->inuse * class->size;
+		spin_unlock(&class->lock);
+	}
+
+	mutex_lock(&pool->compact_lock);
+	stats->compactions = pool->compactions;
+	stats->objs_moved = pool->objs_moved;
+	stats->pages_compacted = pool->pages_compacted;
+	mutex_unlock(&pool->compact_lock);
+}
+EXPORT_SYMBOL_GPL(zs_get_stats);
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	zs_handle_cache = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!zs_handle_cache)
+		goto fail;
+
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zs_map_area, cpu).buf);
+		per_cpu(zs_map_area, cpu).buf = NULL;
+	}
+	pr_err("zsmalloc: cannot allocate mapping buffers\n");
+	return -ENOMEM;
+}
+subsys_initcall(zs_init);
@@ -0,0 +1,49 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+/* How a mapped object is going to be accessed */
+enum zs_mapmode {
+	ZS_MM_RW,
+	ZS_MM_RO,	/* not copied back on unmap */
+	ZS_MM_WO,	/* old contents not copied in on map */
+};
+
+struct zs_pool_stats {
+	u64 pages;		/* pages backing the pool */
+	u64 objs;		/* objects allocated */
+	u64 obj_bytes;		/* bytes of the size classes of those objects */
+	u64 compactions;
+	u64 objs_moved;		/* by compaction */
+	u64 pages_compacted;	/* pages freed by compaction */
+};
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(void);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+unsigned long zs_compact(struct zs_pool *pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+
+#endif
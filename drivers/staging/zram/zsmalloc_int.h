@@ -0,0 +1,119 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are ZS_SIZE_CLASS_DELTA bytes apart, so an object wastes
+ * less than that much space to rounding.
+ */
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage is made of up to this many pages.  Objects may straddle the
+ * pages of a zspage, so a class can pick the page count that leaves the
+ * least space unused at the end.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/* End of user params */
+
+/*
+ * A zspage on the ZS_ALMOST_FULL list has at least 3/4 of its objects in
+ * use.  Allocations are served from ZS_ALMOST_FULL first, compaction
+ * moves objects out of ZS_ALMOST_EMPTY zspages.  Empty zspages are freed.
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+#define ZS_ALMOST_FULL_FRAC	3	/* in quarters */
+
+/*
+ * A handle gives the location of an object.  The object may move during
+ * compaction, but only while the handle is not pinned: map, unmap and
+ * free pin it with the ZS_HANDLE_PIN bit spinlock in loc.
+ */
+#define ZS_HANDLE_PIN		0
+#define ZS_HANDLE_IDX_SHIFT	1
+
+struct zs_handle {
+	struct zspage *zspage;
+	unsigned long loc;	/* object index << ZS_HANDLE_IDX_SHIFT | pin */
+};
+
+/*
+ * slots[] holds the handle of each allocated object.  A free slot has
+ * ZS_SLOT_FREE set and the index of the next free slot above it.
+ */
+#define ZS_SLOT_FREE		1UL
+#define ZS_SLOT_NEXT_SHIFT	1
+
+struct zspage {
+	struct list_head list;		/* in class->fullness_list */
+	struct size_class *class;
+	unsigned int inuse;		/* objects allocated */
+	unsigned int free_idx;		/* first free slot */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long slots[0];
+};
+
+struct size_class {
+	spinlock_t lock;
+	unsigned int size;
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	unsigned long zspages;		/* stats */
+	unsigned long inuse;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	atomic_long_t pages;		/* stats */
+
+	/* Serializes zs_compact() and protects its stats */
+	struct mutex compact_lock;
+	u64 compactions;
+	u64 objs_moved;
+	u64 pages_compacted;
+};
+
+/*
+ * Objects that straddle two pages are copied into buf while mapped.  Only
+ * one object can be mapped at a time on each cpu.
+ */
+struct mapping_area {
+	void *kaddr;		/* kmap of a non-straddling object */
+	char *buf;
+	enum zs_mapmode mm;
+};
+
+#endif
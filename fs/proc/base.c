@@ -1143,6 +1143,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		lowmem_index_update(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1278,6 +1280,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		lowmem_index_update(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
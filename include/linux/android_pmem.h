@@ -61,6 +61,9 @@ struct android_pmem_platform_data
 	unsigned buffered;
 	/* type of pmem */
 	enum pmem_type type;
+	/* if set, allocate from this contiguous heap (linux/contig_heap.h)
+	 * rather than from start; size then caps what the device may hold */
+	const char *heap;
 };
 
 struct pmem_region {
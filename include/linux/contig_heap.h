@@ -0,0 +1,113 @@
+/*
+ * include/linux/contig_heap.h
+ *
+ * Named heaps of physically contiguous memory, lent to the page
+ * allocator while unused.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _LINUX_CONTIG_HEAP_H
+#define _LINUX_CONTIG_HEAP_H
+
+#include <linux/errno.h>
+#include <linux/types.h>
+
+struct page;
+struct contig_heap;
+
+#ifdef CONFIG_CMA
+
+/*
+ * A heap is declared from the machine's reserve() hook, while memblock
+ * is still the allocator, and handed to the page allocator as
+ * MIGRATE_CMA pageblocks at core_initcall time.  From then on its free
+ * pages hold movable pages (page cache, anonymous memory) and
+ * contig_heap_alloc() migrates those out of the range it returns.
+ */
+extern int contig_heap_declare(const char *name, phys_addr_t size,
+			       phys_addr_t limit);
+extern struct contig_heap *contig_heap_find(const char *name);
+extern phys_addr_t contig_heap_base(struct contig_heap *heap);
+extern unsigned long contig_heap_size(struct contig_heap *heap);
+
+/* count pages aligned to 1 << align pages, zeroed, or NULL */
+extern struct page *contig_heap_alloc(struct contig_heap *heap,
+				      unsigned long count, unsigned int align);
+/* the same at a given pfn, for callers managing the heap's space */
+extern int contig_heap_alloc_at(struct contig_heap *heap, unsigned long pfn,
+				unsigned long count);
+extern void contig_heap_free(struct contig_heap *heap, struct page *pages,
+			     unsigned long count);
+
+/*
+ * Heap pages are also in the kernel's cacheable linear mapping.  Before
+ * mapping a range uncached anywhere, make that alias uncached as well;
+ * contig_heap_free() makes it cacheable again.  -ENOSYS where the
+ * architecture cannot do this.
+ */
+extern int contig_heap_uncache(struct contig_heap *heap, struct page *pages,
+			       unsigned long count);
+
+/* architecture hooks behind the above */
+extern void arch_contig_heap_reserve(phys_addr_t base, phys_addr_t size);
+extern int arch_contig_heap_remap(struct page *page, unsigned long count,
+				  bool cached);
+
+#else
+
+static inline int contig_heap_declare(const char *name, phys_addr_t size,
+				      phys_addr_t limit)
+{
+	return -ENOSYS;
+}
+
+static inline struct contig_heap *contig_heap_find(const char *name)
+{
+	return NULL;
+}
+
+static inline phys_addr_t contig_heap_base(struct contig_heap *heap)
+{
+	return 0;
+}
+
+static inline unsigned long contig_heap_size(struct contig_heap *heap)
+{
+	return 0;
+}
+
+static inline struct page *contig_heap_alloc(struct contig_heap *heap,
+					     unsigned long count,
+					     unsigned int align)
+{
+	return NULL;
+}
+
+static inline int contig_heap_alloc_at(struct contig_heap *heap,
+				       unsigned long pfn, unsigned long count)
+{
+	return -ENOSYS;
+}
+
+static inline void contig_heap_free(struct contig_heap *heap,
+				    struct page *pages, unsigned long count)
+{
+}
+
+static inline int contig_heap_uncache(struct contig_heap *heap,
+				      struct page *pages, unsigned long count)
+{
+	return -ENOSYS;
+}
+
+#endif
+
+#endif /* _LINUX_CONTIG_HEAP_H */
@@ -20,6 +20,7 @@
 #define CPUIDLE_STATE_MAX	8
 #define CPUIDLE_NAME_LEN	16
 #define CPUIDLE_DESC_LEN	32
+#define CPUIDLE_HIST_BUCKETS	16
 
 struct cpuidle_device;
 
@@ -40,6 +41,9 @@ struct cpuidle_state {
 
 	unsigned long long	usage;
 	unsigned long long	time; /* in US */
+	unsigned long long	above; /* idle too short for this state */
+	unsigned long long	below; /* idle long enough for a deeper one */
+	unsigned int		residency_hist[CPUIDLE_HIST_BUCKETS];
 
 	int (*enter)	(struct cpuidle_device *dev,
 			 struct cpuidle_state *state);
@@ -51,6 +55,18 @@ struct cpuidle_state {
 
 #define CPUIDLE_DRIVER_FLAGS_MASK (0xFFFF0000)
 
+/**
+ * cpuidle_hist_bucket - residency histogram bucket of a duration
+ * @us: the duration in US
+ *
+ * Bucket 0 holds 0, bucket n holds [2^(n-1), 2^n) and the last one
+ * everything from 2^(CPUIDLE_HIST_BUCKETS-2) up.
+ */
+static inline int cpuidle_hist_bucket(unsigned int us)
+{
+	return min(fls(us), CPUIDLE_HIST_BUCKETS - 1);
+}
+
 /**
  * cpuidle_get_statedata - retrieves private driver state data
  * @state: the state
@@ -52,6 +52,9 @@ struct irq_desc {
 	unsigned int		irq_count;	/* For detecting broken IRQs */
 	unsigned long		last_unhandled;	/* Aging timer for unhandled count */
 	unsigned int		irqs_unhandled;
+#ifdef CONFIG_IRQ_TIME_STATS
+	u64			time_ns;	/* time in the handlers */
+#endif
 	raw_spinlock_t		lock;
 #ifdef CONFIG_SMP
 	const struct cpumask	*affinity_hint;
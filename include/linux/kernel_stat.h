@@ -70,6 +70,15 @@ do {							\
 	__this_cpu_inc(kstat.irqs_sum);			\
 } while (0)
 
+#ifdef CONFIG_IRQ_TIME_STATS
+extern u64 kstat_irq_time(unsigned int irq);
+#else
+static inline u64 kstat_irq_time(unsigned int irq)
+{
+	return 0;
+}
+#endif
+
 #endif
 
 static inline void kstat_incr_softirqs_this_cpu(unsigned int irq)
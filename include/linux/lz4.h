@@ -0,0 +1,56 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ * LZ4 Kernel Interface
+ *
+ * Compressor and decompressor for the LZ4 block format: a sequence of
+ * literal runs and back-references of at least 4 bytes within a 64KB
+ * window, trading some ratio against LZO for faster compression and
+ * much faster decompression.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(u32))
+
+/*
+ * lz4_compressbound()
+ * Provides the maximum size that LZ4 may output in a "worst case" scenario
+ * (input data not compressible)
+ */
+static inline size_t lz4_compressbound(size_t isize)
+{
+	return isize + (isize / 255) + 16;
+}
+
+/*
+ * lz4_compress()
+ *	src     : source address of the original data
+ *	src_len : size of the original data
+ *	dst     : output buffer address of the compressed data
+ *	dst_len : is the output size, which is returned after compress done;
+ *		  on entry it is the size of the output buffer
+ *	workmem : address of the working memory, LZ4_MEM_COMPRESS bytes.
+ *	return  : Success if return 0
+ *		  Error if return (< 0), e.g. the output buffer is too small
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4_decompress_unknownoutputsize()
+ *	src     : source address of the compressed data
+ *	src_len : is the input size, therefore the compressed size
+ *	dest	: output buffer address of the decompressed data
+ *	dest_len: is the max size of the destination buffer, which is
+ *		  returned with actual size of decompressed data after
+ *		  decompress done
+ *	return  : Success if return 0
+ *		  Error if return (< 0), for malformed or truncated input
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len);
+#endif
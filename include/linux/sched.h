@@ -141,6 +141,7 @@ extern unsigned long nr_uninterruptible(void);
 extern unsigned long nr_iowait(void);
 extern unsigned long nr_iowait_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
+extern unsigned int sched_get_nr_running_avg(int cpu);
 
 
 extern void calc_global_load(unsigned long ticks);
@@ -1280,6 +1281,9 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct list_head lowmem_node;	/* oom_adj bucket, leaders only */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
@@ -2596,6 +2600,29 @@ extern long sched_getaffinity(pid_t pid, struct cpumask *mask);
 
 extern void normalize_rt_tasks(void);
 
+#ifdef CONFIG_CPU_FREQ
+/*
+ * A cpufreq governor can have the scheduler call it whenever the load of
+ * a cpu may have changed: on enqueue, dequeue and tick of that cpu's
+ * runqueue.  @func runs on that cpu with its runqueue lock held and
+ * interrupts disabled, so it must not sleep nor wake tasks up.  @time is
+ * the runqueue clock in ns.
+ */
+#define SCHED_CPUFREQ_RT	(1U << 0)	/* an rt task is involved */
+
+struct update_util_data {
+	void (*func)(struct update_util_data *data, u64 time,
+		     unsigned int flags);
+};
+
+extern void cpufreq_add_update_util_hook(int cpu,
+			struct update_util_data *data,
+			void (*func)(struct update_util_data *data, u64 time,
+				     unsigned int flags));
+/* callers must synchronize_sched() before freeing the data */
+extern void cpufreq_remove_update_util_hook(int cpu);
+#endif
+
 #ifdef CONFIG_CGROUP_SCHED
 
 extern struct task_group root_task_group;
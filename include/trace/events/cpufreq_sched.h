@@ -0,0 +1,76 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cpufreq_sched
+
+#if !defined(_TRACE_CPUFREQ_SCHED_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CPUFREQ_SCHED_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * cpufreq_sched_target - a cpu asked for a new frequency
+ * @cpu:	the cpu
+ * @load:	its load in percent
+ * @old:	the frequency it asked for before
+ * @new:	the frequency it asks for now
+ */
+TRACE_EVENT(cpufreq_sched_target,
+
+	TP_PROTO(unsigned int cpu, unsigned int load, unsigned int old,
+		 unsigned int new),
+
+	TP_ARGS(cpu, load, old, new),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	cpu	)
+		__field(	unsigned int,	load	)
+		__field(	unsigned int,	old	)
+		__field(	unsigned int,	new	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = cpu;
+		__entry->load = load;
+		__entry->old = old;
+		__entry->new = new;
+	),
+
+	TP_printk("cpu=%u load=%u old=%u new=%u", __entry->cpu,
+		  __entry->load, __entry->old, __entry->new)
+);
+
+/*
+ * cpufreq_sched_setspeed - the policy thread changed the frequency
+ * @cpu:	the policy's cpu
+ * @target:	the highest frequency asked for by the policy's cpus
+ * @actual:	the frequency the driver set
+ * @latency:	us from the first request to the change
+ */
+TRACE_EVENT(cpufreq_sched_setspeed,
+
+	TP_PROTO(unsigned int cpu, unsigned int target, unsigned int actual,
+		 unsigned int latency),
+
+	TP_ARGS(cpu, target, actual, latency),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	cpu	)
+		__field(	unsigned int,	target	)
+		__field(	unsigned int,	actual	)
+		__field(	unsigned int,	latency	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = cpu;
+		__entry->target = target;
+		__entry->actual = actual;
+		__entry->latency = latency;
+	),
+
+	TP_printk("cpu=%u target=%u actual=%u latency=%uus", __entry->cpu,
+		  __entry->target, __entry->actual, __entry->latency)
+);
+
+#endif /* _TRACE_CPUFREQ_SCHED_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -0,0 +1,114 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM k3hotplug
+
+#if !defined(_TRACE_K3HOTPLUG_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_K3HOTPLUG_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * k3hotplug_sample - the inputs of one hotplug decision
+ * @online:	online cpus
+ * @min_load:	lowest average load of an online cpu, percent
+ * @max_load:	highest average load of an online cpu, percent
+ * @nr_sample:	total runqueue length over the period, times 100
+ * @nr_avg:	its decaying average, times 100
+ */
+TRACE_EVENT(k3hotplug_sample,
+
+	TP_PROTO(unsigned int online, unsigned int min_load,
+		 unsigned int max_load, unsigned int nr_sample,
+		 unsigned int nr_avg),
+
+	TP_ARGS(online, min_load, max_load, nr_sample, nr_avg),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	online		)
+		__field(	unsigned int,	min_load	)
+		__field(	unsigned int,	max_load	)
+		__field(	unsigned int,	nr_sample	)
+		__field(	unsigned int,	nr_avg		)
+	),
+
+	TP_fast_assign(
+		__entry->online = online;
+		__entry->min_load = min_load;
+		__entry->max_load = max_load;
+		__entry->nr_sample = nr_sample;
+		__entry->nr_avg = nr_avg;
+	),
+
+	TP_printk("online=%u min_load=%u max_load=%u nr_sample=%u nr_avg=%u",
+		  __entry->online, __entry->min_load, __entry->max_load,
+		  __entry->nr_sample, __entry->nr_avg)
+);
+
+/*
+ * k3hotplug_decision - a core is to be added or removed
+ * @online:	online cpus
+ * @request:	1 to add a core, -1 to remove one
+ * @held:	ms the condition held
+ * @needed:	ms it had to hold
+ */
+TRACE_EVENT(k3hotplug_decision,
+
+	TP_PROTO(unsigned int online, int request, unsigned int held,
+		 unsigned int needed),
+
+	TP_ARGS(online, request, held, needed),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	online	)
+		__field(	int,		request	)
+		__field(	unsigned int,	held	)
+		__field(	unsigned int,	needed	)
+	),
+
+	TP_fast_assign(
+		__entry->online = online;
+		__entry->request = request;
+		__entry->held = held;
+		__entry->needed = needed;
+	),
+
+	TP_printk("online=%u request=%d held=%ums needed=%ums",
+		  __entry->online, __entry->request, __entry->held,
+		  __entry->needed)
+);
+
+/*
+ * k3hotplug_transition - the hotplug thread brought a cpu up or down
+ * @cpu:	the cpu
+ * @up:		1 if brought up
+ * @latency:	us cpu_up or cpu_down took
+ * @ret:	what it returned
+ */
+TRACE_EVENT(k3hotplug_transition,
+
+	TP_PROTO(unsigned int cpu, unsigned int up, unsigned int latency,
+		 int ret),
+
+	TP_ARGS(cpu, up, latency, ret),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	cpu	)
+		__field(	unsigned int,	up	)
+		__field(	unsigned int,	latency	)
+		__field(	int,		ret	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = cpu;
+		__entry->up = up;
+		__entry->latency = latency;
+		__entry->ret = ret;
+	),
+
+	TP_printk("cpu=%u %s latency=%uus ret=%d", __entry->cpu,
+		  __entry->up ? "up" : "down", __entry->latency, __entry->ret)
+);
+
+#endif /* _TRACE_K3HOTPLUG_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -118,6 +118,7 @@ handle_irq_event_percpu(struct irq_desc *desc, struct irqaction *action)
 {
 	irqreturn_t retval = IRQ_NONE;
 	unsigned int random = 0, irq = desc->irq_data.irq;
+	u64 start = irq_time_stats_start();
 
 	do {
 		irqreturn_t res;
@@ -156,6 +157,8 @@ handle_irq_event_percpu(struct irq_desc *desc, struct irqaction *action)
 		action = action->next;
 	} while (action);
 
+	irq_time_stats_account(desc, start);
+
 	if (random & IRQF_SAMPLE_RANDOM)
 		add_interrupt_randomness(irq);
 
@@ -6,6 +6,7 @@
  * of this file for your non core code.
  */
 #include <linux/irqdesc.h>
+#include <linux/sched.h>
 
 #ifdef CONFIG_SPARSE_IRQ
 # define IRQ_BITMAP_BITS	(NR_IRQS + 8196)
@@ -142,6 +143,25 @@ irq_put_desc_unlock(struct irq_desc *desc, unsigned long flags)
 	__irq_put_desc_unlock(desc, flags, false);
 }
 
+#ifdef CONFIG_IRQ_TIME_STATS
+static inline u64 irq_time_stats_start(void)
+{
+	return sched_clock();
+}
+
+/*
+ * Only per cpu interrupts run their handlers on several cpus at once,
+ * and may lose an update here.
+ */
+static inline void irq_time_stats_account(struct irq_desc *desc, u64 start)
+{
+	desc->time_ns += sched_clock() - start;
+}
+#else
+static inline u64 irq_time_stats_start(void) { return 0; }
+static inline void irq_time_stats_account(struct irq_desc *desc, u64 start) { }
+#endif
+
 /*
  * Manipulation functions for irq_data.state
  */
@@ -85,6 +85,9 @@ static void desc_set_defaults(unsigned int irq, struct irq_desc *desc, int node)
 	desc->depth = 1;
 	desc->irq_count = 0;
 	desc->irqs_unhandled = 0;
+#ifdef CONFIG_IRQ_TIME_STATS
+	desc->time_ns = 0;
+#endif
 	desc->name = NULL;
 	for_each_possible_cpu(cpu)
 		*per_cpu_ptr(desc->kstat_irqs, cpu) = 0;
@@ -464,3 +467,17 @@ unsigned int kstat_irqs(unsigned int irq)
 		sum += *per_cpu_ptr(desc->kstat_irqs, cpu);
 	return sum;
 }
+
+#ifdef CONFIG_IRQ_TIME_STATS
+/*
+ * Time spent in the handlers of @irq, in ns.  The read is not atomic on
+ * 32 bit, callers comparing samples must cope with an occasional torn
+ * value.
+ */
+u64 kstat_irq_time(unsigned int irq)
+{
+	struct irq_desc *desc = irq_to_desc(irq);
+
+	return desc ? desc->time_ns : 0;
+}
+#endif
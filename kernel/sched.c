@@ -474,6 +474,11 @@ struct rq {
 	unsigned long nr_load_updates;
 	u64 nr_switches;
 
+	/* runnable task history, see sched_get_nr_running_avg() */
+	u64 nr_stamp;
+	u64 nr_prod_sum;
+	u64 nr_avg_stamp;
+
 	struct cfs_rq cfs;
 	struct rt_rq rt;
 
@@ -1780,13 +1785,27 @@ static const struct sched_class rt_sched_class;
 
 #include "sched_stats.h"
 
+/*
+ * Integrate nr_running over rq->clock, the caller has updated the clock.
+ */
+static inline void account_nr_running(struct rq *rq)
+{
+	u64 now = rq->clock;
+
+	if (now > rq->nr_stamp)
+		rq->nr_prod_sum += (now - rq->nr_stamp) * rq->nr_running;
+	rq->nr_stamp = now;
+}
+
 static void inc_nr_running(struct rq *rq)
 {
+	account_nr_running(rq);
 	rq->nr_running++;
 }
 
 static void dec_nr_running(struct rq *rq)
 {
+	account_nr_running(rq);
 	rq->nr_running--;
 }
 
@@ -2027,6 +2046,49 @@ static void update_rq_clock_task(struct rq *rq, s64 delta)
 
 #endif /* CONFIG_IRQ_TIME_ACCOUNTING */
 
+#ifdef CONFIG_CPU_FREQ
+static DEFINE_PER_CPU(struct update_util_data *, cpufreq_update_util_data);
+
+void cpufreq_add_update_util_hook(int cpu, struct update_util_data *data,
+			void (*func)(struct update_util_data *data, u64 time,
+				     unsigned int flags))
+{
+	if (WARN_ON(!data || !func))
+		return;
+	if (WARN_ON(per_cpu(cpufreq_update_util_data, cpu)))
+		return;
+
+	data->func = func;
+	rcu_assign_pointer(per_cpu(cpufreq_update_util_data, cpu), data);
+}
+
+void cpufreq_remove_update_util_hook(int cpu)
+{
+	rcu_assign_pointer(per_cpu(cpufreq_update_util_data, cpu), NULL);
+}
+
+/*
+ * Tell the cpufreq governor that the load of rq may have changed.  Only
+ * done for the local runqueue: remote wakeups are seen at the next event
+ * on that cpu.
+ */
+static inline void cpufreq_update_util(struct rq *rq, unsigned int flags)
+{
+	struct update_util_data *data;
+
+	if (cpu_of(rq) != smp_processor_id())
+		return;
+
+	data = rcu_dereference_sched(__get_cpu_var(cpufreq_update_util_data));
+	if (data)
+		data->func(data, rq->clock, flags);
+}
+#else
+static inline void cpufreq_update_util(struct rq *rq, unsigned int flags)
+{
+}
+#endif
+
 #include "sched_idletask.c"
 #include "sched_fair.c"
 #include "sched_rt.c"
@@ -3255,6 +3317,42 @@ unsigned long this_cpu_load(void)
 	return this->cpu_load[0];
 }
 
+/*
+ * sched_get_nr_running_avg - time weighted average of a runqueue's length
+ * @cpu:	the runqueue's cpu
+ *
+ * Returns the average number of runnable tasks on @cpu, times 100, since
+ * the previous call for that cpu, and starts a new period.  Meant for a
+ * single consumer, such as a cpu hotplug policy sampling at a fixed rate.
+ */
+unsigned int sched_get_nr_running_avg(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long flags;
+	u64 period, sum;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	update_rq_clock(rq);
+	account_nr_running(rq);
+	period = rq->clock - rq->nr_avg_stamp;
+	sum = rq->nr_prod_sum;
+	rq->nr_prod_sum = 0;
+	rq->nr_avg_stamp = rq->clock;
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	if (!period)
+		return rq->nr_running * 100;
+	/* 64 bit division is not cheap on 32 bit, go to us first */
+	do_div(period, NSEC_PER_USEC);
+	do_div(sum, NSEC_PER_USEC / 100);
+	if (!period)
+		return rq->nr_running * 100;
+	do_div(sum, period);
+
+	return sum;
+}
+EXPORT_SYMBOL_GPL(sched_get_nr_running_avg);
+
 
 /* Variables and functions for calc_load */
 static atomic_long_t calc_load_tasks;
@@ -1342,6 +1342,7 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 		update_cfs_shares(cfs_rq);
 	}
 
+	cpufreq_update_util(rq, 0);
 	hrtick_update(rq);
 }
 
@@ -1382,6 +1383,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 		update_cfs_shares(cfs_rq);
 	}
 
+	cpufreq_update_util(rq, 0);
 	hrtick_update(rq);
 }
 
@@ -4120,6 +4122,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	cpufreq_update_util(rq, 0);
 }
 
 /*
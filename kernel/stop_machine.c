@@ -249,6 +249,12 @@ repeat:
 		return 0;
 	}
 
+	if (kthread_should_park()) {
+		__set_current_state(TASK_RUNNING);
+		kthread_parkme();
+		goto repeat;
+	}
+
 	work = NULL;
 	spin_lock_irq(&stopper->lock);
 	if (!list_empty(&stopper->works)) {
@@ -297,25 +303,27 @@ static int __cpuinit cpu_stop_cpu_callback(struct notifier_block *nfb,
 	struct cpu_stopper *stopper = &per_cpu(cpu_stopper, cpu);
 	struct task_struct *p;
 
+	/*
+	 * The stopper is created parked the first time the cpu comes up
+	 * and parked again, instead of stopped, once it is dead.
+	 */
 	switch (action & ~CPU_TASKS_FROZEN) {
 	case CPU_UP_PREPARE:
-		BUG_ON(stopper->thread || stopper->enabled ||
-		       !list_empty(&stopper->works));
-		p = kthread_create_on_node(cpu_stopper_thread,
-					   stopper,
-					   cpu_to_node(cpu),
-					   "migration/%d", cpu);
-		if (IS_ERR(p))
-			return notifier_from_errno(PTR_ERR(p));
-		get_task_struct(p);
-		kthread_bind(p, cpu);
+		BUG_ON(stopper->enabled || !list_empty(&stopper->works));
+		p = stopper->thread;
+		if (!p) {
+			p = kthread_create_on_cpu(cpu_stopper_thread, stopper,
+						  cpu, "migration/%d");
+			if (IS_ERR(p))
+				return notifier_from_errno(PTR_ERR(p));
+			get_task_struct(p);
+			stopper->thread = p;
+		}
 		sched_set_stop_task(cpu, p);
-		stopper->thread = p;
 		break;
 
 	case CPU_ONLINE:
-		/* strictly unnecessary, as first user will wake it */
-		wake_up_process(stopper->thread);
+		kthread_unpark(stopper->thread);
 		/* mark enabled */
 		spin_lock_irq(&stopper->lock);
 		stopper->enabled = true;
@@ -329,17 +337,15 @@ static int __cpuinit cpu_stop_cpu_callback(struct notifier_block *nfb,
 		struct cpu_stop_work *work;
 
 		sched_set_stop_task(cpu, NULL);
-		/* kill the stopper */
-		kthread_stop(stopper->thread);
+		/* park the stopper until the cpu comes back */
+		kthread_park(stopper->thread);
 		/* drain remaining works */
 		spin_lock_irq(&stopper->lock);
 		list_for_each_entry(work, &stopper->works, list)
 			cpu_stop_signal_done(work->done, false);
+		INIT_LIST_HEAD(&stopper->works);
 		stopper->enabled = false;
 		spin_unlock_irq(&stopper->lock);
-		/* release the stopper */
-		put_task_struct(stopper->thread);
-		stopper->thread = NULL;
 		break;
 	}
 #endif
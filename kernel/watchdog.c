@@ -316,15 +316,20 @@ static enum hrtimer_restart watchdog_timer_fn(struct hrtimer *hrtimer)
 
 
 /*
- * The watchdog thread - touches the timestamp.
+ * The watchdog thread - touches the timestamp.  It is parked while its
+ * cpu is offline or the watchdog is disabled, see watchdog_disable().
  */
 static int watchdog(void *unused)
 {
 	static struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
-	struct hrtimer *hrtimer = &__raw_get_cpu_var(watchdog_hrtimer);
+	struct hrtimer *hrtimer;
 
 	sched_setscheduler(current, SCHED_FIFO, &param);
 
+start:
+	/* kthread_unpark() bound us to our cpu again */
+	hrtimer = &__raw_get_cpu_var(watchdog_hrtimer);
+
 	/* initialize timestamp */
 	__touch_watchdog();
 
@@ -340,6 +345,15 @@ static int watchdog(void *unused)
 	 * debug-printout triggers in watchdog_timer_fn().
 	 */
 	while (!kthread_should_stop()) {
+		if (kthread_should_park()) {
+			/* the timer was cancelled before parking */
+			__set_current_state(TASK_RUNNING);
+			kthread_parkme();
+			if (kthread_should_stop())
+				break;
+			goto start;
+		}
+
 		__touch_watchdog();
 		schedule();
 
@@ -419,7 +433,6 @@ static void watchdog_prepare_cpu(int cpu)
 {
 	struct hrtimer *hrtimer = &per_cpu(watchdog_hrtimer, cpu);
 
-	WARN_ON(per_cpu(softlockup_watchdog, cpu));
 	hrtimer_init(hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	hrtimer->function = watchdog_timer_fn;
 }
@@ -434,9 +447,9 @@ static int watchdog_enable(int cpu)
 
 	/* Regardless of err above, fall through and start softlockup */
 
-	/* create the watchdog thread */
+	/* create the watchdog thread the first time, it is parked */
 	if (!p) {
-		p = kthread_create(watchdog, (void *)(unsigned long)cpu, "watchdog/%d", cpu);
+		p = kthread_create_on_cpu(watchdog, NULL, cpu, "watchdog/%d");
 		if (IS_ERR(p)) {
 			printk(KERN_ERR "softlockup watchdog for %i failed\n", cpu);
 			if (!err) {
@@ -447,11 +460,10 @@ static int watchdog_enable(int cpu)
 			}
 			goto out;
 		}
-		kthread_bind(p, cpu);
-		per_cpu(watchdog_touch_ts, cpu) = 0;
 		per_cpu(softlockup_watchdog, cpu) = p;
-		wake_up_process(p);
 	}
+	per_cpu(watchdog_touch_ts, cpu) = 0;
+	kthread_unpark(p);
 
 out:
 	return err;
@@ -471,11 +483,9 @@ static void watchdog_disable(int cpu)
 	/* disable the perf event */
 	watchdog_nmi_disable(cpu);
 
-	/* stop the watchdog thread */
-	if (p) {
-		per_cpu(softlockup_watchdog, cpu) = NULL;
-		kthread_stop(p);
-	}
+	/* park the watchdog thread, it is reused when the cpu comes back */
+	if (p)
+		kthread_park(p);
 }
 
 static void watchdog_enable_all_cpus(void)
@@ -534,7 +544,7 @@ out:
 
 
 /*
- * Create/destroy watchdog threads as CPUs come and go:
+ * Start/park watchdog threads as CPUs come and go:
  */
 static int __cpuinit
 cpu_callback(struct notifier_block *nfb, unsigned long action, void *hcpu)
@@ -3475,6 +3475,13 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 
 	switch (action) {
 	case CPU_DOWN_PREPARE:
+		/*
+		 * Unlike ksoftirqd, the stopper and the watchdog, the
+		 * trustee is still forked for every cpu going down, as is
+		 * a first worker for every one coming up.  The trustee
+		 * exits by itself once it has handed the gcwq back, so it
+		 * is not simply parkable.
+		 */
 		new_trustee = kthread_create(trustee_thread, gcwq,
 					     "workqueue_trustee/%d\n", cpu);
 		if (IS_ERR(new_trustee))
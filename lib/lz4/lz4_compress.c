@@ -0,0 +1,133 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ *
+ * Greedy single-pass compressor for the LZ4 block format.  Positions of
+ * earlier 4-byte sequences are kept in a hash table in the working memory;
+ * a hit that really matches within the 64KB window becomes a match, which
+ * is first extended backwards over pending literals and then forwards.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(u32 sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/* Encode the extra bytes of a literal or match length of 15 or more */
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *const iend = src + src_len;
+	const unsigned char *const mflimit = iend - MFLIMIT;
+	const unsigned char *const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *const oend = dst + *dst_len;
+	unsigned char *token;
+	u32 *table = wrkmem;
+	size_t litlen, matchlen;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	table[lz4_hash(get_unaligned((const u32 *)ip))] = 0;
+	ip++;
+
+	while (ip <= mflimit) {
+		const unsigned char *ref;
+		u32 sequence = get_unaligned((const u32 *)ip);
+		u32 h = lz4_hash(sequence);
+
+		ref = src + table[h];
+		table[h] = ip - src;
+		if (ip - ref > MAX_DISTANCE ||
+		    get_unaligned((const u32 *)ref) != sequence) {
+			ip++;
+			continue;
+		}
+
+		/* Catch up over literals that match as well */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		litlen = ip - anchor;
+		matchlen = MINMATCH;
+		while (ip + matchlen < matchlimit && ip[matchlen] == ref[matchlen])
+			matchlen++;
+		matchlen -= MINMATCH;
+
+		/* token, literals, offset and both length extensions */
+		if (op + 1 + litlen + litlen / 255 + 1 + 2 +
+		    matchlen / 255 + 1 > oend)
+			return -1;
+
+		token = op++;
+		if (litlen >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, litlen - RUN_MASK);
+		} else {
+			*token = litlen << ML_BITS;
+		}
+		memcpy(op, anchor, litlen);
+		op += litlen;
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		if (matchlen >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, matchlen - ML_MASK);
+		} else {
+			*token |= matchlen;
+		}
+
+		ip += matchlen + MINMATCH;
+		anchor = ip;
+	}
+
+last_literals:
+	litlen = iend - anchor;
+	if (op + 1 + litlen + litlen / 255 + 1 > oend)
+		return -1;
+
+	token = op++;
+	if (litlen >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, litlen - RUN_MASK);
+	} else {
+		*token = litlen << ML_BITS;
+	}
+	memcpy(op, anchor, litlen);
+	op += litlen;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
@@ -0,0 +1,98 @@
+/*
+ * LZ4 Decompressor
+ *
+ * Safe decompression of the LZ4 block format: every length and offset is
+ * checked against the input and output buffers, so malformed input fails
+ * with an error instead of reading or writing out of bounds.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+/* Decode the extra bytes of a literal or match length */
+static inline int lz4_get_length(const unsigned char **ip,
+				 const unsigned char *iend, size_t *len)
+{
+	unsigned int s;
+
+	do {
+		if (*ip >= iend)
+			return -1;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+
+	return 0;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char *const iend = src + src_len;
+	unsigned char *op = dest;
+	unsigned char *const oend = dest + *dest_len;
+	const unsigned char *ref;
+	unsigned int token;
+	size_t len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* literals */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && lz4_get_length(&ip, iend, &len))
+			goto fail;
+		if (len > iend - ip || len > oend - op)
+			goto fail;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence has no match */
+		if (ip == iend)
+			break;
+
+		/* match */
+		if (iend - ip < 2)
+			goto fail;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (offset == 0 || offset > op - dest)
+			goto fail;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && lz4_get_length(&ip, iend, &len))
+			goto fail;
+		len += MINMATCH;
+		if (len > oend - op)
+			goto fail;
+
+		ref = op - offset;
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* overlapping copy repeats the last offset bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dest_len = op - dest;
+	return 0;
+
+fail:
+	return -1;
+}
+EXPORT_SYMBOL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
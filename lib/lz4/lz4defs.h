@@ -0,0 +1,19 @@
+/*
+ * lz4defs.h -- architecture specific defines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <asm/unaligned.h>
+
+#define MINMATCH	4
+#define LASTLITERALS	5	/* the last 5 bytes are always literals */
+#define MFLIMIT		(8 + MINMATCH)	/* no match starts closer to the end */
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
@@ -0,0 +1,470 @@
+/* mm/contig_heap.c
+**
+** Named heaps of physically contiguous memory.
+**
+** The memory of a heap is reserved at boot but handed to the page
+** allocator as MIGRATE_CMA pageblocks, which only take movable pages.
+** While the heap is idle the memory holds page cache and anonymous pages
+** like any other; an allocation from the heap picks a free range in the
+** heap's bitmap and has alloc_contig_range() migrate whatever lives
+** there out of the way.
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#ifdef CONFIG_CMA_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/memblock.h>
+#include <linux/bitmap.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/contig_heap.h>
+
+#include <asm/div64.h>
+
+#define MAX_CONTIG_HEAPS	4
+
+struct contig_heap {
+	const char *name;
+	unsigned long base_pfn;
+	unsigned long count;		/* pages, 0 if the heap is unusable */
+	unsigned long *bitmap;		/* pages handed out */
+	unsigned long *uncached;	/* of those, linear map uncached */
+	struct mutex lock;		/* bitmap and statistics */
+	struct kobject *kobj;
+
+	unsigned long used;		/* pages */
+	unsigned long nr_allocs;
+	unsigned long nr_failed;
+	unsigned long nr_busy;		/* ranges skipped, pages pinned */
+	u64 alloc_ns;			/* total time spent allocating */
+	u64 alloc_ns_max;
+};
+
+static struct contig_heap contig_heaps[MAX_CONTIG_HEAPS];
+static unsigned int nr_contig_heaps;
+
+/* Architectures that can remap the linear mapping override these */
+void __weak __init arch_contig_heap_reserve(phys_addr_t base, phys_addr_t size)
+{
+}
+
+int __weak arch_contig_heap_remap(struct page *page, unsigned long count,
+				  bool cached)
+{
+	return cached ? 0 : -ENOSYS;
+}
+
+/* heaps are aligned so that isolating one never touches another */
+static unsigned long __init contig_heap_align(void)
+{
+	return PAGE_SIZE << max_t(unsigned int, MAX_ORDER - 1, pageblock_order);
+}
+
+/**
+ * contig_heap_declare() -- reserve memory for a heap
+ * @name:	name the users look the heap up with
+ * @size:	size in bytes, rounded up to whole pageblocks
+ * @limit:	highest address the heap may end at, or 0 for any lowmem
+ *
+ * Must be called from the machine's reserve() hook.
+ */
+int __init contig_heap_declare(const char *name, phys_addr_t size,
+			       phys_addr_t limit)
+{
+	struct contig_heap *heap;
+	unsigned long align = contig_heap_align();
+	phys_addr_t base;
+
+	if (nr_contig_heaps == MAX_CONTIG_HEAPS || !size)
+		return -EINVAL;
+
+	size = ALIGN(size, align);
+	base = __memblock_alloc_base(size, align,
+				     limit ?: MEMBLOCK_ALLOC_ACCESSIBLE);
+	if (!base) {
+		pr_err("contig_heap: no %lu MiB for heap %s\n",
+		       (unsigned long)size >> 20, name);
+		return -ENOMEM;
+	}
+
+	heap = &contig_heaps[nr_contig_heaps++];
+	heap->name = name;
+	heap->base_pfn = PFN_DOWN(base);
+	heap->count = size >> PAGE_SHIFT;
+	arch_contig_heap_reserve(base, size);
+	pr_info("contig_heap: %lu MiB at 0x%08lx for heap %s\n",
+		(unsigned long)size >> 20, (unsigned long)base, name);
+
+	return 0;
+}
+
+/* All of a heap must be in one zone for alloc_contig_range() */
+static int __init contig_heap_activate_one(struct contig_heap *heap)
+{
+	unsigned long pfn = heap->base_pfn;
+	unsigned long end = heap->base_pfn + heap->count;
+	struct zone *zone = page_zone(pfn_to_page(pfn));
+
+	for (; pfn < end; pfn += pageblock_nr_pages) {
+		if (!pfn_valid(pfn) || page_zone(pfn_to_page(pfn)) != zone) {
+			pr_err("contig_heap: heap %s spans zones\n",
+			       heap->name);
+			return -EINVAL;
+		}
+	}
+
+	heap->bitmap = kzalloc(BITS_TO_LONGS(heap->count) * sizeof(long),
+			       GFP_KERNEL);
+	heap->uncached = kzalloc(BITS_TO_LONGS(heap->count) * sizeof(long),
+				 GFP_KERNEL);
+	if (!heap->bitmap || !heap->uncached) {
+		kfree(heap->bitmap);
+		kfree(heap->uncached);
+		return -ENOMEM;
+	}
+	mutex_init(&heap->lock);
+
+	for (pfn = heap->base_pfn; pfn < end; pfn += pageblock_nr_pages)
+		init_cma_reserved_pageblock(pfn_to_page(pfn));
+
+	return 0;
+}
+
+static int __init contig_heap_activate(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_contig_heaps; i++) {
+		/* a heap that cannot be activated stays reserved */
+		if (contig_heap_activate_one(&contig_heaps[i]))
+			contig_heaps[i].count = 0;
+	}
+
+	return 0;
+}
+core_initcall(contig_heap_activate);
+
+struct contig_heap *contig_heap_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_contig_heaps; i++)
+		if (contig_heaps[i].count &&
+		    !strcmp(contig_heaps[i].name, name))
+			return &contig_heaps[i];
+
+	return NULL;
+}
+EXPORT_SYMBOL(contig_heap_find);
+
+phys_addr_t contig_heap_base(struct contig_heap *heap)
+{
+	return PFN_PHYS(heap->base_pfn);
+}
+EXPORT_SYMBOL(contig_heap_base);
+
+unsigned long contig_heap_size(struct contig_heap *heap)
+{
+	return heap->count << PAGE_SHIFT;
+}
+EXPORT_SYMBOL(contig_heap_size);
+
+static void contig_heap_account(struct contig_heap *heap, ktime_t start,
+				unsigned long count, int ret)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (ret) {
+		heap->nr_failed++;
+		pr_debug("contig_heap: %s: %lu pages failed (%d) after %llu ns\n",
+			 heap->name, count, ret, ns);
+		return;
+	}
+
+	heap->used += count;
+	heap->nr_allocs++;
+	heap->alloc_ns += ns;
+	if (ns > heap->alloc_ns_max)
+		heap->alloc_ns_max = ns;
+	pr_debug("contig_heap: %s: %lu pages in %llu ns\n",
+		 heap->name, count, ns);
+}
+
+/*
+ * Take [offset, offset + count) of the heap, which is clear in the
+ * bitmap.  Called with heap->lock held.
+ */
+static int contig_heap_take(struct contig_heap *heap, unsigned long offset,
+			    unsigned long count)
+{
+	unsigned long pfn = heap->base_pfn + offset;
+	unsigned long i;
+	int ret;
+
+	bitmap_set(heap->bitmap, offset, count);
+	ret = alloc_contig_range(pfn, pfn + count);
+	if (ret) {
+		bitmap_clear(heap->bitmap, offset, count);
+		return ret;
+	}
+
+	/* the pages may have held anybody's data */
+	for (i = 0; i < count; i++)
+		clear_highpage(pfn_to_page(pfn + i));
+
+	return 0;
+}
+
+/**
+ * contig_heap_alloc() -- allocate contiguous pages from a heap
+ * @heap:	the heap
+ * @count:	number of pages
+ * @align:	order of the alignment, in pages
+ *
+ * Ranges that still hold pinned pages are skipped.  Returns the first
+ * page, or NULL if no range of the heap could be had.
+ */
+struct page *contig_heap_alloc(struct contig_heap *heap, unsigned long count,
+			       unsigned int align)
+{
+	unsigned long mask = (1UL << align) - 1;
+	unsigned long start = 0, offset;
+	struct page *page = NULL;
+	ktime_t t0 = ktime_get();
+	int ret = -ENOMEM;
+
+	if (!heap || !count || count > heap->count)
+		return NULL;
+
+	mutex_lock(&heap->lock);
+	for (;;) {
+		offset = bitmap_find_next_zero_area(heap->bitmap, heap->count,
+						    start, count, mask);
+		if (offset >= heap->count) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		ret = contig_heap_take(heap, offset, count);
+		if (!ret) {
+			page = pfn_to_page(heap->base_pfn + offset);
+			break;
+		}
+		if (ret != -EBUSY)
+			break;
+
+		heap->nr_busy++;
+		start = offset + mask + 1;
+	}
+	contig_heap_account(heap, t0, count, ret);
+	mutex_unlock(&heap->lock);
+
+	return page;
+}
+EXPORT_SYMBOL(contig_heap_alloc);
+
+/**
+ * contig_heap_alloc_at() -- allocate given pages of a heap
+ * @heap:	the heap
+ * @pfn:	first page
+ * @count:	number of pages
+ *
+ * For users that keep their own map of the heap.  Returns 0, -EINVAL if
+ * the range is not all free heap, or -EBUSY if pages in it are pinned.
+ */
+int contig_heap_alloc_at(struct contig_heap *heap, unsigned long pfn,
+			 unsigned long count)
+{
+	unsigned long offset = pfn - heap->base_pfn;
+	ktime_t t0 = ktime_get();
+	int ret;
+
+	if (pfn < heap->base_pfn || !count || offset + count > heap->count)
+		return -EINVAL;
+
+	mutex_lock(&heap->lock);
+	if (find_next_bit(heap->bitmap, offset + count, offset) <
+	    offset + count)
+		ret = -EINVAL;
+	else
+		ret = contig_heap_take(heap, offset, count);
+	if (ret == -EBUSY)
+		heap->nr_busy++;
+	contig_heap_account(heap, t0, count, ret);
+	mutex_unlock(&heap->lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(contig_heap_alloc_at);
+
+/**
+ * contig_heap_uncache() -- make the linear mapping of pages uncached
+ * @heap:	the heap
+ * @pages:	first page, as allocated from the heap
+ * @count:	number of pages
+ *
+ * For pages that are about to be mapped uncached elsewhere.  Their
+ * contents are written back first.  Returns 0, or -ENOSYS if the
+ * architecture cannot remap the linear mapping.
+ */
+int contig_heap_uncache(struct contig_heap *heap, struct page *pages,
+			unsigned long count)
+{
+	unsigned long pfn = page_to_pfn(pages);
+	unsigned long offset = pfn - heap->base_pfn;
+	int ret;
+
+	if (WARN_ON(pfn < heap->base_pfn || offset + count > heap->count))
+		return -EINVAL;
+
+	mutex_lock(&heap->lock);
+	ret = arch_contig_heap_remap(pages, count, false);
+	if (!ret)
+		bitmap_set(heap->uncached, offset, count);
+	mutex_unlock(&heap->lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(contig_heap_uncache);
+
+/* Give pages back to the heap, and so to the page allocator */
+void contig_heap_free(struct contig_heap *heap, struct page *pages,
+		      unsigned long count)
+{
+	unsigned long pfn = page_to_pfn(pages);
+	unsigned long offset = pfn - heap->base_pfn;
+
+	if (WARN_ON(pfn < heap->base_pfn || offset + count > heap->count))
+		return;
+
+	mutex_lock(&heap->lock);
+	/* the page allocator only deals in cacheable memory */
+	if (find_next_bit(heap->uncached, offset + count, offset) <
+	    offset + count) {
+		arch_contig_heap_remap(pages, count, true);
+		bitmap_clear(heap->uncached, offset, count);
+	}
+	free_contig_range(pfn, count);
+	bitmap_clear(heap->bitmap, offset, count);
+	heap->used -= count;
+	mutex_unlock(&heap->lock);
+	pr_debug("contig_heap: %s: %lu pages freed\n", heap->name, count);
+}
+EXPORT_SYMBOL(contig_heap_free);
+
+/* /sys/kernel/mm/contig_heap/<name>/ */
+
+static struct kobject *contig_heap_kobj;
+
+static struct contig_heap *kobj_to_heap(struct kobject *kobj)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_contig_heaps; i++)
+		if (contig_heaps[i].kobj == kobj)
+			return &contig_heaps[i];
+
+	return NULL;
+}
+
+static ssize_t size_show(struct kobject *kobj, struct kobj_attribute *attr,
+			 char *buf)
+{
+	struct contig_heap *heap = kobj_to_heap(kobj);
+
+	return sprintf(buf, "%lu\n", heap->count << PAGE_SHIFT);
+}
+
+static ssize_t used_show(struct kobject *kobj, struct kobj_attribute *attr,
+			 char *buf)
+{
+	struct contig_heap *heap = kobj_to_heap(kobj);
+
+	return sprintf(buf, "%lu\n", heap->used << PAGE_SHIFT);
+}
+
+/* allocs failed busy avg_alloc_us max_alloc_us */
+static ssize_t stats_show(struct kobject *kobj, struct kobj_attribute *attr,
+			  char *buf)
+{
+	struct contig_heap *heap = kobj_to_heap(kobj);
+	u64 avg = 0, max;
+	ssize_t ret;
+
+	mutex_lock(&heap->lock);
+	if (heap->nr_allocs) {
+		avg = heap->alloc_ns;
+		do_div(avg, heap->nr_allocs);
+	}
+	do_div(avg, NSEC_PER_USEC);
+	max = heap->alloc_ns_max;
+	do_div(max, NSEC_PER_USEC);
+	ret = sprintf(buf, "%8lu %8lu %8lu %8llu %8llu\n",
+		      heap->nr_allocs, heap->nr_failed, heap->nr_busy,
+		      (unsigned long long)avg, (unsigned long long)max);
+	mutex_unlock(&heap->lock);
+
+	return ret;
+}
+
+static struct kobj_attribute size_attr = __ATTR_RO(size);
+static struct kobj_attribute used_attr = __ATTR_RO(used);
+static struct kobj_attribute stats_attr = __ATTR_RO(stats);
+
+static struct attribute *contig_heap_attrs[] = {
+	&size_attr.attr,
+	&used_attr.attr,
+	&stats_attr.attr,
+	NULL,
+};
+
+static struct attribute_group contig_heap_attr_group = {
+	.attrs = contig_heap_attrs,
+};
+
+static int __init contig_heap_sysfs_init(void)
+{
+	struct contig_heap *heap;
+	unsigned int i;
+
+	if (!nr_contig_heaps)
+		return 0;
+
+	contig_heap_kobj = kobject_create_and_add("contig_heap", mm_kobj);
+	if (!contig_heap_kobj)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_contig_heaps; i++) {
+		heap = &contig_heaps[i];
+		if (!heap->count)
+			continue;
+		heap->kobj = kobject_create_and_add(heap->name,
+						    contig_heap_kobj);
+		if (!heap->kobj)
+			return -ENOMEM;
+		if (sysfs_create_group(heap->kobj, &contig_heap_attr_group))
+			pr_err("contig_heap: no sysfs for heap %s\n",
+			       heap->name);
+	}
+
+	return 0;
+}
+subsys_initcall(contig_heap_sysfs_init);
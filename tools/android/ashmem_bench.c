@@ -0,0 +1,215 @@
+/*
+ * ashmem_bench.c -- pin/unpin throughput of ashmem across threads
+ *
+ * Runs 1 to N threads at once, each unpinning and re-pinning random
+ * page ranges of an ashmem area the way cache owners (cursor windows,
+ * image caches) do, and reports the aggregate pin/unpin cycles per
+ * second for each thread count.  Every thread uses its own area unless
+ * -S is given, in which case they all share one.  With -p a purger
+ * thread keeps issuing ASHMEM_PURGE_ALL_CACHES (needs CAP_SYS_ADMIN), so
+ * the cost of the shrinker on pin and unpin shows up as well.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/* From include/linux/ashmem.h */
+struct ashmem_pin {
+	uint32_t offset;
+	uint32_t len;
+};
+
+#define __ASHMEMIOC		0x77
+#define ASHMEM_SET_SIZE		_IOW(__ASHMEMIOC, 3, size_t)
+#define ASHMEM_PIN		_IOW(__ASHMEMIOC, 7, struct ashmem_pin)
+#define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
+#define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+
+static const char *device = "/dev/ashmem";
+static unsigned long iterations = 100000;
+static unsigned int max_threads = 4;
+static unsigned int area_pages = 256;
+static unsigned int max_range = 16;
+static long page_size;
+static int shared_fd = -1;
+static volatile int stop_purger;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The area must be mapped before it can be pinned or unpinned */
+static int open_area(void)
+{
+	size_t size = (size_t)area_pages * page_size;
+	void *addr;
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		die(device);
+	if (ioctl(fd, ASHMEM_SET_SIZE, size) < 0)
+		die("ASHMEM_SET_SIZE");
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		die("mmap");
+	memset(addr, 0x5a, size);
+
+	return fd;
+}
+
+static void *pin_thread(void *arg)
+{
+	unsigned int seed = (uintptr_t)arg;
+	struct ashmem_pin pin;
+	unsigned long i;
+	int fd;
+
+	fd = shared_fd >= 0 ? shared_fd : open_area();
+	for (i = 0; i < iterations; i++) {
+		unsigned int start = rand_r(&seed) % area_pages;
+		unsigned int len = 1 + rand_r(&seed) % max_range;
+
+		if (start + len > area_pages)
+			len = area_pages - start;
+		pin.offset = start * page_size;
+		pin.len = len * page_size;
+		if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0)
+			die("ASHMEM_UNPIN");
+		if (ioctl(fd, ASHMEM_PIN, &pin) < 0)
+			die("ASHMEM_PIN");
+	}
+
+	if (fd != shared_fd)
+		close(fd);
+	return NULL;
+}
+
+static void *purger_thread(void *arg)
+{
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		die(device);
+	while (!stop_purger) {
+		if (ioctl(fd, ASHMEM_PURGE_ALL_CACHES) < 0)
+			die("ASHMEM_PURGE_ALL_CACHES");
+		usleep(1000);
+	}
+	close(fd);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-S] [-p] [-d device] [-t max_threads] [-n iterations] [-a area_pages] [-r max_range_pages]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *tids, purger;
+	unsigned int nr, i;
+	int opt, shared = 0, with_purger = 0;
+
+	while ((opt = getopt(argc, argv, "Spd:t:n:a:r:")) != -1) {
+		switch (opt) {
+		case 'S':
+			shared = 1;
+			break;
+		case 'p':
+			with_purger = 1;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			area_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			max_range = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads == 0 || iterations == 0 || area_pages == 0 ||
+	    max_range == 0)
+		usage(argv[0]);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	tids = calloc(max_threads, sizeof(*tids));
+	if (tids == NULL)
+		die("calloc");
+	if (shared)
+		shared_fd = open_area();
+	if (with_purger && pthread_create(&purger, NULL, purger_thread, NULL))
+		die("pthread_create");
+
+	printf("%s: %u page %s, ranges of up to %u pages, %lu cycles per thread%s\n",
+	       device, area_pages, shared ? "shared area" : "area per thread",
+	       max_range, iterations, with_purger ? ", with purger" : "");
+	printf("%8s %16s %16s\n", "threads", "cycles/s", "latency (us)");
+	for (nr = 1; nr <= max_threads; nr++) {
+		double start, elapsed;
+
+		start = now();
+		for (i = 0; i < nr; i++)
+			if (pthread_create(&tids[i], NULL, pin_thread,
+					   (void *)(uintptr_t)(i + 1)))
+				die("pthread_create");
+		for (i = 0; i < nr; i++)
+			pthread_join(tids[i], NULL);
+		elapsed = now() - start;
+		printf("%8u %16.0f %16.2f\n", nr,
+		       nr * iterations / elapsed,
+		       elapsed * 1e6 / iterations);
+	}
+
+	if (with_purger) {
+		stop_purger = 1;
+		pthread_join(purger, NULL);
+	}
+	if (shared_fd >= 0)
+		close(shared_fd);
+	free(tids);
+	return 0;
+}
@@ -0,0 +1,528 @@
+/*
+ * binder_bench.c -- multi-threaded binder ping-pong benchmark
+ *
+ * A server process registers itself as the binder context manager and
+ * runs a pool of looper threads that reply to every transaction.  The
+ * client process then issues synchronous transactions to handle 0 from
+ * 1 to N threads at once and reports transactions per second for each
+ * thread count.
+ *
+ * With -c the client instead sweeps the payload size from one page up
+ * to the -s size (1M by default) on a single thread and compares the round trip of an
+ * inline payload, which is copied into the receiver's buffer, with a
+ * BINDER_TYPE_BLOB payload sent with and without TF_ZERO_COPY.  The
+ * server does not touch the payload in any of the three modes.
+ *
+ * Only one context manager can exist at a time, so on a running Android
+ * system servicemanager has to be stopped first.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/* $(CROSS_COMPILE)cc -Wall -O2 -I../../drivers/staging/android -o binder_bench binder_bench.c -lpthread */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binder.h"
+
+#define BINDER_DEV	"/dev/binder"
+#define BINDER_VM_SIZE	(1024 * 1024 - 2 * 4096)
+
+/* transaction codes understood by the server */
+#define BENCH_PING	1
+#define BENCH_GET_NODE	2
+
+enum payload_mode {
+	PAYLOAD_INLINE,
+	PAYLOAD_BLOB,
+	PAYLOAD_ZERO_COPY,
+};
+
+struct client_args {
+	uint32_t handle;
+	enum payload_mode mode;
+	size_t size;
+	unsigned long iterations;
+};
+
+struct cmd_buf {
+	uint8_t data[512];
+	size_t len;
+};
+
+static int binder_fd;
+static size_t payload_size;
+static unsigned long iterations = 10000;
+static unsigned int max_threads = 4;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void cmd_put(struct cmd_buf *cb, const void *p, size_t len)
+{
+	if (cb->len + len > sizeof(cb->data)) {
+		fprintf(stderr, "command buffer overflow\n");
+		exit(1);
+	}
+	memcpy(cb->data + cb->len, p, len);
+	cb->len += len;
+}
+
+static void cmd_put_u32(struct cmd_buf *cb, uint32_t v)
+{
+	cmd_put(cb, &v, sizeof(v));
+}
+
+static void cmd_put_ptr(struct cmd_buf *cb, const void *v)
+{
+	cmd_put(cb, &v, sizeof(v));
+}
+
+static int binder_io(struct cmd_buf *wr, void *rbuf, size_t rsize,
+		     size_t *rlen)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	memset(&bwr, 0, sizeof(bwr));
+	if (wr) {
+		bwr.write_buffer = (unsigned long)wr->data;
+		bwr.write_size = wr->len;
+	}
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rbuf ? rsize : 0;
+	do {
+		ret = ioctl(binder_fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+	if (wr)
+		wr->len = 0;
+	if (rlen)
+		*rlen = bwr.read_consumed;
+	return 0;
+}
+
+static void binder_setup(void)
+{
+	struct binder_version vers;
+
+	binder_fd = open(BINDER_DEV, O_RDWR);
+	if (binder_fd < 0)
+		die("open " BINDER_DEV);
+	if (ioctl(binder_fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %ld, expected %d\n",
+			vers.protocol_version, BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	if (mmap(NULL, BINDER_VM_SIZE, PROT_READ, MAP_PRIVATE,
+		 binder_fd, 0) == MAP_FAILED)
+		die("mmap " BINDER_DEV);
+}
+
+static int server_node;
+
+static void server_reply(struct cmd_buf *wr,
+			 const struct binder_transaction_data *tr)
+{
+	static const uint32_t reply_data[4];
+	static size_t node_offset;
+	struct flat_binder_object obj;
+	struct binder_transaction_data rtr;
+	const size_t *offp = tr->data.ptr.offsets;
+	size_t i;
+
+	/* drop the descriptors of any blobs that came with the call */
+	for (i = 0; i < tr->offsets_size / sizeof(size_t); i++) {
+		const struct flat_binder_object *fp;
+
+		fp = (const void *)((const uint8_t *)tr->data.ptr.buffer +
+				    offp[i]);
+		if (fp->type == BINDER_TYPE_BLOB)
+			close(fp->handle);
+	}
+	cmd_put_u32(wr, BC_FREE_BUFFER);
+	cmd_put_ptr(wr, tr->data.ptr.buffer);
+
+	memset(&rtr, 0, sizeof(rtr));
+	if (tr->code == BENCH_GET_NODE) {
+		/* a node that accepts fds, so that blobs can be sent to it */
+		memset(&obj, 0, sizeof(obj));
+		obj.type = BINDER_TYPE_BINDER;
+		obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+		obj.binder = &server_node;
+		rtr.data_size = sizeof(obj);
+		rtr.data.ptr.buffer = &obj;
+		rtr.offsets_size = sizeof(node_offset);
+		rtr.data.ptr.offsets = &node_offset;
+	} else {
+		rtr.data_size = sizeof(reply_data);
+		rtr.data.ptr.buffer = reply_data;
+	}
+	cmd_put_u32(wr, BC_REPLY);
+	cmd_put(wr, &rtr, sizeof(rtr));
+}
+
+static void *server_thread(void *arg)
+{
+	uint32_t rbuf[256];
+	struct cmd_buf wr = { .len = 0 };
+
+	cmd_put_u32(&wr, BC_ENTER_LOOPER);
+	for (;;) {
+		uint8_t *ptr, *end;
+		size_t len;
+
+		if (binder_io(&wr, rbuf, sizeof(rbuf), &len) < 0)
+			die("server BINDER_WRITE_READ");
+		ptr = (uint8_t *)rbuf;
+		end = ptr + len;
+		while (ptr + sizeof(uint32_t) <= end) {
+			uint32_t cmd;
+
+			memcpy(&cmd, ptr, sizeof(cmd));
+			ptr += sizeof(cmd);
+			switch (cmd) {
+			case BR_TRANSACTION: {
+				struct binder_transaction_data tr;
+
+				memcpy(&tr, ptr, sizeof(tr));
+				server_reply(&wr, &tr);
+				break;
+			}
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+				cmd_put_u32(&wr, cmd == BR_INCREFS ?
+					    BC_INCREFS_DONE : BC_ACQUIRE_DONE);
+				cmd_put(&wr, ptr,
+					sizeof(struct binder_ptr_cookie));
+				break;
+			default:
+				break;
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+	return NULL;
+}
+
+static void run_server(int ready_fd)
+{
+	pthread_t tid;
+	unsigned int i;
+	size_t zero = 0;
+
+	binder_setup();
+	if (ioctl(binder_fd, BINDER_SET_MAX_THREADS, &zero) < 0)
+		die("BINDER_SET_MAX_THREADS");
+	if (ioctl(binder_fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		die("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+	for (i = 0; i < max_threads; i++)
+		if (pthread_create(&tid, NULL, server_thread, NULL))
+			die("pthread_create");
+	if (write(ready_fd, "r", 1) != 1)
+		die("write");
+	for (;;)
+		pause();
+}
+
+/*
+ * Send one synchronous transaction and wait for its reply.  The reply
+ * buffer is left queued in wr to be freed with the next command, and
+ * the reply data is returned in reply.
+ */
+static void transact(struct cmd_buf *wr, uint32_t handle, uint32_t code,
+		     const void *data, size_t data_size,
+		     const size_t *offsets, size_t offsets_size,
+		     uint32_t flags, struct binder_transaction_data *reply)
+{
+	struct binder_transaction_data tr;
+	uint32_t rbuf[128];
+	int got_reply = 0;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.flags = flags;
+	tr.data_size = data_size;
+	tr.data.ptr.buffer = data;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.offsets = offsets;
+	cmd_put_u32(wr, BC_TRANSACTION);
+	cmd_put(wr, &tr, sizeof(tr));
+
+	while (!got_reply) {
+		uint8_t *ptr, *end;
+		size_t len;
+
+		if (binder_io(wr, rbuf, sizeof(rbuf), &len) < 0)
+			die("client BINDER_WRITE_READ");
+		ptr = (uint8_t *)rbuf;
+		end = ptr + len;
+		while (ptr + sizeof(uint32_t) <= end) {
+			uint32_t cmd;
+
+			memcpy(&cmd, ptr, sizeof(cmd));
+			ptr += sizeof(cmd);
+			switch (cmd) {
+			case BR_REPLY:
+				memcpy(reply, ptr, sizeof(*reply));
+				got_reply = 1;
+				break;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				fprintf(stderr, "transaction failed: %s\n",
+					cmd == BR_DEAD_REPLY ?
+					"BR_DEAD_REPLY" : "BR_FAILED_REPLY");
+				exit(1);
+			default:
+				break;
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+}
+
+static void *client_thread(void *arg)
+{
+	struct client_args *args = arg;
+	struct binder_transaction_data reply;
+	struct flat_binder_object obj;
+	struct cmd_buf wr = { .len = 0 };
+	static const size_t obj_offset;
+	const void *data;
+	size_t data_size, offsets_size;
+	uint32_t flags = 0;
+	uint8_t *payload;
+	unsigned long i;
+
+	payload = mmap(NULL, args->size ? args->size : 1,
+		       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		       -1, 0);
+	if (payload == MAP_FAILED)
+		die("mmap payload");
+	memset(payload, 0x5a, args->size);
+
+	if (args->mode == PAYLOAD_INLINE) {
+		data = payload;
+		data_size = args->size;
+		offsets_size = 0;
+	} else {
+		memset(&obj, 0, sizeof(obj));
+		obj.type = BINDER_TYPE_BLOB;
+		obj.binder = payload;
+		obj.cookie = (void *)args->size;
+		data = &obj;
+		data_size = sizeof(obj);
+		offsets_size = sizeof(obj_offset);
+		if (args->mode == PAYLOAD_ZERO_COPY)
+			flags = TF_ZERO_COPY;
+	}
+
+	for (i = 0; i < args->iterations; i++) {
+		transact(&wr, args->handle, BENCH_PING, data, data_size,
+			 &obj_offset, offsets_size, flags, &reply);
+		cmd_put_u32(&wr, BC_FREE_BUFFER);
+		cmd_put_ptr(&wr, reply.data.ptr.buffer);
+	}
+	/* return the last reply buffer */
+	if (wr.len && binder_io(&wr, NULL, 0, NULL) < 0)
+		die("client BC_FREE_BUFFER");
+	munmap(payload, args->size ? args->size : 1);
+	return NULL;
+}
+
+/* ask the server for a node that accepts blobs and keep a reference */
+static uint32_t get_server_node(void)
+{
+	struct binder_transaction_data reply;
+	struct flat_binder_object obj;
+	struct cmd_buf wr = { .len = 0 };
+
+	transact(&wr, 0, BENCH_GET_NODE, NULL, 0, NULL, 0, 0, &reply);
+	if (reply.data_size != sizeof(obj)) {
+		fprintf(stderr, "bad BENCH_GET_NODE reply\n");
+		exit(1);
+	}
+	memcpy(&obj, reply.data.ptr.buffer, sizeof(obj));
+	if (obj.type != BINDER_TYPE_HANDLE) {
+		fprintf(stderr, "BENCH_GET_NODE returned type %lx\n",
+			obj.type);
+		exit(1);
+	}
+	cmd_put_u32(&wr, BC_ACQUIRE);
+	cmd_put_u32(&wr, obj.handle);
+	cmd_put_u32(&wr, BC_FREE_BUFFER);
+	cmd_put_ptr(&wr, reply.data.ptr.buffer);
+	if (binder_io(&wr, NULL, 0, NULL) < 0)
+		die("BC_ACQUIRE");
+	return obj.handle;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run_clients(struct client_args *args, unsigned int nr)
+{
+	pthread_t *tids;
+	unsigned int i;
+	double start;
+
+	tids = calloc(nr, sizeof(*tids));
+	if (tids == NULL)
+		die("calloc");
+	start = now();
+	for (i = 0; i < nr; i++)
+		if (pthread_create(&tids[i], NULL, client_thread, args))
+			die("pthread_create");
+	for (i = 0; i < nr; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+	return now() - start;
+}
+
+static void copy_sweep(void)
+{
+	static const char * const mode_names[] = {
+		"inline", "blob copy", "blob zero-copy",
+	};
+	struct client_args args;
+	size_t size;
+	int mode;
+
+	args.handle = get_server_node();
+	args.iterations = iterations;
+	printf("%lu transactions per size, round trip in us\n", iterations);
+	printf("%10s", "bytes");
+	for (mode = PAYLOAD_INLINE; mode <= PAYLOAD_ZERO_COPY; mode++)
+		printf(" %16s", mode_names[mode]);
+	printf("\n");
+	for (size = 4096; size <= payload_size; size *= 2) {
+		printf("%10zu", size);
+		for (mode = PAYLOAD_INLINE; mode <= PAYLOAD_ZERO_COPY; mode++) {
+			args.mode = mode;
+			args.size = size;
+			/* inline payloads have to fit the receiver's buffer */
+			if (mode == PAYLOAD_INLINE && size > BINDER_VM_SIZE / 2) {
+				printf(" %16s", "-");
+				continue;
+			}
+			printf(" %16.1f",
+			       run_clients(&args, 1) * 1e6 / iterations);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c] [-t max_threads] [-n iterations] [-s payload_bytes]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct client_args args;
+	unsigned int nr;
+	int pipefd[2], opt, sweep = 0;
+	pid_t server;
+	char c;
+
+	while ((opt = getopt(argc, argv, "ct:n:s:")) != -1) {
+		switch (opt) {
+		case 'c':
+			sweep = 1;
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			payload_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads == 0 || iterations == 0)
+		usage(argv[0]);
+	if (payload_size == 0)
+		payload_size = sweep ? 1024 * 1024 : 32;
+
+	if (pipe(pipefd))
+		die("pipe");
+	server = fork();
+	if (server < 0)
+		die("fork");
+	if (server == 0) {
+		close(pipefd[0]);
+		run_server(pipefd[1]);
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+
+	binder_setup();
+	if (sweep) {
+		copy_sweep();
+		goto out;
+	}
+
+	args.handle = 0;
+	args.mode = PAYLOAD_INLINE;
+	args.size = payload_size;
+	args.iterations = iterations;
+	printf("payload %zu bytes, %lu transactions per thread\n",
+	       payload_size, iterations);
+	printf("%8s %16s %16s\n", "threads", "transactions/s", "latency (us)");
+	for (nr = 1; nr <= max_threads; nr++) {
+		double elapsed = run_clients(&args, nr);
+
+		printf("%8u %16.0f %16.1f\n", nr,
+		       nr * iterations / elapsed,
+		       elapsed * 1e6 / iterations);
+	}
+
+out:
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * lmk_bench.c -- victim selection latency of the Android lowmemorykiller
+ *
+ * Forks an increasing number of idle background tasks spread over oom_adj
+ * 0 to 14, then repeatedly forks a single victim at oom_adj 15 and pokes
+ * the shrinkers through /proc/sys/vm/drop_caches with the thresholds set
+ * so that only oom_adj 15 may be killed.  For each task count it reports
+ * the time taken by the write to drop_caches and, when the kernel exports
+ * them, the lowmemorykiller's own victim selection counters.
+ *
+ * Needs root.  Anything else running at oom_adj 15 (hidden Android apps)
+ * may be killed as well, so run it on a test device.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LMK_PARAMS	"/sys/module/lowmemorykiller/parameters/"
+#define VICTIM_ADJ	15
+
+static unsigned int max_tasks = 4000;
+static unsigned int rounds = 20;
+static pid_t *tasks;
+static unsigned int nr_tasks;
+static char saved_adj[256];
+static char saved_minfree[256];
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_file(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	return 0;
+}
+
+static void write_file(const char *path, const char *val)
+{
+	int fd;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		die(path);
+	if (write(fd, val, strlen(val)) < 0)
+		die(path);
+	close(fd);
+}
+
+static unsigned long read_param(const char *name)
+{
+	char path[128], buf[32];
+
+	snprintf(path, sizeof(path), LMK_PARAMS "%s", name);
+	if (read_file(path, buf, sizeof(buf)))
+		return 0;
+	return strtoul(buf, NULL, 0);
+}
+
+static void set_oom_adj(pid_t pid, int adj)
+{
+	char path[64], val[16];
+
+	snprintf(path, sizeof(path), "/proc/%d/oom_adj", pid);
+	snprintf(val, sizeof(val), "%d", adj);
+	write_file(path, val);
+}
+
+static pid_t spawn(int adj)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (pid == 0) {
+		for (;;)
+			pause();
+	}
+	set_oom_adj(pid, adj);
+	return pid;
+}
+
+static void restore(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_tasks; i++)
+		kill(tasks[i], SIGKILL);
+	for (i = 0; i < nr_tasks; i++)
+		waitpid(tasks[i], NULL, 0);
+	nr_tasks = 0;
+	if (saved_adj[0])
+		write_file(LMK_PARAMS "adj", saved_adj);
+	if (saved_minfree[0])
+		write_file(LMK_PARAMS "minfree", saved_minfree);
+}
+
+static void on_signal(int sig)
+{
+	restore();
+	_exit(1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n max_tasks] [-r rounds]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int step;
+	int opt, have_stats;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			max_tasks = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_tasks == 0 || rounds == 0)
+		usage(argv[0]);
+
+	tasks = calloc(max_tasks, sizeof(*tasks));
+	if (tasks == NULL)
+		die("calloc");
+	if (read_file(LMK_PARAMS "adj", saved_adj, sizeof(saved_adj)) ||
+	    read_file(LMK_PARAMS "minfree", saved_minfree,
+		      sizeof(saved_minfree)))
+		die(LMK_PARAMS);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	/* Every zone is "low", but only oom_adj 15 may be killed */
+	write_file(LMK_PARAMS "adj", "15");
+	write_file(LMK_PARAMS "minfree", "2147483647");
+
+	have_stats = access(LMK_PARAMS "select_count", R_OK) == 0;
+	printf("%u rounds per step, victim at oom_adj %d\n", rounds, VICTIM_ADJ);
+	printf("%8s %18s %18s %18s\n", "tasks", "drop_caches (us)",
+	       have_stats ? "select avg (us)" : "",
+	       have_stats ? "select max (us)" : "");
+
+	for (step = max_tasks < 250 ? max_tasks : 250; ;
+	     step = step * 2 < max_tasks ? step * 2 : max_tasks) {
+		unsigned long count0, time0;
+		double elapsed = 0;
+		unsigned int r;
+
+		while (nr_tasks < step) {
+			tasks[nr_tasks] = spawn(nr_tasks % VICTIM_ADJ);
+			nr_tasks++;
+		}
+
+		count0 = read_param("select_count");
+		time0 = read_param("select_time_us");
+		for (r = 0; r < rounds; r++) {
+			pid_t victim = spawn(VICTIM_ADJ);
+			double start;
+
+			start = now();
+			write_file("/proc/sys/vm/drop_caches", "2");
+			elapsed += now() - start;
+			kill(victim, SIGKILL);
+			waitpid(victim, NULL, 0);
+		}
+
+		printf("%8u %18.1f", nr_tasks, elapsed * 1e6 / rounds);
+		if (have_stats) {
+			unsigned long count = read_param("select_count") - count0;
+			unsigned long time = read_param("select_time_us") - time0;
+
+			printf(" %18.1f %18.1f",
+			       count ? (double)time / count : 0.0,
+			       read_param("select_time_max_ns") / 1e3);
+		}
+		printf("\n");
+		if (step == max_tasks)
+			break;
+	}
+
+	restore();
+	free(tasks);
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * logger_bench.c -- concurrent writer stress test for the Android logger
+ *
+ * Runs 1 to N writer threads at once, each writing entries to the log
+ * device the way liblog does (priority, tag and message as three
+ * iovecs), and reports the aggregate writes per second for each thread
+ * count.  With -r a reader thread drains the log in the background like
+ * logcat does, so the cost of readers on writers shows up as well.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+#define LOG_PRIO_INFO	4
+
+static const char *device = "/dev/log/main";
+static unsigned long iterations = 100000;
+static unsigned int max_threads = 4;
+static size_t msg_size = 64;
+static volatile int stop_reader;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer_thread(void *arg)
+{
+	static const char tag[] = "logger_bench";
+	unsigned char prio = LOG_PRIO_INFO;
+	struct iovec iov[3];
+	char *msg;
+	unsigned long i;
+	int fd;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0)
+		die(device);
+	msg = malloc(msg_size + 1);
+	if (msg == NULL)
+		die("malloc");
+	memset(msg, 'x', msg_size);
+	msg[msg_size] = '\0';
+
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = (void *)tag;
+	iov[1].iov_len = sizeof(tag);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = msg_size + 1;
+
+	for (i = 0; i < iterations; i++) {
+		if (writev(fd, iov, 3) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("writev");
+		}
+	}
+
+	free(msg);
+	close(fd);
+	return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+	char buf[LOGGER_ENTRY_MAX_LEN + 1];
+	int fd;
+
+	fd = open(device, O_RDONLY | O_NONBLOCK);
+	if (fd < 0)
+		die(device);
+	while (!stop_reader) {
+		if (read(fd, buf, sizeof(buf)) < 0) {
+			if (errno == EAGAIN)
+				usleep(1000);
+			else if (errno != EINTR)
+				die("read");
+		}
+	}
+	close(fd);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-r] [-d device] [-t max_threads] [-n iterations] [-s msg_bytes]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *tids, reader;
+	unsigned int nr, i;
+	int opt, with_reader = 0;
+
+	while ((opt = getopt(argc, argv, "rd:t:n:s:")) != -1) {
+		switch (opt) {
+		case 'r':
+			with_reader = 1;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			msg_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads == 0 || iterations == 0 ||
+	    msg_size + 16 > LOGGER_ENTRY_MAX_PAYLOAD)
+		usage(argv[0]);
+
+	tids = calloc(max_threads, sizeof(*tids));
+	if (tids == NULL)
+		die("calloc");
+	if (with_reader && pthread_create(&reader, NULL, reader_thread, NULL))
+		die("pthread_create");
+
+	printf("%s: %zu byte messages, %lu writes per thread%s\n", device,
+	       msg_size, iterations, with_reader ? ", with reader" : "");
+	printf("%8s %16s %16s\n", "threads", "writes/s", "latency (us)");
+	for (nr = 1; nr <= max_threads; nr++) {
+		double start, elapsed;
+
+		start = now();
+		for (i = 0; i < nr; i++)
+			if (pthread_create(&tids[i], NULL, writer_thread, NULL))
+				die("pthread_create");
+		for (i = 0; i < nr; i++)
+			pthread_join(tids[i], NULL);
+		elapsed = now() - start;
+		printf("%8u %16.0f %16.2f\n", nr,
+		       nr * iterations / elapsed,
+		       elapsed * 1e6 / iterations);
+	}
+
+	if (with_reader) {
+		stop_reader = 1;
+		pthread_join(reader, NULL);
+	}
+	free(tids);
+	return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * pmem_bench.c -- allocation latency of heap backed pmem
+ *
+ * With CONFIG_CMA the pmem devices allocate from a contiguous heap whose
+ * idle pages hold movable memory; an allocation first migrates those
+ * pages out.  This times PMEM_ALLOCATE for a range of buffer sizes,
+ * optionally after filling memory with -m MiB of anonymous pages and
+ * reading -f file through the page cache, so that the heap is in use by
+ * the page allocator and every allocation pays for the migration.
+ * Buffers are freed (the fd closed) after each allocation, which hands
+ * the pages back to the page allocator.
+ *
+ * The heap statistics from /sys/kernel/mm/contig_heap/<heap>/stats are
+ * printed before and after the run.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* From include/linux/android_pmem.h */
+struct pmem_region {
+	unsigned long offset;
+	unsigned long len;
+};
+
+#define PMEM_IOCTL_MAGIC	'p'
+#define PMEM_GET_SIZE		_IOW(PMEM_IOCTL_MAGIC, 3, unsigned int)
+#define PMEM_ALLOCATE		_IOW(PMEM_IOCTL_MAGIC, 5, unsigned int)
+#define PMEM_GET_TOTAL_SIZE	_IOW(PMEM_IOCTL_MAGIC, 7, unsigned int)
+
+static const char *device = "/dev/gralloc_pmem";
+static const char *heap = "media";
+static unsigned int iterations = 20;
+static unsigned long anon_mb;
+static const char *fill_file;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_heap_stats(const char *when)
+{
+	char path[128], line[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/kernel/mm/contig_heap/%s/stats",
+		 heap);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return;
+	if (fgets(line, sizeof(line), f))
+		printf("%s (allocs failed busy avg_us max_us): %s", when, line);
+	fclose(f);
+}
+
+/* anonymous pages, kept until exit */
+static void fill_anon(void)
+{
+	size_t size = anon_mb << 20;
+	char *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		die("mmap");
+	memset(p, 0x5a, size);
+}
+
+static void fill_page_cache(void)
+{
+	static char buf[1 << 16];
+	int fd;
+
+	fd = open(fill_file, O_RDONLY);
+	if (fd < 0)
+		die(fill_file);
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	close(fd);
+}
+
+/* seconds for one allocation, or -1 if the heap had no room */
+static double alloc_one(unsigned long size)
+{
+	struct pmem_region region;
+	double start, elapsed;
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		die(device);
+
+	start = now();
+	if (ioctl(fd, PMEM_ALLOCATE, size) < 0)
+		die("PMEM_ALLOCATE");
+	elapsed = now() - start;
+
+	if (ioctl(fd, PMEM_GET_SIZE, &region) < 0)
+		die("PMEM_GET_SIZE");
+	close(fd);
+
+	return region.len ? elapsed : -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-H heap] [-n iterations] [-m anon_mb] [-f file]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct pmem_region total;
+	unsigned long size;
+	unsigned int i;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "d:H:n:m:f:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'H':
+			heap = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			anon_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fill_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (iterations == 0)
+		usage(argv[0]);
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		die(device);
+	if (ioctl(fd, PMEM_GET_TOTAL_SIZE, &total) < 0)
+		die("PMEM_GET_TOTAL_SIZE");
+	close(fd);
+
+	if (anon_mb)
+		fill_anon();
+	if (fill_file)
+		fill_page_cache();
+
+	printf("%s: %lu KiB, %u allocations per size%s%s\n", device,
+	       total.len >> 10, iterations, anon_mb ? ", anon fill" : "",
+	       fill_file ? ", page cache fill" : "");
+	print_heap_stats("before");
+	printf("%10s %8s %12s %12s %12s\n", "size (KiB)", "failed",
+	       "min (ms)", "avg (ms)", "max (ms)");
+
+	for (size = 64 << 10; size <= total.len; size <<= 2) {
+		double t, min = 0, max = 0, sum = 0;
+		unsigned int ok = 0;
+
+		for (i = 0; i < iterations; i++) {
+			t = alloc_one(size);
+			if (t < 0)
+				continue;
+			if (!ok || t < min)
+				min = t;
+			if (t > max)
+				max = t;
+			sum += t;
+			ok++;
+		}
+		printf("%10lu %8u %12.3f %12.3f %12.3f\n", size >> 10,
+		       iterations - ok, min * 1e3, ok ? sum / ok * 1e3 : 0,
+		       max * 1e3);
+	}
+
+	print_heap_stats("after");
+	return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * cpufreq_latency.c -- frequency ramp-up latency of a cpufreq governor
+ *
+ * Mimics touch input on one cpu: bursts of busy looping separated by
+ * idle periods.  Each burst start is written to trace_marker, and the
+ * power:cpu_frequency events recorded by ftrace give, per burst:
+ *
+ *  - up:    time from the burst start to the first frequency increase;
+ *  - ramp:  time to reach the target frequency (-f, scaling_max_freq by
+ *           default), or a miss if the burst ends first;
+ *
+ * and for the whole run the time weighted average frequency, as a proxy
+ * for power.  Works with any governor, so runs with "interactive" and
+ * "sched" can be compared.  The cpufreq_sched events, if present, are
+ * enabled too and left in the trace for closer inspection.
+ *
+ * Needs debugfs mounted and root.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_BURSTS	1000
+
+static const char *tracing = "/sys/kernel/debug/tracing";
+static int cpu;
+static unsigned int nr_bursts = 50;
+static unsigned int burst_ms = 100;
+static unsigned int idle_ms = 400;
+static unsigned long target_freq;
+
+static double burst_start[MAX_BURSTS];
+static double burst_end[MAX_BURSTS];
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_file(const char *dir, const char *name, const char *val)
+{
+	char path[256];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY | O_TRUNC);
+	if (fd < 0)
+		return -1;
+	ret = write(fd, val, strlen(val));
+	close(fd);
+	return ret < 0 ? -1 : 0;
+}
+
+static unsigned long read_cpufreq(const char *name)
+{
+	char path[128];
+	unsigned long val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/%s", cpu, name);
+	f = fopen(path, "r");
+	if (f == NULL)
+		die(path);
+	if (fscanf(f, "%lu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+static void busy(double seconds)
+{
+	double end = now() + seconds;
+
+	while (now() < end)
+		;
+}
+
+/*
+ * Split a trace line "task-pid [cpu] ... ts: event: data" into its
+ * timestamp, event name and data.
+ */
+static int parse_line(char *line, double *ts, char **event, char **data)
+{
+	char *p = strchr(line, ']'), *end;
+
+	if (p == NULL)
+		return -1;
+	for (p++; *p; p = end) {
+		while (*p == ' ')
+			p++;
+		*ts = strtod(p, &end);
+		if (end != p && *end == ':')
+			break;
+		end = strchr(p, ' ');
+		if (end == NULL)
+			return -1;
+	}
+	if (!*p)
+		return -1;
+	p = end + 1;
+	while (*p == ' ')
+		p++;
+	*event = p;
+	p = strchr(p, ':');
+	if (p == NULL)
+		return -1;
+	*p++ = '\0';
+	*data = p;
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, double *lat, unsigned int n,
+		   unsigned int missed)
+{
+	double sum = 0;
+	unsigned int i;
+
+	if (n == 0) {
+		printf("%-5s no samples, %u missed\n", name, missed);
+		return;
+	}
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	printf("%-5s min %8.2f  avg %8.2f  p90 %8.2f  max %8.2f ms, "
+	       "%u missed\n", name, lat[0] * 1e3, sum / n * 1e3,
+	       lat[n * 9 / 10] * 1e3, lat[n - 1] * 1e3, missed);
+}
+
+/*
+ * Walk the trace: tie the markers to the bursts (trace clock and
+ * CLOCK_MONOTONIC may differ, so only trace timestamps are used) and
+ * measure each burst against the cpu_frequency events of our cpu.
+ */
+static void analyse(unsigned long start_freq)
+{
+	static double up[MAX_BURSTS], ramp[MAX_BURSTS];
+	static char line[1024];
+	unsigned int nr_up = 0, nr_ramp = 0, miss_up = 0, miss_ramp = 0;
+	unsigned int b = 0, n = 0, event_cpu;
+	unsigned long freq = start_freq, new_freq, burst_freq = 0;
+	double ts, first = 0, last = 0, weighted = 0;
+	int in_burst = 0, seen_up = 0, seen_ramp = 0;
+	char path[256], *event, *data;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/trace", tracing);
+	f = fopen(path, "r");
+	if (f == NULL)
+		die(path);
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || parse_line(line, &ts, &event, &data))
+			continue;
+
+		if (!strcmp(event, "tracing_mark_write")) {
+			if (strstr(data, "cpufreq_latency: start")) {
+				if (!first)
+					first = last = ts;
+				in_burst = 1;
+				seen_up = seen_ramp = 0;
+				burst_start[b] = ts;
+				burst_freq = freq;
+				if (freq >= target_freq) {
+					ramp[nr_ramp++] = 0;
+					seen_up = seen_ramp = 1;
+				}
+			} else if (strstr(data, "cpufreq_latency: end")) {
+				burst_end[b] = ts;
+				if (in_burst && !seen_up)
+					miss_up++;
+				if (in_burst && !seen_ramp)
+					miss_ramp++;
+				in_burst = 0;
+				if (b < MAX_BURSTS - 1)
+					b++;
+			}
+			continue;
+		}
+
+		if (strcmp(event, "cpu_frequency") ||
+		    sscanf(data, " state=%lu cpu_id=%u", &new_freq,
+			   &event_cpu) != 2 || (int)event_cpu != cpu)
+			continue;
+
+		if (first) {
+			weighted += (ts - last) * freq;
+			last = ts;
+		}
+		freq = new_freq;
+		n++;
+		if (!in_burst)
+			continue;
+		if (!seen_up && freq > burst_freq) {
+			up[nr_up++] = ts - burst_start[b];
+			seen_up = 1;
+		}
+		if (!seen_ramp && freq >= target_freq) {
+			ramp[nr_ramp++] = ts - burst_start[b];
+			seen_ramp = 1;
+		}
+	}
+	fclose(f);
+
+	if (b == 0) {
+		fprintf(stderr, "no markers in the trace, buffer too small?\n");
+		exit(1);
+	}
+	weighted += (burst_end[b - 1] - last) * freq;
+
+	printf("%u bursts, %u frequency changes\n", b, n);
+	report("up", up, nr_up, miss_up);
+	report("ramp", ramp, nr_ramp, miss_ramp);
+	if (burst_end[b - 1] > first)
+		printf("average frequency %.0f kHz\n",
+		       weighted / (burst_end[b - 1] - first));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c cpu] [-n bursts] [-b burst_ms] [-i idle_ms] "
+		"[-f target_khz] [-t tracing_dir]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long start_freq;
+	char path[256], buf[64];
+	cpu_set_t mask;
+	unsigned int i;
+	int opt, marker;
+
+	while ((opt = getopt(argc, argv, "c:n:b:i:f:t:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'n':
+			nr_bursts = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			burst_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			idle_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			target_freq = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			tracing = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_bursts == 0 || nr_bursts > MAX_BURSTS - 1)
+		usage(argv[0]);
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask))
+		die("sched_setaffinity");
+
+	if (!target_freq)
+		target_freq = read_cpufreq("scaling_max_freq");
+
+	write_file(tracing, "tracing_on", "0");
+	if (write_file(tracing, "trace", ""))
+		die("trace: is debugfs mounted?");
+	write_file(tracing, "buffer_size_kb", "4096");
+	if (write_file(tracing, "events/power/cpu_frequency/enable", "1"))
+		die("events/power/cpu_frequency");
+	write_file(tracing, "events/cpufreq_sched/enable", "1");
+
+	snprintf(path, sizeof(path), "%s/trace_marker", tracing);
+	marker = open(path, O_WRONLY);
+	if (marker < 0)
+		die(path);
+
+	/* settle at the idle frequency first */
+	usleep(idle_ms * 1000);
+	start_freq = read_cpufreq("scaling_cur_freq");
+	write_file(tracing, "tracing_on", "1");
+
+	for (i = 0; i < nr_bursts; i++) {
+		usleep(idle_ms * 1000);
+		snprintf(buf, sizeof(buf), "cpufreq_latency: start %u\n", i);
+		if (write(marker, buf, strlen(buf)) < 0)
+			die("trace_marker");
+		busy(burst_ms / 1e3);
+		snprintf(buf, sizeof(buf), "cpufreq_latency: end %u\n", i);
+		if (write(marker, buf, strlen(buf)) < 0)
+			die("trace_marker");
+	}
+
+	write_file(tracing, "tracing_on", "0");
+	close(marker);
+	write_file(tracing, "events/power/cpu_frequency/enable", "0");
+	write_file(tracing, "events/cpufreq_sched/enable", "0");
+
+	printf("cpu %d: %u ms bursts every %u ms, target %lu kHz\n", cpu,
+	       burst_ms, burst_ms + idle_ms, target_freq);
+	analyse(start_freq);
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef HISI_MEMHEAP_LINUX_KERNEL_H
+#define HISI_MEMHEAP_LINUX_KERNEL_H
+
+/* Just enough of the kernel for the heap and lib/rbtree.c */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef container_of
+#define container_of(ptr, type, member) ({			\
+	const typeof(((type *)0)->member) * __mptr = (ptr);	\
+	(type *)((char *)__mptr - offsetof(type, member)); })
+#endif
+
+#define KERN_ERR		""
+#define KERN_INFO		""
+
+extern int memheap_quiet;
+
+#define printk(fmt, ...) \
+	(memheap_quiet ? 0 : fprintf(stderr, fmt, ##__VA_ARGS__))
+
+/* the kernel's scnprintf returns what was written, not what would be */
+#define scnprintf(buf, size, fmt, ...) ({				\
+	int __n = snprintf(buf, size, fmt, ##__VA_ARGS__);		\
+	__n >= (int)(size) ? (int)(size) - 1 : __n; })
+
+#endif
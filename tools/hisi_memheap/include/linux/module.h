@@ -0,0 +1,6 @@
+#ifndef HISI_MEMHEAP_LINUX_MODULE_H
+#define HISI_MEMHEAP_LINUX_MODULE_H
+
+#define EXPORT_SYMBOL(name)
+
+#endif
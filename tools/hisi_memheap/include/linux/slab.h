@@ -0,0 +1,11 @@
+#ifndef HISI_MEMHEAP_LINUX_SLAB_H
+#define HISI_MEMHEAP_LINUX_SLAB_H
+
+#include <stdlib.h>
+
+#define GFP_KERNEL		0
+
+#define kzalloc(size, flags)	calloc(1, size)
+#define kfree(ptr)		free(ptr)
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * memheap_test.c -- user space test of the hisi_memheap allocator
+ *
+ * Builds drivers/hik3/memalloc/hisi_memheap.c and lib/rbtree.c against the
+ * headers in include/ and runs
+ *
+ *  - a random test: allocations and frees by several owners, checking
+ *    after every step that buffers are page aligned, inside the heap and
+ *    do not overlap, that the statistics add up, and in the end that
+ *    freeing everything leaves a single free block;
+ *  - a benchmark: alloc/free pairs per second on a heap fragmented into
+ *    an increasing number of blocks, which should stay roughly flat.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hisi_memheap.h"
+
+#define HEAP_BASE	0x40000000UL
+#define HEAP_SIZE	(128UL << 20)
+#define PAGE_BYTES	4096UL
+#define NR_OWNERS	4
+#define MAX_BUFS	4096
+
+int memheap_quiet = 1;
+
+struct buf {
+	unsigned long base;
+	unsigned long size;	/* page aligned */
+	int owner;
+};
+
+static struct buf bufs[MAX_BUFS];
+static unsigned int nr_bufs;
+static int owners[NR_OWNERS];
+
+static void fail(const char *msg, unsigned long step)
+{
+	fprintf(stderr, "step %lu: %s\n", step, msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_base(const void *a, const void *b)
+{
+	const struct buf *x = a, *y = b;
+
+	return x->base < y->base ? -1 : x->base > y->base;
+}
+
+static void check(struct memheap *heap, unsigned long step)
+{
+	struct memheap_stats stats;
+	struct buf sorted[MAX_BUFS];
+	unsigned long used = 0;
+	unsigned int i;
+
+	memcpy(sorted, bufs, nr_bufs * sizeof(*bufs));
+	qsort(sorted, nr_bufs, sizeof(*sorted), cmp_base);
+	for (i = 0; i < nr_bufs; i++) {
+		if (sorted[i].base % PAGE_BYTES)
+			fail("unaligned buffer", step);
+		if (sorted[i].base < HEAP_BASE ||
+		    sorted[i].base + sorted[i].size > HEAP_BASE + HEAP_SIZE)
+			fail("buffer outside the heap", step);
+		if (i && sorted[i - 1].base + sorted[i - 1].size >
+			 sorted[i].base)
+			fail("overlapping buffers", step);
+		used += sorted[i].size;
+	}
+
+	memheap_get_stats(heap, &stats);
+	if (stats.used_bytes != used || stats.nr_used != nr_bufs)
+		fail("used stats do not match", step);
+	if (stats.used_bytes + stats.free_bytes != HEAP_SIZE)
+		fail("free stats do not match", step);
+	if (stats.largest_free > stats.free_bytes ||
+	    (stats.free_bytes && !stats.nr_free))
+		fail("free block stats do not match", step);
+	/* neighbouring free blocks are always merged */
+	if (stats.nr_free > nr_bufs + 1)
+		fail("free blocks not coalesced", step);
+}
+
+static unsigned long random_size(void)
+{
+	/* mostly small buffers, some frame sized ones */
+	if (rand() % 8)
+		return 1 + rand() % (64 * 1024);
+	return 1 + rand() % (4 << 20);
+}
+
+static void random_test(unsigned long steps)
+{
+	struct memheap heap;
+	struct memheap_stats stats;
+	unsigned long step, base, size;
+	unsigned int i;
+	int o;
+
+	if (memheap_init(&heap, HEAP_BASE, HEAP_SIZE) != INIT_SUCCEED)
+		fail("init", 0);
+
+	for (step = 0; step < steps; step++) {
+		if (nr_bufs < MAX_BUFS && (rand() % 2 || !nr_bufs)) {
+			size = random_size();
+			o = rand() % NR_OWNERS;
+			base = memheap_alloc(&heap, size, &owners[o], o);
+			if (base) {
+				bufs[nr_bufs].base = base;
+				bufs[nr_bufs].size = (size + PAGE_BYTES - 1) &
+						     ~(PAGE_BYTES - 1);
+				bufs[nr_bufs].owner = o;
+				nr_bufs++;
+			}
+		} else if (rand() % 64) {
+			i = rand() % nr_bufs;
+			if (memheap_free(&heap, bufs[i].base))
+				fail("free of a live buffer failed", step);
+			bufs[i] = bufs[--nr_bufs];
+		} else {
+			/* an owner goes away without freeing */
+			o = rand() % NR_OWNERS;
+			memheap_free_owner(&heap, &owners[o]);
+			for (i = 0; i < nr_bufs; )
+				if (bufs[i].owner == o)
+					bufs[i] = bufs[--nr_bufs];
+				else
+					i++;
+		}
+		check(&heap, step);
+	}
+
+	if (!memheap_free(&heap, HEAP_BASE + HEAP_SIZE + PAGE_BYTES))
+		fail("free of a bogus address succeeded", step);
+
+	while (nr_bufs) {
+		if (memheap_free(&heap, bufs[nr_bufs - 1].base))
+			fail("final free failed", step);
+		nr_bufs--;
+	}
+	memheap_get_stats(&heap, &stats);
+	if (stats.nr_free != 1 || stats.largest_free != HEAP_SIZE ||
+	    stats.frag_pct)
+		fail("heap not whole after freeing everything", step);
+
+	memheap_destroy(&heap);
+	printf("random test: %lu steps ok\n", steps);
+}
+
+/*
+ * Split the heap into 2 * nr_blocks one page buffers and free every other
+ * one, then time alloc/free pairs that fit only in the tail of the heap.
+ */
+static void bench(unsigned long nr_blocks, unsigned long rounds)
+{
+	struct memheap heap;
+	struct memheap_stats stats;
+	unsigned long i, base;
+	double start, elapsed;
+
+	if (memheap_init(&heap, HEAP_BASE, HEAP_SIZE) != INIT_SUCCEED)
+		fail("init", 0);
+	for (i = 0; i < 2 * nr_blocks; i++)
+		if (!memheap_alloc(&heap, PAGE_BYTES, &owners[0], 0))
+			fail("bench fill", i);
+	for (i = 0; i < 2 * nr_blocks; i += 2)
+		memheap_free(&heap, HEAP_BASE + i * PAGE_BYTES);
+
+	start = now();
+	for (i = 0; i < rounds; i++) {
+		base = memheap_alloc(&heap, 2 * PAGE_BYTES, &owners[1], 1);
+		if (!base)
+			fail("bench alloc", i);
+		memheap_free(&heap, base);
+	}
+	elapsed = now() - start;
+
+	memheap_get_stats(&heap, &stats);
+	printf("%10lu %10lu %14.0f %10lu%%\n", stats.nr_used + stats.nr_free,
+	       stats.nr_free, rounds / elapsed, stats.frag_pct);
+	memheap_destroy(&heap);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-v] [-s steps] [-n rounds] [-r seed]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long steps = 20000, rounds = 200000, nr;
+	unsigned int seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vs:n:r:")) != -1) {
+		switch (opt) {
+		case 'v':
+			memheap_quiet = 0;
+			break;
+		case 's':
+			steps = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	srand(seed);
+
+	random_test(steps);
+
+	printf("%10s %10s %14s %11s\n", "blocks", "free", "alloc+free/s",
+	       "frag");
+	for (nr = 16; nr <= HEAP_SIZE / PAGE_BYTES / 4; nr *= 4)
+		bench(nr, rounds);
+
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * hotplug_latency.c -- cpu offline/online latency
+ *
+ * Takes a cpu down and up again through sysfs, -n times, and reports
+ * how long each write to cpuN/online took.  Meanwhile a thread spins
+ * on another cpu reading the clock; the longest gap it sees is how long
+ * that cpu was stalled by the transition (stop_machine keeps all cpus
+ * busy with interrupts off while the cpu is taken down).
+ *
+ * Needs root.  Runs on any SMP kernel, for instance under QEMU:
+ *
+ *   make CROSS_COMPILE=arm-linux-gnueabi- LDFLAGS=-static
+ *   qemu-system-arm -M vexpress-a9 -smp 4 -kernel zImage \
+ *	-initrd rootfs.cpio.gz -append "console=ttyAMA0"
+ *   ./hotplug_latency -c 3 -n 200
+ *
+ * Under QEMU the absolute numbers mean little, but the ratio between
+ * two kernels does.  With three cpus or more the spinner has its cpu to
+ * itself; with two it shares it with the writes and sees their time
+ * too.  With the k3hotplug governor the cpu must be the highest online
+ * one and above the governor's minimum.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ITERATIONS	10000
+
+static int cpu = -1;
+static int spin_cpu;
+static unsigned int iterations = 100;
+static unsigned int settle_ms = 10;
+
+static double down_lat[MAX_ITERATIONS];
+static double up_lat[MAX_ITERATIONS];
+static double trip_lat[MAX_ITERATIONS];
+
+static volatile int spinning = 1;
+static volatile double max_stall;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int set_online(int online)
+{
+	char path[64];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/online",
+		 cpu);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		die(path);
+	ret = write(fd, online ? "1" : "0", 1);
+	close(fd);
+	return ret < 0 ? -errno : 0;
+}
+
+/* the highest cpu that can be taken down */
+static int last_cpu(void)
+{
+	char path[64];
+	int i, last = -1;
+
+	for (i = 1; i < 64; i++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/online", i);
+		if (access(path, W_OK) == 0)
+			last = i;
+	}
+	return last;
+}
+
+/* spin on spin_cpu and record the longest time the clock did not move */
+static void *spinner(void *arg)
+{
+	double last, t;
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(spin_cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask))
+		die("sched_setaffinity");
+
+	last = now();
+	while (spinning) {
+		t = now();
+		if (t - last > max_stall)
+			max_stall = t - last;
+		last = t;
+	}
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, double *lat, unsigned int n)
+{
+	double sum = 0;
+	unsigned int i;
+
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	printf("%-8s min %8.3f  avg %8.3f  p90 %8.3f  max %8.3f ms\n", name,
+	       lat[0] * 1e3, sum / n * 1e3, lat[n * 9 / 10] * 1e3,
+	       lat[n - 1] * 1e3);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c cpu] [-n iterations] [-s settle_ms] [-p spin_cpu]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	double stall_sum = 0, stall_max = 0, t;
+	unsigned int i;
+	pthread_t thread;
+	cpu_set_t mask;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "c:n:s:p:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			settle_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			spin_cpu = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (iterations == 0 || iterations > MAX_ITERATIONS)
+		usage(argv[0]);
+	if (cpu < 0)
+		cpu = last_cpu();
+	if (cpu <= 0 || cpu == spin_cpu) {
+		fprintf(stderr, "no cpu to take down\n");
+		return 1;
+	}
+
+	/* stay off the cpu going down, and off the spinner's if we can */
+	CPU_ZERO(&mask);
+	for (i = 0; i < (unsigned int)sysconf(_SC_NPROCESSORS_CONF); i++)
+		if ((int)i != cpu && (int)i != spin_cpu)
+			CPU_SET(i, &mask);
+	if (CPU_COUNT(&mask) == 0)
+		CPU_SET(spin_cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask))
+		die("sched_setaffinity");
+
+	/* bring it up if it was down */
+	set_online(1);
+
+	if (pthread_create(&thread, NULL, spinner, NULL))
+		die("pthread_create");
+
+	for (i = 0; i < iterations; i++) {
+		usleep(settle_ms * 1000);
+
+		max_stall = 0;
+		t = now();
+		ret = set_online(0);
+		if (ret) {
+			errno = -ret;
+			die("offline");
+		}
+		down_lat[i] = now() - t;
+		stall_sum += max_stall;
+		if (max_stall > stall_max)
+			stall_max = max_stall;
+
+		usleep(settle_ms * 1000);
+
+		t = now();
+		ret = set_online(1);
+		if (ret) {
+			errno = -ret;
+			die("online");
+		}
+		up_lat[i] = now() - t;
+		trip_lat[i] = down_lat[i] + up_lat[i];
+	}
+
+	spinning = 0;
+	pthread_join(thread, NULL);
+
+	printf("cpu %d, %u round trips\n", cpu, iterations);
+	report("offline", down_lat, iterations);
+	report("online", up_lat, iterations);
+	report("trip", trip_lat, iterations);
+	printf("cpu %d stalled during offline: avg %.3f max %.3f ms\n",
+	       spin_cpu, stall_sum / iterations * 1e3, stall_max * 1e3);
+	return 0;
+}
@@ -0,0 +1,404 @@
+/*
+ * zram_bench.c -- parallel 4K read/write throughput of a zram device
+ *
+ * Splits the device into one region per thread and runs 1 to N threads
+ * at once, each writing every 4K page of its region with O_DIRECT and
+ * then reading it back.  Reports the aggregate MB/s and the mean latency
+ * of a single page for writes and reads at each thread count, which
+ * shows how well compression and decompression scale over the cores.
+ *
+ * Page contents are half random bytes and half repeated text, so they
+ * compress to roughly 50% and are never taken for zero filled pages.
+ *
+ * With -w, it checks writeback instead (CONFIG_ZRAM_WRITEBACK).  It
+ * resets the device, attaches a backing file through a loop device,
+ * and writes every page, with random (huge) pages and ordinary ones
+ * interleaved.  It then writes back 'huge', 'idle' and, after
+ * rewriting every page, 'all', and reads every page back and compares
+ * it after each step.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/loop.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_BYTES	4096
+
+static const char *device = "/dev/zram0";
+static const char *loop_device = "/dev/block/loop0";
+static unsigned int max_threads = 4;
+static unsigned long total_pages;
+static int do_write;
+
+struct worker {
+	pthread_t tid;
+	unsigned long first, nr;
+	double elapsed;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* huge pages are random throughout, so they do not compress */
+static void fill_page_huge(unsigned char *buf, unsigned long seed, int huge)
+{
+	static const char text[] = "zram benchmark page contents ";
+	uint32_t x = seed * 2654435761u + 1;
+	int i;
+
+	for (i = 0; i < (huge ? PAGE_BYTES : PAGE_BYTES / 2); i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x;
+	}
+	for (; i < PAGE_BYTES; i++)
+		buf[i] = text[i % (sizeof(text) - 1)];
+}
+
+static void fill_page(unsigned char *buf, unsigned long seed)
+{
+	fill_page_huge(buf, seed, 0);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char *buf;
+	unsigned long i;
+	double start;
+	int fd;
+
+	fd = open(device, (do_write ? O_WRONLY : O_RDONLY) | O_DIRECT);
+	if (fd < 0)
+		die(device);
+	if (posix_memalign((void **)&buf, PAGE_BYTES, PAGE_BYTES))
+		die("posix_memalign");
+
+	start = now();
+	for (i = w->first; i < w->first + w->nr; i++) {
+		off_t off = (off_t)i * PAGE_BYTES;
+		ssize_t ret;
+
+		if (do_write) {
+			fill_page(buf, i);
+			ret = pwrite(fd, buf, PAGE_BYTES, off);
+		} else {
+			ret = pread(fd, buf, PAGE_BYTES, off);
+		}
+		if (ret != PAGE_BYTES)
+			die(do_write ? "pwrite" : "pread");
+	}
+	w->elapsed = now() - start;
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+/* Returns MB/s; *lat is the mean latency of one page in microseconds */
+static double run(struct worker *workers, unsigned int nr, double *lat)
+{
+	unsigned long per_thread = total_pages / nr;
+	double start, elapsed, busy = 0;
+	unsigned int i;
+
+	start = now();
+	for (i = 0; i < nr; i++) {
+		workers[i].first = i * per_thread;
+		workers[i].nr = per_thread;
+		if (pthread_create(&workers[i].tid, NULL, worker_thread,
+				   &workers[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nr; i++) {
+		pthread_join(workers[i].tid, NULL);
+		busy += workers[i].elapsed;
+	}
+	elapsed = now() - start;
+
+	*lat = busy * 1e6 / (per_thread * nr);
+	return per_thread * nr * (double)PAGE_BYTES / elapsed / (1 << 20);
+}
+
+static void sysfs_path(char *path, size_t len, const char *name)
+{
+	const char *dev = strrchr(device, '/');
+
+	snprintf(path, len, "/sys/block/%s/%s", dev ? dev + 1 : device, name);
+}
+
+static void sysfs_write(const char *name, const char *val)
+{
+	char path[256];
+	int fd;
+
+	sysfs_path(path, sizeof(path), name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		die(path);
+	if (write(fd, val, strlen(val)) != (ssize_t)strlen(val))
+		die(path);
+	close(fd);
+}
+
+/* Prints bd_stat and returns the number of pages on the backing device */
+static unsigned long print_bd_stat(const char *step)
+{
+	char path[256], buf[128];
+	ssize_t len;
+	int fd;
+
+	sysfs_path(path, sizeof(path), "bd_stat");
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die(path);
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0)
+		die(path);
+	buf[len] = '\0';
+	close(fd);
+	printf("%-8s bd_stat: %s", step, buf);
+	return strtoul(buf, NULL, 10);
+}
+
+/* even pages are huge; seed changes the contents of every page */
+static void wb_write_all(unsigned long seed)
+{
+	unsigned char *buf;
+	unsigned long i;
+	int fd;
+
+	fd = open(device, O_WRONLY | O_DIRECT);
+	if (fd < 0)
+		die(device);
+	if (posix_memalign((void **)&buf, PAGE_BYTES, PAGE_BYTES))
+		die("posix_memalign");
+	for (i = 0; i < total_pages; i++) {
+		fill_page_huge(buf, i + seed, !(i & 1));
+		if (pwrite(fd, buf, PAGE_BYTES, (off_t)i * PAGE_BYTES) !=
+		    PAGE_BYTES)
+			die("pwrite");
+	}
+	free(buf);
+	close(fd);
+}
+
+/* Returns the number of pages that did not read back as written */
+static unsigned long wb_verify_all(unsigned long seed)
+{
+	unsigned char *buf, *expect;
+	unsigned long i, bad = 0;
+	int fd;
+
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+		die(device);
+	if (posix_memalign((void **)&buf, PAGE_BYTES, PAGE_BYTES))
+		die("posix_memalign");
+	expect = malloc(PAGE_BYTES);
+	if (expect == NULL)
+		die("malloc");
+	for (i = 0; i < total_pages; i++) {
+		if (pread(fd, buf, PAGE_BYTES, (off_t)i * PAGE_BYTES) !=
+		    PAGE_BYTES)
+			die("pread");
+		fill_page_huge(expect, i + seed, !(i & 1));
+		if (memcmp(buf, expect, PAGE_BYTES)) {
+			if (!bad)
+				fprintf(stderr, "page %lu differs\n", i);
+			bad++;
+		}
+	}
+	free(expect);
+	free(buf);
+	close(fd);
+	return bad;
+}
+
+/* Returns the number of pages that are wrong or not written back */
+static unsigned long wb_step(const char *mode, unsigned long seed,
+			     unsigned long expect_wb)
+{
+	unsigned long bad, wb;
+
+	sysfs_write("writeback", mode);
+	wb = print_bd_stat(mode);
+	if (wb != expect_wb)
+		fprintf(stderr, "%s: %lu pages written back, expected %lu\n",
+			mode, wb, expect_wb);
+	bad = wb_verify_all(seed);
+	printf("%-8s %lu of %lu pages differ\n", mode, bad, total_pages);
+	return bad + (wb != expect_wb);
+}
+
+static int wb_check(const char *backing_file)
+{
+	char val[32], path[256];
+	unsigned long bad = 0;
+	int file_fd, loop_fd;
+
+	/* fail before the loop device is set up without writeback */
+	sysfs_path(path, sizeof(path), "backing_dev");
+	if (access(path, W_OK))
+		die(path);
+
+	file_fd = open(backing_file, O_RDWR | O_CREAT, 0600);
+	if (file_fd < 0)
+		die(backing_file);
+	/* block 0 of the backing device is never used */
+	if (ftruncate(file_fd, (off_t)(total_pages + 1) * PAGE_BYTES))
+		die("ftruncate");
+	loop_fd = open(loop_device, O_RDWR);
+	if (loop_fd < 0)
+		die(loop_device);
+	if (ioctl(loop_fd, LOOP_SET_FD, file_fd))
+		die("LOOP_SET_FD");
+
+	sysfs_write("reset", "1");
+	sysfs_write("backing_dev", loop_device);
+	snprintf(val, sizeof(val), "%lu",
+		 (unsigned long)total_pages * PAGE_BYTES);
+	sysfs_write("disksize", val);
+	sysfs_write("writeback_idle_age", "1");
+
+	printf("%s: %lu pages backed by %s on %s\n", device, total_pages,
+	       backing_file, loop_device);
+
+	/* the huge pages go out */
+	wb_write_all(0);
+	bad += wb_step("huge", 0, (total_pages + 1) / 2);
+
+	/* then the others, once the reads above are a second old */
+	sleep(2);
+	bad += wb_step("idle", 0, total_pages);
+
+	/* rewriting releases the blocks, everything goes out again */
+	wb_write_all(1);
+	sleep(2);
+	bad += wb_step("all", 1, total_pages);
+
+	sysfs_write("reset", "1");
+	sysfs_write("backing_dev", "none");
+	if (ioctl(loop_fd, LOOP_CLR_FD, 0))
+		die("LOOP_CLR_FD");
+	close(loop_fd);
+	close(file_fd);
+
+	printf("writeback check %s\n", bad ? "FAILED" : "passed");
+	return bad ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d device] [-t max_threads] [-m MB]\n"
+		"       %s -w backing_file [-l loop_device] [-d device] "
+		"[-m MB]\n", prog, prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	const char *backing_file = NULL;
+	unsigned long mb = 256;
+	uint64_t size;
+	unsigned int nr;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "d:t:m:w:l:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			backing_file = optarg;
+			break;
+		case 'l':
+			loop_device = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads == 0 || mb == 0)
+		usage(argv[0]);
+
+	if (backing_file) {
+		total_pages = mb << (20 - 12);
+		return wb_check(backing_file);
+	}
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0)
+		die(device);
+	if (ioctl(fd, BLKGETSIZE64, &size))
+		die("BLKGETSIZE64");
+	close(fd);
+
+	total_pages = mb << (20 - 12);
+	if (total_pages > size / PAGE_BYTES)
+		total_pages = size / PAGE_BYTES;
+	if (total_pages < max_threads) {
+		fprintf(stderr, "%s: device too small\n", device);
+		return 1;
+	}
+
+	workers = calloc(max_threads, sizeof(*workers));
+	if (workers == NULL)
+		die("calloc");
+
+	printf("%s: %lu pages of %d bytes\n", device, total_pages, PAGE_BYTES);
+	printf("%8s %12s %14s %12s %14s\n", "threads", "write MB/s",
+	       "write lat (us)", "read MB/s", "read lat (us)");
+	for (nr = 1; nr <= max_threads; nr++) {
+		double wmb, rmb, wlat, rlat;
+
+		do_write = 1;
+		wmb = run(workers, nr, &wlat);
+		do_write = 0;
+		rmb = run(workers, nr, &rlat);
+		printf("%8u %12.1f %14.2f %12.1f %14.2f\n", nr,
+		       wmb, wlat, rmb, rlat);
+	}
+
+	free(workers);
+	return 0;
+}